@@ -3,6 +3,7 @@
 #include "Source/Interpreter.h"
 #include "Target/Emulator.h"
 #include "Target/Pretty.h"
+#include "Common/CallQueue.h"
 
 namespace V3DLib {
 
@@ -10,6 +11,14 @@ using ::operator<<;  // C++ weirdness
 
 BaseKernel::BaseKernel() {}
 
+
+/**
+ * Pending async calls refer to the kernel drivers, these need to complete first
+ */
+BaseKernel::~BaseKernel() {
+  wait();
+}
+
 bool BaseKernel::has_vc4() const { return m_vc4_driver.get() != nullptr; }
 bool BaseKernel::has_v3d() const { return m_v3d_driver.get() != nullptr; }
 
@@ -79,7 +88,49 @@ void BaseKernel::emu() {
   }
 
   assert(uniforms.size() != 0);
-  emulate(m_numQPUs, vc4().targetCode(), vc4().numVars(), uniforms, getBufferObject());
+  IntList unif = vc4().spill_params(uniforms);
+  emulate(m_numQPUs, vc4().targetCode(), vc4().numVars(), unif, getBufferObject());
+}
+
+
+/**
+ * Invoke the emulator with the timing model
+ *
+ * This is slower than `emu()`, but gives an estimate of how the kernel would run on the
+ * hardware, with a breakdown of the stalls per QPU. See `EmuTiming`.
+ *
+ * @return timing of the run
+ */
+EmuTiming BaseKernel::emu_timed() {
+  EmuTiming ret;
+
+  if (vc4().has_errors()) {
+    warning("Not running on emulator, there were errors during compile.");
+    return ret;
+  }
+
+  assert(uniforms.size() != 0);
+  IntList unif = vc4().spill_params(uniforms);
+  emulate(m_numQPUs, vc4().targetCode(), vc4().numVars(), unif, getBufferObject(), &ret);
+  return ret;
+}
+
+
+/**
+ * Invoke the v3d emulator
+ *
+ * The v3d emulator runs the opcodes as generated for v3d.
+ *
+ * @return run statistics of the emulator
+ */
+v3d::EmuStats BaseKernel::emu_v3d() {
+  if (v3d().has_errors()) {
+    warning("Not running on v3d emulator, there were errors during compile.");
+    return v3d::EmuStats();
+  }
+
+  assert(uniforms.size() != 0);
+  return m_v3d_driver->emu(m_numQPUs, uniforms);
 }
 
 
@@ -125,7 +176,85 @@ void BaseKernel::call() {
 #else
   emu();
 #endif
-};
+}
+
+
+/**
+ * Invoke the kernel asynchronously
+ *
+ * The call is added to the submission queue and run on a worker thread, in the same way as `call()`.
+ * The uniforms and number of QPUs are copied on submit, so the host can `load()` the parameters
+ * for the next call while this call runs.
+ *
+ * Until the returned future is ready, the host must not:
+ *
+ *   - read or write the arrays passed in as parameters
+ *   - deallocate these arrays, or move them to another place
+ *
+ * The call reads the arrays directly, without any synchronization with the host.
+ * Other shared arrays can be allocated and deallocated in the meantime. This may add or release
+ * heap segments, but the call works on a snapshot of the segment table (see `BufferObject::segments()`).
+ *
+ * Compile errors are reported directly, in which case the call is not submitted.
+ *
+ * @return future which becomes ready when the call has completed
+ */
+std::shared_future<void> BaseKernel::call_async() {
+  assert(uniforms.size() != 0);
+  int numQPUs = m_numQPUs;
+  CallQueue::Call call;
+
+#ifdef QPU_MODE
+  if (Platform::use_main_memory()) {
+    warning("Main memory selected in QPU mode, running on emulator instead of QPU.");
+  } else {
+    // Drivers are held by unique_ptr, so they stay put when the kernel is moved
+    KernelDriver *driver = Platform::has_vc4()? (KernelDriver *) m_vc4_driver.get()
+                                              : (KernelDriver *) m_v3d_driver.get();
+    assert(driver != nullptr);
+
+    if (driver->has_errors()) {
+      fatal("Errors during kernel compilation/encoding, can't continue.");
+    }
+
+    IntList unif = uniforms;
+    call = [driver, numQPUs, unif] () mutable {
+      driver->invoke(numQPUs, unif);
+    };
+  }
+#endif
+
+  if (!call) {
+    if (vc4().has_errors()) {
+      warning("Not running on emulator, there were errors during compile.");
+      std::promise<void> done;
+      done.set_value();
+      return done.get_future().share();
+    }
+
+    KernelDriver *driver = m_vc4_driver.get();
+    IntList unif = driver->spill_params(uniforms);
+
+    call = [driver, numQPUs, unif] () mutable {
+      emulate(numQPUs, driver->targetCode(), driver->numVars(), unif, getBufferObject());
+    };
+  }
+
+  m_last_call = CallQueue::instance().submit(call);
+  return m_last_call;
+}
+
+
+/**
+ * Wait until all async calls of this kernel have completed
+ *
+ * Calls are run in order, so it is sufficient to wait for the last one.
+ */
+void BaseKernel::wait() {
+  if (m_last_call.valid()) {
+    m_last_call.wait();
+  }
+}
 
 
 std::string BaseKernel::compile_info() const {
@@ -144,7 +273,7 @@ std::string BaseKernel::compile_info() const {
     }
 
     if (has_v3d()) {
-      ret << "vc4:\n"
+      ret << "v3d:\n"
           << v3d().compile_info() << "\n\n";
     }
   }
@@ -1,8 +1,10 @@
 #ifndef _V3DLIB_BASEKERNEL_H_
 #define _V3DLIB_BASEKERNEL_H_
 #include <memory>
+#include <future>
 #include "vc4/KernelDriver.h"
 #include "v3d/KernelDriver.h"
+#include "Target/EmuTiming.h"
 
 namespace V3DLib {
 
@@ -16,9 +18,15 @@ namespace V3DLib {
  *
  *     - interpret(...)  - run on source code interpreter
  *     - emu(...)        - run on the target code emulator (`vc4` code only)
+ *     - emu_timed(...)  - same as `emu()`, with an estimate of the cycles used on the hardware
+ *     - emu_v3d(...)    - run the `v3d` opcodes on the v3d emulator
  *     - qpu(...)        - run on physical QPUs (only when QPU_MODE enabled))
  *     - call(...)       - depending on QPU_MODE, call `qpu()` or `emu()`
  *                      This is useful for cross-platform compatibility
+ *     - call_async(...) - same as `call()`, but returns directly with a future.
+ *                         The call is run in order with other async calls on a worker thread,
+ *                         see `CallQueue`. Until the future is ready, the host must not
+ *                         access or deallocate the arrays passed to the kernel.
  *
  *    The interpreter and emulator are useful for development/debugging and 
  *    for equivalence testing for the hardware QPU.
@@ -51,11 +59,15 @@ namespace V3DLib {
  *
  *    Because the interpreter and emulator work with vc4 code,
  *    the vc4 kernel driver is always used, even if only assembling for v3d.
+ *
+ *    The v3d emulator is the exception; it runs the encoded v3d opcodes, so that
+ *    v3d code can be verified without a Pi4.
  */
 class BaseKernel {
 public:
   BaseKernel();
   BaseKernel(BaseKernel &&k) = default;
+  ~BaseKernel();
 
   bool has_vc4() const;
   bool has_v3d() const;
@@ -71,8 +83,12 @@ public:
   int numQPUs() const { return m_numQPUs; }
 
   void emu();
+  EmuTiming emu_timed();
+  v3d::EmuStats emu_v3d();
   void interpret();
   void call();
+  std::shared_future<void> call_async();
+  void wait();
 #ifdef QPU_MODE
   void qpu();
 #endif  // QPU_MODE
@@ -92,6 +108,8 @@ protected:
   // (There are other reasons but this is the main one)
   std::unique_ptr<vc4::KernelDriver> m_vc4_driver;
   std::unique_ptr<v3d::KernelDriver> m_v3d_driver;
+
+  std::shared_future<void> m_last_call;  // Most recent async call, if any
 };
 
 
@@ -0,0 +1,46 @@
+#ifndef _V3DLIB_COMMON_ARRAYVIEW_H_
+#define _V3DLIB_COMMON_ARRAYVIEW_H_
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+namespace V3DLib {
+
+/**
+ * Non-owning view on a contiguous range of elements, similar to `std::span` in C++20.
+ *
+ * Element access is not range checked, so that it costs no more than a raw pointer.
+ * The view is only valid as long as the underlying memory is.
+ */
+template<typename T>
+class ArrayView {
+public:
+  ArrayView() = default;
+  ArrayView(T *data, size_t size) : m_data(data), m_size(size) {}
+
+  // Allow conversion of non-const to const views
+  template<typename U, typename = std::enable_if_t<std::is_convertible<U (*)[], T (*)[]>::value>>
+  ArrayView(ArrayView<U> const &rhs) : m_data(rhs.data()), m_size(rhs.size()) {}
+
+  T *data() const     { return m_data; }
+  size_t size() const { return m_size; }
+  bool empty() const  { return m_size == 0; }
+
+  T *begin() const { return m_data; }
+  T *end() const   { return m_data + m_size; }
+
+  T &operator[](size_t i) const { return m_data[i]; }
+
+  ArrayView subview(size_t offset, size_t count) const {
+    assert(offset + count <= m_size);
+    return ArrayView(m_data + offset, count);
+  }
+
+private:
+  T     *m_data = nullptr;
+  size_t m_size = 0;
+};
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_COMMON_ARRAYVIEW_H_
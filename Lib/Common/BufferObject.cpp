@@ -1,30 +1,323 @@
 #include "BufferObject.h"
+#include <algorithm>
 #include "Support/Platform.h"
+#include "Support/basics.h"
 #include "Support/debug.h"
 #include "BufferType.h"
 #include "Target/BufferObject.h"
 #include "vc4/BufferObject.h"
 #include "v3d/BufferObject.h"
+#include "LibSettings.h"
 
 namespace V3DLib {
 
+BufferObject::BufferObject() {
+  update_table();
+}
+
+
+BufferObject::~BufferObject() {
+  if (m_release) m_release();
+}
+
+
 /**
  * @param size_in_bytes        requested size of memory to allocate 
  * @param array_start_address  out parameter; memory address of the newly allocated memory in the heap
+ * @param alignment            required alignment of the memory, power of two.
+ *                             The heap memory itself is page aligned.
  *
  * @return physical address of the newly allocated memory in the heap
  */
-uint32_t BufferObject::alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address) {
-  int new_offset = HeapManager::alloc_array(size_in_bytes);
-  assert(new_offset >= 0);
-  array_start_address = arm_base + (uint32_t) new_offset;
-  return phy_address() + (uint32_t) new_offset;
+uint32_t BufferObject::alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address, uint32_t alignment) {
+  uint32_t ret = 0;
+  if (try_alloc_array(size_in_bytes, array_start_address, ret, alignment)) return ret;
+
+  return grow(size_in_bytes, array_start_address, alignment);
+}
+
+
+/**
+ * Allocate memory in the existing segments, without growing the heap.
+ *
+ * @param out_phyaddr  physical address of the newly allocated memory, if allocated
+ *
+ * @return true if allocated, false if none of the segments has space
+ */
+bool BufferObject::try_alloc_array(
+  uint32_t size_in_bytes,
+  uint8_t *&array_start_address,
+  uint32_t &out_phyaddr,
+  uint32_t alignment
+) {
+  int new_offset = HeapManager::alloc_array(size_in_bytes, alignment);
+
+  if (new_offset >= 0) {
+    array_start_address = arm_base + (uint32_t) new_offset;
+    out_phyaddr = phy_address() + (uint32_t) new_offset;
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(m_segment_mutex);
+  return alloc_in_segments(size_in_bytes, array_start_address, out_phyaddr, alignment);
+}
+
+
+/**
+ * Allocate from the extra segments.
+ *
+ * To be called with the segment list locked.
+ */
+bool BufferObject::alloc_in_segments(
+  uint32_t size_in_bytes,
+  uint8_t *&array_start_address,
+  uint32_t &out_phyaddr,
+  uint32_t alignment
+) {
+  for (auto &seg : m_segments) {
+    if (seg->m_imported) continue;
+
+    int offset = seg->HeapManager::alloc_array(size_in_bytes, alignment);
+    if (offset < 0) continue;
+
+    array_start_address = seg->arm_base + (uint32_t) offset;
+    out_phyaddr = seg->phyaddr + (uint32_t) offset;
+    return true;
+  }
+
+  return false;
+}
+
+
+/**
+ * Allocate from the extra segments, adding a segment if none of them has space.
+ */
+uint32_t BufferObject::grow(uint32_t size_in_bytes, uint8_t *&array_start_address, uint32_t alignment) {
+  std::lock_guard<std::mutex> lock(m_segment_mutex);
+
+  // Check again, another thread may have added a segment in the meantime
+  uint32_t ret = 0;
+  if (alloc_in_segments(size_in_bytes, array_start_address, ret, alignment)) return ret;
+
+  BufferObject *seg = nullptr;
+
+  if (LibSettings::heap_growth()) {
+    // Same size as the initial segment, unless more is needed for the array
+    uint32_t const PAGE_SIZE = 4096;
+    uint32_t needed = (size_in_bytes + std::max(alignment, GRANULE) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    seg = new_segment(std::max(size(), needed));
+  }
+
+  if (seg == nullptr) {
+    fatal("V3DLib: heap overflow (increase heap size)");  // throws, doesn't return
+  }
+
+  m_segments.emplace_back(seg);
+  update_table();
+
+  int offset = seg->HeapManager::alloc_array(size_in_bytes, alignment);
+  assert(offset >= 0);
+  array_start_address = seg->arm_base + (uint32_t) offset;
+  return seg->phyaddr + (uint32_t) offset;
 }
 
 
 void BufferObject::dealloc_array(uint32_t in_phyaddr, uint32_t in_size) {
-  assert(phy_address() <= in_phyaddr && in_phyaddr < (phy_address() + size()));
-  HeapManager::dealloc_array(in_phyaddr - phy_address(), in_size);
+  if (contains(in_phyaddr)) {
+    HeapManager::dealloc_array(in_phyaddr - phy_address(), in_size);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_segment_mutex);
+
+  for (auto it = m_segments.begin(); it != m_segments.end(); ++it) {
+    auto &seg = **it;
+    if (!seg.contains(in_phyaddr)) continue;
+
+    if (seg.m_imported) {
+      assert(in_phyaddr == seg.phyaddr && in_size == seg.size());
+      m_segments.erase(it);
+      update_table();
+      return;
+    }
+
+    seg.HeapManager::dealloc_array(in_phyaddr - seg.phyaddr, in_size);
+
+    if (seg.unused()) {
+      // Release the segment if there is another empty one to serve as spare
+      bool have_spare = std::any_of(m_segments.begin(), m_segments.end(), [&seg] (auto const &rhs) {
+        return rhs.get() != &seg && rhs->unused();
+      });
+
+      if (have_spare) {
+        m_segments.erase(it);
+        update_table();
+      }
+    }
+
+    return;
+  }
+
+  assertq(false, "BufferObject::dealloc_array(): address not in heap", true);
+}
+
+
+/**
+ * Use existing host memory for an array in this heap, without copying.
+ *
+ * The memory gets a segment of its own, which is released when the array is deallocated.
+ * The memory must stay valid until then.
+ *
+ * @param release      called when the segment is released, may be empty
+ * @param out_phyaddr  physical address of the array, if imported
+ *
+ * @return true if imported, false if the back-end can not use host memory
+ */
+bool BufferObject::import_array(
+  uint8_t *mem,
+  uint32_t size_in_bytes,
+  std::function<void()> const &release,
+  uint32_t &out_phyaddr
+) {
+  assert(mem != nullptr);
+  assert(size_in_bytes > 0);
+
+  std::lock_guard<std::mutex> lock(m_segment_mutex);
+
+  BufferObject *seg = import_segment(mem, size_in_bytes);
+  if (seg == nullptr) return false;
+
+  seg->m_imported = true;
+  seg->m_release  = release;
+  m_segments.emplace_back(seg);
+  update_table();
+
+  out_phyaddr = seg->phyaddr;
+  return true;
+}
+
+
+/**
+ * Get the address in main memory for a physical address in any segment of the heap
+ *
+ * For repeated lookups, it is better to use a snapshot of the segment table, see `segments()`.
+ */
+uint8_t *BufferObject::usr_address(uint32_t in_phyaddr) {
+  if (contains(in_phyaddr)) {
+    return arm_base + (in_phyaddr - phyaddr);
+  }
+
+  return usr_address(*segments(), in_phyaddr);
+}
+
+
+/**
+ * Get the address in main memory for a physical address in any segment of a segment table.
+ *
+ * No locking is done, the table is immutable.
+ */
+uint8_t *BufferObject::usr_address(SegmentTable const &table, uint32_t in_phyaddr) {
+  for (auto const &seg : table) {
+    if (seg->contains(in_phyaddr)) {
+      return seg->arm_base + (in_phyaddr - seg->phyaddr);
+    }
+  }
+
+  assertq(false, "BufferObject::usr_address(): address not in heap", true);
+  return nullptr;
+}
+
+
+/**
+ * @return true if no memory is allocated in any segment
+ */
+bool BufferObject::empty() const {
+  if (!HeapManager::empty()) return false;
+
+  std::lock_guard<std::mutex> lock(m_segment_mutex);
+
+  for (auto const &seg : m_segments) {
+    if (!seg->unused()) return false;
+  }
+
+  return true;
+}
+
+
+/**
+ * @return number of segments, including the initial one
+ */
+int BufferObject::num_segments() const {
+  std::lock_guard<std::mutex> lock(m_segment_mutex);
+  return 1 + (int) m_segments.size();
+}
+
+
+/**
+ * Get a snapshot of the segment table.
+ *
+ * The snapshot does not change when segments are added or released afterwards.
+ * Segments which are released in the meantime stay alive until the snapshot is gone.
+ */
+std::shared_ptr<BufferObject::SegmentTable const> BufferObject::segments() const {
+  std::lock_guard<std::mutex> lock(m_segment_mutex);
+  return m_table;
+}
+
+
+/**
+ * Replace the segment table after a change in the segments.
+ *
+ * To be called with the segment list locked, or from the constructor.
+ * The initial segment is this object, which is not owned by the table.
+ */
+void BufferObject::update_table() {
+  auto table = std::make_shared<SegmentTable>();
+  table->emplace_back(std::shared_ptr<BufferObject const>(), this);  // Non-owning
+
+  for (auto const &seg : m_segments) {
+    table->push_back(seg);
+  }
+
+  m_table = table;
+}
+
+
+/**
+ * First physical address after all segments.
+ *
+ * Intended for back-ends which assign physical addresses themselves.
+ * Called from `new_segment()`, with the segment list locked.
+ */
+uint32_t BufferObject::end_phy_address() const {
+  uint32_t ret = phyaddr + size();
+
+  for (auto const &seg : m_segments) {
+    ret = std::max(ret, seg->phyaddr + seg->size());
+  }
+
+  return ret;
+}
+
+
+std::string BufferObject::dump() const {
+  auto table = segments();
+  if (table->size() == 1) return HeapManager::dump();
+
+  std::string ret;
+
+  for (int i = 0; i < (int) table->size(); ++i) {
+    auto const &seg = *(*table)[i];
+    ret << "Segment " << i << ", physical address " << seg.phy_address() << ":\n";
+
+    if (seg.m_imported) {
+      ret << "  Imported host memory, size " << seg.size() << "\n";
+    } else {
+      ret << seg.HeapManager::dump();
+    }
+  }
+
+  return ret;
 }
 
 
@@ -43,6 +336,12 @@ void BufferObject::set_phy_address(uint32_t val) {
 
 
 void BufferObject::clear() {
+  {
+    std::lock_guard<std::mutex> lock(m_segment_mutex);
+    m_segments.clear();  // Segments release their own memory, when no longer in a snapshot
+    update_table();
+  }
+
   phyaddr = 0;
   HeapManager::clear();
 }
@@ -51,6 +350,7 @@ void BufferObject::clear() {
 bool BufferObject::is_cleared() const {
   if  (size() == 0) {
     assert(phyaddr == 0);
+    assert(num_segments() == 1);
   }
 
   return HeapManager::is_cleared();
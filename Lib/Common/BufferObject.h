@@ -3,6 +3,11 @@
 // This is the very first include file of the library to be compiled,
 // therefore a great place for global includes.
 #include <stdint.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 #include "defines.h"
 #include "Common/BufferType.h"
 #include "Support/HeapManager.h"
@@ -10,19 +15,49 @@
 
 namespace V3DLib {
 
+/**
+ * Shared (CPU-GPU) memory, from which `SharedArray` instances are allocated.
+ *
+ * When the memory runs out, the heap can grow by adding extra segments, which are separate
+ * buffer objects of the same type (see `LibSettings::heap_growth()`).
+ * Allocated memory never moves, so addresses of shared arrays stay valid.
+ * Each segment has its own range of physical addresses; a kernel can use arrays from all segments.
+ *
+ * An extra segment is released when it becomes empty, except for one which is kept as spare.
+ *
+ * Existing host memory can be made part of the heap with `import_array()`, if the back-end allows.
+ * Such memory gets a segment of its own, which is released as soon as the array is deallocated.
+ *
+ * The segments are listed in an immutable table, which is replaced when segments are added or
+ * released. A snapshot of the table, obtained with `segments()`, can be used without locking,
+ * and keeps the listed segments alive as long as it exists.
+ */
 class BufferObject : public HeapManager {
 public:
-  BufferObject() {}
+  using SegmentTable = std::vector<std::shared_ptr<BufferObject const>>;  // Entry 0 is the initial segment
+
+  BufferObject();
   BufferObject(BufferObject *buffer) = delete;
-  virtual ~BufferObject() {}
+  virtual ~BufferObject();
 
   virtual uint32_t getHandle() const;
 
-  uint32_t alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address);
+  uint32_t alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address, uint32_t alignment = GRANULE);
+  bool try_alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address, uint32_t &out_phyaddr,
+                       uint32_t alignment = GRANULE);
   void dealloc_array(uint32_t in_phyaddr, uint32_t in_size);
+  bool import_array(uint8_t *mem, uint32_t size_in_bytes, std::function<void()> const &release, uint32_t &out_phyaddr);
 
   uint32_t phy_address() const { return phyaddr; }
   uint8_t *usr_address() { return arm_base; }
+  uint8_t *usr_address(uint32_t in_phyaddr);
+
+  bool empty() const;
+  std::string dump() const;
+
+  int num_segments() const;
+  std::shared_ptr<SegmentTable const> segments() const;
+  static uint8_t *usr_address(SegmentTable const &table, uint32_t in_phyaddr);
 
 protected:
   uint8_t *arm_base = nullptr;
@@ -30,6 +65,21 @@ protected:
   void set_phy_address(uint32_t val);
   void clear();
   bool is_cleared() const;
+  uint32_t end_phy_address() const;
+
+  /**
+   * Create an extra segment for this heap, with memory allocated.
+   *
+   * Back-ends which can not grow return nullptr.
+   */
+  virtual BufferObject *new_segment(uint32_t size_in_bytes) { return nullptr; }
+
+  /**
+   * Create a segment for this heap which uses the given host memory.
+   *
+   * Back-ends which can not use host memory return nullptr.
+   */
+  virtual BufferObject *import_segment(uint8_t *mem, uint32_t size_in_bytes) { return nullptr; }
 
 private:
   // Disallow assignment
@@ -37,6 +87,23 @@ private:
   void operator=(BufferObject const &a);
 
   uint32_t phyaddr  = 0;
+
+  std::vector<std::shared_ptr<BufferObject>> m_segments;  // Extra segments, in order of creation
+  std::shared_ptr<SegmentTable const>        m_table;     // All segments, replaced on each change
+  mutable std::mutex m_segment_mutex;                     // Guards the two fields above
+
+  bool                  m_imported = false;  // If true, segment uses host memory for a single array
+  std::function<void()> m_release;           // Called on destruction of an imported segment, if set
+
+  bool contains(uint32_t in_phyaddr) const {
+    return phyaddr <= in_phyaddr && in_phyaddr < (phyaddr + size());
+  }
+
+  bool unused() const { return !m_imported && HeapManager::empty(); }
+  bool alloc_in_segments(uint32_t size_in_bytes, uint8_t *&array_start_address, uint32_t &out_phyaddr,
+                         uint32_t alignment);
+  uint32_t grow(uint32_t size_in_bytes, uint8_t *&array_start_address, uint32_t alignment);
+  void update_table();
 };
 
 BufferObject &getBufferObject();
@@ -0,0 +1,74 @@
+#include "CallQueue.h"
+
+namespace V3DLib {
+
+CallQueue::CallQueue() : m_worker(&CallQueue::run, this) {}
+
+
+/**
+ * Any calls still in the queue are run before the worker thread exits.
+ */
+CallQueue::~CallQueue() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+
+  m_cond.notify_one();
+  m_worker.join();
+}
+
+
+CallQueue &CallQueue::instance() {
+  static CallQueue queue;
+  return queue;
+}
+
+
+/**
+ * Add a call to the end of the queue.
+ *
+ * @return future which becomes ready when the call has completed.
+ *         Any exception thrown by the call is rethrown by `get()` on the future.
+ */
+std::shared_future<void> CallQueue::submit(Call const &call) {
+  std::packaged_task<void()> task(call);
+  std::shared_future<void> ret = task.get_future().share();
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_calls.push_back(std::move(task));
+  }
+
+  m_cond.notify_one();
+  return ret;
+}
+
+
+/**
+ * @return number of calls which have not been started yet
+ */
+int CallQueue::pending() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return (int) m_calls.size();
+}
+
+
+void CallQueue::run() {
+  while (true) {
+    std::packaged_task<void()> task;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this] () { return m_stop || !m_calls.empty(); });
+      if (m_calls.empty()) break;  // Stop requested and nothing left to do
+
+      task = std::move(m_calls.front());
+      m_calls.pop_front();
+    }
+
+    task();
+  }
+}
+
+}  // namespace V3DLib
@@ -0,0 +1,45 @@
+#ifndef _V3DLIB_COMMON_CALLQUEUE_H_
+#define _V3DLIB_COMMON_CALLQUEUE_H_
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace V3DLib {
+
+/**
+ * Submission queue for asynchronous kernel invocations.
+ *
+ * Submitted calls are run in order on a single worker thread, one at a time.
+ * This matches the hardware, which runs one kernel at a time.
+ * In the meantime, the host thread can prepare the input for the next call.
+ *
+ * There is one queue for the entire process. The worker thread is started on first use.
+ */
+class CallQueue {
+public:
+  using Call = std::function<void()>;
+
+  ~CallQueue();
+
+  static CallQueue &instance();
+  std::shared_future<void> submit(Call const &call);
+  int pending();
+
+private:
+  CallQueue();
+
+  std::mutex                             m_mutex;  // Guards the fields below
+  std::condition_variable                m_cond;
+  std::deque<std::packaged_task<void()>> m_calls;
+  bool                                   m_stop = false;
+  std::thread                            m_worker;
+
+  void run();
+};
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_COMMON_CALLQUEUE_H_
@@ -1,35 +1,79 @@
 #include "CompileData.h"
+#include <cstdio>
 #include "Support/basics.h"
+#include "Support/Helpers.h"  // indentBy()
+#include "LibSettings.h"
 
 namespace V3DLib {
+namespace {
+
+thread_local int phase_depth = 0;  // Nesting level of the currently running compile phase
+
+}  // anon namespace
 
 //using ::operator<<;  // C++ weirdness
 
-CompileData compile_data;
+thread_local CompileData compile_data;
 
+/**
+ * Format the debug dumps taken during compilation.
+ *
+ * The dumps are only present if the kernel was compiled with diagnostics level `DIAG_FULL`.
+ */
 std::string CompileData::dump() const {
   std::string ret;
 
-  ret << title("Liveness dump")
-      << liveness_dump
-      << title("Reg usage dump")
-      << reg_usage_dump
-      << title("Allocated registers to variables")
-      << allocated_registers_dump;
+  if (!liveness_dump) {
+    ret << "No debug dumps present, compile with `LibSettings::compile_diagnostics(LibSettings::DIAG_FULL)` "
+        << "to capture them.\n";
+  } else {
+    ret << title("Liveness dump")
+        << liveness_dump()
+        << title("Reg usage dump")
+        << reg_usage_dump();
+  }
+
+  if (allocated_registers_dump) {
+    ret << title("Allocated registers to variables")
+        << allocated_registers_dump();
+  }
 
-  if (!target_code_before_optimization.empty()) {
+  if (target_code_before_optimization) {
     ret << title("Target code before optimization")
-        << target_code_before_optimization;
+        << target_code_before_optimization();
   }
 
-  if (!target_code_before_regalloc.empty()) {
+  if (target_code_before_regalloc) {
     ret << title("Target code before regAlloc()")
-        << target_code_before_regalloc;
+        << target_code_before_regalloc();
   }
 
-  if (!target_code_before_liveness.empty()) {
+  if (target_code_before_liveness) {
     ret << title("Target code before liveness, after peepholes")
-        << target_code_before_liveness;
+        << target_code_before_liveness();
+  }
+
+  if (!phase_times.empty()) {
+    ret << title("Compile phase times")
+        << dump_phase_times();
+  }
+
+  return ret;
+}
+
+
+/**
+ * Show the compile phase times in milliseconds, as a tree.
+ */
+std::string CompileData::dump_phase_times(int indent) const {
+  std::string ret;
+
+  for (auto const &phase : phase_times) {
+    std::string name = indentBy(indent + 2*phase.depth) + phase.name;
+
+    char buf[80];
+    snprintf(buf, sizeof(buf), "%-32s: %10.3f", name.c_str(), phase.usecs/1000.0);
+    ret << buf << "\n";
   }
 
   return ret;
@@ -37,13 +81,64 @@ std::string CompileData::dump() const {
 
 
 void CompileData::clear() {
-  liveness_dump.clear();
-  target_code_before_optimization.clear();
-  target_code_before_regalloc.clear();
-  target_code_before_liveness.clear();
-  allocated_registers_dump.clear();
+  liveness_dump = nullptr;
+  target_code_before_optimization = nullptr;
+  target_code_before_regalloc = nullptr;
+  target_code_before_liveness = nullptr;
+  allocated_registers_dump = nullptr;
+  reg_usage_dump = nullptr;
+  phase_times.clear();
   num_accs_introduced = 0;
+  num_copies_propagated = 0;
   num_instructions_combined = 0;
+  num_delay_slots_filled = 0;
+  num_spill_slots = 0;
+  uses_vpm = false;
+  num_constants_folded = 0;
+  num_exprs_simplified = 0;
+  num_subexprs_reused = 0;
+  num_dead_assigns_removed = 0;
+  num_invariants_hoisted = 0;
+  num_strength_reductions = 0;
+  num_loops_unrolled = 0;
+  num_unrolls_limited = 0;
+}
+
+
+bool CompileData::capture_dumps() {
+  return LibSettings::compile_diagnostics() >= LibSettings::DIAG_FULL;
+}
+
+
+bool CompileData::capture_timing() {
+  return LibSettings::compile_diagnostics() >= LibSettings::DIAG_TIMING;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Class CompilePhase
+///////////////////////////////////////////////////////////////////////////////
+
+CompilePhase::CompilePhase(char const *name) {
+  if (!CompileData::capture_timing()) return;
+
+  m_index = (int) compile_data.phase_times.size();
+  compile_data.phase_times.push_back({name, phase_depth, 0.0});
+  phase_depth++;
+  m_start = std::chrono::steady_clock::now();
+}
+
+
+CompilePhase::~CompilePhase() {
+  if (m_index < 0) return;
+
+  std::chrono::duration<double, std::micro> diff = std::chrono::steady_clock::now() - m_start;
+  phase_depth--;
+
+  // The compile data may have been cleared in the meantime
+  if (m_index < (int) compile_data.phase_times.size()) {
+    compile_data.phase_times[m_index].usecs = diff.count();
+  }
 }
 
 }  // namespace V3DLib
@@ -2,25 +2,91 @@
 #define _V3DLIB_COMMON_COMPILEDATA_H_
 #include <string>
 #include <vector>
+#include <chrono>
+#include <functional>
 #include "Target/instr/Reg.h"
 
 namespace V3DLib {
 
 struct CompileData {
-  std::string liveness_dump;
-  std::string target_code_before_optimization;
-  std::string target_code_before_regalloc;
-  std::string target_code_before_liveness;
-  std::string allocated_registers_dump;
-  std::string reg_usage_dump;
+  /**
+   * Debug dump, formatted on request only.
+   *
+   * The data to format is copied when the dump is taken; this is only done if
+   * `LibSettings::compile_diagnostics()` is `DIAG_FULL`.
+   */
+  using Dump = std::function<std::string()>;
+
+  /**
+   * Run time of a compile phase.
+   *
+   * Phases may nest; the time of a phase includes the time of its nested phases.
+   */
+  struct PhaseTime {
+    char const *name;
+    int    depth;  // Nesting level, 0 for top
+    double usecs;
+  };
+
+  Dump liveness_dump;
+  Dump target_code_before_optimization;
+  Dump target_code_before_regalloc;
+  Dump target_code_before_liveness;
+  Dump allocated_registers_dump;
+  Dump reg_usage_dump;
+  std::vector<PhaseTime> phase_times;  // In order of start of phase
+
   int num_accs_introduced = 0;
+  int num_copies_propagated = 0;
   int num_instructions_combined = 0;
+  int num_delay_slots_filled = 0;
+  int num_spill_slots = 0;
+  bool uses_vpm = false;  // Source code uses the VPM/DMA operations of vc4 directly
+
+  // Statistics of the source code optimizer, see `optimize()`
+  int num_constants_folded = 0;
+  int num_exprs_simplified = 0;
+  int num_subexprs_reused = 0;
+  int num_dead_assigns_removed = 0;
+  int num_invariants_hoisted = 0;
+  int num_strength_reductions = 0;
+  int num_loops_unrolled = 0;
+  int num_unrolls_limited = 0;
 
   std::string dump() const;
+  std::string dump_phase_times(int indent = 0) const;
   void clear();
+
+  static bool capture_dumps();
+  static bool capture_timing();
 };
 
-extern CompileData compile_data;
+/**
+ * Data collected during compilation of the current kernel.
+ *
+ * The compile state is per thread, so that kernels can be compiled in parallel.
+ */
+extern thread_local CompileData compile_data;
+
+
+/**
+ * Scoped timer for a compile phase.
+ *
+ * Adds the run time of the enclosing scope to `compile_data.phase_times`.
+ * Does nothing unless timing of compile phases is enabled.
+ */
+class CompilePhase {
+public:
+  CompilePhase(char const *name);
+  ~CompilePhase();
+
+  CompilePhase(CompilePhase const &) = delete;
+  CompilePhase &operator=(CompilePhase const &) = delete;
+
+private:
+  int m_index = -1;  // Index of the phase in `compile_data.phase_times`, -1 if not timing
+  std::chrono::steady_clock::time_point m_start;
+};
 
 }  // namespace V3DLib
 
@@ -0,0 +1,314 @@
+#include "KernelCache.h"
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Support/basics.h"
+#include "Support/Platform.h"
+#include "Support/Hash.h"
+#include "LibSettings.h"
+
+namespace V3DLib {
+namespace {
+
+uint32_t const MAGIC          = 0x4b443356;  // 'V3DK'
+uint32_t const FORMAT_VERSION = 7;           // Increment when the file format changes
+
+/**
+ * Layout of the start of a cache file.
+ *
+ * It is followed by the key input, the serialized target code and the opcodes.
+ * The checksum is taken over the entire file, with the checksum field itself set to zero.
+ * The serialized target code is deserialized without bounds checks, so it must be intact.
+ */
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t key_size;           // in words
+  int32_t  num_vars;
+  int32_t  num_accs_introduced;
+  int32_t  num_copies_propagated;
+  int32_t  num_instructions_combined;
+  int32_t  num_delay_slots_filled;
+  int32_t  num_spill_slots;
+  uint32_t target_code_size;   // in words
+  uint32_t num_opcodes;
+  uint32_t checksum;
+};
+
+static_assert(sizeof(Header) % sizeof(uint32_t) == 0, "Header must consist of whole words for the checksum");
+
+
+/**
+ * Checksum of a cache file, with the checksum field of the header ignored.
+ *
+ * @param rest  all data after the header
+ */
+uint32_t checksum(Header header, uint32_t const *rest, size_t rest_words) {
+  header.checksum = 0;
+
+  uint64_t hash = hash_words(FNV_OFFSET, (uint32_t const *) &header, sizeof(Header)/sizeof(uint32_t));
+  hash = hash_words(hash, rest, rest_words);
+  return (uint32_t) (hash ^ (hash >> 32));
+}
+
+
+size_t align_up(size_t val, size_t align) {
+  return (val + align - 1) & ~(align - 1);
+}
+
+
+/**
+ * Callback for `dl_iterate_phdr()`, to get the build id of the binary containing this code.
+ *
+ * This is the GNU build id note, which the linker derives from the contents of the binary.
+ * If the binary has no build id, its file size and modification time are used instead.
+ */
+int find_build_id(struct dl_phdr_info *info, size_t, void *data) {
+  auto self = (ElfW(Addr)) &find_build_id;
+  bool found = false;
+
+  for (int i = 0; i < info->dlpi_phnum && !found; i++) {
+    auto const &ph = info->dlpi_phdr[i];
+    ElfW(Addr) start = info->dlpi_addr + ph.p_vaddr;
+    found = (ph.p_type == PT_LOAD && self >= start && self < start + ph.p_memsz);
+  }
+
+  if (!found) return 0;  // Try next binary
+
+  auto &ret = *(std::vector<uint32_t> *) data;
+
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    auto const &ph = info->dlpi_phdr[i];
+    if (ph.p_type != PT_NOTE) continue;
+
+    size_t align = (ph.p_align == 8)? 8 : 4;
+    auto p   = (char const *) (info->dlpi_addr + ph.p_vaddr);
+    auto end = p + ph.p_memsz;
+
+    while (p + sizeof(ElfW(Nhdr)) <= end) {
+      auto note = (ElfW(Nhdr) const *) p;
+      auto name = p + sizeof(ElfW(Nhdr));
+      auto desc = name + align_up(note->n_namesz, align);
+
+      if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+        ret.resize(align_up(note->n_descsz, 4)/4, 0);
+        memcpy(ret.data(), desc, note->n_descsz);
+        return 1;
+      }
+
+      p = desc + align_up(note->n_descsz, align);
+    }
+  }
+
+  std::string file = info->dlpi_name;
+  if (file.empty()) file = "/proc/self/exe";  // Main program
+
+  struct stat st;
+  if (stat(file.c_str(), &st) == 0) {
+    ret = {
+      (uint32_t) st.st_size,
+      (uint32_t) st.st_mtime,
+      (uint32_t) (((uint64_t) st.st_mtime) >> 32)
+    };
+  }
+
+  return 1;
+}
+
+
+std::vector<uint32_t> const &build_id() {
+  static std::vector<uint32_t> const ret = [] {
+    std::vector<uint32_t> id;
+    dl_iterate_phdr(find_build_id, &id);
+    return id;
+  }();
+
+  return ret;
+}
+
+}  // anon namespace
+
+
+bool KernelCache::enabled() {
+  return !LibSettings::kernel_cache_dir().empty();
+}
+
+
+/**
+ * Determine the cache key for the given target code.
+ *
+ * The code passed in is the code as generated from the source code, before any further processing.
+ */
+KernelCache::Key KernelCache::key(Instr::List const &code) {
+  auto const &id = build_id();
+
+  Key ret;
+  ret.input = {
+    FORMAT_VERSION,
+    Platform::compiling_for_vc4()? 1u : 0u,
+    LibSettings::use_tmu_for_load()? 1u : 0u,
+    (uint32_t) Platform::size_regfile(),
+    (uint32_t) id.size()
+  };
+  ret.input.insert(ret.input.end(), id.begin(), id.end());
+
+  for (int i = 0; i < code.size(); i++) {
+    code[i].serialize(ret.input);
+  }
+
+  ret.hash = hash_words(FNV_OFFSET, ret.input.data(), ret.input.size());
+  return ret;
+}
+
+
+/**
+ * Load the cache entry for the given key.
+ *
+ * An entry is only used if its key is the same as the given key, word for word,
+ * and if its checksum is correct. A corrupt entry is treated as not found.
+ *
+ * @return true if an entry was found, false otherwise
+ */
+bool KernelCache::load(Key const &key, Entry &entry) {
+  int fd = open(path(key.hash).c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = (size_t) st.st_size;
+  void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) return false;
+
+  auto data = (char const *) ptr;
+  Header header;
+  memcpy(&header, data, sizeof(header));
+
+  size_t key_bytes    = sizeof(uint32_t)*header.key_size;
+  size_t code_bytes   = sizeof(uint32_t)*header.target_code_size;
+  size_t opcode_bytes = sizeof(uint64_t)*header.num_opcodes;
+
+  bool ok = header.magic == MAGIC
+         && header.version == FORMAT_VERSION
+         && header.key == key.hash
+         && header.key_size == key.input.size()
+         && size == sizeof(Header) + key_bytes + code_bytes + opcode_bytes
+         && memcmp(data + sizeof(Header), key.input.data(), key_bytes) == 0
+         && header.checksum == checksum(header, (uint32_t const *) (data + sizeof(Header)),
+                                        (size - sizeof(Header))/sizeof(uint32_t));
+
+  if (ok) {
+    data += sizeof(Header) + key_bytes;
+
+    entry.num_vars                  = header.num_vars;
+    entry.num_accs_introduced       = header.num_accs_introduced;
+    entry.num_copies_propagated     = header.num_copies_propagated;
+    entry.num_instructions_combined = header.num_instructions_combined;
+    entry.num_delay_slots_filled    = header.num_delay_slots_filled;
+    entry.num_spill_slots           = header.num_spill_slots;
+
+    entry.target_code.resize(header.target_code_size);
+    memcpy(entry.target_code.data(), data, code_bytes);
+
+    entry.opcodes.resize(header.num_opcodes);
+    memcpy(entry.opcodes.data(), data + code_bytes, opcode_bytes);
+  }
+
+  munmap(ptr, size);
+  return ok;
+}
+
+
+/**
+ * Store a cache entry for the given key.
+ *
+ * Failure to store is not an error, the kernel will just be compiled again next time.
+ */
+void KernelCache::store(Key const &key, Entry const &entry) {
+  std::string const &dir = LibSettings::kernel_cache_dir();
+  mkdir(dir.c_str(), 0755);  // Fails if already present, which is fine
+
+  Header header;
+  header.magic                     = MAGIC;
+  header.version                   = FORMAT_VERSION;
+  header.key                       = key.hash;
+  header.key_size                  = (uint32_t) key.input.size();
+  header.num_vars                  = entry.num_vars;
+  header.num_accs_introduced       = entry.num_accs_introduced;
+  header.num_copies_propagated     = entry.num_copies_propagated;
+  header.num_instructions_combined = entry.num_instructions_combined;
+  header.num_delay_slots_filled    = entry.num_delay_slots_filled;
+  header.num_spill_slots           = entry.num_spill_slots;
+  header.target_code_size          = (uint32_t) entry.target_code.size();
+  header.num_opcodes               = (uint32_t) entry.opcodes.size();
+
+  {
+    // Same as the layout of the file after the header
+    std::vector<uint32_t> rest(key.input);
+    rest.insert(rest.end(), entry.target_code.begin(), entry.target_code.end());
+
+    auto op_words = (uint32_t const *) entry.opcodes.data();
+    rest.insert(rest.end(), op_words, op_words + 2*entry.opcodes.size());
+
+    header.checksum = checksum(header, rest.data(), rest.size());
+  }
+
+  std::string file = path(key.hash);
+  std::string tmp  = file + ".XXXXXX";
+
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) {
+    warning("KernelCache: can not create cache file in " + dir);
+    return;
+  }
+
+  fchmod(fd, 0644);  // mkstemp() creates the file as private
+
+  auto write_all = [fd] (void const *buf, size_t size) -> bool {
+    return size == 0 || write(fd, buf, size) == (ssize_t) size;
+  };
+
+  bool ok = write_all(&header, sizeof(header))
+         && write_all(key.input.data(), sizeof(uint32_t)*key.input.size())
+         && write_all(entry.target_code.data(), sizeof(uint32_t)*entry.target_code.size())
+         && write_all(entry.opcodes.data(), sizeof(uint64_t)*entry.opcodes.size());
+
+  close(fd);
+
+  if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+    warning("KernelCache: failed to write cache file " + file);
+    unlink(tmp.c_str());
+  }
+}
+
+
+char const *KernelCache::status_str(Status status) {
+  switch (status) {
+    case DISABLED: return "disabled";
+    case MISS:     return "miss";
+    case HIT:      return "hit";
+  }
+
+  return "unknown";
+}
+
+
+std::string KernelCache::path(uint64_t hash) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) hash);
+
+  std::string ret = LibSettings::kernel_cache_dir();
+  ret << "/" << buf << ".kernel";
+  return ret;
+}
+
+}  // namespace V3DLib
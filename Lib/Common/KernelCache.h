@@ -0,0 +1,73 @@
+#ifndef _V3DLIB_COMMON_KERNELCACHE_H_
+#define _V3DLIB_COMMON_KERNELCACHE_H_
+#include <string>
+#include <vector>
+#include "Target/instr/Instr.h"
+
+namespace V3DLib {
+
+/**
+ * Persistent on-disk cache of compiled kernels.
+ *
+ * Compilation of a kernel is expensive, mainly due to liveness analysis and register allocation.
+ * With the cache enabled (see `LibSettings::kernel_cache_dir()`), the result of a compilation
+ * is stored in a file, and reused by later compilations of the same kernel, also in other processes.
+ *
+ * The key of a cache entry is made from the target code as generated directly from the source code,
+ * together with the target platform, the compile settings, the cache format version and the
+ * build id of the binary containing the library.
+ * The generated target code is an exact representation of the source code, including the bit
+ * values of literals. This is in contrast to the printed form of the source code.
+ * The build id ensures that entries of a different build of the library, which might
+ * generate different code, are never used.
+ *
+ * An entry contains the final target code and the encoded opcodes for the kernel,
+ * together with the compile data which is needed for running it.
+ * The full key is stored in the entry as well and compared on load, so that a hash collision
+ * can not result in running the wrong kernel.
+ *
+ * Each entry is a separate file. It is written to a temporary file first and then renamed,
+ * so that concurrent compiles never see partial entries.
+ */
+class KernelCache {
+public:
+  enum Status {
+    DISABLED,
+    MISS,
+    HIT
+  };
+
+  struct Entry {
+    int num_vars                  = 0;
+    int num_accs_introduced       = 0;
+    int num_copies_propagated     = 0;
+    int num_instructions_combined = 0;
+    int num_delay_slots_filled    = 0;
+    int num_spill_slots           = 0;   // Determines the extra uniform for spill memory
+    std::vector<uint32_t> target_code;   // Serialized final target code, see `Instr::serialize()`
+    std::vector<uint64_t> opcodes;
+  };
+
+  /**
+   * Key of a cache entry.
+   *
+   * The hash is used for the file name; the input words are what the hash is made from.
+   */
+  struct Key {
+    uint64_t hash = 0;
+    std::vector<uint32_t> input;
+  };
+
+  static bool enabled();
+  static Key key(Instr::List const &code);
+  static bool load(Key const &key, Entry &entry);
+  static void store(Key const &key, Entry const &entry);
+  static char const *status_str(Status status);
+
+private:
+  static std::string path(uint64_t hash);
+};
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_COMMON_KERNELCACHE_H_
@@ -1,4 +1,9 @@
 #include "SharedArray.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "SharedArrayPool.h"
 
 namespace V3DLib {
 
@@ -8,6 +13,13 @@ BaseSharedArray::BaseSharedArray(BufferObject *heap, uint32_t element_size) :
 {}
 
 
+BaseSharedArray::BaseSharedArray(std::shared_ptr<SharedArrayPool> const &pool, uint32_t element_size) :
+  m_heap(&pool->heap()),
+  m_pool(pool),
+  m_element_size(element_size)
+{}
+
+
 bool BaseSharedArray::allocated() const {
   if (m_size > 0) {
     assert(m_heap != nullptr);
@@ -18,6 +30,7 @@ bool BaseSharedArray::allocated() const {
     assert(m_phyaddr == 0);
     assert(m_usraddr == nullptr);
     assert(!m_is_heap_view);
+    assert(!m_is_import);
     return false;
   }
 }
@@ -25,6 +38,8 @@ bool BaseSharedArray::allocated() const {
 
 /**
  * @param n number of 4-byte elements to allocate (so NOT memory size!)
+ *
+ * If no heap was given and a `SharedArrayScope` is active, the memory comes from the pool of the scope.
  */
 void BaseSharedArray::alloc(uint32_t n) {
   assert(!allocated());
@@ -32,10 +47,21 @@ void BaseSharedArray::alloc(uint32_t n) {
   assert(m_element_size > 0);
 
   if (m_heap == nullptr) {
-    m_heap = &getBufferObject();
+    auto scope = SharedArrayScope::current();
+
+    if (scope != nullptr) {
+      m_pool = scope->pool();
+      m_heap = &m_pool->heap();
+    } else {
+      m_heap = &getBufferObject();
+    }
   }
 
-  m_phyaddr = m_heap->alloc_array((uint32_t) (m_element_size*n), m_usraddr);
+  if (m_pool) {
+    m_phyaddr = m_pool->acquire((uint32_t) (m_element_size*n), m_usraddr);
+  } else {
+    m_phyaddr = m_heap->alloc_array((uint32_t) (m_element_size*n), m_usraddr);
+  }
   m_size = n;
   assert(allocated());
 }
@@ -50,7 +76,13 @@ void BaseSharedArray::dealloc() {
   if (m_size > 0) {
     assert(allocated());
     assert(m_heap != nullptr);
-    if (!m_is_heap_view) { 
+    if (m_is_heap_view) {
+      // Nothing to return
+    } else if (m_is_import) {
+      m_heap->dealloc_array(m_phyaddr, (uint32_t) (m_element_size*m_size));  // Releases the memory
+    } else if (m_pool) {
+      m_pool->release(m_phyaddr, m_usraddr, (uint32_t) (m_element_size*m_size));
+    } else {
       m_heap->dealloc_array(m_phyaddr, (uint32_t) (m_element_size*m_size));
     }
 
@@ -58,6 +90,8 @@ void BaseSharedArray::dealloc() {
     m_size = 0;
     m_usraddr = nullptr;
     m_is_heap_view = false;
+    m_is_import = false;
+    m_segments.reset();
   } else {
     assert(!allocated());
   }
@@ -70,21 +104,132 @@ void BaseSharedArray::heap_view(BufferObject &heap) {
 
   m_heap = &heap;
   m_is_heap_view = true;
-  m_size = m_heap->size();
+  m_size = m_heap->size()/m_element_size;
   assert(m_size > 0);
   m_usraddr = m_heap->usr_address();
   m_phyaddr = m_heap->phy_address();
+  m_segments = m_heap->segments();
+}
+
+
+/**
+ * Use host memory for this array.
+ *
+ * Imports are never taken from or returned to a pool.
+ *
+ * @param n        number of elements in `mem`
+ * @param release  called when the memory is no longer needed, may be empty
+ *
+ * @return true if the memory is used as is, false if allocated and copied
+ */
+bool BaseSharedArray::import(uint8_t *mem, uint32_t n, std::function<void()> const &release) {
+  assert(!allocated());
+  assert(mem != nullptr);
+  assert(n > 0);
+  assertq(((uintptr_t) mem) % m_element_size == 0, "SharedArray::import(): memory not aligned for element type", true);
+  assertq(((size_t) n)*m_element_size <= UINT32_MAX, "SharedArray::import(): memory too large for a shared array", true);
+
+  if (m_heap == nullptr) {
+    m_heap = &getBufferObject();
+  }
+
+  uint32_t size_in_bytes = m_element_size*n;
+
+  if (m_heap->import_array(mem, size_in_bytes, release, m_phyaddr)) {
+    m_usraddr   = mem;
+    m_size      = n;
+    m_is_import = true;
+    assert(allocated());
+    return true;
+  }
+
+  // Heap can not use host memory, copy instead
+  alloc(n);
+  std::memcpy(m_usraddr, mem, size_in_bytes);
+  if (release) release();
+  return false;
 }
 
 
 /**
- * Get actual offset within the heap for given index of current shared array.
+ * Map a file into memory and use the mapping for this array.
+ *
+ * The file is mapped privately, pages are loaded when accessed.
+ *
+ * @param offset  start of data in file, in bytes
+ * @param n       number of elements, 0 for all up to the end of the file
+ *
+ * @return true if the mapping is used as is, false if copied
  */
-uint32_t BaseSharedArray::phy(uint32_t i) {
+bool BaseSharedArray::import_file(std::string const &filename, size_t offset, uint32_t n) {
+  assertq(offset % m_element_size == 0, "SharedArray::import_file(): offset not aligned for element type", true);
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fatal("SharedArray::import_file(): can not open file '" + filename + "'");
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    fatal("SharedArray::import_file(): can not get size of file '" + filename + "'");
+  }
+
+  size_t file_size = (size_t) st.st_size;
+  size_t count     = n;
+  if (count == 0 && offset < file_size) {
+    count = (file_size - offset)/m_element_size;
+  }
+
+  if (count == 0 || offset + count*m_element_size > file_size) {
+    close(fd);
+    fatal("SharedArray::import_file(): file '" + filename + "' too small for requested data");
+  }
+
+  // Check before narrowing; a truncated size would silently map less than the file
+  if (count*m_element_size > UINT32_MAX) {
+    close(fd);
+    assertq(false, "SharedArray::import_file(): data in file '" + filename + "' too large for a shared array", true);
+  }
+
+  n = (uint32_t) count;
+
+  // Mappings must start on a page boundary
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  size_t map_start = offset & ~(page_size - 1);
+  size_t map_len   = offset - map_start + ((size_t) n)*m_element_size;
+
+  void *map = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t) map_start);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    fatal("SharedArray::import_file(): can not map file '" + filename + "'");
+  }
+
+  return import((uint8_t *) map + (offset - map_start), n, [map, map_len] () {
+    munmap(map, map_len);
+  });
+}
+
+
+/**
+ * Get the address in main memory for given physical address.
+ *
+ * @param i  physical address, in units of the element size
+ *
+ * For heap views, this covers all segments of the heap which existed when the view was made.
+ * The view keeps these alive, and looks up addresses without locking.
+ */
+uint8_t *BaseSharedArray::phy(uint32_t i) {
   assert(m_phyaddr % m_element_size == 0);
-  int index = (int) (i - ((uint32_t) m_phyaddr/m_element_size));
-  assert(index >= 0);
-  return (uint32_t) index;
+  uint32_t addr = i*m_element_size;
+
+  if (m_phyaddr <= addr && addr - m_phyaddr < m_size*m_element_size) {
+    return m_usraddr + (addr - m_phyaddr);
+  }
+
+  assertq(m_is_heap_view, "SharedArray::phy(): address outside of array", true);
+  return BufferObject::usr_address(*m_segments, addr);
 }
 
 }  // namespace V3DLib
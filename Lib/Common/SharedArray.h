@@ -1,12 +1,21 @@
 #ifndef _V3DLIB_COMMON_SHAREDARRAY_H_
 #define _V3DLIB_COMMON_SHAREDARRAY_H_
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
 #include <vector>
 #include "BufferObject.h"
+#include "ArrayView.h"
 #include "../Support/basics.h"
 #include "../Support/Platform.h"  // has_vc4
 
 namespace V3DLib {
 
+class SharedArrayPool;
+
 class BaseSharedArray {
 public:
   BaseSharedArray(BaseSharedArray &&a) = default;
@@ -26,15 +35,21 @@ protected:
 
   BaseSharedArray(BufferObject *heap, uint32_t element_size);
   BaseSharedArray(uint32_t element_size) : BaseSharedArray(nullptr, element_size) {}
+  BaseSharedArray(std::shared_ptr<SharedArrayPool> const &pool, uint32_t element_size);
 
-  uint32_t phy(uint32_t i);
+  uint8_t *phy(uint32_t i);
+  bool import(uint8_t *mem, uint32_t n, std::function<void()> const &release);
+  bool import_file(std::string const &filename, size_t offset, uint32_t n);
 
 private:
   BufferObject *m_heap = nullptr;  // Reference to used heap
+  std::shared_ptr<SharedArrayPool> m_pool;  // If set, memory is taken from and returned to this pool
   uint32_t const m_element_size;
   uint32_t m_phyaddr   = 0;        // Starting index of memory in GPU space
   uint32_t m_size      = 0;        // Number of contained elements (not memory size!)
   bool     m_is_heap_view = false;
+  bool     m_is_import    = false;  // If true, memory is host memory imported into the heap
+  std::shared_ptr<BufferObject::SegmentTable const> m_segments;  // Heap views only: segments at time of creation
 
   BaseSharedArray(BaseSharedArray const &a) = delete;  // Disallow copy
 
@@ -59,19 +74,60 @@ public:
   SharedArray(uint32_t n) : SharedArray() { Parent::alloc(n); }
   SharedArray(uint32_t n, BufferObject &heap) : BaseSharedArray(&heap, sizeof(T)) { Parent::alloc(n); }
   SharedArray(BufferObject &heap) : BaseSharedArray(&heap, sizeof(T)) {}
+  SharedArray(uint32_t n, std::shared_ptr<SharedArrayPool> const &pool) : BaseSharedArray(pool, sizeof(T)) {
+    Parent::alloc(n);
+  }
 
   SharedArray(SharedArray &&a) = default;
   SharedArray &operator=(SharedArray &&a) = default; 
 
   ~SharedArray() { Parent::dealloc(); }
 
+  /**
+   * Use caller-owned memory for this array, without copying.
+   *
+   * The memory must be aligned for `T` and stay valid until the array is deallocated.
+   * If the heap can not use host memory (vc4 and v3d hardware), memory is allocated
+   * and the data is copied instead.
+   *
+   * @return true if the memory is used as is, false if copied
+   */
+  bool import(T *data, uint32_t n) {
+    return Parent::import((uint8_t *) data, n, nullptr);
+  }
+
+
+  /**
+   * Map a file of raw `T` values into this array, without copying.
+   *
+   * The mapping is private; changes to the array are not written to the file.
+   * If the heap can not use host memory, the data is read from the mapping into
+   * allocated memory instead.
+   *
+   * @param offset  start of data in file, in bytes. Must be a multiple of `sizeof(T)`
+   * @param n       number of values to map, 0 for all values up to the end of the file
+   *
+   * @return true if the file is used as is, false if copied
+   */
+  bool import_file(std::string const &filename, size_t offset = 0, uint32_t n = 0) {
+    return Parent::import_file(filename, offset, n);
+  }
+
+
   T const *ptr() const { return (T *) m_usraddr; }  // Return pointer to data in main memory
   T *ptr() { return (T *) m_usraddr; }
 
+  /**
+   * Raw view on the data in main memory.
+   *
+   * Access through the view is not range checked, use for bulk processing.
+   */
+  ArrayView<T> view()             { return ArrayView<T>(ptr(), size()); }
+  ArrayView<T const> view() const { return ArrayView<T const>(ptr(), size()); }
+
   void fill(T val) {
     assertq(allocated(), "Can not fill unallocated array", true);
-    for (int i = 0; i < (int) size(); i++)
-      (*this)[i] = val;
+    std::fill_n(ptr(), size(), val);
   }
 
 
@@ -85,39 +141,41 @@ public:
    * Needed by interpreter and emulator.
    */
   inline T& phy(uint32_t i) {
-    return (*this)[Parent::phy(i)];
+    return *((T *) Parent::phy(i));
   }
 
 
+  /**
+   * Copy values from main memory to the start of this array.
+   *
+   * The copies are done with `memcpy()`, so that they run at memory bandwidth.
+   */
   void copyFrom(T const *src, uint32_t in_size) {
+    static_assert(std::is_trivially_copyable<T>::value, "SharedArray: element type must be trivially copyable");
     assert(src != nullptr);
-    assert(in_size <= size());
+    assertq(in_size <= size(), "SharedArray::copyFrom(): source larger than array", true);
 
-    // TODO: consider using memcpy() instead
-    for (uint32_t offset = 0; offset < in_size; ++offset) {
-      (*this)[offset] = src[offset];
-    }
+    std::memcpy(ptr(), src, in_size*sizeof(T));
   }
 
   void copyFrom(std::vector<T> const &src) {
     assert(!src.empty());
-    assert(src.size() <= size());
+    copyFrom(src.data(), (uint32_t) src.size());
+  }
 
-    // TODO: consider using memcpy() instead
-    for (uint32_t offset = 0; offset < src.size(); ++offset) {
-      (*this)[offset] = src[offset];
-    }
+  void copyTo(T *dst, uint32_t in_size) const {
+    static_assert(std::is_trivially_copyable<T>::value, "SharedArray: element type must be trivially copyable");
+    assert(dst != nullptr);
+    assertq(in_size <= size(), "SharedArray::copyTo(): requested more than array size", true);
+
+    std::memcpy(dst, ptr(), in_size*sizeof(T));
   }
 
-  void copyTo(std::vector<T> &dst) {
+  void copyTo(std::vector<T> &dst) const {
     assert(!empty());
 
     dst.resize(size());
-
-    // TODO: consider using memcpy() instead
-    for (uint32_t offset = 0; offset < size(); ++offset) {
-      dst[offset] = (*this)[offset];
-    }
+    copyTo(dst.data(), size());
   }
 
 
@@ -159,12 +217,7 @@ public:
 
   bool operator==(SharedArray const &rhs) const { 
     if (size() != rhs.size()) return false;
-
-    for (int i = 0; i < (int) size(); ++i) {
-      if ((*this)[i] != rhs[i]) return false;
-    }
-
-    return true;
+    return std::equal(ptr(), ptr() + size(), rhs.ptr());
   }
 
 protected:
@@ -227,9 +280,32 @@ public:
     Parent::alloc(rows*columns);
   }
 
+  /**
+   * Use caller-owned memory for this array, see `SharedArray::import()`
+   */
+  bool import(T *data, int rows, int columns) {
+    m_rows = rows;
+    m_columns = columns;
+    validate();
+
+    return Parent::import(data, rows*columns);
+  }
+
+  /**
+   * Map a file of raw `T` values, stored by row, into this array, see `SharedArray::import_file()`
+   */
+  bool import_file(std::string const &filename, int rows, int columns, size_t offset = 0) {
+    m_rows = rows;
+    m_columns = columns;
+    validate();
+
+    return Parent::import_file(filename, offset, rows*columns);
+  }
+
   using Parent::fill;
   using Parent::getAddress;
   using Parent::allocated;
+  using Parent::view;
 
   Parent const &get_parent() { return (Parent const &) *this; }  // explicit cast
 
@@ -237,17 +313,29 @@ public:
   int columns() const { return m_columns; }
 
   /**
-   * Copy values from square array `a` to array `b`, tranposing the array in the process
+   * Copy values from array `rhs` to this array, transposing the array in the process.
+   *
+   * The copy is done in square blocks, so that both the reads and the writes stay within the cache.
    */
   void copy_transposed(Shared2DArray const &rhs) {
-    assertq(is_square() && rhs.is_square(), "copy_transposed(): can only transpose if both arrays are square");
-    assertq(m_rows == rhs.m_rows, "copy_transposed(): can only copy if arrays have same dimension");
+    assertq(m_rows == rhs.m_columns && m_columns == rhs.m_rows,
+      "copy_transposed(): dimensions of arrays do not match for transpose");
+
+    int const BLOCK = 16;
+    T const *src = rhs.ptr();
+    T *dst = ptr();
 
-    int dim = m_rows;
+    for (int r0 = 0; r0 < rhs.m_rows; r0 += BLOCK) {
+      int r_end = std::min(r0 + BLOCK, rhs.m_rows);
 
-    for (int r = 0; r < dim; r++) {
-      for (int c = 0; c < dim; c++) {
-        (*this)[c][r] = rhs[r][c];
+      for (int c0 = 0; c0 < rhs.m_columns; c0 += BLOCK) {
+        int c_end = std::min(c0 + BLOCK, rhs.m_columns);
+
+        for (int r = r0; r < r_end; r++) {
+          for (int c = c0; c < c_end; c++) {
+            dst[c*m_columns + r] = src[r*rhs.m_columns + c];
+          }
+        }
       }
     }
   }
@@ -270,15 +358,27 @@ public:
     return Row(this, row, m_columns);
   }
 
+  /**
+   * Raw view on a row, not range checked.
+   */
+  ArrayView<T> row(int r) {
+    assert(0 <= r && r < m_rows);
+    return view().subview(r*m_columns, m_columns);
+  }
+
+  ArrayView<T const> row(int r) const {
+    assert(0 <= r && r < m_rows);
+    return view().subview(r*m_columns, m_columns);
+  }
+
   void make_unit_matrix() {
     assert(m_rows == m_columns);  // square matrices only
 
     int dim = m_columns;
 
-    for (int r = 0; r < dim; r++) {
-      for (int c = 0; c < dim; c++) {
-        Parent::access(r*dim + c) = (r == c)? 1 : 0;
-      }
+    fill(0);
+    for (int i = 0; i < dim; i++) {
+      ptr()[i*dim + i] = 1;
     }
   }
 
@@ -303,17 +403,42 @@ public:
   }
 
 
-  void copyTo(std::vector<T> &dst) {
+  void copyTo(std::vector<T> &dst) const {
     assert(rows() > 0);
     assert(columns() > 0);
 
-    dst.resize(rows()*columns());
+    Parent::copyTo(dst);
+  }
 
-    for (int r = 0; r < rows(); ++r) {
-      for (int c = 0; c < columns(); ++c) {
-        int offset = r*columns() + c;
-        dst[offset] = (*this)[r][c];
-      }
+
+  /**
+   * Copy a block of values from main memory, with rows `src_stride` elements apart.
+   *
+   * The block is written at (`row`, `col`) in this array.
+   */
+  void copyFrom(T const *src, int src_stride, int num_rows, int num_cols, int row = 0, int col = 0) {
+    assert(src != nullptr);
+    assert(num_cols <= src_stride);
+    assertq(0 <= row && row + num_rows <= m_rows && 0 <= col && col + num_cols <= m_columns,
+      "Shared2DArray::copyFrom(): block outside of array", true);
+
+    for (int r = 0; r < num_rows; r++) {
+      std::memcpy(ptr() + (row + r)*m_columns + col, src + r*src_stride, num_cols*sizeof(T));
+    }
+  }
+
+
+  /**
+   * Copy a block of values at (`row`, `col`) to main memory, with rows `dst_stride` elements apart.
+   */
+  void copyTo(T *dst, int dst_stride, int num_rows, int num_cols, int row = 0, int col = 0) const {
+    assert(dst != nullptr);
+    assert(num_cols <= dst_stride);
+    assertq(0 <= row && row + num_rows <= m_rows && 0 <= col && col + num_cols <= m_columns,
+      "Shared2DArray::copyTo(): block outside of array", true);
+
+    for (int r = 0; r < num_rows; r++) {
+      std::memcpy(dst + r*dst_stride, ptr() + (row + r)*m_columns + col, num_cols*sizeof(T));
     }
   }
 
@@ -0,0 +1,185 @@
+#include "SharedArrayPool.h"
+
+namespace V3DLib {
+namespace {
+
+thread_local SharedArrayPool::Ptr thread_pool;
+thread_local SharedArrayScope *current_scope = nullptr;
+
+}  // anon namespace
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Class SharedArrayPool
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Get memory for an array, from the cache if possible.
+ *
+ * If the array is not in the cache and does not fit in the heap, the cache is returned
+ * to the heap first. Only if that does not help, the heap grows.
+ *
+ * @return physical address of the memory
+ */
+uint32_t SharedArrayPool::acquire(uint32_t size_in_bytes, uint8_t *&array_start_address) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_free.find(size_in_bytes);
+    if (it != m_free.end() && !it->second.empty()) {
+      auto block = it->second.back();  // Most recently released, likely still in the CPU cache
+      it->second.pop_back();
+
+      array_start_address = block->usraddr;
+      uint32_t ret = block->phyaddr;
+
+      m_blocks.erase(block);
+      m_cached_bytes -= size_in_bytes;
+      m_hits++;
+      return ret;
+    }
+
+    m_misses++;
+  }
+
+  uint32_t ret = 0;
+  if (m_heap.try_alloc_array(size_in_bytes, array_start_address, ret)) return ret;
+
+  if (cached_bytes() > 0) {
+    trim();
+    if (m_heap.try_alloc_array(size_in_bytes, array_start_address, ret)) return ret;
+  }
+
+  return m_heap.alloc_array(size_in_bytes, array_start_address);
+}
+
+
+/**
+ * Keep the memory of an array for reuse.
+ *
+ * Blocks larger than the cap go straight back to the heap.
+ */
+void SharedArrayPool::release(uint32_t phyaddr, uint8_t *usraddr, uint32_t size_in_bytes) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (size_in_bytes > m_max_cached_bytes) {
+    m_heap.dealloc_array(phyaddr, size_in_bytes);
+    return;
+  }
+
+  evict(m_max_cached_bytes - size_in_bytes);
+
+  m_blocks.push_back({phyaddr, usraddr, size_in_bytes});
+  m_free[size_in_bytes].push_back(std::prev(m_blocks.end()));
+  m_cached_bytes += size_in_bytes;
+}
+
+
+/**
+ * Return all cached memory to the heap.
+ */
+void SharedArrayPool::trim() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  evict(0);
+}
+
+
+/**
+ * Return the least recently released blocks to the heap, until at most `max_bytes` are cached.
+ *
+ * To be called with the pool locked.
+ */
+void SharedArrayPool::evict(uint32_t max_bytes) {
+  while (m_cached_bytes > max_bytes) {
+    assert(!m_blocks.empty());
+    auto const &block = m_blocks.front();
+
+    // Blocks of the same size are in the same order in both lists
+    auto &same_size = m_free[block.size_in_bytes];
+    assert(!same_size.empty() && same_size.front() == m_blocks.begin());
+    same_size.pop_front();
+
+    m_heap.dealloc_array(block.phyaddr, block.size_in_bytes);
+    m_cached_bytes -= block.size_in_bytes;
+    m_blocks.pop_front();
+  }
+}
+
+
+uint32_t SharedArrayPool::cached_bytes() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cached_bytes;
+}
+
+
+uint32_t SharedArrayPool::max_cached_bytes() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_max_cached_bytes;
+}
+
+
+/**
+ * Set the maximum number of bytes to keep in the cache.
+ *
+ * The default is a quarter of the initial heap size.
+ * If the cache is over the new maximum, the excess is returned to the heap.
+ */
+void SharedArrayPool::max_cached_bytes(uint32_t val) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_max_cached_bytes = val;
+  evict(val);
+}
+
+
+/**
+ * Get the pool of the current thread, for the global heap.
+ *
+ * Each thread has its own pool, so that pools are not contended.
+ */
+SharedArrayPool::Ptr const &SharedArrayPool::for_thread() {
+  if (!thread_pool) {
+    thread_pool = std::make_shared<SharedArrayPool>(getBufferObject());
+  }
+
+  return thread_pool;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Class SharedArrayScope
+///////////////////////////////////////////////////////////////////////////////
+
+SharedArrayScope::SharedArrayScope(SharedArrayPool::Ptr const &pool) :
+  m_pool(pool),
+  m_prev(current_scope)
+{
+  assert(m_pool);
+  current_scope = this;
+}
+
+
+SharedArrayScope::~SharedArrayScope() {
+  assert(current_scope == this);  // Scopes must be destroyed in reverse order of creation
+  release();
+  current_scope = m_prev;
+}
+
+
+/**
+ * Deallocate all arrays created with `array()`.
+ *
+ * References to these arrays are invalid afterwards.
+ */
+void SharedArrayScope::release() {
+  m_arrays.clear();
+}
+
+
+/**
+ * @return innermost active scope of the current thread, nullptr if none
+ */
+SharedArrayScope *SharedArrayScope::current() {
+  return current_scope;
+}
+
+}  // namespace V3DLib
@@ -0,0 +1,113 @@
+#ifndef _V3DLIB_COMMON_SHAREDARRAYPOOL_H_
+#define _V3DLIB_COMMON_SHAREDARRAYPOOL_H_
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "SharedArray.h"
+
+namespace V3DLib {
+
+/**
+ * Cache of heap memory for shared arrays.
+ *
+ * Memory of deallocated arrays is kept per size and handed out again to new arrays
+ * of the same size, without going through the heap.
+ * The memory is returned to the heap with `trim()`, or when the pool is destroyed.
+ *
+ * The cached memory is capped, see `max_cached_bytes()`. When the cap is exceeded, the
+ * least recently released blocks go back to the heap first.
+ * If a new array does not fit in the heap, the cache is emptied before the heap grows.
+ *
+ * A pool is held by `std::shared_ptr`; arrays using the pool keep it alive.
+ * Allocation and deallocation can be called from multiple threads.
+ */
+class SharedArrayPool {
+public:
+  using Ptr = std::shared_ptr<SharedArrayPool>;
+
+  SharedArrayPool(BufferObject &heap) : m_heap(heap), m_max_cached_bytes(heap.size()/4) {}
+  SharedArrayPool(SharedArrayPool const &) = delete;
+  SharedArrayPool &operator=(SharedArrayPool const &) = delete;
+  ~SharedArrayPool() { trim(); }
+
+  BufferObject &heap() { return m_heap; }
+  uint32_t acquire(uint32_t size_in_bytes, uint8_t *&array_start_address);
+  void release(uint32_t phyaddr, uint8_t *usraddr, uint32_t size_in_bytes);
+  void trim();
+
+  uint32_t cached_bytes() const;
+  uint32_t max_cached_bytes() const;
+  void max_cached_bytes(uint32_t val);
+  int hits() const   { return m_hits; }
+  int misses() const { return m_misses; }
+
+  static Ptr const &for_thread();
+
+private:
+  struct Block {
+    uint32_t phyaddr;
+    uint8_t *usraddr;
+    uint32_t size_in_bytes;
+  };
+
+  using BlockList = std::list<Block>;
+
+  BufferObject &m_heap;
+  mutable std::mutex m_mutex;  // Guards the fields below
+  BlockList m_blocks;          // Cached blocks, least recently released first
+  std::unordered_map<uint32_t, std::deque<BlockList::iterator>> m_free;  // Cached blocks, per size in bytes
+  uint32_t m_cached_bytes     = 0;
+  uint32_t m_max_cached_bytes = 0;
+  int      m_hits             = 0;
+  int      m_misses           = 0;
+
+  void evict(uint32_t max_bytes);
+};
+
+
+/**
+ * Scope for shared arrays which are used for a limited time, e.g. one frame or one request.
+ *
+ * - Arrays created with `array()` belong to the scope, and are released all together
+ *   with `release()` or at the end of the scope.
+ * - While a scope is active, all other shared arrays which are allocated on the current
+ *   thread without an explicit heap use the pool of the scope as well.
+ *   This includes the arrays which are passed to a kernel with `Kernel::load()`, as well
+ *   as the per-call buffers of the kernel drivers.
+ *
+ * The memory goes back to the pool, so that repeating the same work in a new scope
+ * reuses the memory without going through the heap.
+ *
+ * Scopes can be nested; they must be destroyed in reverse order of creation.
+ */
+class SharedArrayScope {
+public:
+  SharedArrayScope(SharedArrayPool::Ptr const &pool = SharedArrayPool::for_thread());
+  SharedArrayScope(SharedArrayScope const &) = delete;
+  SharedArrayScope &operator=(SharedArrayScope const &) = delete;
+  ~SharedArrayScope();
+
+  template<typename T>
+  SharedArray<T> &array(uint32_t n) {
+    auto arr = std::make_shared<SharedArray<T>>(n, m_pool);
+    m_arrays.push_back(arr);
+    return *arr;
+  }
+
+  void release();
+  SharedArrayPool::Ptr const &pool() const { return m_pool; }
+
+  static SharedArrayScope *current();
+
+private:
+  SharedArrayPool::Ptr m_pool;
+  std::vector<std::shared_ptr<BaseSharedArray>> m_arrays;  // shared_ptr deletes with the actual type
+  SharedArrayScope *m_prev = nullptr;
+};
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_COMMON_SHAREDARRAYPOOL_H_
@@ -2,7 +2,9 @@
 #define _V3DLIB_KERNEL_H_
 #include <tuple>
 #include <algorithm>  // std::move
+#include <future>
 #include "BaseKernel.h"
+#include "Common/SharedArrayPool.h"
 #include "Source/Complex.h"
 //#include "Support/assign.h"
 
@@ -90,13 +92,27 @@ public:
 
   /**
    * Construct kernel out of C++ function
+   *
+   * The compiler state is local to the compiling thread.
+   * When compiling for both platforms, the vc4 kernel is compiled on a separate thread,
+   * in parallel with the v3d kernel.
    */
   Kernel(KernelFunction f, CompileFor compile_for) {
+    std::future<void> vc4_done;
+
     if (compile_for & VC4) {
-      compile_init(true);
-      vc4().compile([this, f] () {
-        f(mkArg<ts>()...);  // Construct the AST for vc4; see Note 2 in class header
-      });
+      auto compile_vc4 = [this, f] () {
+        compile_init(true);
+        vc4().compile([this, f] () {
+          f(mkArg<ts>()...);  // Construct the AST for vc4; see Note 2 in class header
+        });
+      };
+
+      if (compile_for & V3D) {
+        vc4_done = std::async(std::launch::async, compile_vc4);
+      } else {
+        compile_vc4();
+      }
     }
 
     if (compile_for & V3D) {
@@ -106,6 +122,10 @@ public:
         f(mkArg<ts>()...);  // Construct the AST for v3d
       });
     }
+
+    if (vc4_done.valid()) {
+      vc4_done.get();  // Rethrows any exception from the vc4 compile
+    }
   }
 
 
@@ -113,6 +133,9 @@ public:
    * Load uniform values.
    *
    * Pass params, checking arguments types us against parameter types ts.
+   *
+   * For repeated calls with new arrays, e.g. per request, allocate the arrays within
+   * a `SharedArrayScope`, so that their memory is recycled.
    */
   template <typename... us>
   Kernel &load(us... args) {
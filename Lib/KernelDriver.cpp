@@ -2,13 +2,15 @@
 #include <iostream>            // cout
 #include "Support/basics.h"
 #include "Support/Platform.h"
+#include "Support/Arena.h"
 #include "Source/StmtStack.h"
 #include "Source/Pretty.h"
 #include "Source/Translate.h"
+#include "Source/Optimize.h"
 #include "Source/Lang.h"       // initStmt
 #include "Target/Satisfy.h"
+#include "Liveness/Spill.h"
 #include "SourceTranslate.h"
-#include "Support/Timer.h"
 #include "Target/instr/Mnemonics.h"
 
 namespace V3DLib {
@@ -123,12 +125,18 @@ void compile_postprocess(Instr::List &targetCode) {
     loadStorePass(targetCode);
   }
 
-  //compile_data.target_code_before_regalloc = targetCode.dump();
+  if (CompileData::capture_dumps()) {
+    compile_data.target_code_before_regalloc = [code = targetCode] () { return code.dump(); };
+  }
 
   // Perform register allocation
-  getSourceTranslate().regAlloc(targetCode);  // performance hog 32/33s
+  {
+    CompilePhase phase("regalloc");
+    getSourceTranslate().regAlloc(targetCode);  // performance hog 32/33s
+  }
 
   // Satisfy target code constraints
+  CompilePhase phase("satisfy");
   satisfy(targetCode);
 }
 
@@ -170,6 +178,9 @@ void KernelDriver::obtain_ast() {
   }
 
   m_body = *m_stmtStack.pop();
+
+  CompilePhase phase("optimize source");
+  optimize(m_body);
 }
 
 
@@ -177,10 +188,20 @@ void KernelDriver::obtain_ast() {
  * Entry point for compilation of source code to target code.
  *
  * This method is here to just handle thrown exceptions.
+ *
+ * The syntax tree of each compile gets its own arena, which is released with the tree.
  */
 void KernelDriver::compile(std::function<void()> create_ast) {
+  Arena::start_new();
+
   try {
-    create_ast();
+    CompilePhase phase("compile");
+
+    {
+      CompilePhase phase("build AST");
+      create_ast();
+    }
+
     compile_intern();
     m_numVars = VarGen::count();
   } catch (V3DLib::Exception const &e) {
@@ -202,6 +223,80 @@ void KernelDriver::compile(std::function<void()> create_ast) {
 }
 
 
+/**
+ * Try to obtain the compiled kernel from the kernel cache.
+ *
+ * To be called directly after the target code has been generated from the source code.
+ * On a hit, the generated target code is replaced with the final target code from the cache,
+ * and the opcodes are loaded. The rest of the compilation can then be skipped.
+ *
+ * @return true if the kernel was found in the cache, false otherwise
+ */
+bool KernelDriver::load_from_cache() {
+  if (!KernelCache::enabled()) return false;
+
+  m_cache_key = KernelCache::key(m_targetCode);
+  m_cache_status = KernelCache::MISS;
+
+  KernelCache::Entry entry;
+  if (!KernelCache::load(m_cache_key, entry)) return false;
+
+  // The entry passed its checksum, so the code deserializes without reading past the end
+  Instr::List code;
+  uint32_t const *p   = entry.target_code.data();
+  uint32_t const *end = p + entry.target_code.size();
+
+  while (p < end) {
+    code << Instr::deserialize(p);
+  }
+
+  assert(p == end);
+
+  m_targetCode.clear();
+  m_targetCode << code;
+
+  VarGen::reset(entry.num_vars);
+  compile_data.num_accs_introduced       = entry.num_accs_introduced;
+  compile_data.num_copies_propagated     = entry.num_copies_propagated;
+  compile_data.num_instructions_combined = entry.num_instructions_combined;
+  compile_data.num_delay_slots_filled    = entry.num_delay_slots_filled;
+  compile_data.num_spill_slots           = entry.num_spill_slots;
+
+  load_opcodes(entry.opcodes);
+
+  m_cache_status = KernelCache::HIT;
+  m_cache_key    = KernelCache::Key();  // Not needed any more
+  return true;
+}
+
+
+/**
+ * Store the compiled kernel in the kernel cache.
+ *
+ * Only done if `load_from_cache()` was called for the compile and missed.
+ */
+void KernelDriver::store_in_cache() {
+  if (m_cache_status != KernelCache::MISS) return;
+  if (has_errors()) return;
+
+  KernelCache::Entry entry;
+  entry.num_vars                  = VarGen::count();
+  entry.num_accs_introduced       = compile_data.num_accs_introduced;
+  entry.num_copies_propagated     = compile_data.num_copies_propagated;
+  entry.num_instructions_combined = compile_data.num_instructions_combined;
+  entry.num_delay_slots_filled    = compile_data.num_delay_slots_filled;
+  entry.num_spill_slots           = compile_data.num_spill_slots;
+  entry.opcodes                   = opcodes();
+
+  for (int i = 0; i < m_targetCode.size(); i++) {
+    m_targetCode[i].serialize(entry.target_code);
+  }
+
+  KernelCache::store(m_cache_key, entry);
+  m_cache_key = KernelCache::Key();  // Not needed any more
+}
+
+
 std::string KernelDriver::get_errors() const {
   std::string ret;
 
@@ -292,8 +387,31 @@ void KernelDriver::invoke(int numQPUs, IntList &params) {
     fatal("Errors during kernel compilation/encoding, can't continue.");
   }
 
-   // Invoke kernel on QPUs
-  invoke_intern(numQPUs, params);
+  // Invoke kernel on QPUs
+  IntList unif = spill_params(params);
+  invoke_intern(numQPUs, unif);
+}
+
+
+/**
+ * Add the memory for spilled variables to the kernel parameters.
+ *
+ * This is passed as the last parameter. If no variables were spilled,
+ * the parameters are returned unchanged.
+ */
+IntList KernelDriver::spill_params(IntList const &params) {
+  IntList ret;
+  ret << params;
+
+  if (num_spill_slots() > 0) {
+    if (!m_spill.allocated()) {
+      m_spill.alloc(num_spill_slots()*Spill::SLOT_SIZE);
+    }
+
+    ret << (int) m_spill.getAddress();
+  }
+
+  return ret;
 }
 
 
@@ -302,8 +420,29 @@ std::string KernelDriver::compile_info() const {
 
   ret << "  compile num generated variables: " << numVars() << "\n"
       << "  num accs introduced            : " << numAccs() << "\n"
+      << "  num copies propagated          : " << m_compile_data.num_copies_propagated << "\n"
+      << "  num spilled variables          : " << num_spill_slots() << "\n"
+      << "  num constants folded           : " << m_compile_data.num_constants_folded << "\n"
+      << "  num expressions simplified     : " << m_compile_data.num_exprs_simplified << "\n"
+      << "  num subexpressions reused      : " << m_compile_data.num_subexprs_reused << "\n"
+      << "  num dead assignments removed   : " << m_compile_data.num_dead_assigns_removed << "\n"
+      << "  num loop invariants hoisted    : " << m_compile_data.num_invariants_hoisted << "\n"
+      << "  num strength reductions        : " << m_compile_data.num_strength_reductions << "\n"
+      << "  num loops unrolled             : " << m_compile_data.num_loops_unrolled << "\n"
+      << "  num unroll factors limited     : " << m_compile_data.num_unrolls_limited << "\n"
+      << "  num instructions combined      : " << m_compile_data.num_instructions_combined << "\n"
+      << "  num delay slots filled         : " << m_compile_data.num_delay_slots_filled << "\n"
+      << "  kernel cache                   : " << KernelCache::status_str(m_cache_status) << "\n"
       << "  num compile errors             : " << errors.size();
 
+  if (!m_compile_data.phase_times.empty()) {
+    std::string phases = m_compile_data.dump_phase_times(4);
+    phases.pop_back();  // Drop final newline
+
+    ret << "\n  compile phases (ms):\n"
+        << phases;
+  }
+
   return ret;
 }
 
@@ -5,6 +5,8 @@
 #include <functional>
 #include "Common/BufferType.h"
 #include "Common/CompileData.h"
+#include "Common/KernelCache.h"
+#include "Common/SharedArray.h"
 #include "Source/StmtStack.h"
 
 namespace V3DLib {
@@ -27,7 +29,11 @@ public:
 
   void pretty(char const *filename = nullptr, bool output_qpu_code = true);
   std::string compile_info() const;
+  int num_spill_slots() const { return m_compile_data.num_spill_slots; }
+  CompileData const &stats() const { return m_compile_data; }
+  IntList spill_params(IntList const &params);
   void dump_compile_data(char const *filename) const;
+  KernelCache::Status cache_status() const { return m_cache_status; }
 
 protected:
   Instr::List m_targetCode;           // Target code generated from AST
@@ -38,15 +44,22 @@ protected:
 
   virtual void emit_opcodes(FILE *f) {} 
   void obtain_ast();
+  bool load_from_cache();
+  void store_in_cache();
 
 private:
   BufferType const buffer_type;
   StmtStack m_stmtStack;
   int m_numVars = 0;                  // The number of variables in the source code for vc4
   CompileData m_compile_data;
+  Data        m_spill;                // Memory for spilled variables, if any
+  KernelCache::Status m_cache_status = KernelCache::DISABLED;
+  KernelCache::Key    m_cache_key;
 
   virtual void compile_intern() = 0;
   virtual void invoke_intern(int numQPUs, IntList &params) = 0;
+  virtual std::vector<uint64_t> opcodes() = 0;
+  virtual void load_opcodes(std::vector<uint64_t> const &code) = 0;
 
   int numAccs() const { return m_compile_data.num_accs_introduced; }
 
@@ -8,9 +8,13 @@ int const QPU_TIMEOUT = 10;
 
 struct SettingsInternal {
   int  heap_size   = -1;                  // bytes, size of shared (CPU-GPU) memory
+  bool heap_growth = true;                // If true, add segments to the heap when it is full
   int  qpu_timeout = -1;                  // seconds, time to wait for response from QPU
   bool use_tmu_for_load = true;           // vc4 only, ignored for v3d. If false, use DMA
   bool use_high_precision_sincos = false; // If true, add extra precision to sin/cos calculation for function version
+  bool emu_lockstep = true;               // If true, emulator and interpreter run QPUs in lockstep on a single thread
+  std::string kernel_cache_dir;           // Directory for compiled kernels. If empty, no caching is done
+  LibSettings::Diagnostics compile_diagnostics = LibSettings::DIAG_NONE;
 } settings;
 
 }  // anon namespace
@@ -58,6 +62,17 @@ void LibSettings::heap_size(int val) {
 }
 
 
+/**
+ * Select if the shared heap may grow.
+ *
+ * When the heap is full, an extra segment at least the size of the initial heap is added to it.
+ * Extra segments are released again when they are no longer used.
+ * If disabled, running out of heap space is fatal.
+ */
+bool LibSettings::heap_growth()         { return settings.heap_growth; }
+void LibSettings::heap_growth(bool val) { settings.heap_growth = val; }
+
+
 bool LibSettings::use_tmu_for_load()         { return settings.use_tmu_for_load; }
 void LibSettings::use_tmu_for_load(bool val) { settings.use_tmu_for_load = val; }
 
@@ -65,4 +80,41 @@ void LibSettings::use_tmu_for_load(bool val) { settings.use_tmu_for_load = val;
 bool LibSettings::use_high_precision_sincos()         { return settings.use_high_precision_sincos; }
 void LibSettings::use_high_precision_sincos(bool val) { settings.use_high_precision_sincos = val; }
 
+
+/**
+ * Select how the emulator and interpreter run multiple QPUs.
+ *
+ * By default, all QPUs run in lockstep on the calling thread, one instruction per QPU at a time.
+ * This is deterministic, which is useful for debugging.
+ *
+ * With lockstep off, each QPU runs on its own host thread. This is faster for kernels which
+ * do a lot of work per QPU, but the order in which the QPUs access shared memory varies
+ * from run to run.
+ */
+bool LibSettings::emu_lockstep()         { return settings.emu_lockstep; }
+void LibSettings::emu_lockstep(bool val) { settings.emu_lockstep = val; }
+
+
+/**
+ * Select the level of diagnostics collected during compilation.
+ *
+ * By default, only the statistics shown in `compile_info()` are collected.
+ * The debug dumps for `dump_compile_data()` are expensive to make and are only
+ * taken with `DIAG_FULL`. This must be set before compiling the kernel.
+ */
+LibSettings::Diagnostics LibSettings::compile_diagnostics()         { return settings.compile_diagnostics; }
+void LibSettings::compile_diagnostics(LibSettings::Diagnostics val) { settings.compile_diagnostics = val; }
+
+
+/**
+ * Select the directory for the on-disk cache of compiled kernels.
+ *
+ * Compiled kernels are stored here and reused by subsequent compiles of the same kernel,
+ * also over program runs. See `KernelCache`. The directory is created if not present.
+ *
+ * By default this is empty, and caching is disabled.
+ */
+std::string const &LibSettings::kernel_cache_dir()     { return settings.kernel_cache_dir; }
+void LibSettings::kernel_cache_dir(std::string const &val) { settings.kernel_cache_dir = val; }
+
 }  // namespace V3DLib
@@ -1,5 +1,6 @@
 #ifndef _V3DLIB_LIBSETTINGS_H_
 #define _V3DLIB_LIBSETTINGS_H_
+#include <string>
 
 namespace V3DLib {
 
@@ -8,17 +9,38 @@ namespace V3DLib {
  */
 class LibSettings {
 public:
+  /**
+   * Level of diagnostics collected during compilation, see `CompileData`
+   */
+  enum Diagnostics {
+    DIAG_NONE,    // Collect statistics only
+    DIAG_TIMING,  // Also time the compile phases
+    DIAG_FULL     // Also take debug dumps, for `dump_compile_data()`
+  };
+
   static int  qpu_timeout();
   static void qpu_timeout(int val);
 
   static int  heap_size();
   static void heap_size(int val);
 
+  static bool heap_growth();
+  static void heap_growth(bool val);
+
   static bool use_tmu_for_load();
   static void use_tmu_for_load(bool val);
 
   static bool use_high_precision_sincos();
   static void use_high_precision_sincos(bool val);
+
+  static bool emu_lockstep();
+  static void emu_lockstep(bool val);
+
+  static Diagnostics compile_diagnostics();
+  static void compile_diagnostics(Diagnostics val);
+
+  static std::string const &kernel_cache_dir();
+  static void kernel_cache_dir(std::string const &val);
 };
 
 }  // namespace V3DLib
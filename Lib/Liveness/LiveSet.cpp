@@ -10,19 +10,22 @@ namespace V3DLib {
 // Class LiveSets
 ///////////////////////////////////////////////////////////////////////////////
 
-LiveSets::LiveSets(int size) : m_size(size) {
+LiveSets::LiveSets(int size) : m_size(size), m_sets(size) {
   assert(size > 0);
-  m_sets = new RegIdSet[size];
-}
-
 
-LiveSets::~LiveSets() {
-  delete [] m_sets;
+  for (auto &set : m_sets) {
+    set.resize(size);
+  }
 }
 
 
+/**
+ * Determine for each variable the variables which are live at the same time.
+ *
+ * A variable is never added to its own set.
+ */
 void LiveSets::init(Instr::List &instrs, Liveness &live) {
-  RegIdSet liveOut;
+  RegBitSet liveOut;
 
   for (int i = 0; i < instrs.size(); i++) {
     live.computeLiveOut(i, liveOut);
@@ -30,22 +33,22 @@ void LiveSets::init(Instr::List &instrs, Liveness &live) {
     Reg rd = instrs[i].dst_a_reg();
 
     for (auto rx : liveOut) {
-      for (auto ry : liveOut) {
-        if (rx != ry) (*this)[rx].insert(ry);
-      }
-
-      if (rd.tag != NONE) {
-        if (rd.regId != rx) {
-          (*this)[rx].insert(rd.regId);
-          (*this)[rd.regId].insert(rx);
-        }
-      }
+      auto &set = (*this)[rx];
+      set.add(liveOut);
+      if (rd.tag != NONE) set.insert(rd.regId);
+      set.remove(rx);
+    }
+
+    if (rd.tag != NONE && !liveOut.empty()) {
+      auto &set = (*this)[rd.regId];
+      set.add(liveOut);
+      set.remove(rd.regId);
     }
   }
 }
 
 
-RegIdSet &LiveSets::operator[](int index) {
+RegBitSet &LiveSets::operator[](int index) {
   assert(index >=0 && index < m_size);
   return m_sets[index];
 }
@@ -65,7 +68,7 @@ std::vector<bool> LiveSets::possible_registers(int index, RegUsage &alloc, RegTa
   for (int j = 0; j < NUM_REGS; j++)
     possible[j] = true;
 
-  RegIdSet &set = (*this)[index];
+  RegBitSet &set = (*this)[index];
 
   // Eliminate impossible choices of register for this variable
   for (auto j : set) {
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include "Target/instr/Instr.h"
+#include "Support/RegBitSet.h"
 
 namespace V3DLib {
 
@@ -13,10 +14,9 @@ class RegUsage;
 class LiveSets {
 public:
   LiveSets(int size);
-  ~LiveSets();
 
   void init(Instr::List &instrs, Liveness &live);
-  RegIdSet &operator[](int index);
+  RegBitSet &operator[](int index);
   std::vector<bool> possible_registers(int index, RegUsage &alloc, RegTag reg_tag = REG_A);
 
   static RegId choose_register(std::vector<bool> &possible, bool check_limit = true);  
@@ -26,7 +26,7 @@ public:
 
 private:
   int m_size = 0;
-  RegIdSet *m_sets = nullptr;
+  std::vector<RegBitSet> m_sets;
 };
 
 }  // namespace V3DLib
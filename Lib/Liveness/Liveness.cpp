@@ -3,13 +3,13 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 #include "Liveness.h"
+#include <algorithm>
 #include <iostream>
 #include "Support/basics.h"
 #include "Support/Platform.h"
 #include "Target/Subst.h"
 #include "Common/CompileData.h"
 #include "Optimizations.h"
-#include "Support/Timer.h"
 #include "UseDef.h"
 
 namespace V3DLib {
@@ -129,107 +129,253 @@ Instr::List  remove_replaced_instructions(Instr::List &instrs) {
 ///////////////////////////////////////////////////////////////////////////////
 
 /**
- * Determine the liveness sets for each instruction.
+ * Determine the 'use' and 'def' variables of each instruction
  */
-void Liveness::compute_liveness(Instr::List &instrs) {
-  //Timer t("compute_liveness", true);
+void Liveness::set_use_def(Instr::List &instrs) {
+  m_defs.resize(instrs.size());
+  m_uses.resize(instrs.size());
+  m_def_used.resize(instrs.size());
 
-  // Initialise live mapping to have one entry per instruction
-  setSize(instrs.size());
-/*
-  // Went wrong with Seq<>, you never know later on
-  for (int i = 0; i < (int) m_set.size(); i++) {
-    assert(m_set[i].empty());
+  for (int i = 0; i < (int) instrs.size(); i++) {
+    auto &instr = instrs[i];
+
+    bool also_set_used = false;
+
+    if (instr.isCondAssign()) {  // no performance impact ~ 1.5%
+      Reg dst = instr.dst_a_reg();
+
+      if (dst.tag != NONE) {
+        auto &item = m_reg_usage[dst.regId];
+
+        // If the dst variable is not used before, it should not be set as used as well
+        assert(item.first_dst() <= i);
+        also_set_used = (item.first_dst() < i);
+
+        if (!also_set_used) {
+          //
+          // Sanity check: in this case, we expect the variable to be in the condition assign block only
+          //
+          // Notably, this assertion fails for init of variables without an explicit init value.
+          // This can be extremely confusing, hence this comment.
+          //
+          AssignCond assign_cond = instr.assign_cond();
+          for (int j = item.first_usage(); j <= item.last_usage(); j++) {
+            assertq((assign_cond == instrs[j].assign_cond())            // expected usage
+                 || (instrs[j].is_always() && !instrs[j].is_branch()),  // Interim basic usage allowed (happens)
+              "Expected variable to be in condition assign block only", true
+            );
+          }
+        }
+      }
+    }
+
+    // Compute 'use' and 'def' sets
+    // The assigned variable of a conditional assign is kept apart from the uses,
+    // so that the uses match the reg usage.
+    UseDef useDef(instr);
+
+    m_defs[i] = (useDef.def.tag != NONE)? useDef.def.regId : -1;
+    m_uses[i].assign(useDef.use.begin(), useDef.use.end());
+    m_def_used[i] = also_set_used && (instr.tag == InstrTag::LI || instr.tag == InstrTag::ALU);
   }
-*/
+}
 
-  // For temporarily storing live-in and live-out variables
-  RegIdSet liveIn;
-  RegIdSet liveOut;
 
-  bool changed = true;
-  int count = 0;
+/**
+ * Derive the predecessors of each instruction from the CFG
+ */
+void Liveness::set_preds() {
+  m_preds.resize(m_cfg.size());
 
-  //Timer t2("compute_liveness loop intern");
-  //Timer t3("compute liveOut");
-  //Timer t4("compute use/def rest");
-  //Timer t5("compute insert");
-
-  // Iterate until no change, i.e. fixed point
-  while (changed) {
-    changed = false;
-
-    // Propagate live variables backwards
-    for (int i = instrs.size() - 1; i >= 0; i--) {
-      auto &instr = instrs[i];
-
-      bool also_set_used = false;
-
-      if (instr.isCondAssign()) {  // no performance impact ~ 1.5%
-        Reg dst = instr.dst_a_reg();
-
-        if (dst.tag != NONE) {
-          auto &item = m_reg_usage[dst.regId];
-
-          // If the dst variable is not used before, it should not be set as used as well
-          assert(item.first_dst() <= i);
-          also_set_used = (item.first_dst() < i);
-
-          if (!also_set_used) {
-            //
-            // Sanity check: in this case, we expect the variable to be in the condition assign block only
-            //
-            // Notably, this assertion fails for init of variables without an explicit init value.
-            // This can be extremely confusing, hence this comment.
-            //
-            AssignCond assign_cond = instr.assign_cond();
-            for (int j = item.first_usage(); j <= item.last_usage(); j++) {
-              assertq((assign_cond == instrs[j].assign_cond())            // expected usage
-                   || (instrs[j].is_always() && !instrs[j].is_branch()),  // Interim basic usage allowed (happens)
-                "Expected variable to be in condition assign block only", true
-              );
-            }
-          }
-        }
-      }
+  for (int i = 0; i < (int) m_cfg.size(); i++) {
+    for (auto s : m_cfg[i]) {
+      m_preds[s].push_back(i);
+    }
+  }
+}
 
-      //t2.start();
-      // Compute 'use' and 'def' sets
-      UseDef useDef(instr, also_set_used);
 
-      //t3.start();
-      computeLiveOut(i, liveOut);
-      //t3.stop();
+/**
+ * Split the instruction list into basic blocks, using the CFG.
+ *
+ * A block starts at the first instruction, at a branch target and after
+ * any instruction which does not simply pass on to the next instruction.
+ */
+void Liveness::build_blocks() {
+  int const num_instrs = (int) m_cfg.size();
+  if (num_instrs == 0) return;
+
+  std::vector<bool> leader(num_instrs, false);
+  leader[0] = true;
+
+  for (int i = 0; i < num_instrs; i++) {
+    auto const &succs = m_cfg[i];
+    if (succs.size() == 1 && succs.first() == i + 1) continue;  // Regular instruction
+
+    if (i + 1 < num_instrs) leader[i + 1] = true;
+
+    for (auto s : succs) {
+      leader[s] = true;
+    }
+  }
+
+  std::vector<int> block_of(num_instrs);
+
+  for (int i = 0; i < num_instrs; i++) {
+    if (leader[i]) {
+      Block block;
+      block.first = i;
+      m_blocks.push_back(block);
+    }
+
+    m_blocks.back().last = i;
+    block_of[i] = (int) m_blocks.size() - 1;
+  }
+
+  for (int b = 0; b < (int) m_blocks.size(); b++) {
+    auto &block = m_blocks[b];
+
+    for (auto s : m_cfg[block.last]) {
+      int succ = block_of[s];
+      block.succs.push_back(succ);
+      m_blocks[succ].preds.push_back(b);
+    }
+
+    // Combined 'use' and 'def' sets of the block, going backwards
+    block.use.resize(m_num_vars);
+    block.def.resize(m_num_vars);
+    block.live_in.resize(m_num_vars);
+
+    for (int i = block.last; i >= block.first; i--) {
+      if (m_defs[i] != -1) {
+        block.use.remove(m_defs[i]);
+        block.def.insert(m_defs[i]);
+      }
 
-      //t4.start();
-      liveIn = liveOut;
-      if (useDef.def.tag != NONE) {
-        liveIn.remove(useDef.def.regId);  // Remove the 'def' set from the live-out set to give live-in set
+      if (m_def_used[i]) {
+        block.use.insert(m_defs[i]);
       }
-      liveIn.add(useDef.use);
-      //t4.stop();
 
-      //t5.start();
-      if (insert(i, liveIn)) {
-        changed = true;
+      for (auto r : m_uses[i]) {
+        block.use.insert(r);
       }
-      //t5.stop();
-      //t2.stop();
     }
+  }
+}
+
+
+/**
+ * Determine the post-order of the blocks in the CFG.
+ *
+ * This is the reverse post-order of the reversed CFG, which is the order in which a
+ * backward dataflow analysis converges fastest.
+ *
+ * Blocks which can not be reached from the start are added at the end.
+ */
+std::vector<int> Liveness::post_order() const {
+  int const num_blocks = (int) m_blocks.size();
+
+  std::vector<int>  ret;
+  std::vector<bool> visited(num_blocks, false);
+  std::vector<std::pair<int, int>> stack;  // block, index of next successor to visit
+
+  for (int start = 0; start < num_blocks; start++) {
+    if (visited[start]) continue;
 
-    count++;
+    visited[start] = true;
+    stack.push_back({start, 0});
+
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      auto const &succs = m_blocks[top.first].succs;
+
+      if (top.second < (int) succs.size()) {
+        int succ = succs[top.second++];
+
+        if (!visited[succ]) {
+          visited[succ] = true;
+          stack.push_back({succ, 0});
+        }
+      } else {
+        ret.push_back(top.first);
+        stack.pop_back();
+      }
+    }
   }
 
-  //t2.end();
-  //t3.end();
-  //t4.end();
-  //t5.end();
+  return ret;
+}
 
-/*
-  std::string msg;
-  msg << "compute_liveness num iterations: " << count;
-  debug(msg);
-*/
+
+/**
+ * Determine the liveness sets for each instruction.
+ *
+ * The dataflow is first solved on the basic blocks, with a worklist.
+ * The live sets of the instructions are then derived from the live-out sets of the blocks
+ * in a single pass.
+ *
+ * The sets are bit vectors, so that union and difference are cheap.
+ */
+void Liveness::compute_liveness(Instr::List &instrs) {
+  set_use_def(instrs);
+  build_blocks();
+
+  int const num_blocks = (int) m_blocks.size();
+  auto order = post_order();
+
+  std::vector<int>  worklist(order.rbegin(), order.rend());  // Used as stack, top is back
+  std::vector<bool> in_list(num_blocks, true);
+  RegBitSet liveOut(m_num_vars);
+
+  while (!worklist.empty()) {
+    int b = worklist.back();
+    worklist.pop_back();
+    in_list[b] = false;
+
+    auto &block = m_blocks[b];
+
+    liveOut.clear();
+    for (auto s : block.succs) {
+      liveOut.add(m_blocks[s].live_in);
+    }
+
+    // live_in = use + (live_out - def); live_in only grows, so adding suffices
+    bool changed = block.live_in.add(block.use);
+    changed = block.live_in.add_diff(liveOut, block.def) || changed;
+    if (!changed) continue;
+
+    for (auto p : block.preds) {
+      if (in_list[p]) continue;
+      in_list[p] = true;
+      worklist.push_back(p);
+    }
+  }
+
+  // Derive the live-in set of each instruction
+  m_set.resize(instrs.size());
+
+  for (auto &block : m_blocks) {
+    liveOut.clear();
+    for (auto s : block.succs) {
+      liveOut.add(m_blocks[s].live_in);
+    }
+
+    for (int i = block.last; i >= block.first; i--) {
+      if (m_defs[i] != -1) {
+        liveOut.remove(m_defs[i]);  // Remove the 'def' set from the live-out set to give live-in set
+      }
+
+      if (m_def_used[i]) {
+        liveOut.insert(m_defs[i]);
+      }
+
+      for (auto r : m_uses[i]) {
+        liveOut.insert(r);
+      }
+
+      m_set[i] = liveOut;
+    }
+  }
 }
 
 
@@ -237,6 +383,11 @@ void Liveness::clear() {
   m_cfg.clear();
   m_set.clear();
   m_reg_usage.reset();
+  m_defs.clear();
+  m_uses.clear();
+  m_def_used.clear();
+  m_preds.clear();
+  m_blocks.clear();
 }
 
 
@@ -244,62 +395,205 @@ void Liveness::compute(Instr::List &instrs) {
   clear();
 
   m_cfg.build(instrs);
+  set_preds();
   m_reg_usage.set_used(instrs);
 
-  //Timer t3("compute liveness", false);
-  compute_liveness(instrs); // performance hog 23/28s
-  //t3.end();
+  compute_liveness(instrs);
   assert(instrs.size() == size());
 
   m_reg_usage.set_live(*this);
 
-  compile_data.reg_usage_dump = m_reg_usage.dump(true);
-  compile_data.liveness_dump = dump();
+  if (CompileData::capture_dumps()) {
+    compile_data.reg_usage_dump = [usage = m_reg_usage] () { return usage.dump(true); };
+    compile_data.liveness_dump  = [sets = m_set] () { return dump_sets(sets); };
+  }
 
   m_reg_usage.check();
 }
 
 
 /**
- * Compute live sets for each instruction
+ * Update the liveness after instructions have been changed in place.
  *
- * Compute the live-out variables of an instruction, given the live-in
- * variables of all instructions and the CFG.
+ * Only the variables used or assigned in the changed instructions, before or after
+ * the change, are redone. The number of instructions and the control flow may not change;
+ * removed instructions should be replaced with SKIP.
+ *
+ * A variable which only gained uses is extended from the new uses, which is cheap.
+ * Otherwise, the liveness of the variable is cleared and determined anew from its uses.
+ *
+ * @return the variables whose usage changed
  */
-void Liveness::computeLiveOut(InstrId i, RegIdSet &liveOut) {
-  liveOut.clear();
+std::vector<RegId> Liveness::update(Instr::List &instrs, std::vector<InstrId> const &changed) {
+  std::vector<RegId> vars;
+  std::vector<bool>  redo;                 // Per entry in vars, true if var needs full recompute
+  std::vector<std::vector<InstrId>> added; // Per entry in vars, new use lines
+
+  auto index_of = [&vars, &redo, &added] (RegId var) -> int {
+    for (int k = 0; k < (int) vars.size(); k++) {
+      if (vars[k] == var) return k;
+    }
 
-  for (auto const &val : m_cfg[i]) {
-    liveOut.add(get(val));
+    vars.push_back(var);
+    redo.push_back(false);
+    added.push_back({});
+    return (int) vars.size() - 1;
+  };
+
+  for (auto i : changed) {
+    auto &instr = instrs[i];
+    UseDef useDef(instr);
+
+    int def = (instr.has_registers() && useDef.def.tag != NONE)? useDef.def.regId : -1;
+    std::vector<int> uses;
+    if (instr.has_registers()) uses.assign(useDef.use.begin(), useDef.use.end());
+
+    if (def != m_defs[i]) {
+      if (m_defs[i] != -1) {
+        m_reg_usage[m_defs[i]].remove_dst(i);
+        redo[index_of(m_defs[i])] = true;
+      }
+
+      if (def != -1) {
+        m_reg_usage[def].add_dst(i, instr.isCondAssign());
+        redo[index_of(def)] = true;
+      }
+    }
+
+    for (auto r : m_uses[i]) {
+      if (std::find(uses.begin(), uses.end(), r) != uses.end()) continue;
+      m_reg_usage[r].remove_src(i);
+      redo[index_of(r)] = true;
+    }
+
+    for (auto r : uses) {
+      if (std::find(m_uses[i].begin(), m_uses[i].end(), r) != m_uses[i].end()) continue;
+      m_reg_usage[r].add_src(i);
+      added[index_of(r)].push_back(i);
+    }
+
+    bool def_used = (def != -1) && instr.isCondAssign() && (m_reg_usage[def].first_dst() < i);
+    def_used = def_used && (instr.tag == InstrTag::LI || instr.tag == InstrTag::ALU);
+
+    if (def_used != m_def_used[i]) {
+      redo[index_of(def != -1? def : m_defs[i])] = true;
+    }
+
+    m_defs[i] = def;
+    m_uses[i] = uses;
+    m_def_used[i] = def_used;
+  }
+
+  for (int k = 0; k < (int) vars.size(); k++) {
+    if (redo[k]) {
+      recompute_var(vars[k]);
+    } else {
+      extend_var(vars[k], added[k]);
+    }
   }
+
+  return vars;
 }
 
 
-void Liveness::setSize(int size) {
-  m_set.resize(size);
+/**
+ * Clear the liveness of given variable and determine it again from its uses
+ */
+void Liveness::recompute_var(RegId var) {
+  auto &item = m_reg_usage[var];
+
+  if (item.first_live() != -1) {
+    for (int i = item.first_live(); i <= item.last_live(); i++) {
+      m_set[i].remove(var);
+    }
+  }
+
+  item.clear_live();
+
+  std::vector<InstrId> stack(item.srcs());
+
+  for (auto i : item.dsts()) {
+    if (m_def_used[i]) stack.push_back(i);
+  }
+
+  extend_var(var, stack);
+}
+
+
+/**
+ * Extend the liveness of given variable backwards from the given lines, in which it is used.
+ *
+ * The walk stops at assignments and at lines where the variable is already live.
+ * The latter is valid because the existing liveness is complete.
+ */
+void Liveness::extend_var(RegId var, std::vector<InstrId> &stack) {
+  auto &item = m_reg_usage[var];
+
+  auto set_live = [this, &item, var] (InstrId i) -> bool {
+    if (m_set[i].member(var)) return false;
+    m_set[i].insert(var);
+    item.add_live(i);
+    return true;
+  };
+
+  // Lines with uses are live-in; only keep the ones not yet visited
+  int count = 0;
+  for (auto i : stack) {
+    if (set_live(i)) stack[count++] = i;
+  }
+  stack.resize(count);
+
+  while (!stack.empty()) {
+    InstrId i = stack.back();
+    stack.pop_back();
+
+    for (auto p : m_preds[i]) {
+      if (m_defs[p] == var) continue;  // Assigned here; if also used, it's already live
+      if (set_live(p)) stack.push_back(p);
+    }
+  }
+}
+
+
+bool Liveness::is_live_out(InstrId i, RegId var) const {
+  for (auto s : m_cfg[i]) {
+    if (m_set[s].member(var)) return true;
+  }
+
+  return false;
 }
 
 
 /**
- * @return true if something inserted, false otherwise
+ * Compute the live-out variables of an instruction, given the live-in
+ * variables of all instructions and the CFG.
  */
-bool Liveness::insert(int index, RegIdSet const &set) {
-  auto &item = m_set[index];
+void Liveness::computeLiveOut(InstrId i, RegBitSet &liveOut) const {
+  if (liveOut.size() != m_num_vars) {
+    liveOut.resize(m_num_vars);
+  } else {
+    liveOut.clear();
+  }
+
+  for (auto const &val : m_cfg[i]) {
+    liveOut.add(m_set[val]);
+  }
+}
 
-  int prev_size = (int) item.size();
-  item.add(set);
-  return ((int) item.size() != prev_size);
+
+std::string Liveness::dump() const {
+  return dump_sets(m_set);
 }
 
 
-std::string Liveness::dump() {
+std::string Liveness::dump_sets(std::vector<RegBitSet> const &sets) {
   std::string ret;
 
-  for (int i = 0; i < (int) m_set.size(); ++i) {
+  for (int i = 0; i < (int) sets.size(); ++i) {
     std::string line;
     line += std::to_string(i) + ": ";
 
-    auto &item = m_set[i];
+    auto const &item = sets[i];
     bool did_first = false;
 
     for (auto it : item) {
@@ -332,36 +626,44 @@ std::string Liveness::dump() {
  */
 void Liveness::optimize(Instr::List &instrs, int numVars) {
   assertq(count_skips(instrs) == 0, "optimize(): SKIPs detected in instruction list");
-  compile_data.target_code_before_optimization = instrs.dump();
+  CompilePhase phase("liveness optimize");
+
+  if (CompileData::capture_dumps()) {
+    compile_data.target_code_before_optimization = [code = instrs] () { return code.dump(); };
+  }
 
-  //Timer t1("live compute");
   Liveness live(numVars);
-  live.compute(instrs);
-  //std::cout << live.dump() << std::endl;
-  //t1.end();
 
-  if (combineImmediates(live, instrs)) {
-    //std::cout << "After combineImmediates:\n"; 
-    //std::cout << instrs.dump(true) << std::endl;  // Useful sometimes for debug
+  {
+    CompilePhase phase("liveness");
+    live.compute(instrs);
+  }
 
-    //Timer t3("combine immediates compute", true);
-    live.compute(instrs);  // instructions have changed, redo liveness
-    //std::cout << live.dump() << std::endl;
+  // The following keep the liveness up to date, no need to recompute
+  {
+    CompilePhase phase("combine immediates");
+    combineImmediates(live, instrs);
   }
 
-  //Timer t3("introduceAccum");
-  int prev_count_skips = count_skips(instrs);
-  compile_data.num_accs_introduced = introduceAccum(live, instrs);
-  assertq(prev_count_skips == count_skips(instrs), "SKIP count changed after introduceAccum()");
-	//t3.end();
+  {
+    CompilePhase phase("simplify vars");
+    simplifyVars(live, instrs);
+  }
 
-  // Times for following (now) insignificant
+  {
+    CompilePhase phase("introduce accs");
+    int prev_count_skips = count_skips(instrs);
+    compile_data.num_accs_introduced = introduceAccum(live, instrs);
+    assertq(prev_count_skips == count_skips(instrs), "SKIP count changed after introduceAccum()");
+  }
 
   instrs = remove_replaced_instructions(instrs);
   assertq(count_skips(instrs) == 0, "optimize(): SKIPs detected in instruction list after cleanup");
 
   //std::cout << count_reg_types(instrs).dump() << std::endl;
-  compile_data.target_code_before_liveness = instrs.dump();
+  if (CompileData::capture_dumps()) {
+    compile_data.target_code_before_liveness = [code = instrs] () { return code.dump(); };
+  }
 }
 
 
@@ -9,6 +9,7 @@
 #include "CFG.h"
 #include "RegUsage.h"
 #include "LiveSet.h"
+#include "Support/RegBitSet.h"
 
 namespace V3DLib {
 
@@ -34,29 +35,58 @@ namespace V3DLib {
  */
 class Liveness {
 public:
-  Liveness(int numVars) : m_reg_usage(numVars) {}
+  Liveness(int numVars) : m_num_vars(numVars), m_reg_usage(numVars) {}
 
   CFG const &cfg() const { return m_cfg; }
   int size() const { return (int) m_set.size(); }
+  int num_vars() const { return m_num_vars; }
   RegUsage &reg_usage() { return m_reg_usage; }
-  RegIdSet &operator[](int index) { return get(index); }
+  RegBitSet const &operator[](int index) const { return m_set[index]; }
 
   void compute(Instr::List &instrs);
-  void computeLiveOut(InstrId i, RegIdSet &liveOut);
-  std::string dump();
+  std::vector<RegId> update(Instr::List &instrs, std::vector<InstrId> const &changed);
+  void computeLiveOut(InstrId i, RegBitSet &liveOut) const;
+  bool is_live_out(InstrId i, RegId var) const;
+  std::string dump() const;
 
   static void optimize(Instr::List &instrs, int numVars);
 
 private:
+
+  /**
+   * Basic block of the instruction list, for the dataflow analysis.
+   */
+  struct Block {
+    InstrId first;
+    InstrId last;
+    std::vector<int> succs;
+    std::vector<int> preds;
+    RegBitSet use;       // Variables used in block before being assigned
+    RegBitSet def;       // Variables assigned in block
+    RegBitSet live_in;
+  };
+
+  int          m_num_vars;
   CFG          m_cfg;
-  std::vector<RegIdSet> m_set;
+  std::vector<RegBitSet> m_set;  // live-in set per instruction
   RegUsage     m_reg_usage;
 
-  RegIdSet &get(int index) { return m_set[index]; }
+  std::vector<int> m_defs;               // Variable assigned per instruction, -1 if none
+  std::vector<std::vector<int>> m_uses;  // Variables used per instruction
+  std::vector<bool> m_def_used;          // If true, the assigned variable counts as used (conditional assign)
+  std::vector<std::vector<int>> m_preds; // Predecessors per instruction
+  std::vector<Block> m_blocks;
+
+  static std::string dump_sets(std::vector<RegBitSet> const &sets);
+
   void clear();
+  void set_use_def(Instr::List &instrs);
+  void set_preds();
+  void recompute_var(RegId var);
+  void extend_var(RegId var, std::vector<InstrId> &stack);
+  void build_blocks();
+  std::vector<int> post_order() const;
   void compute_liveness(Instr::List &instrs);
-  void setSize(int size);
-  bool insert(int index, RegIdSet const &set);
 };
 
 
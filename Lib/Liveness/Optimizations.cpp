@@ -1,226 +1,341 @@
 #include "Optimizations.h"
 #include <iostream>
+#include "Common/CompileData.h"
 #include "Liveness.h"
+#include "Peephole.h"
 #include "Support/Platform.h"
 #include "Target/Subst.h"
-#include "Support/Timer.h"
 #include "Support/basics.h"
 
 namespace V3DLib {
 namespace {
 
-void replace_acc(Instr::List &instrs, RegUsageItem &item, int var_id, int acc_id) {
+/**
+ * Check if the instruction is a move from one variable to another:
+ *
+ *     x <- or(y, y)
+ */
+bool is_var_move(Instr const &instr) {
+  if (instr.tag != InstrTag::ALU || !(instr.ALU.op == ALUOp::A_BOR)) return false;
+  if (instr.set_cond().flags_set()) return false;
+  if (instr.dest().tag != REG_A) return false;
+
+  auto const &srcA = instr.ALU.srcA;
+  auto const &srcB = instr.ALU.srcB;
+
+  return srcA.is_reg() && srcA.reg().tag == REG_A && srcB.is_reg() && srcB.reg() == srcA.reg();
+}
+
+
+/**
+ * Check if the only effect of an instruction is the assignment to its destination.
+ */
+bool only_assigns(Instr const &instr) {
+  if (instr.tag == InstrTag::LI) return !instr.set_cond().flags_set();
+  if (instr.tag != InstrTag::ALU) return false;
+  if (instr.set_cond().flags_set()) return false;
+  if (instr.isRot()) return false;
+
+  auto op = instr.ALU.op;
+  if (op == ALUOp::A_TMUWT || op == ALUOp::A_FSIN) return false;
+
+  // Reading a special register may have side effects, e.g. consuming a uniform
+  auto plain = [] (RegOrImm const &src) -> bool {
+    if (!src.is_reg()) return true;
+
+    Reg reg = src.reg();
+    if (reg.tag != SPECIAL) return true;
+    return reg.regId == SPECIAL_ELEM_NUM || reg.regId == SPECIAL_QPU_NUM;
+  };
+
+  return plain(instr.ALU.srcA) && plain(instr.ALU.srcB);
+}
+
+
+/**
+ * Rename all usages of a variable within given range to an accumulator
+ */
+void replace_acc(Rewriter &rw, RegUsageItem const &item, int var_id, int acc_id) {
   Reg current(REG_A, var_id);
   Reg replace_with(ACC, acc_id);
 
   for (int i = item.first_usage(); i <= item.last_usage(); i++) {
-    auto &instr = instrs[i];
-    if (!instr.has_registers()) continue;  // Doesn't help much
+    if (!rw[i].has_registers()) continue;  // Doesn't help much
 
-    instr.rename_dest(current, replace_with);
-    renameUses(instr, current, replace_with);
+    Instr instr = rw[i];
+    bool changed = instr.rename_dest(current, replace_with);
+    changed = renameUses(instr, current, replace_with) || changed;
+    if (changed) rw.replace(i, instr);
   }
 
-  // DANGEROUS! Do not use this value downstream.   
-  // Currently stored for debug display purposes only! 
-  item.reg = replace_with;    
+  rw.note_acc(var_id, replace_with);
 }
 
 
 /**
+ * Replace variables with a short use range by an accumulator.
+ *
+ * The variables are handled in order of increasing use range, and by id within the same use range.
+ * They are bucketed beforehand, so that a single pass over the variables suffices.
+ *
  * Not as useful as I would have hoped. range_size > 1 in practice happens, but seldom.
  */
-int peephole_0(int range_size, Instr::List &instrs, RegUsage &allocated_vars) {
-  if (range_size == 0) {
-    warning("peephole_0(): range_size == 0 passed in. This does nothing, not bothering");
-    return 0;
-  }
-
-  int subst_count = 0;
+int peephole_0(Rewriter &rw) {
+  int const MAX_RANGE_SIZE = 15;  // 10 -> so that tmp var in sin_v3d() gets replaced
 
-  for (int var_id = 0; var_id < (int) allocated_vars.size(); var_id++) {
-    auto &item = allocated_vars[var_id];
+  std::vector<std::vector<RegId>> buckets(MAX_RANGE_SIZE + 1);  // Index is use range
 
+  for (int var_id = 0; var_id < (int) rw.live().num_vars(); var_id++) {
+    auto const &item = rw.usage(var_id);
     if (item.reg.tag != NONE) continue;
     if (item.unused()) continue;
-    if (item.use_range() != range_size) continue;
-    assert(range_size != 0 || item.only_assigned());
 
-    // Guard for this special case for the time being.
-    // It should actually be possible to load a uniform in an accumulator,
-    // not bothering right now.
-    if (instrs[item.first_dst()].isUniformLoad()) {
-      continue;
-    }
+    int range_size = item.use_range();
+    if (range_size > MAX_RANGE_SIZE) continue;
+    assert(range_size != 0);
 
-    //
-    // NOTE: There may be a slight issue here:
-    //       in line of first use, src acc's may be used for vars which have
-    //       last use in this line. I.e. they would be free for usage in this line.
-    //
-    // This is a small thing, perhaps for later optimization
-    //
-    int acc_id = instrs.get_free_acc(item.first_usage(), item.last_usage());
-
-    if (acc_id == -1) {
-/*
-      warning("No free acc!");
+    buckets[range_size].push_back(var_id);
+  }
 
-      std::string msg;
-      msg << "range_size: " << range_size << ", Var " << var_id << ", "
-          << "lines " << item.first_usage()  << "-" << item.last_usage() << "\n"
-          << instrs.check_acc_usage(item.first_usage(), item.last_usage()) << "\n";
+  int subst_count = 0;
 
-      debug(msg);
-*/
-      continue;
-    }
+  for (auto const &bucket : buckets) {
+    for (auto var_id : bucket) {
+      auto const &item = rw.usage(var_id);
 
-    Reg replace_with(ACC, acc_id);
+      // Guard for this special case for the time being.
+      // It should actually be possible to load a uniform in an accumulator,
+      // not bothering right now.
+      if (rw[item.first_dst()].isUniformLoad()) {
+        continue;
+      }
 
-/*
-    // This call is an extreme performance hog and has not failed in recent memory
-    // Enable if you're totally paranoid
-    allocated_vars.check_overlap_usage(replace_with, item);
-*/
+      //
+      // NOTE: There may be a slight issue here:
+      //       in line of first use, src acc's may be used for vars which have
+      //       last use in this line. I.e. they would be free for usage in this line.
+      //
+      // This is a small thing, perhaps for later optimization
+      //
+      int acc_id = rw.instrs().get_free_acc(item.first_usage(), item.last_usage());
+      if (acc_id == -1) continue;
 
-    replace_acc(instrs, item, var_id, acc_id);
+      replace_acc(rw, item, var_id, acc_id);
+      rw.commit();
 
-    subst_count++;
+      subst_count++;
+    }
   }
 
-
   return subst_count;
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Rewrite rules
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Remove moves which do nothing:
+ *
+ *     x <- or(x, x)
+ */
+bool mov_elimination(Rewriter &rw, InstrId i) {
+  auto const &instr = rw[i];
+  if (!is_var_move(instr)) return false;
+  if (instr.dest() != instr.ALU.srcA.reg()) return false;
+
+  rw.remove(i);
+  return true;
+}
+
+
 /**
- * This is a simple peephole optimisation, captured by the following
- * rewrite rule:
+ * Remove assignments to variables which are not used afterwards:
  *
  *     i:  x <- f(...)
- *     j:  g(..., x, ...)
- * 
- * ===> if x not live-out of j
- * 
- *     i:  acc <- f(...)
- *     j:  g(..., acc, ...)
  *
- * @param allocated_vars  write param, to register which vars have an accumulator registered
+ * ===> if x not live-out of i and f has no side effects
  *
- * @return Number of substitutions performed;
+ *     i:  (removed)
  */
-int peephole_1(Liveness &live, Instr::List &instrs, RegUsage &allocated_vars) {
-  RegIdSet liveOut;
-  int subst_count = 0;
-
-  for (int i = 1; i < instrs.size(); i++) {
-    Instr prev  = instrs[i-1];
-    if (!prev.has_registers()) continue;  // Doesn't help much
-
-    Instr instr = instrs[i];
+bool dead_assign(Rewriter &rw, InstrId i) {
+  auto const &instr = rw[i];
+  if (!instr.has_registers() || instr.dest().tag != REG_A) return false;
+  if (!only_assigns(instr)) return false;
+  if (instr.isUniformLoad()) return false;
+  if (rw.is_live_out(i, instr.dest().regId)) return false;
+
+  rw.remove(i);
+  return true;
+}
 
-    Reg dst = prev.dst_a_reg();
-    if (dst.tag == NONE) continue;
-    RegId def = dst.regId;
 
-    // Guard for this special case for the time being.
-    // It should actually be possible to load a uniform in an accumulator,
-    // not bothering right now.
-    if (instr.isUniformLoad()) {
-      continue;
-    }
+/**
+ * Copy propagation, captured by the following rewrite rule:
+ *
+ *     i:  x <- or(y, y)
+ *     j:  g(..., x, ...)
+ *
+ * ===> if i is the only assignment of x, all uses of x are in the same basic block after i,
+ *      x is not live-out of the last use and y is not reassigned before the last use
+ *
+ *     i:  x <- or(y, y)
+ *     j:  g(..., y, ...)
+ *
+ * x is then unused, and the move is removed by `dead_assign()`.
+ * The register pressure does not increase, y simply takes over the live range of x.
+ */
+bool copy_propagation(Rewriter &rw, InstrId i) {
+  auto const &instr = rw[i];
+  if (!is_var_move(instr) || !instr.is_always()) return false;
 
-    live.computeLiveOut(i, liveOut);  // Compute vars live-out of instr
+  Reg x = instr.dest();
+  Reg y = instr.ALU.srcA.reg();
+  if (x == y) return false;
 
-    // If 'instr' is not last usage of the found var, skip
-    if (!(instr.src_a_regs().member(def) && !liveOut.member(def))) continue;
+  auto const &item = rw.usage(x.regId);
+  if (item.num_defs() != 1 || item.num_uses() == 0) return false;
+  if (item.srcs().front() <= i) return false;
 
-    // Can't remove this test.
-    // Reason: There may be a preceding instruction which sets the var to be replaced.
-    //         If 'prev' is conditional, replacing the var with an acc will ignore the previously set value.
-    if (!prev.is_always()) {
-/*
-      std::string msg;
-      msg << "peephole_1(): Skipping replacement for line " << i << " because prev.is_always() == false\n"
-          << "prev : " << prev.dump()  << "\n"
-          << "instr: " << instr.dump() << "\n";
+  int last = item.last_usage();
+  if (rw.is_live_out(last, x.regId)) return false;
 
-      warning(msg);
-*/
-      continue;
-    }
-
-    Reg current(REG_A, def);
-    Reg replace_with(ACC, instrs.get_free_acc(i - 1, i));
-    assert(replace_with.regId != -1);
-
-    prev.rename_dest(current, replace_with);
-    renameUses(instr, current, replace_with);
-    instrs[i-1] = prev;
-    instrs[i]   = instr;
+  for (int j = i + 1; j < last; j++) {
+    auto const &instr2 = rw[j];
+    if (instr2.is_label() || instr2.is_branch()) return false;  // Stay within basic block
+    if (instr2.is_dst_reg(y)) return false;
+  }
 
-    // DANGEROUS! Do not use this value downstream.   
-    // Currently stored for debug display purposes only! 
-    allocated_vars[def].reg = replace_with;    
+  for (int j = i + 1; j <= last; j++) {
+    if (!rw[j].is_src_reg(x)) continue;
 
-    subst_count++;
+    Instr instr2 = rw[j];
+    renameUses(instr2, x, y);
+    rw.replace(j, instr2);
   }
 
-  return subst_count;
+  compile_data.num_copies_propagated++;
+  return true;
 }
 
+
 /**
- * Replace assign-only variables with an accumulator
+ * Replace a variable used only in the next instruction with an accumulator:
+ *
+ *     i:  x <- f(...)
+ *     j:  g(..., x, ...)
+ * 
+ * ===> if x not live-out of j
+ * 
+ *     i:  acc <- f(...)
+ *     j:  g(..., acc, ...)
+ *
+ * Removed instructions in between are skipped.
  */
-int peephole_2(Liveness &live, Instr::List &instrs, RegUsage &allocated_vars) {
-  int subst_count = 0;
-
-  for (int i = 1; i < instrs.size(); i++) {
-    Instr instr = instrs[i];
-    if (!instr.has_registers()) continue;  // Doesn't help much
-
-    // Guard for this special case for the time being.
-    // It should actually be possible to load a uniform in an accumulator,
-    // not bothering right now.
-    if (instr.isUniformLoad()) {
-      continue;
-    }
-
-    Reg dst = instr.dst_a_reg();
-    if (dst.tag == NONE) continue;
-    RegId def = dst.regId;
+bool acc_next_use(Rewriter &rw, InstrId i) {
+  auto const &instr = rw[i];
+
+  // Guard for this special case for the time being.
+  // It should actually be possible to load a uniform in an accumulator,
+  // not bothering right now.
+  if (instr.isUniformLoad()) return false;
+
+  InstrId p = i - 1;
+  while (p >= 0 && rw[p].tag == InstrTag::SKIP) p--;
+  if (p < 0) return false;
+
+  auto const &prev = rw[p];
+  if (!prev.has_registers()) return false;  // Doesn't help much
+
+  Reg dst = prev.dst_a_reg();
+  if (dst.tag == NONE) return false;
+  RegId def = dst.regId;
+
+  // If 'instr' is not last usage of the found var, skip
+  if (!instr.src_a_regs().member(def) || rw.is_live_out(i, def)) return false;
+
+  // Can't remove this test.
+  // Reason: There may be a preceding instruction which sets the var to be replaced.
+  //         If 'prev' is conditional, replacing the var with an acc will ignore the previously set value.
+  if (!prev.is_always()) return false;
+
+  Reg current(REG_A, def);
+  Reg replace_with(ACC, rw.instrs().get_free_acc(p, i));
+  assert(replace_with.regId != -1);
+
+  Instr prev2 = prev;
+  Instr instr2 = instr;
+  prev2.rename_dest(current, replace_with);
+  renameUses(instr2, current, replace_with);
+  rw.replace(p, prev2);
+  rw.replace(i, instr2);
+  rw.note_acc(def, replace_with);
+  return true;
+}
 
-    if (!allocated_vars[def].only_assigned()) continue;
 
-    Reg current(REG_A, def);
-    Reg replace_with(ACC, instrs.get_free_acc(i, i));
-    assert(replace_with.regId != -1);
+/**
+ * Replace assign-only variables with an accumulator
+ */
+bool acc_only_assigned(Rewriter &rw, InstrId i) {
+  auto const &instr = rw[i];
+  if (!instr.has_registers()) return false;  // Doesn't help much
+
+  // Guard for this special case for the time being.
+  // It should actually be possible to load a uniform in an accumulator,
+  // not bothering right now.
+  if (instr.isUniformLoad()) return false;
+
+  Reg dst = instr.dst_a_reg();
+  if (dst.tag == NONE) return false;
+  RegId def = dst.regId;
+
+  if (!rw.usage(def).only_assigned()) return false;
+
+  Reg current(REG_A, def);
+  Reg replace_with(ACC, rw.instrs().get_free_acc(i, i));
+  assert(replace_with.regId != -1);
+
+  Instr instr2 = instr;
+  instr2.rename_dest(current, replace_with);
+  rw.replace(i, instr2);
+  rw.note_acc(def, replace_with);
+  return true;
+}
 
-    instr.rename_dest(current, replace_with);
-    instrs[i] = instr;
 
-    // DANGEROUS! Do not use this value downstream (remember why, old fart?).   
-    // Currently stored for debug display purposes only! 
-    allocated_vars[def].reg = replace_with;    
+/**
+ * Rules which simplify the usage of variables.
+ */
+Rules const var_rules = {
+  { "mov elimination",  mov_elimination  },
+  { "dead assignment",  dead_assign      },
+  { "copy propagation", copy_propagation },
+};
 
-    subst_count++;
-  }
 
-  return subst_count;
-}
+/**
+ * Rules which introduce accumulators.
+ * These come after `peephole_0()`, which handles the bulk of the cases.
+ */
+Rules const acc_rules = {
+  { "acc for next use",      acc_next_use      },
+  { "acc for only assigned", acc_only_assigned },
+};
 
 }  // anon namespace
 
 
 /**
+ * Combine load immediates with the instructions using them.
+ *
+ * The liveness is updated for the changed instructions afterwards.
+ *
  * @return true if any replacements were made, false otherwise
  */
 bool combineImmediates(Liveness &live, Instr::List &instrs) {
-  //Timer t3("combineImmediates loop3", true);
-  //Timer t1("combineImmediates", true);
-
-  bool found_something = false;
+  std::vector<InstrId> changed;
 
 /*
   auto msg_stop_replace = [] (int k, Instr const &instr2, Instr const &instr3) {
@@ -305,10 +420,13 @@ bool combineImmediates(Liveness &live, Instr::List &instrs) {
           if (instr2.ALU.srcB == instr.dest()) {
             instr2.ALU.srcB = instr.LI.imm;
           }
+
+          changed.push_back(i);
         }
 
         if (can_remove) {
           instr.tag = SKIP;
+          changed.push_back(i);
         }
       }
 
@@ -387,6 +505,7 @@ bool combineImmediates(Liveness &live, Instr::List &instrs) {
 
         if (renameUses(instr3, current, replace_with)) {
           //msg_replace(k, instr3, current, replace_with);
+          changed.push_back(k);
           num_subsitutions++;
         }
       }
@@ -400,26 +519,22 @@ bool combineImmediates(Liveness &live, Instr::List &instrs) {
         debug(msg);
 */
         instr2.tag = InstrTag::SKIP;
+        changed.push_back(j);
       }
     }
-
-    found_something = true;
   }
 
-/*
-  if (found_something) {
-    std::cout << live.cfg().dump_blocks() << std::endl;
-  }
-*/
+  if (changed.empty()) return false;
 
-  return found_something;
+  live.update(instrs, changed);
+  return true;
 }
 
 
 /**
  * Optimisation passes that introduce accumulators
  *
- * @param allocated_vars write param; note which vars have an accumulator registered
+ * The reg usage of the liveness notes which vars have an accumulator registered.
  *
  * @return Number of substitutions performed;
  *
@@ -435,67 +550,33 @@ bool combineImmediates(Liveness &live, Instr::List &instrs) {
  *   of the variable that need replacing.
  */
 int introduceAccum(Liveness &live, Instr::List &instrs) {
+#ifdef DEBUG
   RegUsage &allocated_vars = live.reg_usage();
 
-#ifdef DEBUG
   for (int i = 0; i < (int) allocated_vars.size(); i++) {
     assert(allocated_vars[i].reg.tag == NONE);  // Safeguard for the time being
   }
 #endif  // DEBUG
 
-  int subst_count = 0;
-  int const MAX_RANGE_SIZE = 15;  // 10 -> so that tmp var in sin_v3d() gets replaced
+  Rewriter rw(live, instrs);
 
-  //debug(allocated_vars.dump_use_ranges());
   // Picks up a lot usually, but range_size > 1 seldom results in something
-  //Timer t("peephole_0");
-  for (int range_size = 1; range_size <= MAX_RANGE_SIZE; range_size++) {
-    int count = peephole_0(range_size, instrs, allocated_vars);
-
-/*
-    if (count > 0 && range_size > 1) {
-      std::string msg = "peephole_0 for range size ";
-      msg << range_size << ", num substs: " << count;
-      debug(msg);
-    }
-*/
-
-    subst_count += count;
-  }
-  //t.end();
-
-  // This peephole still does a lot of useful stuff
-  {
-    //Timer t("peephole_1", true);
-    int count = peephole_1(live, instrs, allocated_vars);
+  int subst_count = peephole_0(rw);
 
-/*
-    {
-      std::string msg;
-      msg << "peephole_1, num substs: " << count;
-      debug(msg);
-    }
-*/
+  // These still do a lot of useful stuff
+  subst_count += rewrite(live, instrs, acc_rules);
 
-    subst_count += count;
-  }
-
-  // And some things still get done with this peephole, regularly 1 or 2 per compile
-  {
-    //Timer t("peephole_2", true);
-    int count = peephole_2(live, instrs, allocated_vars);
-/*
-    if (count > 0) {
-      std::string msg;
-      msg << "peephole_2, num substs: " << count;
-      debug(msg);
-    }
-*/
+  return subst_count;
+}
 
-    subst_count += count;
-  }
 
-  return subst_count;
+/**
+ * Simplify the usage of variables with copy propagation and the removal of superfluous moves.
+ *
+ * @return Number of rewrites performed
+ */
+int simplifyVars(Liveness &live, Instr::List &instrs) {
+  return rewrite(live, instrs, var_rules);
 }
 
 }  // namespace V3DLib
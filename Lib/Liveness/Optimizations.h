@@ -7,6 +7,7 @@ namespace V3DLib {
 class Liveness;
 
 bool combineImmediates(Liveness &live, Instr::List &instrs);
+int simplifyVars(Liveness &live, Instr::List &instrs);
 int introduceAccum(Liveness &live, Instr::List &instrs);
 
 }  // namespace V3DLib
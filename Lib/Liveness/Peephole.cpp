@@ -0,0 +1,120 @@
+#include "Peephole.h"
+#include "Support/basics.h"
+#include "Liveness.h"
+
+namespace V3DLib {
+
+///////////////////////////////////////////////////////////////////////////////
+// Class Rewriter
+///////////////////////////////////////////////////////////////////////////////
+
+RegUsageItem const &Rewriter::usage(RegId var) const {
+  return m_live.reg_usage()[var];
+}
+
+
+bool Rewriter::is_live_out(InstrId i, RegId var) const {
+  return m_live.is_live_out(i, var);
+}
+
+
+void Rewriter::replace(InstrId i, Instr const &instr) {
+  m_instrs[i] = instr;
+  m_changed.push_back(i);
+}
+
+
+void Rewriter::remove(InstrId i) {
+  m_instrs[i].tag = InstrTag::SKIP;
+  m_changed.push_back(i);
+}
+
+
+/**
+ * Register that a variable has been replaced with an accumulator.
+ *
+ * This is for debug display only, the value should not be used downstream.
+ */
+void Rewriter::note_acc(RegId var, Reg const &acc) {
+  m_live.reg_usage()[var].reg = acc;
+}
+
+
+/**
+ * Update the liveness for the changes made since the previous call.
+ *
+ * @return instructions which should be considered again for rewriting
+ */
+std::vector<InstrId> Rewriter::commit() {
+  std::vector<InstrId> ret;
+  if (m_changed.empty()) return ret;
+
+  auto vars = m_live.update(m_instrs, m_changed);
+
+  for (auto i : m_changed) {
+    if (i > 0) ret.push_back(i - 1);
+    ret.push_back(i);
+    if (i + 1 < size()) ret.push_back(i + 1);
+  }
+
+  // Assignments of changed variables, these may have become superfluous
+  for (auto var : vars) {
+    auto const &item = usage(var);
+    ret.insert(ret.end(), item.dsts().begin(), item.dsts().end());
+  }
+
+  m_changed.clear();
+  return ret;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// End Class Rewriter
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Apply the rules to the instruction list until no rule applies any more.
+ *
+ * The rules are tried in the given order; per instruction, the first rule that applies wins.
+ * The liveness passed in must be up to date with the instruction list, and is kept so.
+ *
+ * @return number of rule applications
+ */
+int rewrite(Liveness &live, Instr::List &instrs, Rules const &rules) {
+  Rewriter rw(live, instrs);
+  int const num_instrs = instrs.size();
+
+  std::vector<InstrId> worklist;  // Used as stack, top is back
+  std::vector<bool>    in_list(num_instrs, true);
+
+  for (int i = num_instrs - 1; i >= 0; i--) {
+    worklist.push_back(i);
+  }
+
+  int count = 0;
+
+  while (!worklist.empty()) {
+    InstrId i = worklist.back();
+    worklist.pop_back();
+    in_list[i] = false;
+
+    if (instrs[i].tag == InstrTag::SKIP) continue;
+
+    for (auto const &rule : rules) {
+      if (!rule.apply(rw, i)) continue;
+      count++;
+
+      for (auto j : rw.commit()) {
+        if (in_list[j]) continue;
+        in_list[j] = true;
+        worklist.push_back(j);
+      }
+
+      break;
+    }
+  }
+
+  return count;
+}
+
+}  // namespace V3DLib
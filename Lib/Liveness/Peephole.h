@@ -0,0 +1,64 @@
+#ifndef _V3DLIB_LIVENESS_PEEPHOLE_H_
+#define _V3DLIB_LIVENESS_PEEPHOLE_H_
+#include <vector>
+#include "Target/instr/Instr.h"
+#include "CFG.h"
+#include "RegUsage.h"
+
+namespace V3DLib {
+
+class Liveness;
+
+/**
+ * Rewriting of the instruction list with local rules, prior to register allocation.
+ *
+ * A rule looks at a single instruction and may change it and other instructions via
+ * the `Rewriter`. Instructions are never inserted or moved; a removed instruction
+ * is replaced with SKIP, which is cleaned up afterwards.
+ *
+ * After each application of a rule, the liveness and reg usage of the variables involved are
+ * updated incrementally (see `Liveness::update()`). The instructions affected by the change are
+ * then queued again, so that the rules are applied until nothing changes any more, without
+ * redoing the liveness analysis for the entire instruction list.
+ */
+class Rewriter {
+public:
+  Rewriter(Liveness &live, Instr::List &instrs) : m_live(live), m_instrs(instrs) {}
+
+  Instr::List const &instrs() const { return m_instrs; }
+  Instr const &operator[](InstrId i) const { return m_instrs[i]; }
+  int size() const { return m_instrs.size(); }
+  Liveness const &live() const { return m_live; }
+  RegUsageItem const &usage(RegId var) const;
+  bool is_live_out(InstrId i, RegId var) const;
+
+  void replace(InstrId i, Instr const &instr);
+  void remove(InstrId i);
+  void note_acc(RegId var, Reg const &acc);
+  std::vector<InstrId> commit();
+
+private:
+  Liveness    &m_live;
+  Instr::List &m_instrs;
+  std::vector<InstrId> m_changed;  // Instructions changed by the current rule application
+};
+
+
+/**
+ * A rewrite rule.
+ *
+ * `apply()` returns true if it changed anything, false otherwise.
+ * It should only return true if the change is an improvement, otherwise the rewriting will not end.
+ */
+struct Rule {
+  char const *name;
+  bool (*apply)(Rewriter &rw, InstrId i);
+};
+
+using Rules = std::vector<Rule>;
+
+int rewrite(Liveness &live, Instr::List &instrs, Rules const &rules);
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_LIVENESS_PEEPHOLE_H_
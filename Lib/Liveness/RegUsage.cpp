@@ -1,4 +1,5 @@
 #include "RegUsage.h"
+#include <algorithm>
 #include "Support/basics.h"
 #include "Support/Platform.h"  // size_regfile()
 #include "Liveness.h"
@@ -7,6 +8,29 @@
 namespace V3DLib {
 namespace {
 
+/**
+ * Add a line number to an ascending list.
+ *
+ * Lines are normally added in order, so appending is the common case.
+ */
+void add_line(std::vector<int> &list, int n) {
+  if (list.empty() || list.back() < n) {
+    list.push_back(n);
+    return;
+  }
+
+  auto it = std::lower_bound(list.begin(), list.end(), n);
+  assertq(*it != n, "RegUsageItem: line number added twice", true);
+  list.insert(it, n);
+}
+
+
+void remove_line(std::vector<int> &list, int n) {
+  auto it = std::lower_bound(list.begin(), list.end(), n);
+  assertq(it != list.end() && *it == n, "RegUsageItem: line number to remove not present", true);
+  list.erase(it);
+}
+
 std::string get_unused_list(RegUsage const &alloc_list) {
   std::string ret;
 
@@ -55,7 +79,7 @@ std::string get_assigned_only_list(RegUsage const &alloc_list) {
 ///////////////////////////////////////////////////////////////////////////////
 
 bool RegUsageItem::unused() const {
-  return (use_dst.empty() && src_range.count() == 0);
+  return (use_dst.empty() && use_src.empty());
 }
 
 
@@ -75,8 +99,15 @@ std::string RegUsageItem::dump() const {
 
   ret << reg.dump() << "; ";
 
-  ret << "use(src_first, src_last, src_count, dst): ("
-      << src_range.dump() << ", {";
+  ret << "use(src_first, src_last, src_count, dst): (";
+
+  if (use_src.empty()) {
+    ret << "-1, -1, 0";
+  } else {
+    ret << use_src.front() << ", " << use_src.back() << ", " << use_src.size();
+  }
+
+  ret << ", {";
 
   for (int i = 0; i < (int) use_dst.size(); ++i) {
     if (i != 0) {
@@ -91,8 +122,6 @@ std::string RegUsageItem::dump() const {
 
 
 void RegUsageItem::add_dst(int n, bool is_cond_assign) {
-  assertq(use_dst.empty() || use_dst.back() < n, "RegUsageItem::add_dst() failed", true);
-
 /*
   // See disabled code where this is used
 
@@ -102,12 +131,14 @@ void RegUsageItem::add_dst(int n, bool is_cond_assign) {
   }
 */
 
-  use_dst << n;
+  add_line(use_dst, n);
 }
 
 
-void RegUsageItem::add_src(int n)  { src_range.add(n); }
-void RegUsageItem::add_live(int n) { m_live_range.add(n); }
+void RegUsageItem::add_src(int n)    { add_line(use_src, n); }
+void RegUsageItem::add_live(int n)   { m_live_range.add(n); }
+void RegUsageItem::remove_dst(int n) { remove_line(use_dst, n); }
+void RegUsageItem::remove_src(int n) { remove_line(use_src, n); }
 
 
 /**
@@ -153,17 +184,17 @@ int RegUsageItem::use_range() const {
   //
 
   // determine first write before src usage (there might be a dummy write before
-  assertq(src_range.first() != -1, "oops", true);
+  assertq(!use_src.empty(), "oops", true);
   int first_write = -1;
   for (auto dst : use_dst) {
-    if (dst >= src_range.first()) break;  // >= because instr can have reg as src as well as dst (eg. add src, src, 1)
+    if (dst >= use_src.front()) break;  // >= because instr can have reg as src as well as dst (eg. add src, src, 1)
     first_write = dst;
   }
   assert(first_write != -1);
 
   // Live range goes in after found dst
   int first_1 = first_write + 1;
-  int last_1 = src_range.last();
+  int last_1 = use_src.empty()? -1 : use_src.back();
   if (last_1 == -1) {                        // Guard for case where var is write only (eg. dummy output)
     last_1 = first_1;
   }
@@ -212,7 +243,7 @@ int RegUsageItem::first_dst() const {
  * Return the first line in which this variable is used (either as src or dst)
  */
 int RegUsageItem::first_usage() const {
-  assert(src_range.first() == -1 || src_range.first() >= first_dst());
+  assert(use_src.empty() || use_src.front() >= first_dst());
   assert(!use_dst.empty());
   return use_dst[0];
 }
@@ -223,7 +254,8 @@ int RegUsageItem::first_usage() const {
  */
 int RegUsageItem::last_usage() const {
   if (only_assigned()) return first_dst();
-  return src_range.last();
+  if (use_src.empty()) return -1;
+  return use_src.back();
 }
 
 
@@ -13,8 +13,11 @@ struct RegUsageItem {
   void add_dst(int n, bool is_cond_assign);
   void add_src(int n);
   void add_live(int n);
+  void remove_dst(int n);
+  void remove_src(int n);
+  void clear_live()           { m_live_range = Range(); }
   bool unused() const;
-  bool only_assigned() const  { return !use_dst.empty() && src_range.count() == 0; }
+  bool only_assigned() const  { return !use_dst.empty() && use_src.empty(); }
   bool never_assigned() const { return !unused() && use_dst.empty(); }
   bool assigned_once() const;
   std::string dump() const;
@@ -25,6 +28,11 @@ struct RegUsageItem {
   int last_live() const       { return m_live_range.last(); }
   int first_usage() const;
   int last_usage() const;
+  int num_defs() const        { return (int) use_dst.size(); }
+  int num_uses() const        { return (int) use_src.size(); }
+  std::vector<int> const &dsts() const { return use_dst; }
+  std::vector<int> const &srcs() const { return use_src; }
+  int live_count() const      { return m_live_range.count(); }
   bool use_overlaps(RegUsageItem const &rhs) const;
 
   bool regular_use() const {
@@ -32,8 +40,8 @@ struct RegUsageItem {
   }
 
 private:
-  Range src_range;           // First and last instructions where var is used as src
-  std::vector<int> use_dst;  // List of line numbers where var is set
+  std::vector<int> use_src;  // List of line numbers where var is used as src, ascending
+  std::vector<int> use_dst;  // List of line numbers where var is set, ascending
   Range m_live_range;
 };
 
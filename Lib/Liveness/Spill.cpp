@@ -0,0 +1,433 @@
+#include "Spill.h"
+#include "Support/basics.h"
+#include "Support/Platform.h"
+#include "Common/CompileData.h"
+#include "Source/Int.h"           // RSV_QPU_ID
+#include "Target/instr/Mnemonics.h"
+#include "Target/Subst.h"
+#include "SourceTranslate.h"
+#include "Liveness.h"
+#include "UseDef.h"
+
+namespace V3DLib {
+
+using ::operator<<;  // C++ weirdness
+
+namespace {
+
+int const NUM_SPILL_ACCS = 4;   // r0..r3 are considered for temporaries
+int const MAX_SLOTS      = 256; // Slot index must be loadable with small immediates
+
+uint8_t acc_bit(Reg const &reg) {
+  if (reg.tag != ACC || reg.regId >= NUM_SPILL_ACCS) return 0;
+  return (uint8_t) (1 << reg.regId);
+}
+
+}  // anon namespace
+
+
+/**
+ * Select a variable to spill, because no register could be found for variable `var`.
+ *
+ * Candidates are `var` itself and the neighbours of `var` which have been assigned a register
+ * that no other neighbour has. Of these, the variable with the lowest cost is selected.
+ * The cost is the number of accesses relative to the number of instructions the variable is live.
+ *
+ * If a neighbour is selected, its register is handed over to `var`.
+ *
+ * Throws an error for vc4 kernels which use the VPM/DMA directly, see class comment.
+ *
+ * @return spilled variable, -1 if no variable could be selected
+ */
+RegId Spill::choose(RegId var, Liveness &live, LiveSets &liveWith) {
+  if (Platform::compiling_for_vc4() && compile_data.uses_vpm) {
+    error("Register allocation failed: spilling is not supported on vc4 for kernels "
+          "which use VPM/DMA operations directly", true);
+  }
+
+  if (!m_prepared) {
+    prepare(live);
+    m_prepared = true;
+  }
+
+  auto &alloc = live.reg_usage();
+  int const NUM_REGS = Platform::size_regfile();
+
+  auto index = [NUM_REGS] (Reg const &reg) -> int {
+    return (reg.tag == REG_B)? NUM_REGS + reg.regId : reg.regId;
+  };
+
+  auto has_reg = [] (Reg const &reg) -> bool {
+    return reg.tag == REG_A || reg.tag == REG_B;
+  };
+
+  // Count the neighbours holding each register
+  std::vector<int> holders(2*NUM_REGS, 0);
+
+  for (auto n : liveWith[var]) {
+    if (has_reg(alloc[n].reg)) holders[index(alloc[n].reg)]++;
+  }
+
+  RegId victim = -1;
+  int victim_accesses = 0;
+  int victim_live = 0;
+
+  auto consider = [&] (RegId v) {
+    auto const &item = alloc[v];
+    if (!m_spillable[v]) return;
+
+    int accesses = item.num_defs() + item.num_uses();
+    if (item.live_count() <= accesses) return;  // Spilling would not shorten the live range
+
+    // Compare accesses/live without division
+    if (victim == -1 || accesses*victim_live < victim_accesses*item.live_count()) {
+      victim          = v;
+      victim_accesses = accesses;
+      victim_live     = item.live_count();
+    }
+  };
+
+  consider(var);
+
+  for (auto n : liveWith[var]) {
+    Reg reg = alloc[n].reg;
+    if (!has_reg(reg) || holders[index(reg)] != 1) continue;
+    consider(n);
+  }
+
+  if (victim == -1) return -1;
+
+  if (victim != var) {
+    alloc[var].reg = alloc[victim].reg;
+  }
+  alloc[victim].reg.tag = NONE;
+
+  m_pending.push_back(victim);
+  return victim;
+}
+
+
+/**
+ * Rewrite the instruction list for the variables selected for spilling.
+ *
+ * On first call, the code for initializing the spill base address is added.
+ */
+void Spill::apply() {
+  assert(pending());
+  assert(m_prepared);
+
+  bool first_time = (m_first_var == -1);
+
+  if (first_time) {
+    m_first_var = VarGen::count();
+    m_base = Reg(VarGen::fresh()).regId;
+  }
+
+  std::vector<int> slot(m_spillable.size(), -1);
+
+  for (auto v : m_pending) {
+    if (m_num_slots >= MAX_SLOTS) {
+      error("Spill::apply(): too many spilled variables", true);
+    }
+
+    slot[v] = m_num_slots++;
+  }
+
+  auto &translate = getSourceTranslate();
+  Instr::List ret(m_instrs.size()*2);
+
+  for (int j = 0; j < m_instrs.size(); j++) {
+    Instr instr = m_instrs[j];
+
+    if (!instr.has_registers()) {
+      ret << instr;
+      continue;
+    }
+
+    UseDef useDef(instr);
+    Instr::List before;
+    Instr::List after;
+    Reg addr, tmp;
+
+    Reg dst_tmp(NONE, 0);
+    RegId def = (useDef.def.tag != NONE)? useDef.def.regId: -1;
+
+    for (auto v : useDef.use) {
+      if (slot[v] < 0) continue;
+
+      Reg reg(VarGen::fresh());
+      if (v == def) dst_tmp = reg;
+
+      assertq(pick_accs(m_free_before[j], addr, tmp), "Spill::apply(): no free accumulators");
+      before << translate.spill_load(reg, slot_address(slot[v], addr), addr, tmp);
+      renameUses(instr, Reg(REG_A, v), reg);
+    }
+
+    if (def != -1 && slot[def] >= 0) {
+      if (dst_tmp.tag == NONE) {
+        dst_tmp = Reg(VarGen::fresh());
+
+        if (instr.isCondAssign()) {
+          // Lanes which are not assigned keep the previous value
+          assertq(pick_accs(m_free_before[j], addr, tmp), "Spill::apply(): no free accumulators");
+          before << translate.spill_load(dst_tmp, slot_address(slot[def], addr), addr, tmp);
+        }
+      }
+
+      instr.rename_dest(Reg(REG_A, def), dst_tmp);
+
+      assertq(pick_accs(m_free_after[j], addr, tmp), "Spill::apply(): no free accumulators");
+      after << translate.spill_store(dst_tmp, slot_address(slot[def], addr), addr, tmp);
+    }
+
+    if (!before.empty()) {
+      before.front().transfer_comments(instr);
+      instr.clear_comments();
+    }
+
+    ret << before << instr << after;
+  }
+
+  m_instrs.clear();
+  m_instrs << ret;
+
+  if (first_time) {
+    insert_setup();
+  }
+
+  m_pending.clear();
+  m_prepared = false;
+}
+
+
+/**
+ * Determine per instruction if spill code can be inserted before and after it,
+ * and which variables may be spilled.
+ */
+void Spill::prepare(Liveness &live) {
+  using namespace V3DLib::Target::instr;
+
+  int const num_instrs = m_instrs.size();
+  auto const &cfg = live.cfg();
+
+  //
+  // Liveness of the accumulators, which are used as temporaries
+  //
+  std::vector<uint8_t> use(num_instrs, 0);
+  std::vector<uint8_t> def(num_instrs, 0);
+  std::vector<uint8_t> live_in(num_instrs, 0);
+  std::vector<uint8_t> live_out(num_instrs, 0);
+
+  for (int i = 0; i < num_instrs; i++) {
+    auto const &instr = m_instrs[i];
+
+    for (auto const &reg : instr.src_regs()) {
+      use[i] |= acc_bit(reg);
+    }
+
+    if (instr.isCondAssign()) {
+      use[i] |= acc_bit(instr.dst_reg());  // Lanes not assigned keep their value
+    } else {
+      def[i] |= acc_bit(instr.dst_reg());
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (int i = num_instrs - 1; i >= 0; i--) {
+      uint8_t out = 0;
+      for (auto s : cfg[i]) out |= live_in[s];
+
+      uint8_t in = (uint8_t) (use[i] | (out & ~def[i]));
+
+      if (in != live_in[i] || out != live_out[i]) {
+        live_in[i]  = in;
+        live_out[i] = out;
+        changed = true;
+      }
+    }
+  }
+
+  //
+  // Pending TMU/VPM/DMA operations; spill code must not be inserted while these run.
+  // The operations are generated as straight sequences, so a linear scan suffices.
+  // VPM/DMA operations in the source code are not tracked here, see `choose()`.
+  //
+  int first = setup_point();
+  int pending_tmu = 0;
+  bool vpm_open = false;
+
+  m_free_before.assign(num_instrs, 0);
+  m_free_after.assign(num_instrs, 0);
+
+  for (int i = 0; i < num_instrs; i++) {
+    auto const &instr = m_instrs[i];
+    bool ok = (i >= first);
+
+    if (ok && pending_tmu == 0 && !vpm_open) {
+      m_free_before[i] = (uint8_t) (~live_in[i] & 0xf);
+    }
+
+    Reg dst = instr.dst_reg();
+
+    if (instr.tag == RECV) {
+      if (pending_tmu > 0) pending_tmu--;
+    } else if (dst == TMU0_S) {
+      pending_tmu++;
+    } else if (dst == RD_SETUP || dst == WR_SETUP || dst == DMA_LD_ADDR || dst == Target::instr::VPM_WRITE) {
+      vpm_open = true;  // VPM_WRITE is also TMUD on v3d
+    } else if (dst == DMA_ST_ADDR) {
+      vpm_open = false; // DMA_ST_ADDR is also TMUA on v3d
+    }
+
+    if (instr.is_src_reg(Target::instr::VPM_READ)) vpm_open = false;
+
+    if (ok && pending_tmu == 0 && !vpm_open) {
+      m_free_after[i] = (uint8_t) (~live_out[i] & 0xf);
+    }
+  }
+
+  //
+  // Determine which variables can be spilled
+  //
+  Reg addr, tmp;
+  m_spillable.assign(live.num_vars(), true);
+
+  for (int i = 0; i < num_instrs; i++) {
+    auto const &instr = m_instrs[i];
+    if (!instr.has_registers()) continue;
+
+    bool ok_before = pick_accs(m_free_before[i], addr, tmp);
+    bool ok_after  = pick_accs(m_free_after[i], addr, tmp);
+
+    UseDef useDef(instr);
+
+    if (!ok_before) {
+      for (auto v : useDef.use) m_spillable[v] = false;
+    }
+
+    if (useDef.def.tag != NONE) {
+      if (!ok_after || (instr.isCondAssign() && !ok_before)) {
+        m_spillable[useDef.def.regId] = false;
+      }
+    }
+  }
+
+  // Variables generated for spilling are never spilled themselves
+  if (m_first_var != -1) {
+    for (int v = m_first_var; v < (int) m_spillable.size(); v++) {
+      m_spillable[v] = false;
+    }
+  }
+}
+
+
+/**
+ * @return index of first instruction before which spill code may be inserted
+ */
+int Spill::setup_point() {
+  int setup_size = (m_first_var == -1)? 0 : setup_code().size();
+
+  if (Platform::compiling_for_vc4()) {
+    return m_instrs.lastUniformOffset() + 1 + setup_size;  // Last uniform load is the dummy
+  } else {
+    return m_instrs.tag_index(INIT_END) + 1 + setup_size;
+  }
+}
+
+
+/**
+ * Generate code to calculate the address of a spill slot.
+ *
+ * Only small immediates are used, a large load immediate would clobber accumulators on v3d.
+ *
+ * Layout of a slot: 16 QPUs x 16 vector elements.
+ * The offset for QPU and element have been added to the base address during setup.
+ */
+Instr::List Spill::slot_address(int slot, Reg addr) const {
+  using namespace V3DLib::Target::instr;
+  assert(0 <= slot && slot < MAX_SLOTS);
+
+  Instr::List ret;
+
+  if (slot < 16) {
+    ret << mov(addr, slot);
+  } else {
+    ret << mov(addr, slot >> 4)
+        << shl(addr, addr, 4);
+
+    if ((slot & 15) != 0) {
+      ret << add(addr, addr, slot & 15);
+    }
+  }
+
+  ret << shl(addr, addr, 10)               // slot*SLOT_SIZE*4
+      << add(addr, addr, Reg(REG_A, m_base));
+
+  return ret;
+}
+
+
+/**
+ * Generate code to add the offsets for the current QPU and vector elements to the spill base address
+ */
+Instr::List Spill::setup_code() const {
+  using namespace V3DLib::Target::instr;
+
+  Reg base(REG_A, m_base);
+  Instr::List ret;
+
+  ret << mov(ACC0, ELEM_ID).comment("Initialize spill base address")
+      << shl(ACC0, ACC0, 2)
+      << add(base, base, ACC0)
+      << shl(ACC0, rf(RSV_QPU_ID), 6)       // qpu num * 16 elements * 4 bytes
+      << add(base, base, ACC0);
+
+  return ret;
+}
+
+
+/**
+ * Add the uniform load for the spill base address and its initialization
+ */
+void Spill::insert_setup() {
+  using namespace V3DLib::Target::instr;
+
+  Instr load = mov(Reg(REG_A, m_base), UNIFORM_READ);
+  load.comment("Spill base address");
+
+  if (Platform::compiling_for_vc4()) {
+    // Must come before the dummy uniform load, which is last
+    int index = m_instrs.lastUniformOffset();
+    m_instrs.insert(index, load);
+    m_instrs.insert(index + 2, setup_code());
+  } else {
+    m_instrs.insert(m_instrs.lastUniformOffset() + 1, load);
+    m_instrs.insert(m_instrs.tag_index(INIT_END) + 1, setup_code());
+  }
+}
+
+
+/**
+ * Select two accumulators from the given set of free accumulators
+ *
+ * @return true if found, false otherwise
+ */
+bool Spill::pick_accs(uint8_t free, Reg &addr, Reg &tmp) {
+  int found[2];
+  int count = 0;
+
+  for (int i = 0; i < NUM_SPILL_ACCS && count < 2; i++) {
+    if ((free & (1 << i)) != 0) found[count++] = i;
+  }
+
+  if (count < 2) return false;
+
+  addr = Reg(ACC, found[0]);
+  tmp  = Reg(ACC, found[1]);
+  return true;
+}
+
+}  // namespace V3DLib
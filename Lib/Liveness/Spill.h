@@ -0,0 +1,72 @@
+#ifndef _V3DLIB_LIVENESS_SPILL_H_
+#define _V3DLIB_LIVENESS_SPILL_H_
+#include <vector>
+#include "Target/instr/Instr.h"
+
+namespace V3DLib {
+
+class Liveness;
+class LiveSets;
+
+/**
+ * Spilling of variables to main memory, for when register allocation runs out of registers.
+ *
+ * During a round of register allocation, a variable is selected for spilling when
+ * no register is available (see `choose()`). At the end of the round, all selected
+ * variables are rewritten in the instruction list (see `apply()`):
+ *
+ *  - before every instruction using a spilled variable, the value is loaded from memory
+ *    into a fresh short-lived variable
+ *  - after every instruction assigning to a spilled variable, the value is stored to memory
+ *
+ * Register allocation is then redone on the new instruction list.
+ *
+ * The memory for the spilled values is passed in as an extra uniform after the kernel
+ * parameters. Each spilled variable gets a slot of 16 QPUs x 16 vector elements,
+ * see `KernelDriver::spill_params()`.
+ *
+ * The load and store code is generated by the platform, via `ISourceTranslate`.
+ * The temporaries it needs are accumulators, which are selected to be free at the insertion point.
+ * Variables are only spilled if all their usages are outside of pending TMU/VPM/DMA operations.
+ *
+ * Restriction: on vc4, spilling is refused for kernels which use the VPM/DMA operations
+ * directly (`vpmGet()`, `vpmPut()`, `dmaStartRead()` etc). The spill code uses the same VPM rows
+ * and setup registers, and would overwrite the state the kernel keeps in them between statements.
+ * Such kernels fail to compile with an error if they run out of registers.
+ */
+class Spill {
+public:
+  static int const SLOT_SIZE = 16*16;  // Size of a spill slot in words
+
+  Spill(Instr::List &instrs) : m_instrs(instrs) {}
+
+  RegId choose(RegId var, Liveness &live, LiveSets &liveWith);
+  bool pending() const { return !m_pending.empty(); }
+  void apply();
+  int num_slots() const { return m_num_slots; }
+
+private:
+  Instr::List &m_instrs;
+
+  bool m_prepared     = false;
+  int  m_first_var    = -1;   // First variable generated for spilling; this and subsequent are never spilled
+  RegId m_base        = -1;   // Variable holding the base address of the spill memory
+  int  m_num_slots    = 0;
+
+  std::vector<RegId>   m_pending;    // Variables selected for spilling in current round
+  std::vector<bool>    m_spillable;  // Per variable
+  std::vector<uint8_t> m_free_before;  // Per instruction: free accumulators before it
+  std::vector<uint8_t> m_free_after;   // Per instruction: free accumulators after it
+
+  void prepare(Liveness &live);
+  int setup_point();
+  Instr::List slot_address(int slot, Reg addr) const;
+  Instr::List setup_code() const;
+  void insert_setup();
+
+  static bool pick_accs(uint8_t free, Reg &addr, Reg &tmp);
+};
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_LIVENESS_SPILL_H_
@@ -96,7 +96,7 @@ void BExpr::cmp_rhs(Expr::Ptr p) { assert(m_tag == CMP); m_cmp_rhs = p; }
  * Return copy of current instance as a shared ptr.
  */
 BExpr::Ptr BExpr::ptr() const {
-  return Ptr(new BExpr(*this));  // Verified correct (looked tricky)
+  return make_node<BExpr>(*this);  // Verified correct (looked tricky)
 }
 
 /**
@@ -106,7 +106,7 @@ BExpr::Ptr BExpr::ptr() const {
  * `not` is a keyword, hence capital.
  */
 BExpr::Ptr BExpr::Not() const {
-  Ptr b(new BExpr());
+  Ptr b = make_node<BExpr>();
   b->m_tag = NOT;
   b->m_lhs = ptr();
   return b;
@@ -120,7 +120,7 @@ BExpr::Ptr BExpr::Not() const {
  * `and` is a keyword, hence capital.
  */
 BExpr::Ptr BExpr::And(Ptr rhs) const {
-  Ptr b(new BExpr());
+  Ptr b = make_node<BExpr>();
   b->m_tag = AND;
   b->m_lhs = ptr();
   b->m_rhs = rhs;
@@ -135,7 +135,7 @@ BExpr::Ptr BExpr::And(Ptr rhs) const {
  * `or` is a keyword, hence capital.
  */
 BExpr::Ptr BExpr::Or(Ptr rhs) const {
-  Ptr b(new BExpr());
+  Ptr b = make_node<BExpr>();
   b->m_tag = OR;
   b->m_lhs = ptr();
   b->m_rhs = rhs;
@@ -18,12 +18,12 @@ std::string CExpr::dump() const {
 // ============================================================================
 
 CExpr::Ptr mkAll(BExpr::Ptr bexpr) {
-  return CExpr::Ptr(new CExpr(ALL, bexpr));
+  return make_node<CExpr>(ALL, bexpr);
 }
 
 
 CExpr::Ptr mkAny(BExpr::Ptr bexpr) {
-  return CExpr::Ptr(new CExpr(ANY, bexpr));
+  return make_node<CExpr>(ANY, bexpr);
 }
 
 }  // namespace V3DLib
@@ -22,7 +22,7 @@ BoolExpr mkIntCmp(IntExpr a, CmpOp::Id cond, IntExpr b) {
 
 
 BExpr::Ptr mkCmp(Expr::Ptr lhs, CmpOp op, Expr::Ptr rhs) {
-  return BExpr::Ptr(new BExpr(lhs, op, rhs));
+  return make_node<BExpr>(lhs, op, rhs);
 }
 
 
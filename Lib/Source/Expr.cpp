@@ -18,7 +18,7 @@ Expr::Expr(Expr const &rhs) :
     case INT_LIT  : intLit     = rhs.intLit; break;
     case FLOAT_LIT: floatLit   = rhs.floatLit; break;
     case VAR:       m_var      = rhs.m_var; break;
-    case APPLY:     m_apply_op.reset(new Op(*rhs.m_apply_op)); break;  // I hate this
+    case APPLY:     new (&m_apply_op) Op(rhs.m_apply_op); break;
 
     case DEREF: break;
     default: assert(false); break;
@@ -41,10 +41,9 @@ Expr::Expr(float in_lit) {
 }
 
 
-Expr::Expr(Ptr in_lhs, Op const &op, Ptr in_rhs) {
+Expr::Expr(Ptr in_lhs, Op const &op, Ptr in_rhs) : m_apply_op(op) {
   m_tag = APPLY;
   lhs(in_lhs);
-  m_apply_op.reset(new Op(op));  // urgh
   rhs(in_rhs);
 }
 
@@ -74,8 +73,8 @@ Expr::Ptr Expr::rhs() const {
 
 
 Op const &Expr::apply_op() const {
-  assert(m_tag == APPLY && m_apply_op != nullptr);
-  return *m_apply_op;
+  assert(m_tag == APPLY);
+  return m_apply_op;
 }
 
 
@@ -202,9 +201,9 @@ std::string BaseExpr::dump() const {
 // Functions on expressions
 // ============================================================================
 
-Expr::Ptr mkIntLit(int lit)      { return std::make_shared<Expr>(lit); }
-Expr::Ptr mkVar(Var var)         { return std::make_shared<Expr>(var); }
-Expr::Ptr mkDeref(Expr::Ptr ptr) { return std::make_shared<Expr>(ptr); }
+Expr::Ptr mkIntLit(int lit)      { return make_node<Expr>(lit); }
+Expr::Ptr mkVar(Var var)         { return make_node<Expr>(var); }
+Expr::Ptr mkDeref(Expr::Ptr ptr) { return make_node<Expr>(ptr); }
 
 
 /**
@@ -214,7 +213,7 @@ Expr::Ptr mkDeref(Expr::Ptr ptr) { return std::make_shared<Expr>(ptr); }
  * will be ignored in the assembly.
  */
 Expr::Ptr mkApply(Expr::Ptr lhs, Op const &op, Expr::Ptr rhs) {
-  return std::make_shared<Expr>(lhs, op, rhs);
+  return make_node<Expr>(lhs, op, rhs);
 }
 
 
@@ -227,7 +226,7 @@ Expr::Ptr mkApply(Expr::Ptr lhs, Op const &op) {
     msg << "mkApply(): " << op.dump() << " expected to be unary";
     assertq(false, msg);
   }
-  return std::make_shared<Expr>(lhs, op, mkIntLit(0));
+  return make_node<Expr>(lhs, op, mkIntLit(0));
 }
 
 
@@ -3,6 +3,7 @@
 #include <memory>
 #include "Var.h"
 #include "Op.h"
+#include "Support/Arena.h"
 
 namespace V3DLib {
 
@@ -12,8 +13,7 @@ namespace V3DLib {
 
 
 struct Expr {
-  using Ptr   = std::shared_ptr<Expr>;
-  using OpPtr = std::unique_ptr<Op>;
+  using Ptr = std::shared_ptr<Expr>;
 
   enum Tag {
     INT_LIT,
@@ -50,13 +50,12 @@ struct Expr {
     int   intLit;      // Integer literal
     float floatLit;    // Float literal
     Var   m_var;       // Variable identifier
+    Op    m_apply_op;  // Application of a binary operator
   };
 
   bool isSimple() const;
 
 private:
-  OpPtr m_apply_op;          // Application of a binary operator
-
   Tag m_tag;                 // What kind of expression is it?
   Ptr m_exp_a;               // lhs for apply, ptr for deref
   Ptr m_exp_b;               // rhs for apply
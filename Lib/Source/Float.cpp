@@ -1,6 +1,7 @@
 #include "Source/Float.h"
 #include "Lang.h"  // only for assign()!
 #include "Functions.h"
+#include "Common/CompileData.h"
 
 namespace V3DLib {
 
@@ -15,7 +16,7 @@ FloatExpr unary_float_op(OpId op_id, FloatExpr a) {
 // Class FloatExpr
 // ============================================================================
 
-FloatExpr::FloatExpr(float x) { m_expr = std::make_shared<Expr>(x); }
+FloatExpr::FloatExpr(float x) { m_expr = make_node<Expr>(x); }
 FloatExpr::FloatExpr(Deref<Float> d) : BaseExpr(d.expr()) {}
 
 FloatExpr FloatExpr::operator-() { return (*this)*-1.0f; }
@@ -44,7 +45,7 @@ Float::Float() { assign_intern(); }
 
 
 Float::Float(float x) {
-  auto a = std::make_shared<Expr>(x);
+  auto a = make_node<Expr>(x);
   assign_intern(a);
 }
 
@@ -160,6 +161,7 @@ void Float::set_at(Int n, Float const &src) {
  * Read vector from VPM
  */
 FloatExpr vpmGetFloat() {
+  compile_data.uses_vpm = true;  // See `Spill`
   Expr::Ptr e = mkVar(VPM_READ);
   return FloatExpr(e);
 }
@@ -473,9 +473,11 @@ void sync_qpus(Int::Ptr signal) {
 
       *signal = 0;        comment("QPU 0 done waiting, let other qpus continue");
     Else
-      Int tmp = *signal;  comment("Other QPUs: Wait till all signals are cleared");
+      // Only look at the signal of the current QPU. Other QPUs may already have set
+      // their signal again for a following sync.
+      Int tmp = *signal;  comment("Other QPUs: Wait till own signal is cleared");
 
-      While (0 != tmp)
+      While (any(index() == me() && 0 != tmp))
         tmp = *signal;
       End
     End
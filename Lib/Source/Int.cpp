@@ -3,6 +3,7 @@
 #include "SourceTranslate.h"
 #include "Support/Platform.h"
 #include "Support/debug.h"
+#include "Common/CompileData.h"
 #include "Functions.h"  // operator/
 
 namespace V3DLib {
@@ -77,7 +78,7 @@ inline IntExpr mkIntApply(IntExpr a, Op const &op, IntExpr b) {
  * Read an Int from the UNIFORM FIFO.
  */
 IntExpr getUniformInt() {
-   Expr::Ptr e = std::make_shared<Expr>(Var(UNIFORM));
+   Expr::Ptr e = make_node<Expr>(Var(UNIFORM));
   return IntExpr(e);
 }
 
@@ -102,7 +103,7 @@ bool Int::passParam(IntList &uniforms, int val) {
  */
 IntExpr index() {
   if (Platform::compiling_for_vc4()) {
-    Expr::Ptr e = std::make_shared<Expr>(Var(ELEM_NUM));
+    Expr::Ptr e = make_node<Expr>(Var(ELEM_NUM));
     return IntExpr(e);
   } else {
     Expr::Ptr a = mkVar(Var(DUMMY));
@@ -114,7 +115,7 @@ IntExpr index() {
 // A vector containing the QPU id
 IntExpr me() {
   // There is reserved var holding the QPU ID.
-  Expr::Ptr e = std::make_shared<Expr>(Var(STANDARD, RSV_QPU_ID));
+  Expr::Ptr e = make_node<Expr>(Var(STANDARD, RSV_QPU_ID));
   return IntExpr(e);
 }
 
@@ -122,7 +123,7 @@ IntExpr me() {
 // A vector containing the QPU count
 IntExpr numQPUs() {
   // There is reserved var holding the QPU count.
-  Expr::Ptr e = std::make_shared<Expr>(Var(STANDARD, RSV_NUM_QPUS));
+  Expr::Ptr e = make_node<Expr>(Var(STANDARD, RSV_NUM_QPUS));
   return IntExpr(e);
 }
 
@@ -131,7 +132,8 @@ IntExpr numQPUs() {
  * Read vector from VPM
  */
 IntExpr vpmGetInt() {
-  Expr::Ptr e = std::make_shared<Expr>(Var(VPM_READ));
+  compile_data.uses_vpm = true;  // See `Spill`
+  Expr::Ptr e = make_node<Expr>(Var(VPM_READ));
   return IntExpr(e);
 }
 
@@ -1,9 +1,11 @@
 #include "Source/Interpreter.h"
 #include <algorithm>  // reverse()
+#include <atomic>
 #include "Common/SharedArray.h"
 #include "Source/Stmt.h"
 #include "Common/BufferObject.h"
 #include "Target/EmuSupport.h"
+#include "Target/LaneOps.h"
 #include "Support/basics.h"
 
 namespace V3DLib {
@@ -25,6 +27,7 @@ struct CoreState {
 
   Stmts stack;                   // Control stack
   Data emuHeap;
+  std::mutex *heap_mutex = nullptr;  // Guards heap memory, shared by all cores
 
   ~CoreState() {
     delete [] m_env;
@@ -54,13 +57,13 @@ private:
   Vec *m_env  = nullptr;      // Environment mapping vars to values
   int sizeEnv = -1;           // Size of the environment
 
-  static int load_show_count;
-  static int store_show_count;
+  static std::atomic<int> load_show_count;
+  static std::atomic<int> store_show_count;
 };
 
 
-int CoreState::load_show_count = 0;
-int CoreState::store_show_count = 0;
+std::atomic<int> CoreState::load_show_count(0);
+std::atomic<int> CoreState::store_show_count(0);
 
 
 // State of the Interpreter.
@@ -73,6 +76,7 @@ struct InterpreterState : public EmuState {
 
 void CoreState::store_to_heap(Vec const &index, Vec &val) {
   assert(writeStride == 0);  // usage of writeStride is probably wrong!
+  std::lock_guard<std::mutex> lock(*heap_mutex);
 
   int const show_count = 3;
 
@@ -83,13 +87,13 @@ void CoreState::store_to_heap(Vec const &index, Vec &val) {
     std::string msg;
     msg << "store_to_heap(): index does not have all same values:" << index.dump();
 
-    if (store_show_count == (show_count - 1)) {
+    int count = store_show_count++;
+    if (count == (show_count - 1)) {
       msg << "\n(this message not shown for further occurences)";
     }
-    if (store_show_count < show_count) {
+    if (count < show_count) {
       warning(msg);
     }
-    store_show_count ++;
     // The human has been warned, assume that she knows what she's doing
 
     for (int i = 0; i < NUM_LANES; i++) {
@@ -110,6 +114,7 @@ void CoreState::store_to_heap(Vec const &index, Vec &val) {
 
 Vec CoreState::load_from_heap(Vec const &index) {
   assert(readStride == 0);  // Usage of readStride is probably wrong!
+  std::lock_guard<std::mutex> lock(*heap_mutex);
   Vec v;
 
   int const show_count = 3;
@@ -118,13 +123,13 @@ Vec CoreState::load_from_heap(Vec const &index) {
     std::string msg;
     msg << "load_from_heap(): index does not have all same values: " << index.dump();
 
-    if (load_show_count == (show_count - 1)) {
+    int count = load_show_count++;
+    if (count == (show_count - 1)) {
       msg << "\n(this message not shown for further occurences)";
     }
-    if (load_show_count < show_count) {
+    if (count < show_count) {
       warning(msg);
     }
-    load_show_count ++;
     // The human has been warned, assume that she knows what she's doing
 
     for (int i = 0; i < NUM_LANES; i++) {
@@ -194,18 +199,14 @@ Vec evalBool(InterpreterState &is, CoreState* s, BExpr::Ptr e) {
   switch (e->tag()) {
     // Negation
     case NOT:
-      v = evalBool(is, s, e->neg());
-      for (int i = 0; i < NUM_LANES; i++)
-        v[i].intVal = !v[i].intVal;
+      lanes::bool_not(v, evalBool(is, s, e->neg()));
       return v;
 
     // Conjunction
     case AND: {
       Vec a = evalBool(is, s, e->lhs());
       Vec b = evalBool(is, s, e->rhs());
-
-      for (int i = 0; i < NUM_LANES; i++)
-        v[i].intVal = a[i].intVal && b[i].intVal;
+      lanes::bool_and(v, a, b);
       return v;
     }
 
@@ -213,9 +214,7 @@ Vec evalBool(InterpreterState &is, CoreState* s, BExpr::Ptr e) {
     case OR: {
       Vec a = evalBool(is, s, e->lhs());
       Vec b = evalBool(is, s, e->rhs());
-
-      for (int i = 0; i < NUM_LANES; i++)
-        v[i].intVal = a[i].intVal || b[i].intVal;
+      lanes::bool_or(v, a, b);
       return v;
     }
 
@@ -225,42 +224,33 @@ Vec evalBool(InterpreterState &is, CoreState* s, BExpr::Ptr e) {
       Vec b = eval(is, s, e->cmp_rhs());
       if (e->cmp.type() == FLOAT) {
         // Floating-point comparison
-        for (int i = 0; i < NUM_LANES; i++) {
-          float x = a[i].floatVal;
-          float y = b[i].floatVal;
-          switch (e->cmp.op()) {
-            case CmpOp::EQ:  v[i].intVal = x == y; break;
-            case CmpOp::NEQ: v[i].intVal = x != y; break;
-            case CmpOp::LT:  v[i].intVal = x <  y; break;
-            case CmpOp::GT:  v[i].intVal = x >  y; break;
-            case CmpOp::LE:  v[i].intVal = x <= y; break;
-            case CmpOp::GE:  v[i].intVal = x >= y; break;
-            default:  assert(false);
-          }
+        switch (e->cmp.op()) {
+          case CmpOp::EQ:  lanes::fcmp_eq(v, a, b); break;
+          case CmpOp::NEQ: lanes::fcmp_ne(v, a, b); break;
+          case CmpOp::LT:  lanes::fcmp_lt(v, a, b); break;
+          case CmpOp::GT:  lanes::fcmp_lt(v, b, a); break;
+          case CmpOp::LE:  lanes::fcmp_le(v, a, b); break;
+          case CmpOp::GE:  lanes::fcmp_le(v, b, a); break;
+          default:  assert(false);
         }
         return v;
       }
       else {
         // Integer comparison
-        for (int i = 0; i < NUM_LANES; i++) {
-          int32_t x = a[i].intVal;
-          int32_t y = b[i].intVal;
-
-          switch (e->cmp.op()) {
-            case CmpOp::EQ:  v[i].intVal = x == y; break;
-            case CmpOp::NEQ: v[i].intVal = x != y; break;
-            // Ideally compiler would implement:
-            // case CmpOp::LT:  v[i].intVal = x <  y; break;
-            // case CmpOp::GT:  v[i].intVal = x >  y; break;
-            // case CmpOp::LE:  v[i].intVal = x <= y; break;
-            // case CmpOp::GE:  v[i].intVal = x >= y; break;
-            // But currently it implements:
-            case CmpOp::LT: v[i].intVal = ((x-y) & 0x80000000) != 0; break;
-            case CmpOp::GE: v[i].intVal = ((x-y) & 0x80000000) == 0; break;
-            case CmpOp::LE: v[i].intVal = ((y-x) & 0x80000000) == 0; break;
-            case CmpOp::GT: v[i].intVal = ((y-x) & 0x80000000) != 0; break;
-            default:  assert(false);
-          }
+        switch (e->cmp.op()) {
+          case CmpOp::EQ:  lanes::icmp_eq(v, a, b); break;
+          case CmpOp::NEQ: lanes::icmp_ne(v, a, b); break;
+          // Ideally compiler would implement:
+          // case CmpOp::LT:  v[i].intVal = x <  y; break;
+          // case CmpOp::GT:  v[i].intVal = x >  y; break;
+          // case CmpOp::LE:  v[i].intVal = x <= y; break;
+          // case CmpOp::GE:  v[i].intVal = x >= y; break;
+          // But currently it implements the sign of the subtraction:
+          case CmpOp::LT: lanes::icmp_lt(v, a, b); break;
+          case CmpOp::GE: lanes::icmp_lt(v, a, b); lanes::bool_not(v, v); break;
+          case CmpOp::LE: lanes::icmp_lt(v, b, a); lanes::bool_not(v, v); break;
+          case CmpOp::GT: lanes::icmp_lt(v, b, a); break;
+          default:  assert(false);
         }
         return v;
       }
@@ -281,19 +271,8 @@ bool evalCond(InterpreterState &is, CoreState* s, CExpr::Ptr e) {
   Vec v = evalBool(is, s, e->bexpr());
 
   switch (e->tag()) {
-    case ALL: {
-      bool b = true;
-      for (int i = 0; i < NUM_LANES; i++)
-        b = b && v[i].intVal;
-      return b;
-    }
-      
-    case ANY: {
-      bool b = false;
-      for (int i = 0; i < NUM_LANES; i++)
-        b = b || v[i].intVal;
-      return b;
-    }
+    case ALL: return lanes::all(v);
+    case ANY: return lanes::any(v);
   }
 
   // Unreachable
@@ -309,11 +288,7 @@ void assignToVar(CoreState* s, Vec cond, Var v, Vec x) {
   switch (v.tag()) {
     // Normal variable
     case STANDARD:
-      for (int i = 0; i < NUM_LANES; i++) {
-        if (cond[i].intVal) {
-          s->env(v.id())[i] = x[i];
-        }
-      }
+      lanes::bool_select(s->env(v.id()), cond, x);
       break;
 
     case TMU0_ADDR: {  // Load via TMU
@@ -362,10 +337,9 @@ void execAssign(InterpreterState &is, CoreState* s, Vec cond, Expr::Ptr lhs, Exp
 /**
  * And two condition vectors
  */
-Vec vecAnd(Vec x, Vec y) {
+Vec vecAnd(Vec const &x, Vec const &y) {
   Vec v;
-  for (int i = 0; i < NUM_LANES; i++)
-    v[i].intVal = x[i].intVal && y[i].intVal;
+  lanes::bool_and(v, x, y);
   return v;
 }
 
@@ -568,6 +542,8 @@ void exec(InterpreterState &is, int core_index) {
  * difference is that the interpreter operates on source code and the
  * emulator on target code.
  *
+ * As in the emulator, multiple cores run in parallel or in lockstep, see `EmuState::run()`.
+ *
  * @param numCores  Number of cores active
  * @param stmt      Source code
  * @param numVars   Max var id used in source
@@ -590,6 +566,7 @@ void interpreter(
     s.id          = i;
     s.init_env(numVars);
     s.emuHeap.heap_view(heap);
+    s.heap_mutex  = &state.heap_mutex;
   }
 
   // Put statement on each core's control stack
@@ -603,16 +580,15 @@ void interpreter(
   CoreState::reset_count();
 
   // Run code
-  bool running = true;
-  while (running) {
-    running = false;
-    for (int i = 0; i < numCores; i++) {
-      if (state.core[i].stack.size() > 0) {
-        running = true;
-        exec(state, i);
-      }
+  state.run([&state] (int core, int max_steps) {
+    auto &stack = state.core[core].stack;
+
+    for (int i = 0; i < max_steps && stack.size() > 0; i++) {
+      exec(state, core);
     }
-  }
+
+    return stack.size() > 0;
+  });
 }
 
 }  // namespace V3DLib
@@ -105,13 +105,14 @@ void Where__(BExpr::Ptr b) {
 // 'For' handling
 //=============================================================================
 
-void ForBody_() {
+void ForBody_(int unroll) {
   auto inc = stmtStack().top();
   assert(inc);
   stmtStack().pop();
 
   Stmt::Ptr s = stmtStack().last_stmt();
   s->inc(*inc);
+  s->unroll(unroll);
 
   stmtStack().push();
 }
@@ -21,6 +21,13 @@ class StmtStack;  // Forward declaration
       inc;                   \
     ForBody_();
 
+// For-loop with a request to unroll the body n times
+#define ForUnroll(n, init, cond, inc) \
+  { init;                    \
+    For_(cond);              \
+      inc;                   \
+    ForBody_(n);
+
 //=============================================================================
 // Statement tokens
 //=============================================================================
@@ -36,7 +43,7 @@ void Where__(BExpr::Ptr b);
 inline void Where_(BoolExpr b) { Where__(b.bexpr()); }
 void For_(Cond c);
 void For_(BoolExpr b);
-void ForBody_();
+void ForBody_(int unroll = 1);
 
 void header(char const *str);
 inline void header(std::string const &str) { header(str.c_str()); }
@@ -51,7 +51,7 @@ struct Op {
   OpId op;
   BaseType type;
 
-  Op(Op const &rhs);
+  Op(Op const &rhs) = default;
   Op(OpId in_op, BaseType in_type);
 
   bool isUnary() const;
@@ -62,7 +62,7 @@ struct Op {
   ALUOp::Enum opcode() const;
 
 private:
-  OpItem const &m_item;
+  OpItem const *m_item;  // Pointer, so that Op is trivially copyable
 };
 
 }  // namespace V3DLib
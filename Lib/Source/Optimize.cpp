@@ -0,0 +1,1298 @@
+#include "Optimize.h"
+#include <algorithm>  // std::find()
+#include <cmath>      // std::fpclassify()
+#include <cstring>    // memcpy()
+#include <functional>
+#include <map>
+#include <set>
+#include "Common/CompileData.h"
+#include "Source/Int.h"          // RSV_DEVNULL
+#include "Target/EmuSupport.h"   // Vec
+#include "Support/basics.h"
+
+namespace V3DLib {
+
+using ::operator<<;  // C++ weirdness
+
+namespace {
+
+// ============================================================================
+// Support
+// ============================================================================
+
+/**
+ * Reading a pure variable has no side effects.
+ *
+ * Reading from the UNIFORM and VPM_READ variables consumes a value, so these are not pure.
+ */
+bool is_pure(Var const &v) {
+  return v.tag() == STANDARD || v.tag() == QPU_NUM || v.tag() == ELEM_NUM;
+}
+
+
+/**
+ * An expression is pure if evaluating it has no side effects,
+ * and the outcome depends only on the values of the variables in it.
+ *
+ * Dereferences are not pure, because memory may change between evaluations.
+ */
+bool is_pure(Expr const &e) {
+  switch (e.tag()) {
+    case Expr::INT_LIT:
+    case Expr::FLOAT_LIT: return true;
+    case Expr::VAR:       return is_pure(e.var());
+    case Expr::APPLY:     return is_pure(*e.lhs()) && is_pure(*e.rhs());
+    default:              return false;
+  }
+}
+
+
+/**
+ * Only standard variables above the reserved ones are candidates for changes.
+ *
+ * The reserved variables are also used directly in the target code.
+ */
+bool is_user_var(Expr const &e) {
+  return e.tag() == Expr::VAR && e.var().tag() == STANDARD && e.var().id() > RSV_DEVNULL;
+}
+
+
+/**
+ * Call `f` for each block of statements nested directly in the given statement
+ */
+void for_blocks(Stmt &s, std::function<void(Stmts &)> f) {
+  switch (s.tag) {
+    case Stmt::SEQ:
+    case Stmt::WHILE:
+      f(s.body());
+      break;
+
+    case Stmt::IF:
+    case Stmt::WHERE:
+      if (!s.then_block().empty()) f(s.then_block());
+      if (!s.else_block().empty()) f(s.else_block());
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+/**
+ * Call `f` for all expressions which are evaluated by the given statement.
+ *
+ * Nested statements are not visited.
+ *
+ * @return true if all expressions could be visited, false if the statement is not handled
+ */
+bool for_exprs(Stmt &s, std::function<void(Expr::Ptr)> f) {
+  std::function<void(BExpr::Ptr)> bexpr = [&f, &bexpr] (BExpr::Ptr b) {
+    switch (b->tag()) {
+      case NOT: bexpr(b->neg()); break;
+      case AND:
+      case OR:  bexpr(b->lhs()); bexpr(b->rhs()); break;
+      case CMP: f(b->cmp_lhs()); f(b->cmp_rhs()); break;
+    }
+  };
+
+  switch (s.tag) {
+    case Stmt::SKIP:
+    case Stmt::SEQ:
+    case Stmt::GATHER_PREFETCH:
+    case Stmt::SEND_IRQ_TO_HOST:
+    case Stmt::SEMA_INC:
+    case Stmt::SEMA_DEC:
+    case Stmt::DMA_READ_WAIT:
+    case Stmt::DMA_WRITE_WAIT:
+      break;
+
+    case Stmt::ASSIGN:
+      if (s.assign_lhs()->tag() == Expr::DEREF) {
+        f(s.assign_lhs()->deref_ptr());
+      }
+      f(s.assign_rhs());
+      break;
+
+    case Stmt::WHERE:        bexpr(s.where_cond());          break;
+    case Stmt::IF:           bexpr(s.if_cond()->bexpr());    break;
+    case Stmt::WHILE:        bexpr(s.loop_cond()->bexpr());  break;
+    case Stmt::LOAD_RECEIVE: f(s.address());                 break;
+
+    default:
+      return false;  // DMA statements with expressions
+  }
+
+  return true;
+}
+
+
+/**
+ * Make sure a block is never empty, downstream does not like that
+ */
+void ensure_not_empty(Stmts &block) {
+  if (block.empty()) {
+    block.push_back(Stmt::create(Stmt::SKIP));
+  }
+}
+
+
+/**
+ * Structural key of a pure expression.
+ *
+ * If versions are passed, the version of each variable is part of the key.
+ *
+ * @return key of the expression, empty if the expression is not pure
+ */
+std::string pure_key(Expr const &e, std::map<VarId, int> const *versions = nullptr) {
+  std::string ret;
+
+  switch (e.tag()) {
+    case Expr::INT_LIT:
+      ret << "i" << e.intLit;
+      break;
+
+    case Expr::FLOAT_LIT: {
+      uint32_t bits;
+      memcpy(&bits, &e.floatLit, sizeof(bits));
+      ret << "f" << bits;
+    }
+    break;
+
+    case Expr::VAR: {
+      Var v = e.var();
+      if (!is_pure(v)) return "";
+      ret << "v" << (int) v.tag() << "_" << v.id();
+
+      if (versions != nullptr) {
+        auto it = versions->find(v.id());
+        ret << "." << ((it == versions->end())? 0 : it->second);
+      }
+    }
+    break;
+
+    case Expr::APPLY: {
+      std::string a = pure_key(*e.lhs(), versions);
+      std::string b = pure_key(*e.rhs(), versions);
+      if (a.empty() || b.empty()) return "";
+      ret << "(" << a << " " << (int) e.apply_op().op << ":" << (int) e.apply_op().type << " " << b << ")";
+    }
+    break;
+
+    default:
+      return "";
+  }
+
+  return ret;
+}
+
+
+// ============================================================================
+// Pass: constant folding and algebraic simplification
+// ============================================================================
+
+bool is_int_lit(Expr const &e, int val)     { return e.tag() == Expr::INT_LIT   && e.intLit == val; }
+bool is_float_lit(Expr const &e, float val) { return e.tag() == Expr::FLOAT_LIT && e.floatLit == val; }
+
+
+/**
+ * Structural equality of pure expressions
+ */
+bool same(Expr const &a, Expr const &b) {
+  if (a.tag() != b.tag()) return false;
+
+  switch (a.tag()) {
+    case Expr::INT_LIT:   return a.intLit == b.intLit;
+    case Expr::FLOAT_LIT: return memcmp(&a.floatLit, &b.floatLit, sizeof(float)) == 0;
+    case Expr::VAR:       return a.var().tag() == b.var().tag() && a.var().id() == b.var().id();
+    case Expr::APPLY:
+      return a.apply_op().op == b.apply_op().op && a.apply_op().type == b.apply_op().type
+          && same(*a.lhs(), *b.lhs()) && same(*a.rhs(), *b.rhs());
+    default:
+      return false;
+  }
+}
+
+
+/**
+ * Evaluate an operation on literals.
+ *
+ * The evaluation is done with the same code as the emulator and interpreter,
+ * so the outcome is the same as when the operation is run.
+ * Operations for which the hardware result may differ from the host are not folded.
+ *
+ * @return literal result if operation could be folded, nullptr otherwise
+ */
+Expr::Ptr fold(Expr const &e) {
+  Op const &op = e.apply_op();
+  Expr const &a = *e.lhs();
+  Expr const &b = *e.rhs();
+
+  bool is_float = (op.type == FLOAT);
+
+  switch (op.op) {
+    case ADD: case SUB: case MUL: case MIN: case MAX:
+      if (is_float) {
+        if (a.tag() != Expr::FLOAT_LIT || b.tag() != Expr::FLOAT_LIT) return nullptr;
+      } else {
+        if (op.type != INT32 || a.tag() != Expr::INT_LIT || b.tag() != Expr::INT_LIT) return nullptr;
+      }
+      break;
+
+    case SHL: case SHR: case USHR: case ROR: case BAND: case BOR: case BXOR:
+      if (a.tag() != Expr::INT_LIT || b.tag() != Expr::INT_LIT) return nullptr;
+      break;
+
+    case BNOT:
+      if (a.tag() != Expr::INT_LIT) return nullptr;
+      break;
+
+    case ItoF:
+      // Conversion is exact up to 24 bits
+      if (a.tag() != Expr::INT_LIT || a.intLit < -(1 << 24) || a.intLit > (1 << 24)) return nullptr;
+      break;
+
+    default:
+      return nullptr;  // Includes SFU functions, rotate and v3d-specific ops
+  }
+
+  Vec va, vb, result;
+  if (a.tag() == Expr::FLOAT_LIT) va = a.floatLit; else va = a.intLit;
+  if (b.tag() == Expr::FLOAT_LIT) vb = b.floatLit; else vb = b.intLit;
+  result.apply(op, va, vb);
+
+  if (op.op == ItoF || is_float) {
+    float f = result[0].floatVal;
+
+    // The QPUs flush denormals, skip these and anything else out of the ordinary
+    int cls = std::fpclassify(f);
+    if (cls != FP_NORMAL && cls != FP_ZERO) return nullptr;
+
+    return make_node<Expr>(f);
+  }
+
+  return mkIntLit(result[0].intVal);
+}
+
+
+/**
+ * Apply algebraic identities to an operation.
+ *
+ * Note that integer multiplication is 24-bit on the QPUs, so `x*1 == x` does not hold for ints.
+ * Operands are only dropped if they are pure.
+ *
+ * @return simplified expression if an identity applies, nullptr otherwise
+ */
+Expr::Ptr simplify_apply(Expr::Ptr e) {
+  Op const &op = e->apply_op();
+  Expr::Ptr a = e->lhs();
+  Expr::Ptr b = e->rhs();
+
+  if (op.type == FLOAT) {
+    switch (op.op) {
+      case MUL:
+        if (is_float_lit(*b, 1.0f)) return a;
+        if (is_float_lit(*a, 1.0f)) return b;
+        break;
+      case SUB:
+        if (is_float_lit(*b, 0.0f) && !std::signbit(b->floatLit)) return a;  // x - 0.0 == x, also for -0.0
+        break;
+      default:
+        break;
+    }
+
+    return nullptr;
+  }
+
+  if (op.type != INT32) return nullptr;
+
+  switch (op.op) {
+    case ADD:
+      if (is_int_lit(*b, 0)) return a;
+      if (is_int_lit(*a, 0)) return b;
+
+      // (x + c1) + c2 -> x + (c1 + c2)
+      if (b->tag() == Expr::INT_LIT && a->tag() == Expr::APPLY
+       && a->apply_op().op == ADD && a->apply_op().type == INT32 && a->rhs()->tag() == Expr::INT_LIT) {
+        int sum = (int) ((uint32_t) a->rhs()->intLit + (uint32_t) b->intLit);
+        return mkApply(a->lhs(), op, mkIntLit(sum));
+      }
+      break;
+
+    case SUB:
+      if (is_int_lit(*b, 0)) return a;
+      if (is_pure(*a) && same(*a, *b)) return mkIntLit(0);
+      break;
+
+    case MUL:
+      if (is_int_lit(*b, 0) && is_pure(*a)) return b;
+      if (is_int_lit(*a, 0) && is_pure(*b)) return a;
+      break;
+
+    case SHL: case SHR: case USHR: case ROR:
+    case BOR: case BXOR:
+      if (is_int_lit(*b, 0)) return a;
+      if (op.op == BOR || op.op == BXOR) {
+        if (is_int_lit(*a, 0)) return b;
+      }
+      break;
+
+    case BAND:
+      if (is_int_lit(*b, -1)) return a;
+      if (is_int_lit(*a, -1)) return b;
+      if (is_int_lit(*b, 0) && is_pure(*a)) return b;
+      if (is_int_lit(*a, 0) && is_pure(*b)) return a;
+      break;
+
+    case MIN: case MAX:
+      if (is_pure(*a) && same(*a, *b)) return a;
+      break;
+
+    default:
+      break;
+  }
+
+  return nullptr;
+}
+
+
+/**
+ * Fold and simplify an expression bottom-up.
+ *
+ * Expression nodes may be shared between statements, so they are never changed in place;
+ * new nodes are created where something changes.
+ */
+Expr::Ptr fold_expr(Expr::Ptr e) {
+  switch (e->tag()) {
+    case Expr::APPLY: {
+      Expr::Ptr lhs = fold_expr(e->lhs());
+      Expr::Ptr rhs = fold_expr(e->rhs());
+
+      if (lhs != e->lhs() || rhs != e->rhs()) {
+        e = mkApply(lhs, e->apply_op(), rhs);
+      }
+
+      Expr::Ptr folded = fold(*e);
+      if (folded) {
+        compile_data.num_constants_folded++;
+        return folded;
+      }
+
+      Expr::Ptr simplified = simplify_apply(e);
+      if (simplified) {
+        compile_data.num_exprs_simplified++;
+        return fold_expr(simplified);  // Simplification may enable further simplification
+      }
+    }
+    break;
+
+    case Expr::DEREF: {
+      Expr::Ptr ptr = fold_expr(e->deref_ptr());
+      if (ptr != e->deref_ptr() && !ptr->isLit()) {  // Literal address not handled downstream
+        e = mkDeref(ptr);
+      }
+    }
+    break;
+
+    default:
+      break;
+  }
+
+  return e;
+}
+
+
+void fold_block(Stmts &block) {
+  for (auto &s : block) {
+    if (s->tag == Stmt::ASSIGN) {
+      Expr::Ptr lhs = s->assign_lhs();
+
+      s->assign_lhs(fold_expr(lhs));
+      s->assign_rhs(fold_expr(s->assign_rhs()));
+    }
+
+    for_blocks(*s, fold_block);
+  }
+}
+
+
+// ============================================================================
+// Pass: common subexpression elimination
+// ============================================================================
+
+/**
+ * Local common subexpression elimination within a straight-line block of assignments.
+ *
+ * Every assignment to a variable gives it a new version, and the versions of the variables
+ * are part of the key of an expression. Two occurrences of an expression with the same key
+ * therefore have the same value.
+ *
+ * Statements other than assignments are treated as barriers; nested blocks are handled separately.
+ * This makes it safe for `where`-blocks, where all assignments have the same condition.
+ *
+ * The block is handled in two passes. The first counts the occurrences of each key,
+ * the second replaces repeated occurrences with a variable holding the value.
+ * If the first occurrence is the complete right-hand side of an assignment to a variable,
+ * that variable is used as long as it is not reassigned. Otherwise, a new variable is introduced.
+ */
+class CSE {
+public:
+  void run(Stmts &block) {
+    State start = m_state;
+    for (auto &s : block) count_stmt(*s);
+
+    m_state = start;
+    Stmts ret;
+
+    for (auto &s : block) {
+      rewrite_stmt(*s, ret);
+      ret.push_back(s);
+    }
+
+    block = ret;
+  }
+
+private:
+  struct Avail {
+    Var var = Var(STANDARD);
+    int version = 0;
+  };
+
+  struct State {
+    std::map<VarId, int> versions;
+    int epoch = 0;
+  };
+
+  State m_state;
+  std::map<std::string, int>   m_counts;
+  std::map<std::string, Avail> m_avail;
+
+  int version(VarId id) const {
+    auto it = m_state.versions.find(id);
+    return (it == m_state.versions.end())? 0 : it->second;
+  }
+
+
+  /**
+   * Only operations are considered for replacement, the rest is simple.
+   */
+  std::string key(Expr const &e) const {
+    if (e.tag() != Expr::APPLY) return "";
+
+    std::string ret = pure_key(e, &m_state.versions);
+    if (ret.empty()) return ret;
+
+    std::string prefix;
+    prefix << m_state.epoch << ":";
+    return prefix + ret;
+  }
+
+
+  void count(Expr::Ptr e) {
+    std::string k = key(*e);
+
+    if (!k.empty()) {
+      if (++m_counts[k] > 1) return;  // Subexpressions already counted for the first occurrence
+    }
+
+    if (e->tag() == Expr::APPLY) {
+      count(e->lhs());
+      count(e->rhs());
+    } else if (e->tag() == Expr::DEREF) {
+      count(e->deref_ptr());
+    }
+  }
+
+
+  void after_stmt(Stmt const &s) {
+    if (s.tag != Stmt::ASSIGN) {
+      m_state.epoch++;
+      return;
+    }
+
+    Expr::Ptr lhs = s.assign_lhs();
+    if (lhs->tag() == Expr::VAR && lhs->var().tag() == STANDARD) {
+      m_state.versions[lhs->var().id()] = version(lhs->var().id()) + 1;
+    }
+  }
+
+
+  void count_stmt(Stmt &s) {
+    if (s.tag == Stmt::ASSIGN) {
+      if (s.assign_lhs()->tag() == Expr::DEREF) {
+        count(s.assign_lhs()->deref_ptr());
+      }
+      count(s.assign_rhs());
+    } else {
+      for_blocks(s, [] (Stmts &block) { CSE().run(block); });  // Nested blocks are handled on their own
+    }
+
+    after_stmt(s);
+  }
+
+
+  bool available(std::string const &k, Var &var) const {
+    auto it = m_avail.find(k);
+    if (it == m_avail.end()) return false;
+    if (version(it->second.var.id()) != it->second.version) return false;  // Reassigned in the meantime
+
+    var = it->second.var;
+    return true;
+  }
+
+
+  /**
+   * Register an occurrence of a key during the rewrite
+   *
+   * @return true if there are more occurrences to come, false otherwise
+   */
+  bool use(std::string const &k) {
+    if (k.empty()) return false;
+
+    int &remaining = m_counts[k];
+    bool ret = remaining > 1;
+    if (remaining > 0) remaining--;
+    return ret;
+  }
+
+
+  /**
+   * @param pre  output; assignments to new variables which need to be placed before the current statement
+   */
+  Expr::Ptr rewrite(Expr::Ptr e, Stmts &pre) {
+    std::string k = key(*e);
+    Var var(STANDARD);
+
+    if (!k.empty() && available(k, var)) {
+      use(k);
+      compile_data.num_subexprs_reused++;
+      return mkVar(var);
+    }
+
+    bool repeated = use(k);
+    Expr::Ptr ret = e;
+
+    if (e->tag() == Expr::APPLY) {
+      Expr::Ptr lhs = rewrite(e->lhs(), pre);
+      Expr::Ptr rhs = rewrite(e->rhs(), pre);
+
+      if (lhs != e->lhs() || rhs != e->rhs()) {
+        ret = mkApply(lhs, e->apply_op(), rhs);
+      }
+    } else if (e->tag() == Expr::DEREF) {
+      Expr::Ptr ptr = rewrite(e->deref_ptr(), pre);
+
+      if (ptr != e->deref_ptr()) {
+        ret = mkDeref(ptr);
+      }
+    }
+
+    if (repeated) {
+      Var tmp = VarGen::fresh();
+      pre.push_back(Stmt::create_assign(mkVar(tmp), ret));
+      m_avail[k] = Avail{tmp, 0};
+      return mkVar(tmp);
+    }
+
+    return ret;
+  }
+
+
+  void rewrite_stmt(Stmt &s, Stmts &out) {
+    if (s.tag == Stmt::ASSIGN) {
+      Expr::Ptr lhs = s.assign_lhs();
+      Expr::Ptr rhs = s.assign_rhs();
+
+      if (lhs->tag() == Expr::DEREF) {
+        Expr::Ptr ptr = rewrite(lhs->deref_ptr(), out);
+        if (ptr != lhs->deref_ptr()) {
+          s.assign_lhs(mkDeref(ptr));
+        }
+      }
+
+      std::string k = key(*rhs);
+      Var var(STANDARD);
+
+      if (is_user_var(*lhs) && !available(k, var) && use(k)) {
+        // First occurrence is the entire rhs; the lhs variable can hold the value
+        Expr::Ptr new_rhs = rhs;
+
+        if (rhs->tag() == Expr::APPLY) {
+          Expr::Ptr a = rewrite(rhs->lhs(), out);
+          Expr::Ptr b = rewrite(rhs->rhs(), out);
+          if (a != rhs->lhs() || b != rhs->rhs()) new_rhs = mkApply(a, rhs->apply_op(), b);
+        }
+
+        s.assign_rhs(new_rhs);
+        after_stmt(s);
+        m_avail[k] = Avail{lhs->var(), version(lhs->var().id())};
+        return;
+      }
+
+      s.assign_rhs(rewrite(rhs, out));
+    }
+
+    after_stmt(s);
+  }
+};
+
+
+// ============================================================================
+// Pass: dead assignment elimination
+// ============================================================================
+
+/**
+ * Collect the number of reads for each variable
+ *
+ * Reads of a variable in an assignment to itself, e.g. `x = x + 1`, are not counted.
+ * If those are the only reads, the value of the variable is never used.
+ *
+ * @return false if the statements contain something which is not handled
+ */
+bool count_reads(Stmts &block, std::map<VarId, int> &reads) {
+  VarId self = -1;
+
+  std::function<void(Expr::Ptr)> count = [&count, &reads, &self] (Expr::Ptr e) {
+    switch (e->tag()) {
+      case Expr::VAR:
+        if (e->var().id() != self) reads[e->var().id()]++;
+        break;
+      case Expr::APPLY: count(e->lhs()); count(e->rhs());     break;
+      case Expr::DEREF: count(e->deref_ptr());                 break;
+      default: break;
+    }
+  };
+
+  bool ok = true;
+
+  for (auto &s : block) {
+    self = -1;
+    if (s->tag == Stmt::ASSIGN && is_user_var(*s->assign_lhs())) {
+      self = s->assign_lhs()->var().id();
+    }
+
+    if (!for_exprs(*s, count)) {
+      ok = false;
+      break;
+    }
+
+    for_blocks(*s, [&ok, &reads] (Stmts &b) {
+      if (ok) ok = count_reads(b, reads);
+    });
+
+    if (!ok) break;
+  }
+
+  return ok;
+}
+
+
+int remove_dead(Stmts &block, std::map<VarId, int> const &reads) {
+  int count = 0;
+  Stmts ret;
+
+  for (auto &s : block) {
+    if (s->tag == Stmt::ASSIGN && is_user_var(*s->assign_lhs())
+     && reads.find(s->assign_lhs()->var().id()) == reads.end()
+     && is_pure(*s->assign_rhs())) {
+      count++;
+      continue;
+    }
+
+    for_blocks(*s, [&count, &reads] (Stmts &b) {
+      count += remove_dead(b, reads);
+      ensure_not_empty(b);
+    });
+
+    ret.push_back(s);
+  }
+
+  block = ret;
+  return count;
+}
+
+
+/**
+ * Remove assignments to variables which are never read.
+ *
+ * Repeated until nothing changes, because a removal can make other variables unused.
+ * The kernel output goes through memory, so this only removes unneeded computations.
+ */
+void dead_assign_elimination(Stmts &body) {
+  while (true) {
+    std::map<VarId, int> reads;
+    if (!count_reads(body, reads)) return;  // Unhandled statements present, don't risk it
+
+    int count = remove_dead(body, reads);
+    if (count == 0) break;
+
+    compile_data.num_dead_assigns_removed += count;
+  }
+}
+
+
+// ============================================================================
+// Pass: loop optimization
+// ============================================================================
+
+/**
+ * Count the assignments to standard variables in the given statements, including nested blocks
+ */
+void count_assigns(Stmts &block, std::map<VarId, int> &assigns) {
+  for (auto &s : block) {
+    Expr::Ptr dst;
+
+    if (s->tag == Stmt::ASSIGN) {
+      dst = s->assign_lhs();
+    } else if (s->tag == Stmt::LOAD_RECEIVE) {
+      dst = s->address();  // This is the receiving variable
+    }
+
+    if (dst && dst->tag() == Expr::VAR && dst->var().tag() == STANDARD) {
+      assigns[dst->var().id()]++;
+    }
+
+    for_blocks(*s, [&assigns] (Stmts &b) { count_assigns(b, assigns); });
+  }
+}
+
+
+/**
+ * Apply `f` to the expressions of all assignments in the given statements, including nested blocks.
+ *
+ * `f` returns the replacement for the expression passed in.
+ */
+void rewrite_assigns(Stmts &block, std::function<Expr::Ptr(Expr::Ptr)> f) {
+  for (auto &s : block) {
+    if (s->tag == Stmt::ASSIGN) {
+      Expr::Ptr lhs = s->assign_lhs();
+
+      if (lhs->tag() == Expr::DEREF) {
+        Expr::Ptr ptr = f(lhs->deref_ptr());
+        if (ptr != lhs->deref_ptr()) s->assign_lhs(mkDeref(ptr));
+      }
+
+      s->assign_rhs(f(s->assign_rhs()));
+    }
+
+    for_blocks(*s, [&f] (Stmts &b) { rewrite_assigns(b, f); });
+  }
+}
+
+
+/**
+ * Replace subexpressions of `e` top-down.
+ *
+ * `f` returns the replacement for a subexpression, or nullptr if the subexpression should be descended into.
+ */
+Expr::Ptr replace_top_down(Expr::Ptr e, std::function<Expr::Ptr(Expr::Ptr)> const &f) {
+  Expr::Ptr ret = f(e);
+  if (ret) return ret;
+
+  if (e->tag() == Expr::APPLY) {
+    Expr::Ptr lhs = replace_top_down(e->lhs(), f);
+    Expr::Ptr rhs = replace_top_down(e->rhs(), f);
+    if (lhs != e->lhs() || rhs != e->rhs()) return mkApply(lhs, e->apply_op(), rhs);
+  } else if (e->tag() == Expr::DEREF) {
+    Expr::Ptr ptr = replace_top_down(e->deref_ptr(), f);
+    if (ptr != e->deref_ptr()) return mkDeref(ptr);
+  }
+
+  return e;
+}
+
+
+/**
+ * An expression is invariant in a loop if it is pure and uses no variables which are assigned in the loop
+ *
+ * @param assigns  the variables assigned in the loop
+ */
+bool is_invariant(Expr const &e, std::map<VarId, int> const &assigns) {
+  switch (e.tag()) {
+    case Expr::INT_LIT:
+    case Expr::FLOAT_LIT: return true;
+    case Expr::VAR:
+      if (!is_pure(e.var())) return false;
+      return e.var().tag() != STANDARD || assigns.find(e.var().id()) == assigns.end();
+    case Expr::APPLY:     return is_invariant(*e.lhs(), assigns) && is_invariant(*e.rhs(), assigns);
+    default:              return false;
+  }
+}
+
+
+/**
+ * Loop-invariant code motion and strength reduction.
+ *
+ * `For`-loops have been converted to `While`-loops at this point, with the increment at the end of the body.
+ * Loops are handled innermost first. New statements for a loop are placed directly before the loop.
+ *
+ * **Strength reduction**
+ *
+ * An induction variable is a variable with exactly one assignment in the loop, of the form `i = i + c`,
+ * on the top level of the loop body. Expressions with shifts `i << k` and multiplications `i * m`,
+ * possibly with invariants added, are replaced by a new variable. This is initialized before the loop and
+ * incremented directly after each increment of `i`. Typically, this is address arithmetic.
+ *
+ * Int multiplication is 24-bit on the QPUs; `(i + c)*m == i*m + c*m` only holds if `i` stays within 24 bits.
+ * Multiplications are therefore only reduced if `i` starts at a non-negative literal and increases.
+ *
+ * **Loop-invariant code motion**
+ *
+ * Pure operations which only use variables not assigned in the loop are calculated before the loop.
+ * This is safe even if the loop is never executed, since pure expressions have no side effects.
+ *
+ * Loops within `Where`-blocks are skipped, because statements placed before the loop would be conditional.
+ */
+class LoopOptimizer {
+public:
+  void run(Stmts &block, bool in_where = false) {
+    for (int i = 0; i < (int) block.size(); i++) {
+      Stmt &s = *block[i];
+      bool nested_where = in_where || s.tag == Stmt::WHERE;
+
+      for_blocks(s, [this, nested_where] (Stmts &b) { run(b, nested_where); });
+
+      if (s.tag != Stmt::WHILE || in_where) continue;
+
+      Stmts pre;
+      optimize_loop(block, i, pre);
+      block.insert(block.begin() + i, pre.begin(), pre.end());
+      i += (int) pre.size();
+    }
+  }
+
+private:
+  std::set<VarId> m_hoisted;  // Variables assigned once with a loop invariant
+
+  Var hoist(Expr::Ptr e, Stmts &pre) {
+    Var tmp = VarGen::fresh();
+    pre.push_back(Stmt::create_assign(mkVar(tmp), e));
+    m_hoisted.insert(tmp.id());
+    return tmp;
+  }
+
+
+  void optimize_loop(Stmts &block, int index, Stmts &pre) {
+    Stmts &body = block[index]->body();
+
+    std::map<VarId, int> assigns;
+    count_assigns(body, assigns);
+
+    // Invariants hoisted out of inner loops can move further out
+    Stmts kept;
+    for (auto &s : body) {
+      if (s->tag == Stmt::ASSIGN && is_user_var(*s->assign_lhs())
+       && m_hoisted.count(s->assign_lhs()->var().id()) != 0
+       && is_invariant(*s->assign_rhs(), assigns)) {
+        assigns.erase(s->assign_lhs()->var().id());
+        pre.push_back(s);
+        compile_data.num_invariants_hoisted++;
+        continue;
+      }
+
+      kept.push_back(s);
+    }
+    body = kept;
+    ensure_not_empty(body);
+
+    // Strength reduction; collect first, since the body changes
+    std::vector<Stmt::Ptr> increments;
+    for (auto &s : body) {
+      if (s->tag != Stmt::ASSIGN || !is_user_var(*s->assign_lhs())) continue;
+      if (assigns[s->assign_lhs()->var().id()] != 1) continue;
+      increments.push_back(s);
+    }
+
+    for (auto &inc : increments) {
+      assigns.clear();
+      count_assigns(body, assigns);  // Previous reductions added assignments
+      reduce_strength(block, index, inc, assigns, pre);
+    }
+
+    // Loop-invariant code motion
+    assigns.clear();
+    count_assigns(body, assigns);
+    std::map<std::string, Var> invariants;
+
+    rewrite_assigns(body, [this, &assigns, &invariants, &pre] (Expr::Ptr e) {
+      return replace_top_down(e, [this, &assigns, &invariants, &pre] (Expr::Ptr e) -> Expr::Ptr {
+        if (e->tag() != Expr::APPLY || !is_invariant(*e, assigns)) return nullptr;
+
+        std::string k = pure_key(*e);
+        auto it = invariants.find(k);
+        if (it == invariants.end()) {
+          it = invariants.insert({k, hoist(e, pre)}).first;
+          compile_data.num_invariants_hoisted++;
+        }
+
+        return mkVar(it->second);
+      });
+    });
+  }
+
+
+  /**
+   * @param inc  candidate increment statement for an induction variable, on the top level of the loop body
+   */
+  void reduce_strength(Stmts &block, int index, Stmt::Ptr inc, std::map<VarId, int> const &assigns, Stmts &pre) {
+    Expr::Ptr rhs = inc->assign_rhs();
+    Var iv = inc->assign_lhs()->var();
+
+    if (rhs->tag() != Expr::APPLY || rhs->apply_op().type != INT32) return;
+    if (rhs->apply_op().op != ADD && rhs->apply_op().op != SUB) return;
+    if (rhs->lhs()->tag() != Expr::VAR || rhs->lhs()->var().id() != iv.id()) return;
+    if (rhs->rhs()->tag() != Expr::INT_LIT) return;
+
+    int step = rhs->rhs()->intLit;
+    if (rhs->apply_op().op == SUB) step = (int) (0u - (uint32_t) step);
+
+    bool can_mul = step > 0 && starts_non_negative(block, index, iv);
+
+    auto is_iv = [&iv] (Expr const &x) { return x.tag() == Expr::VAR && x.var().id() == iv.id(); };
+
+    //
+    // Determine the change of an expression for each increment of the induction variable.
+    // This works for additions of invariants and shifts and multiplications of the induction variable.
+    //
+    // `has_op` is set if a shift or multiplication is present, only these are worth replacing.
+    // Returns nullptr if there is no fixed increment.
+    //
+    std::function<Expr::Ptr(Expr::Ptr, bool &)> increment = [&] (Expr::Ptr e, bool &has_op) -> Expr::Ptr {
+      if (is_iv(*e)) return mkIntLit(step);
+      if (e->tag() != Expr::APPLY || e->apply_op().type != INT32) return nullptr;
+
+      Expr::Ptr a = e->lhs();
+      Expr::Ptr b = e->rhs();
+
+      switch (e->apply_op().op) {
+        case ADD:
+          if (is_invariant(*a, assigns)) std::swap(a, b);
+          if (!is_invariant(*b, assigns)) return nullptr;
+          return increment(a, has_op);
+
+        case SUB:
+          if (!is_invariant(*b, assigns)) return nullptr;
+          return increment(a, has_op);
+
+        case SHL: {
+          if (b->tag() != Expr::INT_LIT || b->intLit <= 0 || b->intLit >= 32) return nullptr;
+          Expr::Ptr incr = increment(a, has_op);
+          if (!incr) return nullptr;
+
+          has_op = true;
+          incr = mkApply(incr, e->apply_op(), b);
+          Expr::Ptr folded = fold(*incr);
+          return folded? folded : incr;
+        }
+
+        case MUL: {
+          if (!can_mul) return nullptr;
+          if (!is_iv(*a)) std::swap(a, b);
+          if (!is_iv(*a) || !is_invariant(*b, assigns)) return nullptr;
+
+          has_op = true;
+          Expr::Ptr incr = mkApply(mkIntLit(step), e->apply_op(), b);
+          Expr::Ptr folded = fold(*incr);
+          return folded? folded : incr;
+        }
+
+        default:
+          return nullptr;
+      }
+    };
+
+    std::map<std::string, Var> reduced;
+    Stmts updates;
+
+    rewrite_assigns(block[index]->body(), [&] (Expr::Ptr e) {
+      return replace_top_down(e, [&] (Expr::Ptr e) -> Expr::Ptr {
+        bool has_op = false;
+        Expr::Ptr incr = increment(e, has_op);
+        if (!incr || !has_op) return nullptr;
+
+        std::string k = pure_key(*e);
+        auto it = reduced.find(k);
+        if (it == reduced.end()) {
+          if (!incr->isLit()) incr = mkVar(hoist(incr, pre));
+
+          Var tmp = VarGen::fresh();
+          pre.push_back(Stmt::create_assign(mkVar(tmp), e));
+          updates.push_back(Stmt::create_assign(mkVar(tmp), mkApply(mkVar(tmp), Op(ADD, INT32), incr)));
+          it = reduced.insert({k, tmp}).first;
+          compile_data.num_strength_reductions++;
+        }
+
+        return mkVar(it->second);
+      });
+    });
+
+    if (updates.empty()) return;
+
+    Stmts &body = block[index]->body();
+    auto pos = std::find(body.begin(), body.end(), inc);
+    assert(pos != body.end());
+    body.insert(pos + 1, updates.begin(), updates.end());
+  }
+
+
+  /**
+   * Check if the last assignment to `var` before the loop assigns a non-negative literal.
+   */
+  static bool starts_non_negative(Stmts &block, int index, Var var) {
+    for (int i = index - 1; i >= 0; i--) {
+      Stmt &s = *block[i];
+      if (s.tag != Stmt::ASSIGN) return false;  // Don't bother looking further
+
+      Expr::Ptr lhs = s.assign_lhs();
+      if (lhs->tag() != Expr::VAR || lhs->var().id() != var.id()) continue;
+
+      Expr::Ptr rhs = s.assign_rhs();
+      return rhs->tag() == Expr::INT_LIT && rhs->intLit >= 0;
+    }
+
+    return false;
+  }
+};
+
+
+// ============================================================================
+// Pass: loop unrolling
+// ============================================================================
+
+int const MAX_UNROLLED_STMTS = 256;  // Limit on the number of statements in an unrolled loop body
+
+
+int count_stmts(Stmts &block) {
+  int ret = 0;
+
+  for (auto &s : block) {
+    ret++;
+    for_blocks(*s, [&ret] (Stmts &b) { ret += count_stmts(b); });
+  }
+
+  return ret;
+}
+
+
+BExpr::Ptr substitute(BExpr::Ptr b, std::function<Expr::Ptr(Expr::Ptr)> const &f) {
+  switch (b->tag()) {
+    case NOT: return substitute(b->neg(), f)->Not();
+    case AND: return substitute(b->lhs(), f)->And(substitute(b->rhs(), f));
+    case OR:  return substitute(b->lhs(), f)->Or(substitute(b->rhs(), f));
+    case CMP: return make_node<BExpr>(f(b->cmp_lhs()), b->cmp, f(b->cmp_rhs()));
+  }
+
+  assert(false);
+  return b;
+}
+
+
+/**
+ * Apply `f` to all expressions read by the given statement, including nested statements.
+ *
+ * Conditions are replaced instead of changed, since they may be shared.
+ *
+ * @return false if the statement contains something which is not handled
+ */
+bool substitute(Stmt &s, std::function<Expr::Ptr(Expr::Ptr)> const &f) {
+  switch (s.tag) {
+    case Stmt::ASSIGN: {
+      Expr::Ptr lhs = s.assign_lhs();
+      if (lhs->tag() == Expr::DEREF) s.assign_lhs(mkDeref(f(lhs->deref_ptr())));
+      s.assign_rhs(f(s.assign_rhs()));
+    }
+    break;
+
+    case Stmt::WHERE: s.where_cond(substitute(s.where_cond(), f));                                         break;
+    case Stmt::IF:    s.cond(make_node<CExpr>(s.if_cond()->tag(), substitute(s.if_cond()->bexpr(), f)));     break;
+    case Stmt::WHILE: s.cond(make_node<CExpr>(s.loop_cond()->tag(), substitute(s.loop_cond()->bexpr(), f))); break;
+
+    default: {
+      bool ok = for_exprs(s, [] (Expr::Ptr) {});  // LOAD_RECEIVE only writes to its variable
+      if (!ok) return false;
+    }
+    break;
+  }
+
+  bool ok = true;
+  for_blocks(s, [&ok, &f] (Stmts &b) {
+    for (auto &nested : b) {
+      if (ok) ok = substitute(*nested, f);
+    }
+  });
+
+  return ok;
+}
+
+
+/**
+ * Unroll loops for which this was requested with `ForUnroll`.
+ *
+ * Only loops of the form generated by `For` with an increasing int counter are unrolled:
+ *
+ *     While (any(i < n))            // Also all() and <=
+ *       body
+ *       i = i + c                   // c > 0, only assignment to i in the loop
+ *     End
+ *
+ * where `n` does not change in the loop. For unroll factor k, this becomes:
+ *
+ *     While (any(i + (k-1)*c < n))
+ *       body                        // k copies, i replaced by i + j*c in copy j
+ *       i = i + k*c
+ *     End
+ *     While (any(i < n))            // Remainder, the original loop
+ *       body
+ *       i = i + c
+ *     End
+ *
+ * If the condition of the unrolled loop holds, it would have held for all k iterations of the original loop.
+ * The same statements are therefore executed in the same order; only the branches are fewer.
+ * This also keeps prefetches and receives within the body paired.
+ * It is assumed that `i + (k-1)*c` does not overflow.
+ *
+ * Loops within `Where`-blocks are not unrolled, since the counter would also be changed for disabled lanes.
+ *
+ * Copies of the body do not add variables, but later optimizations may add variables per copy.
+ * To keep code size and register pressure in check, the unrolled body is limited to MAX_UNROLLED_STMTS
+ * statements; the unroll factor is reduced if needed.
+ */
+class Unroller {
+public:
+  void run(Stmts &block, bool in_where = false) {
+    for (int i = 0; i < (int) block.size(); i++) {
+      Stmt &s = *block[i];
+      bool nested_where = in_where || s.tag == Stmt::WHERE;
+
+      for_blocks(s, [this, nested_where] (Stmts &b) { run(b, nested_where); });
+
+      if (s.tag != Stmt::WHILE || s.unroll() == 1) continue;
+
+      int factor = s.unroll();
+      s.unroll(1);  // Remaining loop is not unrolled again
+
+      if (in_where) {
+        warning("Loops within Where-blocks are not unrolled");
+        continue;
+      }
+
+      if (!unroll(block, i, factor)) {
+        std::string msg;
+        msg << "Loop can not be unrolled, it does not have the form of a For-loop with increasing counter:\n"
+            << s.dump();
+        warning(msg);
+        continue;
+      }
+
+      i++;  // Skip the remainder loop
+    }
+  }
+
+private:
+  bool unroll(Stmts &block, int index, int factor) {
+    Stmt &loop = *block[index];
+    Stmts &body = loop.body();
+
+    // The counter increment
+    Stmt::Ptr inc = body.back();
+    if (inc->tag != Stmt::ASSIGN || !is_user_var(*inc->assign_lhs())) return false;
+
+    Var iv = inc->assign_lhs()->var();
+    auto is_iv = [&iv] (Expr const &x) { return x.tag() == Expr::VAR && x.var().id() == iv.id(); };
+
+    Expr::Ptr rhs = inc->assign_rhs();
+    if (rhs->tag() != Expr::APPLY || rhs->apply_op().op != ADD || rhs->apply_op().type != INT32) return false;
+    if (!is_iv(*rhs->lhs()) || rhs->rhs()->tag() != Expr::INT_LIT || rhs->rhs()->intLit <= 0) return false;
+    int step = rhs->rhs()->intLit;
+
+    std::map<VarId, int> assigns;
+    count_assigns(body, assigns);
+    if (assigns[iv.id()] != 1) return false;
+
+    // The loop condition
+    CExpr::Ptr cond = loop.loop_cond();
+    BExpr::Ptr b = cond->bexpr();
+    if (b->tag() != CMP || b->cmp.type() != INT32) return false;
+
+    bool iv_left;
+    switch (b->cmp.op()) {
+      case CmpOp::LT: case CmpOp::LE: iv_left = true;  break;
+      case CmpOp::GT: case CmpOp::GE: iv_left = false; break;
+      default: return false;
+    }
+
+    Expr::Ptr bound = iv_left? b->cmp_rhs() : b->cmp_lhs();
+    if (!is_iv(*(iv_left? b->cmp_lhs() : b->cmp_rhs())) || !is_invariant(*bound, assigns)) return false;
+
+    // Limit the size
+    bool limited = false;
+    int size = count_stmts(body);
+    if (size*factor > MAX_UNROLLED_STMTS) {
+      factor = MAX_UNROLLED_STMTS/size;
+      limited = true;
+      if (factor < 2) return false;
+    }
+
+    // Create the unrolled body
+    Stmts unrolled;
+
+    for (int j = 0; j < factor; j++) {
+      Expr::Ptr offset = mkApply(mkVar(iv), Op(ADD, INT32), mkIntLit(j*step));
+      auto f = [&is_iv, &offset] (Expr::Ptr e) {
+        return replace_top_down(e, [&is_iv, &offset] (Expr::Ptr e) { return is_iv(*e)? offset : nullptr; });
+      };
+
+      for (int n = 0; n + 1 < (int) body.size(); n++) {
+        Stmt::Ptr s = body[n]->clone();
+        if (j > 0 && !substitute(*s, f)) return false;
+        unrolled.push_back(s);
+      }
+    }
+
+    unrolled.push_back(Stmt::create_assign(mkVar(iv), mkApply(mkVar(iv), Op(ADD, INT32), mkIntLit(factor*step))));
+
+    Expr::Ptr last = mkApply(mkVar(iv), Op(ADD, INT32), mkIntLit((factor - 1)*step));
+    auto new_b = iv_left? make_node<BExpr>(last, b->cmp, bound) : make_node<BExpr>(bound, b->cmp, last);
+
+    Stmt::Ptr ret = Stmt::create(Stmt::WHILE);
+    ret->cond(make_node<CExpr>(cond->tag(), new_b));
+    ret->add_block(unrolled);
+
+    std::string msg;
+    msg << "Loop unrolled " << factor << " times";
+    ret->comment(msg);
+
+    block.insert(block.begin() + index, ret);
+
+    compile_data.num_loops_unrolled++;
+    if (limited) compile_data.num_unrolls_limited++;
+    return true;
+  }
+};
+
+}  // anon namespace
+
+
+/**
+ * Machine-independent optimization of the source code.
+ *
+ * Called on the source code of a kernel, before translation to target code.
+ * The passes are run in order:
+ *
+ *   - unrolling of loops, if requested
+ *   - constant folding and algebraic simplification
+ *   - loop-invariant code motion and strength reduction
+ *   - common subexpression elimination
+ *   - dead assignment elimination
+ *
+ * Statistics for each pass are collected in `compile_data`.
+ */
+void optimize(Stmts &body) {
+  Unroller().run(body);
+  fold_block(body);
+  LoopOptimizer().run(body);
+  CSE().run(body);
+  dead_assign_elimination(body);
+}
+
+}  // namespace V3DLib
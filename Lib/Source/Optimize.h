@@ -0,0 +1,11 @@
+#ifndef _V3DLIB_SOURCE_OPTIMIZE_H_
+#define _V3DLIB_SOURCE_OPTIMIZE_H_
+#include "Source/Stmt.h"
+
+namespace V3DLib {
+
+void optimize(Stmts &body);
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_SOURCE_OPTIMIZE_H_
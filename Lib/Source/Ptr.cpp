@@ -89,7 +89,7 @@ void Pointer::inc() {
 
 
 Expr::Ptr Pointer::getUniformPtr() {
-  Expr::Ptr e = std::make_shared<Expr>(Var(UNIFORM, true));
+  Expr::Ptr e = make_node<Expr>(Var(UNIFORM, true));
   return e;
 }
 
@@ -102,7 +102,7 @@ bool Pointer::passParam(IntList &uniforms, BaseSharedArray const *p) {
 
 PointerExpr devnull() {
   assertq(!Platform::compiling_for_vc4(), "devnull() is for v3d only", true);
-  Expr::Ptr e = std::make_shared<Expr>(Var(STANDARD, RSV_DEVNULL));
+  Expr::Ptr e = make_node<Expr>(Var(STANDARD, RSV_DEVNULL));
   return PointerExpr(e);
 }
 
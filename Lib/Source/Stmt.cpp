@@ -27,8 +27,7 @@ void Stmt::init(Tag in_tag) {
 
 void Stmt::append(Array const &rhs) {
   if (tag != SEQ) {
-    Ptr s0;
-    s0.reset(new Stmt(*this));
+    Ptr s0 = make_node<Stmt>(*this);
     auto tmp = Stmt::create(SEQ);
     tmp->m_stmts_a << s0;
     *this = *tmp;
@@ -71,6 +70,20 @@ Expr::Ptr Stmt::assign_rhs() const {
 }
 
 
+void Stmt::assign_lhs(Expr::Ptr e) {
+  assert(tag == ASSIGN);
+  assert(e.get() != nullptr);
+  m_exp_a = e;
+}
+
+
+void Stmt::assign_rhs(Expr::Ptr e) {
+  assert(tag == ASSIGN);
+  assert(e.get() != nullptr);
+  m_exp_b = e;
+}
+
+
 Expr::Ptr Stmt::address() {
   assert(tag == LOAD_RECEIVE);
   assert(m_exp_a.get() != nullptr);
@@ -126,6 +139,15 @@ Stmt::Array const &Stmt::else_block() const {
 }
 
 
+//
+// Non-const versions of the block accessors, for passes which rewrite the statements in place.
+// The checks are the same as for the const versions.
+//
+Stmt::Array &Stmt::then_block() { return const_cast<Array &>(((Stmt const *) this)->then_block()); }
+Stmt::Array &Stmt::else_block() { return const_cast<Array &>(((Stmt const *) this)->else_block()); }
+Stmt::Array &Stmt::body()       { return const_cast<Array &>(((Stmt const *) this)->body()); }
+
+
 /**
  * @return true if block successfully added, false otherwise
  */
@@ -189,6 +211,37 @@ bool Stmt::add_block(Array const &block) {
 }
 
 
+/**
+ * Set the unroll factor for a loop.
+ *
+ * This is a request; the loop is only unrolled if its form allows it, see `optimize()`.
+ */
+void Stmt::unroll(int n) {
+  assertq(tag == FOR || tag == WHILE, "Unroll only valid for FOR and WHILE", true);
+
+  if (n < 1) {
+    error("Unroll factor must be at least 1", true);
+  }
+
+  m_unroll = n;
+}
+
+
+/**
+ * Create a deep copy of this statement.
+ *
+ * Nested statements are copied as well. Expressions are shared, these are never changed in place.
+ */
+Stmt::Ptr Stmt::clone() const {
+  Ptr ret = make_node<Stmt>(*this);
+
+  for (auto &s : ret->m_stmts_a) s = s->clone();
+  for (auto &s : ret->m_stmts_b) s = s->clone();
+
+  return ret;
+}
+
+
 void Stmt::inc(Array const &arr) {
   assertq(tag == FOR, "Inc-statement only valid for FOR", true);
   assert(m_stmts_b.empty());  // Only assign once
@@ -297,7 +350,7 @@ std::string Stmt::disp_intern(bool with_linebreaks, int seq_depth) const {
 
 
 Stmt::Ptr Stmt::create(Tag in_tag) {
-  Ptr ret(new Stmt());
+  Ptr ret = make_node<Stmt>();
   ret->init(in_tag);
   return ret;
 }
@@ -305,7 +358,7 @@ Stmt::Ptr Stmt::create(Tag in_tag) {
 
 Stmt::Ptr Stmt::create(Tag in_tag, Expr::Ptr e0, Expr::Ptr e1) {
   // Intention: assert(!DMA::Stmt::is_dma_tag(in_tag);  - and change default below
-  Ptr ret(new Stmt());
+  Ptr ret = make_node<Stmt>();
   ret->init(in_tag);
 
   switch (in_tag) {
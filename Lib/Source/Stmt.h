@@ -86,14 +86,19 @@ struct Stmt : public InstructionComment {
 
   Expr::Ptr assign_lhs() const;
   Expr::Ptr assign_rhs() const;
+  void assign_lhs(Expr::Ptr e);
+  void assign_rhs(Expr::Ptr e);
   Expr::Ptr address();
   Stmt *first_in_seq() const;
 
   Array const &then_block() const;
+  Array &then_block();
   bool then_block(Array const &in_block);
   Array const &else_block() const;
+  Array &else_block();
   bool add_block(Array const &in_block);
   Array const &body() const;
+  Array &body();
 
   void inc(Array const &arr);
 
@@ -114,6 +119,11 @@ struct Stmt : public InstructionComment {
   void break_point() { m_break_point = true; }
   bool do_break_point() const { return m_break_point; }
 
+  void unroll(int n);
+  int unroll() const { return m_unroll; }
+
+  Ptr clone() const;
+
 private:
   BExpr::Ptr m_where_cond;
 
@@ -126,6 +136,7 @@ private:
   CExpr::Ptr m_cond;
 
   bool m_break_point = false;
+  int  m_unroll      = 1;      // Requested unroll factor, loops only
 
   static Ptr create(Tag in_tag, Ptr s0, Ptr s1);
   void init(Tag in_tag);
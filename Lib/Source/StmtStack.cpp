@@ -6,7 +6,7 @@
 namespace V3DLib {
 namespace {
 
-StmtStack *p_stmtStack = nullptr;
+thread_local StmtStack *p_stmtStack = nullptr;  // Stack of the kernel being compiled in this thread
 
 StmtStack::Ptr tempStack(StackCallback f) {
   StmtStack::Ptr stack;
@@ -287,7 +287,7 @@ void initStack(StmtStack &stmtStack) {
  * Generate a new prefetch label
  */
 int prefetch_label() {
-  static int count = 0;
+  static thread_local int count = 0;
   return ++count;
 }
 
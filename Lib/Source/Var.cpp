@@ -4,7 +4,7 @@
 namespace V3DLib {
 namespace {
 
-int globalVarId = 0;  // Used for fresh variable generation
+thread_local int globalVarId = 0;  // Used for fresh variable generation, per compiling thread
 
 }  // anon namespace
 
@@ -1,19 +1,10 @@
 #include "SourceTranslate.h"
-#include <memory>
 #include "Support/debug.h"
 #include "Support/Platform.h"
 #include "vc4/SourceTranslate.h"
 #include "v3d/SourceTranslate.h"
 #include "Target/instr/Mnemonics.h"
 
-namespace {
-
-std::unique_ptr<V3DLib::ISourceTranslate> _vc4_source_translate;
-std::unique_ptr<V3DLib::ISourceTranslate> _v3d_source_translate;
-
-}  // anon namespace
-
-
 namespace V3DLib {
 
 /**
@@ -68,17 +59,17 @@ Instr::List add_uniform_pointer_offset(Instr::List &code) {
 }
 
 
+/**
+ * The translators have no state, they can be shared by compiling threads.
+ * Initialization of a local static is thread-safe.
+ */
 ISourceTranslate &getSourceTranslate() {
   if (Platform::compiling_for_vc4()) {
-    if (_vc4_source_translate.get() == nullptr) {
-      _vc4_source_translate.reset(new vc4::SourceTranslate());
-    }
-    return *_vc4_source_translate.get();
+    static vc4::SourceTranslate vc4_source_translate;
+    return vc4_source_translate;
   } else {
-    if (_v3d_source_translate.get() == nullptr) {
-      _v3d_source_translate.reset(new v3d::SourceTranslate());
-    }
-    return *_v3d_source_translate.get();
+    static v3d::SourceTranslate v3d_source_translate;
+    return v3d_source_translate;
   }
 }
 
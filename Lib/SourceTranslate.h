@@ -11,6 +11,8 @@ public:
 
   virtual Instr::List load_var(Var &dst, Expr &e);
   virtual Instr::List store_var(Var dst_addr, Var src) = 0;
+  virtual Instr::List spill_load(Reg dst, Instr::List const &addr_code, Reg addr, Reg tmp) = 0;
+  virtual Instr::List spill_store(Reg src, Instr::List const &addr_code, Reg addr, Reg tmp) = 0;
   virtual void regAlloc(Instr::List &instrs) = 0;
   virtual bool stmt(Instr::List &seq, Stmt::Ptr s) = 0;
 };
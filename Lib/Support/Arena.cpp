@@ -0,0 +1,140 @@
+#include "Arena.h"
+#include <cstdint>
+#include "basics.h"
+
+namespace V3DLib {
+
+/**
+ * Current arena of a thread.
+ *
+ * Gives up the arena when the thread ends; the arena stays as long as it has live allocations.
+ */
+struct ArenaHolder {
+  Arena *arena = nullptr;
+
+  ~ArenaHolder() { reset(); }
+
+  void reset() {
+    if (arena != nullptr) arena->release();
+    arena = nullptr;
+  }
+};
+
+namespace {
+
+thread_local ArenaHolder current_arena;
+std::atomic<int> arena_count(0);
+
+}  // anon namespace
+
+
+Arena::Arena() {
+  arena_count++;
+}
+
+
+Arena::~Arena() {
+  for (auto chunk : m_chunks) {
+    delete [] chunk;
+  }
+
+  arena_count--;
+}
+
+
+/**
+ * Allocate a new chunk.
+ *
+ * Large requests get a chunk of their own; the current chunk then remains in use.
+ *
+ * @return the chunk for a large request, nullptr otherwise
+ */
+char *Arena::add_chunk(size_t size) {
+  if (size > CHUNK_SIZE/4) {
+    char *chunk = new char[size];
+    m_chunks.push_back(chunk);
+    return chunk;
+  }
+
+  char *chunk = new char[CHUNK_SIZE];
+  m_chunks.push_back(chunk);
+  m_next = chunk;
+  m_end  = chunk + CHUNK_SIZE;
+  return nullptr;
+}
+
+
+void *Arena::allocate(size_t size, size_t align) {
+  assert(align != 0 && (align & (align - 1)) == 0);
+  assert(align <= alignof(std::max_align_t));  // Chunks from new[] are aligned at least this much
+
+  m_size += size;
+  m_refs.fetch_add(1, std::memory_order_relaxed);
+
+  auto aligned = [align] (char *p) -> char * {
+    auto val = reinterpret_cast<uintptr_t>(p);
+    return reinterpret_cast<char *>((val + align - 1) & ~(uintptr_t) (align - 1));
+  };
+
+  char *ret = (m_next != nullptr)? aligned(m_next) : nullptr;
+
+  if (ret == nullptr || ret + size > m_end) {
+    char *own = add_chunk(size);
+    if (own != nullptr) return own;
+
+    ret = aligned(m_next);
+  }
+
+  m_next = ret + size;
+  return ret;
+}
+
+
+/**
+ * Signal that an allocation is no longer used.
+ *
+ * The memory itself is only released with the arena.
+ */
+void Arena::deallocate() {
+  release();
+}
+
+
+void Arena::release() {
+  if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete this;
+  }
+}
+
+
+/**
+ * Get the arena for new nodes in the current thread
+ */
+Arena &Arena::current() {
+  if (current_arena.arena == nullptr) {
+    current_arena.arena = new Arena();
+  }
+
+  return *current_arena.arena;
+}
+
+
+/**
+ * Start a new arena for the current thread.
+ *
+ * The previous arena is released as soon as all its nodes are gone.
+ */
+void Arena::start_new() {
+  current_arena.reset();
+  current_arena.arena = new Arena();
+}
+
+
+/**
+ * @return number of existing arenas, intended for unit tests
+ */
+int Arena::count() {
+  return arena_count;
+}
+
+}  // namespace V3DLib
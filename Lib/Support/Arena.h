@@ -0,0 +1,93 @@
+#ifndef _V3DLIB_SUPPORT_ARENA_H_
+#define _V3DLIB_SUPPORT_ARENA_H_
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace V3DLib {
+
+/**
+ * Memory arena for the nodes of the source syntax tree.
+ *
+ * Memory is handed out from large chunks by bumping a pointer. It is only released
+ * when the arena itself is destroyed; single deallocations do nothing.
+ *
+ * The nodes are still handled with `std::shared_ptr`, so that the syntax tree can be
+ * shared as before. The arena counts its live allocations, and deletes itself when
+ * the last one is gone and it is no longer current for a thread.
+ * The allocators only hold a plain pointer to the arena; copying a `shared_ptr` to the arena
+ * for each node turned out to be slower than not using an arena at all.
+ *
+ * Each thread has a current arena, which is used for new nodes.
+ * A new arena is started for each compilation (see `KernelDriver::compile()`),
+ * so that the syntax tree of a kernel is released in one go together with the kernel.
+ *
+ * An arena may only be allocated from by the thread for which it is current.
+ */
+class Arena {
+public:
+  Arena(Arena const &) = delete;
+  Arena &operator=(Arena const &) = delete;
+
+  void *allocate(size_t size, size_t align);
+  void deallocate();
+  size_t size() const { return m_size; }
+
+  static Arena &current();
+  static void start_new();
+  static int count();
+
+private:
+  friend struct ArenaHolder;
+  static size_t const CHUNK_SIZE = 64*1024;
+
+  std::vector<char *> m_chunks;
+  char  *m_next = nullptr;
+  char  *m_end  = nullptr;
+  size_t m_size = 0;              // Number of bytes handed out
+  std::atomic<int> m_refs{1};     // Live allocations, plus one while current for a thread
+
+  Arena();
+  ~Arena();
+
+  char *add_chunk(size_t size);
+  void release();
+};
+
+
+/**
+ * STL allocator for an arena, for usage with `std::allocate_shared()`
+ */
+template<typename T>
+class ArenaAllocator {
+public:
+  using value_type = T;
+
+  ArenaAllocator(Arena &arena) : m_arena(&arena) {}
+  template<typename U> ArenaAllocator(ArenaAllocator<U> const &rhs) : m_arena(rhs.arena()) {}
+
+  T *allocate(size_t n) { return static_cast<T *>(m_arena->allocate(n*sizeof(T), alignof(T))); }
+  void deallocate(T *, size_t) { m_arena->deallocate(); }  // Memory is released with the arena
+
+  Arena *arena() const { return m_arena; }
+
+  template<typename U> bool operator==(ArenaAllocator<U> const &rhs) const { return m_arena == rhs.arena(); }
+  template<typename U> bool operator!=(ArenaAllocator<U> const &rhs) const { return m_arena != rhs.arena(); }
+
+private:
+  Arena *m_arena;
+};
+
+
+/**
+ * Create a syntax tree node in the current arena
+ */
+template<typename T, typename... Args>
+std::shared_ptr<T> make_node(Args&&... args) {
+  return std::allocate_shared<T>(ArenaAllocator<T>(Arena::current()), std::forward<Args>(args)...);
+}
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_SUPPORT_ARENA_H_
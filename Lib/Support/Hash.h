@@ -0,0 +1,30 @@
+#ifndef _V3DLIB_SUPPORT_HASH_H_
+#define _V3DLIB_SUPPORT_HASH_H_
+#include <cstddef>
+#include <cstdint>
+
+namespace V3DLib {
+
+uint64_t const FNV_OFFSET = 0xcbf29ce484222325ull;
+
+/**
+ * FNV-1a, 64 bits
+ *
+ * The hash is continued from the passed value, so that it can be built up incrementally.
+ * The byte order of the words is that of the host.
+ */
+inline uint64_t hash_words(uint64_t hash, uint32_t const *words, size_t count) {
+  uint64_t const PRIME = 0x100000001b3ull;
+
+  auto bytes = (uint8_t const *) words;
+  for (size_t i = 0; i < count*sizeof(uint32_t); i++) {
+    hash ^= bytes[i];
+    hash *= PRIME;
+  }
+
+  return hash;
+}
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_SUPPORT_HASH_H_
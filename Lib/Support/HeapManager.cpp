@@ -1,9 +1,22 @@
 #include "HeapManager.h"
-#include "Support/basics.h"  // fatal()
+#include <algorithm>
+#include <cstdio>
+#include "Support/basics.h"
 
 namespace  {
 
-int const INITIAL_FREE_RANGE_SIZE = 32;
+using V3DLib::HeapManager;
+
+int const NUM_SIZE_CLASSES = HeapManager::MAX_SMALL_SIZE/HeapManager::GRANULE;
+
+uint32_t round_up(uint32_t val, uint32_t align) {
+  return (val + align - 1) & ~(align - 1);
+}
+
+
+int size_class(uint32_t block_size) {
+  return (int) (block_size/HeapManager::GRANULE) - 1;
+}
 
 }  // anon namespace
 
@@ -26,24 +39,7 @@ void HeapManager::alloc_mem(uint32_t size_in_bytes) {
 }
 
 
-unsigned HeapManager::FreeRange::size() const {
-  int ret = (int) right - (int) left + 1;
-  assert(ret >= 0);  // empty range will have left + 1 == right
-
-  return (unsigned) ret;
-}
-
-
-std::string HeapManager::FreeRange::dump() const {
-  std::string ret;
-  ret << "[" << left << ", " << right << "]";
-  return ret;
-}
-
-
-HeapManager::HeapManager() {
-  m_free_ranges.reserve(INITIAL_FREE_RANGE_SIZE);
-}
+HeapManager::HeapManager() : m_bins(NUM_SIZE_CLASSES) {}
 
 
 void HeapManager::set_size(uint32_t val) {
@@ -53,79 +49,202 @@ void HeapManager::set_size(uint32_t val) {
 }
 
 
-bool HeapManager::check_available(uint32_t n) {
-  assert(n > 0);
-
-  if (m_offset + n > m_size) {
-    fatal("V3DLib: heap overflow (increase heap size)");  // throws, doesn't return
-    return false;
-  }
-
-  return true;
-}
-
-
 void HeapManager::clear() {
   m_size = 0;
-  m_offset = 0;
-  m_free_ranges.clear();
+  reset();
+  m_high_water   = 0;
+  m_num_allocs   = 0;
+  m_num_deallocs = 0;
 }
 
 
 bool HeapManager::is_cleared() const {
   if  (m_size == 0) {
     assert(m_offset == 0);
-    assert(m_free_ranges.empty());
+    assert(m_free_blocks.empty());
   }
 
   return (m_size == 0);
 }
 
 
+/**
+ * Return the heap to its initial state, all space free.
+ */
+void HeapManager::reset() {
+  m_offset = 0;
+  m_used   = 0;
+
+  for (auto &bin : m_bins) {
+    bin.clear();
+  }
+  m_bin_bytes = 0;
+
+  m_free_blocks.clear();
+  m_free_sizes.clear();
+
+#ifdef DEBUG
+  m_in_use.clear();
+#endif
+}
+
+
 /**
  * @param size_in_bytes number of bytes to allocate
+ * @param alignment     required alignment of the start offset, power of two.
+ *                      Alignments below `GRANULE` are raised to `GRANULE`.
  *
  * @return Start offset into heap if allocated, -1 if could not allocate.
  */
-int HeapManager::alloc_array(uint32_t size_in_bytes) {
+int HeapManager::alloc_array(uint32_t size_in_bytes, uint32_t alignment) {
+  std::lock_guard<std::mutex> lock(m_mutex);
   assert(m_size > 0);
   assert(size_in_bytes > 0);
   assert(size_in_bytes % 4 == 0);
+  assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+  alignment = std::max(alignment, GRANULE);
+  uint32_t block_size = round_up(size_in_bytes, GRANULE);
+  int ret = -1;
 
-  // Find the first available space that is large enough
-  int found_index = -1;
-  for (int i = 0; i < (int) m_free_ranges.size(); ++i) {
-    auto &cur = m_free_ranges[i];
+  if (block_size <= MAX_SMALL_SIZE) {
+    auto &bin = m_bins[size_class(block_size)];
 
-    if (size_in_bytes <= cur.size()) {
-      found_index = i;
-      break;
+    if (!bin.empty() && bin.back() % alignment == 0) {
+      ret = (int) bin.back();
+      bin.pop_back();
+      m_bin_bytes -= block_size;
     }
   }
 
+  if (ret == -1) {
+    ret = alloc_block(block_size, alignment);
+  }
+
+  if (ret == -1 && m_bin_bytes > 0) {
+    flush_bins();
+    ret = alloc_block(block_size, alignment);
+  }
+
+  if (ret == -1) return -1;
+
+  m_used += block_size;
+  m_num_allocs++;
+
+#ifdef DEBUG
+  m_in_use[(uint32_t) ret] = block_size;
+#endif
+
+  return ret;
+}
+
+
+/**
+ * Get space from the free blocks in the tree, or from above the top.
+ *
+ * The smallest fitting free block is used, the remainder is returned to the tree.
+ * For alignments above `GRANULE`, subsequent larger blocks may need to be examined.
+ *
+ * @return Start offset of block if found, -1 otherwise.
+ */
+int HeapManager::alloc_block(uint32_t size, uint32_t alignment) {
+  for (auto it = m_free_sizes.lower_bound({size, 0}); it != m_free_sizes.end(); ++it) {
+    uint32_t offset  = it->second;
+    uint32_t end     = offset + it->first;
+    uint32_t aligned = round_up(offset, alignment);
+
+    if (aligned + size > end) continue;
+
+    remove_free(m_free_blocks.find(offset));
+    if (aligned > offset)    add_free(offset, aligned - offset);
+    if (aligned + size < end) add_free(aligned + size, end - (aligned + size));
+    return (int) aligned;
+  }
+
+  // Nothing suitable in the tree, take from above the top
+  uint32_t aligned = round_up(m_offset, alignment);
+  if (aligned + size > m_size) return -1;
+
+  if (aligned > m_offset) {
+    add_free(m_offset, aligned - m_offset);  // Alignment padding; no free block ends at the top
+  }
+
+  m_offset = aligned + size;
+  m_high_water = std::max(m_high_water, m_offset);
+  return (int) aligned;
+}
+
+
+void HeapManager::add_free(uint32_t offset, uint32_t size) {
+  m_free_blocks[offset] = size;
+  m_free_sizes.insert({size, offset});
+}
 
-  if (found_index == -1) {
-    // Didn't find a freed location, reserve from the end
-    if (!check_available(size_in_bytes)) {
-      return -1;
+
+void HeapManager::remove_free(std::map<uint32_t, uint32_t>::iterator it) {
+  assert(it != m_free_blocks.end());
+  m_free_sizes.erase({it->second, it->first});
+  m_free_blocks.erase(it);
+}
+
+
+/**
+ * Add a block to the tree, coalescing it with free neighbours.
+ *
+ * A block which ends up at the top lowers the top instead.
+ */
+void HeapManager::free_block(uint32_t offset, uint32_t size) {
+  auto next = m_free_blocks.lower_bound(offset);
+
+#ifdef DEBUG
+  if (next != m_free_blocks.end() && next->first < offset + size) {
+    std::string msg;
+    msg << "HeapManager::dealloc_array(): range to deallocate at " << offset
+        << " overlaps with free block at " << next->first;
+    assertq(msg, true);
+  }
+#endif
+
+  if (next != m_free_blocks.end() && next->first == offset + size) {
+    size += next->second;
+    auto tmp = next++;
+    remove_free(tmp);
+  }
+
+  if (next != m_free_blocks.begin()) {
+    auto prev = std::prev(next);
+    assert(prev->first + prev->second <= offset);
+
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size  += prev->second;
+      remove_free(prev);
     }
+  }
 
-    uint32_t prev_offset = m_offset;
-    m_offset += size_in_bytes;
-    return (int) prev_offset;
+  if (offset + size == m_offset) {
+    m_offset = offset;
+  } else {
+    add_free(offset, size);
   }
+}
 
-  int ret = -1;
 
-  auto &cur = m_free_ranges[found_index];
-  ret = cur.left;
-  cur.left += size_in_bytes;
-  if (cur.empty()) {
-    // remove from list
-    m_free_ranges.erase(m_free_ranges.begin() + found_index);
+/**
+ * Move all free blocks in the size classes to the tree, so that they can be coalesced.
+ */
+void HeapManager::flush_bins() {
+  for (int i = 0; i < (int) m_bins.size(); ++i) {
+    uint32_t block_size = (uint32_t) (i + 1)*GRANULE;
+
+    for (auto offset : m_bins[i]) {
+      free_block(offset, block_size);
+    }
+
+    m_bins[i].clear();
   }
 
-  return ret;
+  m_bin_bytes = 0;
 }
 
 
@@ -135,122 +254,125 @@ int HeapManager::alloc_array(uint32_t size_in_bytes) {
  * This should be called from deallocating SharedArray instances, which allocated
  * from this BO.
  *
- * The goal is to detect if the entire BO is free of use. When that's the case, the
- * allocated size can be reset and the BO can be reused from scratch.
- *
- * Better would be to reuse empty spaces if possible; I'm pushing this ahead of me for now.
- * TODO Examine this
+ * When the entire BO is free of use, it is reset and reused from scratch.
  *
  * @param index  index of memory range to deallocate
- * @param size   number of bytes to deallocate
+ * @param size   number of bytes to deallocate, as passed to `alloc_array()`
  */
 void HeapManager::dealloc_array(uint32_t index, uint32_t size) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  assert(m_size > 0);
   assert(size > 0);
   assert((index + size - 1) < m_size);
+  assert(index % GRANULE == 0);
 
-  dealloc_array(FreeRange(index, index + size -1));
-}
-
-
-void HeapManager::dealloc_array(FreeRange const in_range) {
-  assert(m_size > 0);
+  uint32_t block_size = round_up(size, GRANULE);
 
 #ifdef DEBUG
-  // Check if incoming range is already deallocated
-  for (int i = 0; i < (int) m_free_ranges.size(); ++i) {
-    auto &cur = m_free_ranges[i];
+  {
+    auto it = m_in_use.find(index);
+    if (it == m_in_use.end() || it->second != block_size) {
+      std::string msg;
+      msg << "HeapManager::dealloc_array(): range to deallocate at " << index
+          << " with size " << size << " is not an allocated block";
+      assertq(msg, true);
+    }
+    m_in_use.erase(it);
+  }
+#endif
 
-    if (!cur.overlaps(in_range)) continue;
+  assert(m_used >= block_size);
+  m_used -= block_size;
+  m_num_deallocs++;
 
-    std::string msg;
-    msg << "HeapManager::dealloc_array(): "
-        << "range to deallocate " << in_range.dump() << " "
-        << "overlaps with free range " << cur.dump();
-    assertq(msg, true);
+  if (m_used == 0) {
+    reset();  // We're done, reset the buffer
+    return;
   }
-#endif
 
-  // Find adjacent matches in current free range list
-  int left_match_index  = -1;
-  int right_match_index = -1;
+  if (block_size <= MAX_SMALL_SIZE) {
+    m_bins[size_class(block_size)].push_back(index);
+    m_bin_bytes += block_size;
+  } else {
+    free_block(index, block_size);
+  }
+}
 
-  for (int i = 0; i < (int) m_free_ranges.size(); ++i) {
-    auto &cur = m_free_ranges[i];
 
-    if (in_range.right + 1 == cur.left) {
-      assert(right_match_index == -1);  // Expecting at most one match
-      right_match_index = i;
-    }
+/**
+ * @return number of free blocks below the top
+ */
+uint32_t HeapManager::num_free_ranges() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
 
-    if (in_range.left == cur.right + 1) {
-      assert(left_match_index == -1); // At most one match
-      left_match_index = i;
-    }
+  uint32_t ret = (uint32_t) m_free_blocks.size();
+
+  for (auto const &bin : m_bins) {
+    ret += (uint32_t) bin.size();
   }
 
+  return ret;
+}
 
-  if (left_match_index != -1) {
-    if (right_match_index != -1) {
-      // Both sides match
-      assert(left_match_index != right_match_index);
 
-      // Merge the three ranges to one
-      m_free_ranges[left_match_index].right = m_free_ranges[right_match_index].right;
+/**
+ * Ratio of free space which is not part of the largest contiguous free block.
+ *
+ * 0 means no fragmentation, values close to 1 mean that the free space is scattered.
+ */
+float HeapManager::Stats::fragmentation() const {
+  if (free() == 0) return 0.0f;
+  return 1.0f - ((float) largest_free)/((float) free());
+}
 
-      // Move the last range to the one we want to delete
-      auto tmp = m_free_ranges.back();
-      m_free_ranges.pop_back();
-      if (right_match_index != (int) m_free_ranges.size()) {
-        m_free_ranges[right_match_index] = tmp;
-      } else {
-      }
 
-    } else {
-      // Only left side matches
-      m_free_ranges[left_match_index].right = in_range.right;
-    }
-  } else if (right_match_index != -1) {
-    // Only right side matches
-      m_free_ranges[right_match_index].left = in_range.left;
-  } else {
-    // No match, add given range to list
-    m_free_ranges.push_back(in_range);
+HeapManager::Stats HeapManager::stats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Stats ret;
 
-    assert(m_free_ranges.size() < INITIAL_FREE_RANGE_SIZE);  // Warn me when this ever happens
-                                                             // (possible, currently not likely)
+  ret.size         = m_size;
+  ret.used         = m_used;
+  ret.top          = m_offset;
+  ret.high_water   = m_high_water;
+  ret.free_binned  = m_bin_bytes;
+  ret.largest_free = m_size - m_offset;
+  ret.num_free     = (uint32_t) m_free_blocks.size();
+  ret.num_allocs   = m_num_allocs;
+  ret.num_deallocs = m_num_deallocs;
+
+  for (auto const &item : m_free_blocks) {
+    ret.free_tree += item.second;
   }
 
-  // When fully deallocated, there should be one single range of the entire used space
-  bool is_empty = false;
-  if (m_free_ranges.size() == 1) {
-    auto &tmp = m_free_ranges.front();
-    is_empty = (tmp.left == 0) && (tmp.right == m_offset - 1);
+  if (!m_free_sizes.empty()) {
+    ret.largest_free = std::max(ret.largest_free, m_free_sizes.rbegin()->first);
   }
 
-  if (is_empty) {
-    // We're done, reset the buffer
-    assert(m_offset > 0);  // paranoia
-    m_offset = 0;          // yes, it's that simple
-    m_free_ranges.clear();
-    //debug("BufferObject empty again!");
+  for (auto const &bin : m_bins) {
+    ret.num_free += (uint32_t) bin.size();
   }
+
+  return ret;
 }
 
 
 std::string HeapManager::dump() const {
-  std::string ret;
+  auto s = stats();
 
-  uint32_t used_size = m_offset;
-
-  for (int i = 0; i < (int) m_free_ranges.size(); i++) {
-    auto const &item = m_free_ranges[i];
-    used_size -= item.size();
-  }
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%.1f%%", 100.0f*s.fragmentation());
 
+  std::string ret;
   ret << "HeapManager Usage\n"
       << "-----------------\n"
-      << "  Size/used      : " << size() << ", " << used_size << "\n"
-      << "  Num free ranges: " << num_free_ranges() << "\n";
+      << "  Size/used      : " << s.size << ", " << s.used << "\n"
+      << "  Top/high water : " << s.top << ", " << s.high_water << "\n"
+      << "  Free binned    : " << s.free_binned << "\n"
+      << "  Free in tree   : " << s.free_tree << "\n"
+      << "  Largest free   : " << s.largest_free << "\n"
+      << "  Fragmentation  : " << buf << "\n"
+      << "  Num free ranges: " << s.num_free << "\n"
+      << "  Allocs/deallocs: " << s.num_allocs << ", " << s.num_deallocs << "\n";
 
   return ret;
 }
@@ -1,6 +1,9 @@
 #ifndef _V3DLIB_SUPPORT_HEAPMANAGER_H_
 #define _V3DLIB_SUPPORT_HEAPMANAGER_H_
 #include <stdint.h>
+#include <map>
+#include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -10,23 +13,62 @@ namespace V3DLib {
  * Memory manager for controlled heap objects.
  *
  * Keeps track of allocated and freed memory, handles space allocation.
+ * Allocation and deallocation can be called from multiple threads.
+ *
+ * The administration is kept apart from the managed memory, which is typically shared with the GPU.
+ *
+ * Blocks are handed out in multiples of `GRANULE` bytes, aligned on at least `GRANULE` bytes.
+ * Freed memory is kept in two ways:
+ *
+ * - small blocks (up to `MAX_SMALL_SIZE`) go to a free list per size class.
+ *   These are reused as is for the same size class, in O(1). They are not coalesced,
+ *   unless an allocation can not be satisfied otherwise (see `flush_bins()`).
+ * - large blocks go to a tree ordered by offset, in which they are coalesced with free neighbours.
+ *   An index by size is used to find the best fitting block, in O(log n).
+ *
+ * Space above the highest used block (`m_offset`) is free and handed out when nothing fits.
+ * When everything is deallocated, the heap is reset to its initial state.
+ * If there is no space at all, allocation fails; the caller decides what to do (see `BufferObject`).
  */
 class HeapManager {
 public:
+  static constexpr uint32_t GRANULE        = 16;    // Minimum alignment and size unit of blocks
+  static constexpr uint32_t MAX_SMALL_SIZE = 4096;  // Largest block size handled by the size classes
+
+  /**
+   * Usage statistics, all sizes in bytes
+   */
+  struct Stats {
+    uint32_t size          = 0;
+    uint32_t used          = 0;  // Total size of the allocated blocks
+    uint32_t top           = 0;  // End of the highest allocated block
+    uint32_t high_water    = 0;  // Highest value of `top` since the heap was set up
+    uint32_t free_binned   = 0;  // Total size of the free blocks in the size classes
+    uint32_t free_tree     = 0;  // Total size of the free large blocks below `top`
+    uint32_t largest_free  = 0;  // Largest contiguous free space, including the space above `top`
+    uint32_t num_free      = 0;  // Number of free blocks below `top`
+    uint32_t num_allocs    = 0;
+    uint32_t num_deallocs  = 0;
+
+    uint32_t free() const { return size - used; }
+    float fragmentation() const;
+  };
+
   HeapManager();
   HeapManager(HeapManager *object) = delete;
 
   void alloc(uint32_t size_in_bytes);
   uint32_t size() const { return m_size; }
   bool empty() const { return m_offset == 0; }
+  Stats stats() const;
   std::string dump() const;
 
   // Intended for unit tests
-  uint32_t num_free_ranges() const { return (uint32_t) m_free_ranges.size(); }
+  uint32_t num_free_ranges() const;
 
 protected:
   virtual void alloc_mem(uint32_t size_in_bytes);
-  int alloc_array(uint32_t size_in_bytes);
+  int alloc_array(uint32_t size_in_bytes, uint32_t alignment = GRANULE);
   void dealloc_array(uint32_t index, uint32_t size);
   void set_size(uint32_t val);
   void clear();
@@ -38,27 +80,30 @@ private:
   void operator=(HeapManager& a);
 
   uint32_t m_size   = 0;  // Total allocated size of derived heap/buffer object
-  uint32_t m_offset = 0;
+  uint32_t m_offset = 0;  // End of the highest allocated block, everything above is free
+  uint32_t m_used   = 0;
 
-  struct FreeRange {
-    uint32_t left  = 0;
-    uint32_t right = 0;
+  std::vector<std::vector<uint32_t>>    m_bins;         // Offsets of free small blocks, per size class
+  uint32_t                              m_bin_bytes = 0;
+  std::map<uint32_t, uint32_t>          m_free_blocks;  // Free large blocks, offset -> size
+  std::set<std::pair<uint32_t, uint32_t>> m_free_sizes; // Same blocks as (size, offset), for best fit
 
-    FreeRange(uint32_t l, uint32_t r) : left(l), right(r) {}  // required by std::vector
-    unsigned size() const;
-    bool empty() const { return size() == 0; }
+  uint32_t m_high_water   = 0;
+  uint32_t m_num_allocs   = 0;
+  uint32_t m_num_deallocs = 0;
 
-    bool overlaps(FreeRange const &rhs) const {
-      return !(rhs.left > right || rhs.right < left);
-    }
-
-    std::string dump() const;
-  };
+#ifdef DEBUG
+  std::map<uint32_t, uint32_t> m_in_use;  // Allocated blocks, offset -> size
+#endif
 
-  std::vector<FreeRange> m_free_ranges;
+  mutable std::mutex m_mutex;
 
-  bool check_available(uint32_t n);
-  void dealloc_array(FreeRange const in_range);
+  int alloc_block(uint32_t size, uint32_t alignment);
+  void add_free(uint32_t offset, uint32_t size);
+  void remove_free(std::map<uint32_t, uint32_t>::iterator it);
+  void free_block(uint32_t offset, uint32_t size);
+  void flush_bins();
+  void reset();
 };
 
 }  // namespace V3DLib
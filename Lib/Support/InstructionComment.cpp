@@ -2,21 +2,36 @@
 #include "Support/basics.h"
 
 namespace V3DLib {
+namespace {
 
-void InstructionComment::transfer_comments(InstructionComment const &rhs) {
-  if (!rhs.header().empty()) {
-    header(rhs.header());
-  }
+std::string const empty_string;
 
-  if (!rhs.comment().empty()) {
-    comment(rhs.comment());
-  }
+}  // anon namespace
+
+
+std::string const &InstructionComment::header() const {
+  return (m_header == nullptr)? empty_string : *m_header;
+}
+
+
+std::string const &InstructionComment::comment() const {
+  return (m_comment == nullptr)? empty_string : *m_comment;
 }
 
 
-void InstructionComment::clear_comments() {
-  m_header.clear();
-  m_comment.clear();
+void InstructionComment::transfer_comments(InstructionComment const &rhs) {
+  if (rhs.m_header) {
+    assertq(m_header == nullptr, "Header comment already has a value when setting it", true);
+    m_header = rhs.m_header;
+  }
+
+  if (rhs.m_comment) {
+    if (m_comment == nullptr) {
+      m_comment = rhs.m_comment;  // Share the string
+    } else {
+      comment(rhs.comment());
+    }
+  }
 }
 
 
@@ -27,10 +42,11 @@ void InstructionComment::clear_comments() {
  */
 void InstructionComment::header(std::string const &msg) {
   if (msg.empty()) return;
-  assertq(m_header.empty(), "Header comment already has a value when setting it", true);
+  assertq(m_header == nullptr, "Header comment already has a value when setting it", true);
 
-  m_header = msg;
-  findAndReplaceAll(m_header, "\n", "\n# ");
+  std::string tmp = msg;
+  findAndReplaceAll(tmp, "\n", "\n# ");
+  m_header = std::make_shared<std::string const>(std::move(tmp));
 }
 
 
@@ -46,16 +62,16 @@ void InstructionComment::comment(std::string msg) {
 
   findAndReplaceAll(msg, "\n", "\n# ");
 
-  if (!m_comment.empty()) {
-    m_comment += "; ";
+  if (m_comment != nullptr) {
+    msg = *m_comment + "; " + msg;
   }
 
-  m_comment += msg;
+  m_comment = std::make_shared<std::string const>(std::move(msg));
 }
 
 
 std::string InstructionComment::emit_header() const {
-  if (m_header.empty()) return "";
+  if (m_header == nullptr) return "";
 
   std::string ret;
   ret << "\n# " << header() << "\n";
@@ -71,14 +87,14 @@ std::string InstructionComment::emit_header() const {
  * @param instr_size  size of the associated instruction in bytes
  */
 std::string InstructionComment::emit_comment(int instr_size) const {
-  if (m_comment.empty()) return "";
+  if (m_comment == nullptr) return "";
 
   const int COMMENT_INDENT = 60;
   int spaces = COMMENT_INDENT - instr_size;
   if (spaces < 2) spaces = 2;
 
   std::string ret;
-  ret << tabs(spaces) << "# " << m_comment;
+  ret << tabs(spaces) << "# " << *m_comment;
   return ret;
 }
 
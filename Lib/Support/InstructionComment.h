@@ -1,18 +1,22 @@
 #ifndef _LIB_COMMON_INSTRUCTIONCOMMENT_H
 #define _LIB_COMMON_INSTRUCTIONCOMMENT_H
+#include <memory>
 #include <string>
 
 namespace V3DLib {
 
 /**
  * Mixin for instruction comments
+ *
+ * The comment strings are immutable and shared between copies, which keeps instructions
+ * and statements cheap to copy. A string is released when the last instruction using it is gone.
  */
 class InstructionComment {
 public:
   void transfer_comments(InstructionComment const &rhs);
-  void clear_comments();
-  std::string const &header() const { return m_header; }
-  std::string const &comment() const { return m_comment; }
+  void clear_comments() { m_header = nullptr; m_comment = nullptr; }
+  std::string const &header() const;
+  std::string const &comment() const;
 
   std::string emit_header() const;
   std::string emit_comment(int instr_size) const;
@@ -22,8 +26,8 @@ protected:
   void comment(std::string msg);
 
 private:
-  std::string m_header;
-  std::string m_comment;
+  std::shared_ptr<std::string const> m_header;   // nullptr if no header
+  std::shared_ptr<std::string const> m_comment;  // nullptr if no comment
 };
 
 }  // namespace V3DLib
@@ -170,7 +170,6 @@ public:
 
   bool is_pi_platform;
   bool m_use_main_memory   = false;
-  bool m_compiling_for_vc4 = true;
 
   std::string output() const;
 };
@@ -224,17 +223,16 @@ std::string PlatformInfo::output() const {
 
 // Defined like this to delay the creation of the instance after program init,
 // So that other globals get the chance to use it on program init.
-std::unique_ptr<PlatformInfo> local_instance;
-
-
+// Initialization of a local static is thread-safe.
 PlatformInfo &instance() {
-  if (!local_instance) {
-    local_instance.reset(new PlatformInfo);
-  }
-
-  return *local_instance;
+  static PlatformInfo local_instance;
+  return local_instance;
 }
 
+
+// Target platform is per thread, so that kernels for both platforms can be compiled in parallel
+thread_local bool target_is_vc4 = true;
+
 }  // anon namespace
 
 
@@ -262,9 +260,9 @@ void Platform::use_main_memory(bool val) {
  * This is distinct from the platform we are actually running on.
  * The compilation can occur on any platform, including non-pi.
  */
-void Platform::compiling_for_vc4(bool val) { instance().m_compiling_for_vc4 = val; }
+void Platform::compiling_for_vc4(bool val) { target_is_vc4 = val; }
 
-bool Platform::compiling_for_vc4() { return instance().m_compiling_for_vc4; }
+bool Platform::compiling_for_vc4() { return target_is_vc4; }
 bool Platform::use_main_memory()   { return instance().m_use_main_memory; }
 std::string Platform::platform_info() { return instance().output(); }
 bool Platform::is_pi_platform()    { return instance().is_pi_platform; }
@@ -0,0 +1,146 @@
+#include "RegBitSet.h"
+#include "basics.h"
+
+namespace V3DLib {
+
+///////////////////////////////////////////////////////////////////////////////
+// Class RegBitSet::const_iterator
+///////////////////////////////////////////////////////////////////////////////
+
+RegBitSet::const_iterator::const_iterator(RegBitSet const &set, int word) :
+  m_set(set),
+  m_word(word),
+  m_bits((word < (int) set.m_words.size())? set.m_words[word] : 0)
+{
+  skip_empty();
+}
+
+
+RegBitSet::const_iterator &RegBitSet::const_iterator::operator++() {
+  m_bits &= m_bits - 1;  // Clear lowest bit
+  skip_empty();
+  return *this;
+}
+
+
+void RegBitSet::const_iterator::skip_empty() {
+  int const num_words = (int) m_set.m_words.size();
+
+  while (m_bits == 0 && m_word < num_words) {
+    m_word++;
+    if (m_word < num_words) m_bits = m_set.m_words[m_word];
+  }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Class RegBitSet
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Set the number of id's which can be stored.
+ *
+ * The set is cleared.
+ */
+void RegBitSet::resize(int size) {
+  assert(size >= 0);
+  m_size = size;
+  m_words.assign((size + 63)/64, 0);
+}
+
+
+void RegBitSet::clear() {
+  for (auto &w : m_words) w = 0;
+}
+
+
+bool RegBitSet::empty() const {
+  for (auto w : m_words) {
+    if (w != 0) return false;
+  }
+
+  return true;
+}
+
+
+int RegBitSet::count() const {
+  int ret = 0;
+
+  for (auto w : m_words) {
+    ret += __builtin_popcountll(w);
+  }
+
+  return ret;
+}
+
+
+/**
+ * Union with given set.
+ *
+ * @return true if this set changed, false otherwise
+ */
+bool RegBitSet::add(RegBitSet const &rhs) {
+  assert(m_size == rhs.m_size);
+  uint64_t changed = 0;
+
+  for (int i = 0; i < (int) m_words.size(); i++) {
+    uint64_t prev = m_words[i];
+    m_words[i] |= rhs.m_words[i];
+    changed |= prev ^ m_words[i];
+  }
+
+  return (changed != 0);
+}
+
+
+/**
+ * Difference with given set.
+ */
+void RegBitSet::remove(RegBitSet const &rhs) {
+  assert(m_size == rhs.m_size);
+
+  for (int i = 0; i < (int) m_words.size(); i++) {
+    m_words[i] &= ~rhs.m_words[i];
+  }
+}
+
+
+/**
+ * Add the items of `rhs` which are not in `exclude`.
+ *
+ * This is the combined form of the usual dataflow step `this += (rhs - exclude)`.
+ *
+ * @return true if this set changed, false otherwise
+ */
+bool RegBitSet::add_diff(RegBitSet const &rhs, RegBitSet const &exclude) {
+  assert(m_size == rhs.m_size && m_size == exclude.m_size);
+  uint64_t changed = 0;
+
+  for (int i = 0; i < (int) m_words.size(); i++) {
+    uint64_t prev = m_words[i];
+    m_words[i] |= rhs.m_words[i] & ~exclude.m_words[i];
+    changed |= prev ^ m_words[i];
+  }
+
+  return (changed != 0);
+}
+
+
+/**
+ * Same output format as `RegIdSet::dump()`
+ */
+std::string RegBitSet::dump() const {
+  std::string ret;
+
+  ret << "(";
+
+  for (auto reg : *this) {
+    ret << reg << ", ";
+  }
+
+  ret << ")";
+
+  return ret;
+}
+
+}  // namespace V3DLib
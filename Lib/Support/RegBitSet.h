@@ -0,0 +1,72 @@
+#ifndef _LIB_SUPPORT_REGBITSET_H
+#define _LIB_SUPPORT_REGBITSET_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace V3DLib {
+
+/**
+ * Dense set of register id's, stored as a bit vector.
+ *
+ * Intended for the liveness analysis, where the sets are combined very often.
+ * Union and difference are done one 64-bit word at a time.
+ *
+ * The id's in the set must be in the range `0..size() - 1`.
+ * Binary operations require both sets to have the same size.
+ */
+class RegBitSet {
+public:
+
+  /**
+   * Iterates over the id's in the set, in ascending order
+   */
+  class const_iterator {
+  public:
+    const_iterator(RegBitSet const &set, int word);
+
+    int operator*() const { return m_word*64 + __builtin_ctzll(m_bits); }
+    const_iterator &operator++();
+    bool operator!=(const_iterator const &rhs) const { return m_word != rhs.m_word || m_bits != rhs.m_bits; }
+
+  private:
+    RegBitSet const &m_set;
+    int      m_word;
+    uint64_t m_bits;
+
+    void skip_empty();
+  };
+
+  RegBitSet(int size = 0) { resize(size); }
+
+  void resize(int size);
+  int size() const { return m_size; }
+  void clear();
+  bool empty() const;
+  int count() const;
+
+  void insert(int id) { m_words[id >> 6] |=  bit(id); }
+  void remove(int id) { m_words[id >> 6] &= ~bit(id); }
+  bool member(int id) const { return (m_words[id >> 6] & bit(id)) != 0; }
+
+  bool add(RegBitSet const &rhs);
+  void remove(RegBitSet const &rhs);
+  bool add_diff(RegBitSet const &rhs, RegBitSet const &exclude);
+
+  bool operator==(RegBitSet const &rhs) const { return m_words == rhs.m_words; }
+
+  const_iterator begin() const { return const_iterator(*this, 0); }
+  const_iterator end() const   { return const_iterator(*this, (int) m_words.size()); }
+
+  std::string dump() const;
+
+private:
+  int m_size = 0;
+  std::vector<uint64_t> m_words;
+
+  static uint64_t bit(int id) { return ((uint64_t) 1) << (id & 63); }
+};
+
+}  // namespace V3DLib
+
+#endif  // _LIB_SUPPORT_REGBITSET_H
@@ -1,6 +1,8 @@
 #include "BufferObject.h"
 #include <cassert>
 #include <memory>
+#include <new>
+#include <mutex>
 #include <cstdio>
 #include "../Support/basics.h"
 #include "../Support/debug.h"
@@ -13,6 +15,10 @@ namespace {
 
 // Defined as a smart ptr to avoid issues on program init
 std::unique_ptr<BufferObject> emuHeap;
+std::mutex heap_mutex;
+
+// Same alignment as the device buffer objects, so that array alignment carries over to the addresses
+std::align_val_t const HEAP_ALIGNMENT = std::align_val_t(4096);
 
 }
 
@@ -23,18 +29,65 @@ std::unique_ptr<BufferObject> emuHeap;
 void BufferObject::alloc_mem(uint32_t size_in_bytes) {
   assert(arm_base  == nullptr);
 
-  arm_base = new uint8_t [size_in_bytes];
+  arm_base = static_cast<uint8_t *>(::operator new[](size_in_bytes, HEAP_ALIGNMENT));
   set_size(size_in_bytes);
 }
 
 
-uint32_t BufferObject::alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address) {
+/**
+ * There are no physical addresses in main memory, so these are assigned to the segments here.
+ * The initial segment starts at 0, the following segments come after it.
+ */
+V3DLib::BufferObject *BufferObject::new_segment(uint32_t size_in_bytes) {
+  auto *ret = new BufferObject();
+  ret->alloc(size_in_bytes);
+  ret->set_phy_address(next_phy_address(size_in_bytes));
+  return ret;
+}
+
+
+/**
+ * Main memory can be used as is.
+ */
+V3DLib::BufferObject *BufferObject::import_segment(uint8_t *mem, uint32_t size_in_bytes) {
+  auto *ret = new BufferObject();
+  ret->m_external = true;
+  ret->arm_base = mem;
+  ret->set_size(size_in_bytes);
+  ret->set_phy_address(next_phy_address(size_in_bytes));
+  return ret;
+}
+
+
+/**
+ * Physical address for a new segment, page aligned
+ */
+uint32_t BufferObject::next_phy_address(uint32_t size_in_bytes) const {
+  uint64_t const PAGE_SIZE = 4096;
+  uint64_t ret = (end_phy_address() + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  assertq(ret + size_in_bytes <= UINT32_MAX, "emu::BufferObject: out of physical address space");
+  return (uint32_t) ret;
+}
+
+
+void BufferObject::dealloc() {
+  if (!m_external) {
+    ::operator delete[](arm_base, HEAP_ALIGNMENT);
+  }
+
+  arm_base = nullptr;
+}
+
+
+uint32_t BufferObject::alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address, uint32_t alignment) {
   assert(arm_base != nullptr);
-  return Parent::alloc_array(size_in_bytes, array_start_address);
+  return Parent::alloc_array(size_in_bytes, array_start_address, alignment);
 }
 
 
 BufferObject &BufferObject::getHeap() {
+  std::lock_guard<std::mutex> lock(heap_mutex);
+
   if (!emuHeap) {
     //debug("Allocating emu heap v3d\n");
     emuHeap.reset(new BufferObject());
@@ -11,14 +11,19 @@ class BufferObject : public V3DLib::BufferObject {
 public:
   ~BufferObject() { dealloc(); }
 
-  uint32_t alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address);
+  uint32_t alloc_array(uint32_t size_in_bytes, uint8_t *&array_start_address, uint32_t alignment = GRANULE);
 
   const BufferType buftype = HeapBuffer;
   static BufferObject &getHeap();
 
 private:
   void alloc_mem(uint32_t size_in_bytes) override;
-  void dealloc() { delete [] arm_base; arm_base = nullptr; }
+  bool m_external = false;  // If true, memory is owned elsewhere
+
+  V3DLib::BufferObject *new_segment(uint32_t size_in_bytes) override;
+  V3DLib::BufferObject *import_segment(uint8_t *mem, uint32_t size_in_bytes) override;
+  uint32_t next_phy_address(uint32_t size_in_bytes) const;
+  void dealloc();
 };
 
 
@@ -0,0 +1,289 @@
+#include "EmuProgram.h"
+#include "Support/basics.h"
+#include "Target/SmallLiteral.h"
+
+namespace V3DLib {
+namespace {
+
+EmuOp::Code alu_code(ALUOp::Enum op) {
+  switch (op) {
+    case ALUOp::A_FADD:   return EmuOp::FADD;
+    case ALUOp::A_FSUB:   return EmuOp::FSUB;
+    case ALUOp::A_FMIN:   return EmuOp::FMIN;
+    case ALUOp::A_FMAX:   return EmuOp::FMAX;
+    case ALUOp::A_FtoI:   return EmuOp::FTOI;
+    case ALUOp::A_ItoF:   return EmuOp::ITOF;
+    case ALUOp::M_FMUL:   return EmuOp::FMUL;
+    case ALUOp::A_ADD:    return EmuOp::ADD;
+    case ALUOp::A_SUB:    return EmuOp::SUB;
+    case ALUOp::A_SHR:    return EmuOp::SHR;
+    case ALUOp::A_ASR:    return EmuOp::ASR;
+    case ALUOp::A_SHL:    return EmuOp::SHL;
+    case ALUOp::A_MIN:    return EmuOp::MIN;
+    case ALUOp::A_MAX:    return EmuOp::MAX;
+    case ALUOp::A_BAND:   return EmuOp::BAND;
+    case ALUOp::A_BOR:    return EmuOp::BOR;
+    case ALUOp::A_BXOR:   return EmuOp::BXOR;
+    case ALUOp::A_BNOT:   return EmuOp::BNOT;
+    case ALUOp::M_MUL24:  return EmuOp::MUL24;
+    case ALUOp::M_ROTATE: return EmuOp::ROTATE;
+    default:              return EmuOp::ALU;
+  }
+}
+
+
+EmuOp::Cond flag_cond(Flag flag) {
+  switch (flag) {
+    case ZS: return EmuOp::ZS;
+    case ZC: return EmuOp::ZC;
+    case NS: return EmuOp::NS;
+    case NC: return EmuOp::NC;
+  }
+
+  assert(false);
+  return EmuOp::NEVER;
+}
+
+
+EmuOp::Cond assign_cond(AssignCond cond) {
+  switch (cond.tag) {
+    case AssignCond::NEVER:  return EmuOp::NEVER;
+    case AssignCond::ALWAYS: return EmuOp::ALWAYS;
+    case AssignCond::FLAG:   return flag_cond(cond.flag);
+  }
+
+  assert(false);
+  return EmuOp::NEVER;
+}
+
+
+EmuOp::Branch branch_tag(BranchCond cond) {
+  switch (cond.tag) {
+    case BranchCond::COND_ALWAYS: return EmuOp::BR_ALWAYS;
+    case BranchCond::COND_NEVER:  return EmuOp::BR_NEVER;
+    case BranchCond::COND_ALL:    return EmuOp::BR_ALL;
+    case BranchCond::COND_ANY:    return EmuOp::BR_ANY;
+  }
+
+  assertq(false, "emulator: unexpected branch condition");
+  return EmuOp::BR_NEVER;
+}
+
+}  // anon namespace
+
+
+EmuProgram::EmuProgram(Instr::List &instrs, int maxReg) {
+  reg_b_offset = REG_A_OFFSET + (uint32_t) (maxReg + 1);
+  num_regs     = reg_b_offset + (uint32_t) (maxReg + 1);
+
+  add_const(Vec(0));                // CONST_ZERO
+  add_const(EmuState::index_vec);  // CONST_ELEM_NUM
+
+  ops.reserve(instrs.size());
+
+  for (int pc = 0; pc < instrs.size(); pc++) {
+    ops.push_back(lower(instrs[pc], pc));
+  }
+
+  int size = (int) ops.size();
+  for (int pc = 0; pc < size; pc++) {
+    if (ops[pc].code == EmuOp::BRANCH) add_delay_slots(pc);
+  }
+}
+
+
+/**
+ * Redirect the branch at given position via copies of its delay slots, if these are used
+ */
+void EmuProgram::add_delay_slots(int pc) {
+  int const NUM_DELAY_SLOTS = 3;
+
+  bool all_nops = true;
+  for (int i = 1; i <= NUM_DELAY_SLOTS && pc + i < (int) ops.size(); i++) {
+    if (ops[pc + i].code != EmuOp::NOP) all_nops = false;
+  }
+  if (all_nops) return;
+
+  assertq(pc + NUM_DELAY_SLOTS < (int) ops.size(), "emulator: delay slots beyond end of program", true);
+
+  int stub = (int) ops.size();
+
+  for (int i = 1; i <= NUM_DELAY_SLOTS; i++) {
+    EmuOp op = ops[pc + i];
+    assertq(op.code != EmuOp::BRANCH && !op.paired, "emulator: unexpected op in branch delay slot", true);
+    op.delay_slot = true;
+    ops.push_back(op);
+  }
+
+  EmuOp jump = ops[pc];
+  jump.code       = EmuOp::JUMP;
+  jump.delay_slot = true;
+  ops.push_back(jump);
+
+  ops[pc].target = stub;
+}
+
+
+uint32_t EmuProgram::add_const(Vec const &v) {
+  for (uint32_t i = 0; i < consts.size(); i++) {
+    if (consts[i] == v) return i;
+  }
+
+  consts.push_back(v);
+  return (uint32_t) consts.size() - 1;
+}
+
+
+/**
+ * Resolve a register to a location in the register file or the constant pool
+ */
+EmuSrc EmuProgram::reg(Reg const &reg, bool is_dst) {
+  int r = reg.regId;
+
+  switch (reg.tag) {
+    case NONE:
+      if (is_dst) return { EmuSrc::QPU, SINK };
+      return { EmuSrc::CONST, CONST_ZERO };
+
+    case REG_A:
+      assert(r >= 0 && r < (int) (reg_b_offset - REG_A_OFFSET));
+      return { EmuSrc::QPU, REG_A_OFFSET + (uint32_t) r };
+
+    case REG_B:
+      assert(r >= 0 && r < (int) (num_regs - reg_b_offset));
+      return { EmuSrc::QPU, reg_b_offset + (uint32_t) r };
+
+    case ACC:
+      assert(r >= 0 && r <= 5);
+      return { EmuSrc::QPU, ACC_OFFSET + (uint32_t) r };
+
+    case SPECIAL:
+      if (!is_dst) {
+        if (r == SPECIAL_ELEM_NUM) return { EmuSrc::CONST, CONST_ELEM_NUM };
+        if (r == SPECIAL_QPU_NUM)  return { EmuSrc::QPU, QPU_NUM };
+        assertq(r != SPECIAL_UNIFORM, "emulator: not expecting SPECIAL_UNIFORM to be handled any more");
+      }
+
+      specials.push_back(reg);
+      return { EmuSrc::SPECIAL, (uint32_t) specials.size() - 1 };
+
+    default:
+      fatal("emulator: unexpected register tag");
+      return { EmuSrc::CONST, CONST_ZERO };
+  }
+}
+
+
+EmuSrc EmuProgram::src(RegOrImm const &src) {
+  if (src.is_reg()) {
+    return reg(src.reg(), false);
+  }
+
+  Word w = decodeSmallLit(src.imm().val);
+  Vec v;
+  for (int i = 0; i < NUM_LANES; i++) {
+    v[i] = w;
+  }
+
+  return { EmuSrc::CONST, add_const(v) };
+}
+
+
+EmuOp EmuProgram::lower(Instr const &instr, int pc) {
+  EmuOp op;
+  op.code        = EmuOp::NOP;
+  op.cond        = EmuOp::ALWAYS;
+  op.branch      = EmuOp::BR_NEVER;
+  op.set_flags   = false;
+  op.break_point = instr.break_point();
+  op.paired      = instr.paired();
+  op.delay_slot  = false;
+  op.alu_op      = ALUOp::NOP;
+  op.a           = { EmuSrc::CONST, CONST_ZERO };
+  op.b           = op.a;
+  op.dst         = { EmuSrc::QPU, SINK };
+  op.target      = 0;
+
+  auto set_dst = [this, &op, &instr] () {
+    op.dst       = reg(instr.dest(), true);
+    op.cond      = assign_cond(instr.assign_cond());
+    op.set_flags = instr.set_cond().flags_set();
+  };
+
+  switch (instr.tag) {
+    case LI:
+      op.code = EmuOp::MOV;
+      op.a    = { EmuSrc::CONST, add_const(Vec(instr.LI.imm)) };
+      set_dst();
+      break;
+
+    case ALU:
+      if (instr.ALU.op.isNOP()) break;
+
+      op.alu_op = instr.ALU.op.value();
+
+      if (instr.isUniformLoad()) {
+        op.code = EmuOp::UNIFORM;
+      } else {
+        op.code = alu_code(op.alu_op);
+        op.a    = src(instr.ALU.srcA);
+        op.b    = src(instr.ALU.srcB);
+      }
+
+      set_dst();
+      break;
+
+    case BR: {
+      BranchCond cond = instr.branch_cond();
+      op.code   = EmuOp::BRANCH;
+      op.branch = branch_tag(cond);
+
+      if (op.branch == EmuOp::BR_ALL || op.branch == EmuOp::BR_ANY) {
+        op.cond = flag_cond(cond.flag);
+      }
+
+      BranchTarget t = instr.branch_target();
+      if (t.relative && !t.useRegOffset) {
+        op.target = pc + 1 + 3 + t.immOffset;  // Relative to the instruction after the delay slots
+      } else {
+        fatal("V3DLib: found unsupported form of branch target");
+      }
+    }
+    break;
+
+    case RECV:
+      op.code = EmuOp::RECV;
+      op.dst  = reg(instr.dest(), true);
+      break;
+
+    case SINC:
+    case SDEC:
+      assert(instr.semaId >= 0 && instr.semaId < 16);
+      op.code   = (instr.tag == SINC)? EmuOp::SINC : EmuOp::SDEC;
+      op.target = instr.semaId;
+      break;
+
+    case END:
+      op.code = EmuOp::END;
+      break;
+
+    case BRL:
+    case LAB:
+      op.code = EmuOp::LABEL;
+      break;
+
+    case NO_OP:
+    case IRQ:
+    case INIT_BEGIN:
+    case INIT_END:
+      break;  // ignore
+
+    default:
+      assertq(false, "emulator: unexpected instruction tag");
+      break;
+  }
+
+  return op;
+}
+
+}  // namespace V3DLib
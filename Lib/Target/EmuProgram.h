@@ -0,0 +1,144 @@
+#ifndef _V3DLIB_TARGET_EMUPROGRAM_H_
+#define _V3DLIB_TARGET_EMUPROGRAM_H_
+#include <cstdint>
+#include <vector>
+#include "EmuSupport.h"
+#include "instr/Instr.h"
+
+namespace V3DLib {
+
+/**
+ * Operand of a micro-op.
+ *
+ * `index` is an offset in the storage selected by `file`.
+ */
+struct EmuSrc {
+  enum File : uint8_t {
+    QPU,      // Register file of the executing QPU
+    CONST,    // Constant pool of the program
+    SPECIAL,  // Special register, index into `EmuProgram::specials`
+  };
+
+  File     file;
+  uint32_t index;
+};
+
+
+/**
+ * Destination of a micro-op, same layout as `EmuSrc`.
+ *
+ * File `CONST` is not allowed here.
+ */
+using EmuDst = EmuSrc;
+
+
+/**
+ * Pre-decoded instruction for the emulator.
+ *
+ * This is a POD; all decoding of the source instruction (register tags, small immediates,
+ * conditions, branch targets) is done once, when lowering the instruction list.
+ */
+struct EmuOp {
+  enum Code : uint8_t {
+    NOP,
+    MOV,        // Used for LI; source is in the constant pool
+    UNIFORM,    // Uniform load, ALU op applied to the uniform value
+
+    // Specialized ALU ops
+    FADD, FSUB, FMIN, FMAX, FTOI, ITOF, FMUL,
+    ADD, SUB, SHR, ASR, SHL, MIN, MAX, BAND, BOR, BXOR, BNOT, MUL24,
+    ROTATE,
+    ALU,        // Any other ALU op, handled by `Vec::apply()`
+
+    BRANCH,
+    JUMP,       // Jump from delay slot copies to branch target, not an instruction of the program
+    RECV,
+    SINC,
+    SDEC,
+    END,
+    LABEL,      // Not allowed in emulator, fatal on execution
+
+    NUM_CODES
+  };
+
+  // Values for `cond`
+  enum Cond : uint8_t {
+    NEVER,
+    ALWAYS,
+    ZS,
+    ZC,
+    NS,
+    NC
+  };
+
+  // Values for `branch`
+  enum Branch : uint8_t {
+    BR_ALWAYS,
+    BR_NEVER,
+    BR_ALL,
+    BR_ANY
+  };
+
+  Code        code;
+  Cond        cond;         // Assign condition; for branches, the flag condition
+  Branch      branch;       // Reduction for branch condition
+  bool        set_flags;
+  bool        break_point;
+  bool        paired;       // Issued in the same instruction as the previous op
+  bool        delay_slot;   // Copy of a branch delay slot op, issue is accounted for by the branch
+  ALUOp::Enum alu_op;       // Only used for ALU and UNIFORM
+  EmuSrc      a;
+  EmuSrc      b;
+  EmuDst      dst;
+  int32_t     target;       // Branch target or semaphore id
+};
+
+
+/**
+ * Instruction list lowered to micro-ops, with the register layout for the QPUs.
+ *
+ * The ops of the branch delay slots are executed for taken branches as well. If these are not
+ * all NOPs, a taken branch continues with copies of the delay slot ops at the end of the program,
+ * followed by a jump to the actual branch target.
+ *
+ * Layout of the register file of a QPU:
+ *
+ *     0-5            - accumulators
+ *     QPU_NUM        - vector with QPU id
+ *     SINK           - destination for writes to NONE
+ *     REG_A_OFFSET   - start register file A
+ *     reg_b_offset   - start register file B
+ */
+struct EmuProgram {
+  enum : uint32_t {
+    ACC_OFFSET    = 0,
+    QPU_NUM       = 6,
+    SINK          = 7,
+    REG_A_OFFSET  = 8,
+  };
+
+  // Fixed entries in the constant pool
+  enum : uint32_t {
+    CONST_ZERO     = 0,
+    CONST_ELEM_NUM = 1,
+  };
+
+  std::vector<EmuOp> ops;
+  std::vector<Vec>   consts;
+  std::vector<Reg>   specials;
+  uint32_t reg_b_offset = 0;
+  uint32_t num_regs     = 0;
+
+  EmuProgram(Instr::List &instrs, int maxReg);
+
+private:
+  uint32_t add_const(Vec const &v);
+  EmuSrc src(RegOrImm const &src);
+  EmuSrc reg(Reg const &reg, bool is_dst);
+  EmuOp lower(Instr const &instr, int pc);
+  void add_delay_slots(int pc);
+};
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_TARGET_EMUPROGRAM_H_
@@ -5,6 +5,11 @@
 #include "Support/basics.h"
 #include "Target/instr/ALUOp.h"
 #include "Source/Op.h"
+#include "LaneOps.h"
+#include "LibSettings.h"
+#include <chrono>
+#include <exception>
+#include <thread>
 
 namespace V3DLib {
 namespace {
@@ -194,7 +199,7 @@ Vec Vec::log() const {
 }
 
 
-bool Vec::apply(Op const &op, Vec a, Vec b) {
+bool Vec::apply(Op const &op, Vec const &a, Vec const &b) {
   bool handled = true;
 
   switch (op.op) {
@@ -210,26 +215,28 @@ bool Vec::apply(Op const &op, Vec a, Vec b) {
 }
 
 
-bool Vec::apply(ALUOp const &op, Vec a, Vec b) {
-  bool handled = true;
+/**
+ * Apply an ALU operation on the lanes of the input vectors
+ *
+ * The lane-wise operations are done in `lanes::apply()`; what remains here are the rarely
+ * used operations.
+ *
+ * The output may be the same as one of the inputs.
+ */
+bool Vec::apply(ALUOp const &op, Vec const &a, Vec const &b) {
   if (op.value() == ALUOp::NOP) return true;
+  if (lanes::apply(op.value(), *this, a, b)) return true;
+
+  bool handled = true;
 
-  // Floating-point operations
   for (int i = 0; i < NUM_LANES; i++) {
     float  x = a[i].floatVal;
     float  y = b[i].floatVal;
     float &d = elems[i].floatVal;
 
     switch (op.value()) {
-    case ALUOp::A_FADD:    d = x+y;                       break;
-    case ALUOp::A_FSUB:    d = x-y;                       break;
-    case ALUOp::A_FMIN:    d = x<y?x:y;                   break;
-    case ALUOp::A_FMAX:    d = x>y?x:y;                   break;
     case ALUOp::A_FMINABS: d = fabs(x) < fabs(y) ? x : y; break; // min of absolute values
     case ALUOp::A_FMAXABS: d = fabs(x) > fabs(y) ? x : y; break; // max of absolute values
-    case ALUOp::A_FtoI:    elems[i].intVal = (int) x;     break;
-    case ALUOp::A_ItoF:    d = (float) a[i].intVal;       break;
-    case ALUOp::M_FMUL:    d = x*y;                       break;
 
     default:
       handled = false;
@@ -247,21 +254,8 @@ bool Vec::apply(ALUOp const &op, Vec a, Vec b) {
     int &d = elems[i].intVal;
 
     switch (op.value()) {
-    case ALUOp::A_ADD:   d = x+y;            break;
-    case ALUOp::A_SUB:   d = x-y;            break;
     case ALUOp::A_ROR:   d = rotRight(x, y); break;
-    case ALUOp::A_SHL:   d = x<<y;           break;
-    case ALUOp::A_SHR:   d = (int32_t) (((uint32_t) x) >> y); break;
-    case ALUOp::A_ASR:   d = x >> y; break;
-    case ALUOp::A_MIN:   d = x<y?x:y;        break;
-    case ALUOp::A_MAX:   d = x>y?x:y;        break;
-    case ALUOp::A_BAND:  d = x&y;            break;
-    case ALUOp::A_BOR:   d = x|y;            break;
-    case ALUOp::A_BXOR:  d = x^y;            break;
-    case ALUOp::A_BNOT:  d = ~x; break;
-    case ALUOp::M_MUL24: d = (x&0xffffff)*(y&0xffffff); break; // Integer multiply (24-bit)
-
-    case ALUOp::A_CLZ:    d = clz(x);         break; // Count leading zeros
+    case ALUOp::A_CLZ:   d = clz(x);         break; // Count leading zeros
 
     case ALUOp::A_V8ADDS:
     case ALUOp::A_V8SUBS:
@@ -322,9 +316,7 @@ bool Vec::is_uniform() const {
 
 
 void Vec::assign(Vec const &rhs) {
-  for (int i = 0; i < NUM_LANES; i++) {
-    elems[i] = rhs[i];
-  }
+  memcpy(elems, rhs.elems, sizeof(elems));
 }
 
 
@@ -332,11 +324,24 @@ void Vec::assign(Vec const &rhs) {
 // Class EmuState
 ///////////////////////////////////////////////////////////////////////////////
 
+namespace {
+
+int const MAX_STEPS = 1 << 20;  // Max number of steps a QPU runs uninterrupted
+
+/**
+ * Thrown on the other QPUs, when one QPU fails with parallel execution
+ */
+struct Aborted {};
+
+}  // anon namespace
+
+
 Vec const EmuState::index_vec({0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15});
 
 EmuState::EmuState(int in_num_qpus, IntList const &in_uniforms, bool add_dummy) :
   num_qpus(in_num_qpus),
-  uniforms(in_uniforms)
+  uniforms(in_uniforms),
+  m_parallel(in_num_qpus > 1 && !LibSettings::emu_lockstep())
 {
   // Initialise semaphores
   for (int i = 0; i < 16; i++) sema[i] = 0;
@@ -370,6 +375,12 @@ Vec EmuState::get_uniform(int id, int &next_uniform) {
  */
 bool EmuState::sema_inc(int sema_id) {
   assert(sema_id >= 0 && sema_id < 16);
+
+  if (m_parallel) {
+    sema_wait(sema_id, true);
+    return false;
+  }
+
   if (sema[sema_id] == 15) {
     semaphore_wait_count++;
     assertq(semaphore_wait_count < MAX_SEMAPHORE_WAIT, "Semaphore wait for SINC appears to be stuck");
@@ -387,6 +398,12 @@ bool EmuState::sema_inc(int sema_id) {
  */
 bool EmuState::sema_dec(int sema_id) {
   assert(sema_id >= 0 && sema_id < 16);
+
+  if (m_parallel) {
+    sema_wait(sema_id, false);
+    return false;
+  }
+
   if (sema[sema_id] == 0) {
     semaphore_wait_count++;
     assertq(semaphore_wait_count < MAX_SEMAPHORE_WAIT, "Semaphore wait for SDEC appears to be stuck");
@@ -398,4 +415,128 @@ bool EmuState::sema_dec(int sema_id) {
   }
 }
 
+
+/**
+ * Increment or decrement a semaphore with parallel execution.
+ *
+ * Blocks until the semaphore can be changed. If this takes longer than the QPU timeout,
+ * the QPU is assumed to be stuck.
+ */
+void EmuState::sema_wait(int sema_id, bool inc) {
+  std::unique_lock<std::mutex> lock(m_sema_mutex);
+
+  bool ok = m_sema_cond.wait_for(lock, std::chrono::seconds(LibSettings::qpu_timeout()), [this, sema_id, inc] {
+    return m_aborted || (inc? (sema[sema_id] < 15) : (sema[sema_id] > 0));
+  });
+
+  if (m_aborted) throw Aborted();
+  assertq(ok, inc? "Semaphore wait for SINC appears to be stuck" : "Semaphore wait for SDEC appears to be stuck");
+
+  sema[sema_id] += inc? 1 : -1;
+  lock.unlock();
+  m_sema_cond.notify_all();
+}
+
+
+/**
+ * Stop all QPUs with parallel execution.
+ *
+ * QPUs waiting on a semaphore are woken up.
+ */
+void EmuState::abort() {
+  {
+    std::lock_guard<std::mutex> lock(m_sema_mutex);
+    m_aborted = true;
+  }
+
+  m_sema_cond.notify_all();
+}
+
+
+/**
+ * Run all QPUs until they have halted.
+ *
+ * @param step  Run at most `max_steps` steps on the given QPU. Should return false if
+ *              the QPU has halted. With lockstep, this is called with `max_steps == 1`.
+ */
+void EmuState::run(Step const &step) {
+  if (num_qpus == 1) {
+    while (step(0, MAX_STEPS));
+    return;
+  }
+
+  if (m_parallel) {
+    run_parallel(step);
+    return;
+  }
+
+  std::vector<bool> running(num_qpus, true);
+  bool anyRunning = true;
+
+  while (anyRunning) {
+    anyRunning = false;
+    int num_steps = 0;
+    int prev_wait_count = semaphore_wait_count;
+
+    for (int i = 0; i < num_qpus; i++) {
+      if (!running[i]) continue;
+
+      running[i] = step(i, 1);
+      anyRunning |= running[i];
+      num_steps++;
+    }
+
+    // Semaphore waits are only stuck if no QPU is doing anything else
+    if (semaphore_wait_count - prev_wait_count < num_steps) {
+      semaphore_wait_count = 0;
+    }
+  }
+}
+
+
+/**
+ * Run each QPU on its own host thread.
+ *
+ * If a QPU throws, all QPUs are stopped and the exception is rethrown here.
+ */
+void EmuState::run_parallel(Step const &step) {
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto set_error = [this, &error, &error_mutex] () {
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) error = std::current_exception();
+    }
+
+    abort();
+  };
+
+  std::vector<std::thread> threads;
+
+  try {
+    for (int i = 0; i < num_qpus; i++) {
+      threads.emplace_back([this, i, &step, &set_error] () {
+        try {
+          while (!m_aborted && step(i, MAX_STEPS));
+        } catch (Aborted const &) {
+          // Stopped because another QPU failed
+        } catch (...) {
+          set_error();
+        }
+      });
+    }
+  } catch (...) {
+    set_error();  // Thread creation failed
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
 }  // namespace V3DLib
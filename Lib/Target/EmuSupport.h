@@ -2,6 +2,10 @@
 #define _V3DLIB_TARGET_EMUSUPPORT_H_
 #include <stdint.h>
 #include <vector>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include "Common/Seq.h"
 #include "Target/instr/Imm.h"
 
@@ -57,10 +61,13 @@ struct Vec {
     return elems[index];
   }
 
+  Word *data()             { return elems; }
+  Word const *data() const { return elems; }
+
   std::string dump() const;
   Vec negate() const;
-  bool apply(Op const &op, Vec a, Vec b);
-  bool apply(ALUOp const &op, Vec a, Vec b);
+  bool apply(Op const &op, Vec const &a, Vec const &b);
+  bool apply(ALUOp const &op, Vec const &a, Vec const &b);
   bool is_uniform() const;
 
   Vec recip() const;
@@ -75,15 +82,29 @@ private:
 };
 
 
+/**
+ * State shared by all QPUs in the emulator and the interpreter.
+ *
+ * The QPUs run either in parallel, each on its own host thread, or in lockstep on the
+ * calling thread (see `LibSettings::emu_lockstep()`). With parallel execution, access
+ * to the VPM must be guarded with `vpm_mutex`, and access to the heap memory with `heap_mutex`.
+ * If both are needed, `vpm_mutex` must be locked first. The semaphores take care of themselves.
+ */
 class EmuState {
 public:
+  using Step = std::function<bool(int qpu, int max_steps)>;
+
   int num_qpus;
   Word vpm[VPM_SIZE];      // Shared VPM memory
+  std::mutex vpm_mutex;    // Guards vpm
+  std::mutex heap_mutex;   // Guards the heap memory; QPUs exchange data through it
 
   EmuState(int in_num_qpus, IntList const &in_uniforms, bool add_dummy = false);
   Vec get_uniform(int id, int &next_uniform);
   bool sema_inc(int sema_id);
   bool sema_dec(int sema_id);
+  bool parallel() const { return m_parallel; }
+  void run(Step const &step);
 
   static Vec const index_vec;
 
@@ -94,6 +115,16 @@ private:
   // Protection against locks due to semaphore waiting
   int const MAX_SEMAPHORE_WAIT = 1024;
   int semaphore_wait_count = 0;
+
+  // Parallel execution
+  bool m_parallel = false;
+  std::atomic<bool> m_aborted{false};
+  std::mutex m_sema_mutex;
+  std::condition_variable m_sema_cond;
+
+  void sema_wait(int sema_id, bool inc);
+  void abort();
+  void run_parallel(Step const &step);
 };
 
 
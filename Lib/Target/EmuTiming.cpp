@@ -0,0 +1,265 @@
+#include "EmuTiming.h"
+#include <algorithm>
+#include "Support/basics.h"
+#include "EmuProgram.h"
+
+namespace V3DLib {
+namespace {
+
+//
+// Latencies in cycles, rough estimates
+//
+int const TMU_LATENCY         = 20;  // TMU load, from handling request to data available
+int const TMU_CYCLES_PER_LINE =  4;  // TMU handling of request, per distinct cache line accessed
+int const TMU_LINE_SIZE       = 64;  // Size of a TMU cache line in bytes
+int const VPM_READ_LATENCY    =  3;  // VPM read setup, before the first read
+int const DMA_SETUP           = 30;  // DMA transfer setup
+int const DMA_WORDS_PER_CYCLE =  4;  // DMA throughput
+int const BRANCH_DELAY        =  3;  // Delay slots of a branch
+
+}  // anon namespace
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Class EmuTiming
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @return cycles of the QPU which took longest, i.e. the estimated cycles for the kernel
+ */
+uint64_t EmuTiming::max_cycles() const {
+  uint64_t ret = 0;
+
+  for (auto const &item : qpus) {
+    if (item.cycles > ret) ret = item.cycles;
+  }
+
+  return ret;
+}
+
+
+std::string EmuTiming::dump() const {
+  std::string ret;
+
+  ret << "vc4 emulator timing, " << max_cycles() << " cycles\n";
+
+  for (int i = 0; i < (int) qpus.size(); i++) {
+    auto const &item = qpus[i];
+
+    ret << "  QPU " << i << ": "
+        << item.cycles           << " cycles, "
+        << item.num_instructions << " instructions ("
+        << item.num_nops         << " NOPs)\n"
+        << "    stalls: "
+        << item.tmu_stalls       << " TMU, "
+        << item.vpm_stalls       << " VPM, "
+        << item.dma_stalls       << " DMA, "
+        << item.sema_stalls      << " semaphore, "
+        << item.regfile_stalls   << " regfile; "
+        << item.branch_delays    << " branch delay\n"
+        << "    "
+        << item.num_tmu_loads    << " TMU loads, "
+        << item.num_dma_loads    << " DMA loads, "
+        << item.num_dma_stores   << " DMA stores, "
+        << item.num_sfu_calls    << " SFU calls, "
+        << item.num_branches     << " branches taken\n";
+  }
+
+  return ret;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Class QPUTiming
+///////////////////////////////////////////////////////////////////////////////
+
+QPUTiming::QPUTiming(EmuTiming::Item &item, SharedTiming &shared, EmuProgram const &prog) :
+  m_item(item),
+  m_shared(shared),
+  m_reg_a_offset(EmuProgram::REG_A_OFFSET),
+  m_reg_b_offset(prog.reg_b_offset),
+  m_num_regs(prog.num_regs)
+{}
+
+
+/**
+ * @return 1 for regfile A, 2 for regfile B, 0 otherwise
+ */
+int QPUTiming::regfile(uint32_t index) const {
+  if (index < m_reg_a_offset) return 0;
+  if (index < m_reg_b_offset) return 1;
+  if (index < m_num_regs)     return 2;
+  return 0;
+}
+
+
+/**
+ * Stall until given cycle
+ */
+void QPUTiming::stall(uint64_t until, uint64_t &counter) {
+  if (until <= m_item.cycles) return;
+
+  counter += until - m_item.cycles;
+  m_item.cycles = until;
+}
+
+
+/**
+ * Account for the issue of an instruction
+ *
+ * A paired op is issued in the same instruction as the previous op, and does not
+ * take a cycle of its own.
+ */
+void QPUTiming::issue(EmuOp const &op) {
+  if (op.delay_slot) return;  // Accounted for in `branch_taken()`
+
+  if (!op.paired) {
+    m_item.cycles++;
+    m_item.num_instructions++;
+    if (op.code == EmuOp::NOP) m_item.num_nops++;
+
+    m_last_dst[0] = m_cur_dst[0];
+    m_last_dst[1] = m_cur_dst[1];
+    m_cur_dst[0]  = -1;
+    m_cur_dst[1]  = -1;
+  }
+
+  int file_a = (op.a.file == EmuSrc::QPU)? regfile(op.a.index) : 0;
+  int file_b = (op.b.file == EmuSrc::QPU)? regfile(op.b.index) : 0;
+
+  // Only one register can be read per regfile
+  if (file_a != 0 && file_a == file_b && op.a.index != op.b.index) {
+    m_item.cycles++;
+    m_item.regfile_stalls++;
+  }
+
+  // A regfile register is not available in the instruction after it was written
+  for (auto last_dst : m_last_dst) {
+    if (last_dst == -1) continue;
+
+    bool uses = (file_a != 0 && op.a.index == last_dst) || (file_b != 0 && op.b.index == last_dst);
+
+    if (uses) {
+      m_item.cycles++;
+      m_item.regfile_stalls++;
+      break;
+    }
+  }
+
+  if (op.dst.file == EmuSrc::QPU && op.cond != EmuOp::NEVER && regfile(op.dst.index) != 0) {
+    m_cur_dst[op.paired? 1 : 0] = op.dst.index;
+  }
+}
+
+
+/**
+ * Undo the issue of the last instruction, because it will be executed again
+ */
+void QPUTiming::retry() {
+  assert(m_item.cycles > 0 && m_item.num_instructions > 0);
+  m_item.cycles--;
+  m_item.num_instructions--;
+}
+
+
+void QPUTiming::branch_taken() {
+  m_item.num_branches++;
+  m_item.cycles        += BRANCH_DELAY;
+  m_item.branch_delays += BRANCH_DELAY;
+}
+
+
+/**
+ * Register a TMU load request.
+ *
+ * The TMU handles the requests of a QPU in order. A request takes longer if the lanes
+ * access more cache lines.
+ */
+void QPUTiming::tmu_load(Vec const &addr) {
+  m_item.num_tmu_loads++;
+
+  uint32_t lines[NUM_LANES];
+  for (int i = 0; i < NUM_LANES; i++) {
+    lines[i] = ((uint32_t) addr[i].intVal)/TMU_LINE_SIZE;
+  }
+
+  std::sort(lines, lines + NUM_LANES);
+  int num_lines = (int) (std::unique(lines, lines + NUM_LANES) - lines);
+
+  uint64_t start = std::max(m_item.cycles, m_tmu_free);
+  m_tmu_free = start + (uint64_t) (num_lines*TMU_CYCLES_PER_LINE);
+  m_tmu_ready.push_back(m_tmu_free + TMU_LATENCY);
+}
+
+
+void QPUTiming::tmu_receive() {
+  assert(!m_tmu_ready.empty());
+  stall(m_tmu_ready.front(), m_item.tmu_stalls);
+  m_tmu_ready.erase(m_tmu_ready.begin());
+}
+
+
+void QPUTiming::vpm_read_setup() {
+  m_vpm_ready = m_item.cycles + VPM_READ_LATENCY;
+}
+
+
+void QPUTiming::vpm_read() {
+  stall(m_vpm_ready, m_item.vpm_stalls);
+}
+
+
+/**
+ * Start a DMA transfer.
+ *
+ * The transfer starts when the DMA engine is done with the transfers of other QPUs.
+ */
+void QPUTiming::dma_start(bool load, int num_words) {
+  std::lock_guard<std::mutex> lock(m_shared.mutex);
+
+  uint64_t start = std::max(m_item.cycles, m_shared.dma_free);
+  uint64_t done  = start + DMA_SETUP + (uint64_t) ((num_words + DMA_WORDS_PER_CYCLE - 1)/DMA_WORDS_PER_CYCLE);
+  m_shared.dma_free = done;
+
+  if (load) {
+    m_item.num_dma_loads++;
+    m_dma_load_done = done;
+  } else {
+    m_item.num_dma_stores++;
+    m_dma_store_done = done;
+  }
+}
+
+
+void QPUTiming::dma_wait(bool load) {
+  stall(load? m_dma_load_done : m_dma_store_done, m_item.dma_stalls);
+}
+
+
+/**
+ * Register a semaphore operation, before it is attempted.
+ *
+ * This signals QPUs waiting on the semaphore from which cycle on they can continue.
+ */
+void QPUTiming::sema_release(int sema_id) {
+  assert(0 <= sema_id && sema_id < 16);
+  std::lock_guard<std::mutex> lock(m_shared.mutex);
+
+  uint64_t &cycle = m_shared.sema_cycle[sema_id];
+  cycle = std::max(cycle, m_item.cycles);
+}
+
+
+/**
+ * Register a successful semaphore operation.
+ *
+ * Stall until the semaphore was last changed by another QPU.
+ */
+void QPUTiming::sema_acquire(int sema_id) {
+  assert(0 <= sema_id && sema_id < 16);
+  std::lock_guard<std::mutex> lock(m_shared.mutex);
+
+  stall(m_shared.sema_cycle[sema_id], m_item.sema_stalls);
+}
+
+}  // namespace V3DLib
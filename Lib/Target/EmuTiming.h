@@ -0,0 +1,121 @@
+#ifndef _V3DLIB_TARGET_EMUTIMING_H_
+#define _V3DLIB_TARGET_EMUTIMING_H_
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "EmuSupport.h"
+
+namespace V3DLib {
+
+struct EmuOp;
+struct EmuProgram;
+
+/**
+ * Timing statistics of a vc4 emulator run, per QPU.
+ *
+ * The cycle counts are estimates, derived from a simple model of the VideoCore IV
+ * (see `QPUTiming`). One cycle is the issue of one QPU instruction. The counts are
+ * useful to compare variants of a kernel, not as absolute timings.
+ *
+ * With parallel emulation, the order in which QPUs access shared resources (DMA and
+ * semaphores) may vary between runs, and so may the cycle counts. Use lockstep
+ * emulation for reproducible counts.
+ */
+struct EmuTiming {
+  struct Item {
+    uint64_t cycles           = 0;  // Total estimated cycles, including stalls
+    uint64_t num_instructions = 0;  // Instructions executed
+    uint64_t num_nops         = 0;  // NOPs executed, part of num_instructions
+    uint64_t tmu_stalls       = 0;  // Cycles waiting for TMU loads
+    uint64_t vpm_stalls       = 0;  // Cycles waiting for VPM reads
+    uint64_t dma_stalls       = 0;  // Cycles waiting for DMA transfers
+    uint64_t sema_stalls      = 0;  // Cycles waiting on semaphores
+    uint64_t branch_delays    = 0;  // Cycles for the delay slots of taken branches
+    uint64_t regfile_stalls   = 0;  // Cycles lost to regfile read conflicts
+    int num_tmu_loads  = 0;         // Number of TMU load requests
+    int num_dma_loads  = 0;         // Number of DMA loads
+    int num_dma_stores = 0;         // Number of DMA stores
+    int num_sfu_calls  = 0;         // Number of SFU function calls
+    int num_branches   = 0;         // Number of branches taken
+  };
+
+  std::vector<Item> qpus;
+
+  uint64_t max_cycles() const;
+  std::string dump() const;
+};
+
+
+/**
+ * Timing state shared by all QPUs
+ */
+struct SharedTiming {
+  std::mutex mutex;              // Guards the fields below
+  uint64_t dma_free = 0;         // Cycle at which the DMA engine becomes free
+  uint64_t sema_cycle[16] = {};  // Cycle of the last change per semaphore
+};
+
+
+/**
+ * Timing model of a single QPU, as used by the emulator.
+ *
+ * Every instruction costs one cycle. On top of that, the QPU stalls:
+ *
+ *   - on a TMU receive, until the requested data is loaded
+ *   - on a VPM read, until the VPM read setup has completed
+ *   - on a DMA wait, until the DMA transfer is done. There is one DMA engine for all QPUs,
+ *     transfers of different QPUs are done one after the other.
+ *   - on a semaphore, until another QPU has changed it
+ *   - on a read of two different registers in the same regfile, or of a regfile register
+ *     written by the previous instruction. The compiler avoids these, so these should
+ *     normally not occur.
+ *
+ * A taken branch costs three extra cycles, for the delay slots.
+ * Paired ops, i.e. combined add and mul ALU operations, are issued in the same cycle.
+ *
+ * The latencies are rough estimates.
+ */
+class QPUTiming {
+public:
+  QPUTiming(EmuTiming::Item &item, SharedTiming &shared, EmuProgram const &prog);
+
+  void issue(EmuOp const &op);
+  void retry();
+  void branch_taken();
+  void sfu_call() { m_item.num_sfu_calls++; }
+
+  void tmu_load(Vec const &addr);
+  void tmu_receive();
+
+  void vpm_read_setup();
+  void vpm_read();
+
+  void dma_start(bool load, int num_words);
+  void dma_wait(bool load);
+
+  void sema_release(int sema_id);
+  void sema_acquire(int sema_id);
+
+private:
+  EmuTiming::Item &m_item;
+  SharedTiming &m_shared;
+  uint32_t m_reg_a_offset;
+  uint32_t m_reg_b_offset;
+  uint32_t m_num_regs;
+
+  int64_t m_last_dst[2] = {-1, -1};  // Regfile registers written by previous instruction, -1 if none
+  int64_t m_cur_dst[2]  = {-1, -1};  // Regfile registers written by current instruction, -1 if none
+  uint64_t m_tmu_free = 0;            // Cycle at which the TMU is done handling requests
+  std::vector<uint64_t> m_tmu_ready;  // Cycles at which the outstanding TMU loads are ready
+  uint64_t m_vpm_ready = 0;           // Cycle at which the VPM read setup is done
+  uint64_t m_dma_load_done  = 0;      // Cycle at which the current DMA load is done
+  uint64_t m_dma_store_done = 0;      // Cycle at which the current DMA store is done
+
+  int regfile(uint32_t index) const;
+  void stall(uint64_t until, uint64_t &counter);
+};
+
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_TARGET_EMUTIMING_H_
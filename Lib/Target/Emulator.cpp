@@ -1,10 +1,15 @@
 #include "Target/Emulator.h"
 #include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "Support/basics.h"  // fatal()
 #include "EmuSupport.h"
 #include "Common/SharedArray.h"
-#include "Target/SmallLiteral.h"
 #include "BufferObject.h"
+#include "EmuProgram.h"
+#include "EmuTiming.h"
+#include "LaneOps.h"
 
 namespace V3DLib {
 
@@ -86,13 +91,9 @@ struct QPUState {
 
   bool running = false;                // Is QPU active, or has it halted?
   int pc = 0;                          // Program counter
-  Vec* regFileA = nullptr;             // Register file A
-  int sizeRegFileA = 0;                // (and size)
-  Vec* regFileB = nullptr;             // Register file B
-  int sizeRegFileB = 0;                // (and size)
-  Vec accum[6];                        // Accumulator registers
-  bool negFlags[NUM_LANES];            // Negative flags
-  bool zeroFlags[NUM_LANES];           // Zero flags
+  std::vector<Vec> regs;               // Register files and accumulators, layout as in EmuProgram
+  Vec negFlags;                        // Negative flags, as lane masks
+  Vec zeroFlags;                       // Zero flags, as lane masks
 
   DMAAddr dmaLoad;                     // DMA load address
   DMAAddr dmaStore;                    // DMA store address
@@ -102,30 +103,22 @@ struct QPUState {
   VPMStoreReq vpmStoreSetup;           // VPM store setup
 
   SFU sfu;
+  std::unique_ptr<QPUTiming> timing;   // Timing model, only if timing requested
 
   QPUState() {
     dmaLoad.active     = false;
     dmaStore.active    = false;
-    for (int i = 0; i < NUM_LANES; i++) negFlags[i] = false;
-    for (int i = 0; i < NUM_LANES; i++) zeroFlags[i] = false;
   }
 
 
-  ~QPUState() {
-    delete [] regFileA;
-    delete [] regFileB;
-  }
-
-  void init(int maxReg) {
-    running            = true;
-    regFileA           = new Vec [maxReg+1];
-    sizeRegFileA       = maxReg+1;
-    regFileB           = new Vec [maxReg+1];
-    sizeRegFileB       = maxReg+1;
+  void init(EmuProgram const &prog) {
+    running = true;
+    regs.resize(prog.num_regs);
+    regs[EmuProgram::QPU_NUM] = Vec(id);
   }
 
   void upkeep() {
-    sfu.upkeep(accum[4]);
+    sfu.upkeep(regs[EmuProgram::ACC_OFFSET + 4]);
   }
 };
 
@@ -136,6 +129,7 @@ struct QPUState {
 struct State : public EmuState {
   QPUState qpu[MAX_QPUS];  // State of each QPU
   Data emuHeap;
+  SharedTiming timing;
 
   State(int in_num_qpus, IntList const &in_uniforms) : EmuState(in_num_qpus, in_uniforms, true) {}
 };
@@ -149,6 +143,9 @@ Vec DMA_readReg(QPUState* s, State* g, Reg reg, bool &handled) {
 
   switch (reg.regId) {
       case SPECIAL_VPM_READ: {
+        if (s->timing) s->timing->vpm_read();
+        std::lock_guard<std::mutex> lock(g->vpm_mutex);
+
         // Make sure there's a VPM load request waiting
         assert(!s->vpmLoadQueue.isEmpty());
         VPMLoadReq* req = s->vpmLoadQueue.first();
@@ -177,8 +174,12 @@ Vec DMA_readReg(QPUState* s, State* g, Reg reg, bool &handled) {
       return v;
 
       case SPECIAL_DMA_LD_WAIT: {
+        if (s->timing) s->timing->dma_wait(true);
+
         // Perform DMA load to completion
         if (s->dmaLoad.active == false) return v;
+        std::lock_guard<std::mutex> lock(g->vpm_mutex);
+        std::lock_guard<std::mutex> heap_lock(g->heap_mutex);
         DMALoadReq* req = &s->dmaLoadSetup;
         if (req->hor) {
           // Horizontal access
@@ -210,8 +211,12 @@ Vec DMA_readReg(QPUState* s, State* g, Reg reg, bool &handled) {
      return v; // Return value unspecified
 
       case SPECIAL_DMA_ST_WAIT: {
+        if (s->timing) s->timing->dma_wait(false);
+
         // Perform DMA store to completion
         if (s->dmaStore.active == false) return v;
+        std::lock_guard<std::mutex> lock(g->vpm_mutex);
+        std::lock_guard<std::mutex> heap_lock(g->heap_mutex);
         DMAStoreReq* req = &s->dmaStoreSetup;
         uint32_t memAddr = s->dmaStore.addr.intVal;
 
@@ -254,56 +259,170 @@ Vec DMA_readReg(QPUState* s, State* g, Reg reg, bool &handled) {
   return v;
 }
 
-}  // anon namespace
+
+/**
+ * Read a special register
+ */
+Vec readSpecial(QPUState* s, State* g, Reg reg) {
+  assert(reg.tag == SPECIAL);
+
+  bool handled;
+  Vec v = DMA_readReg(s, g, reg, handled);
+  if (handled) {
+    return v; // Return value unspecified, don't care at this point
+  }
+
+  fatal("V3DLib: can't read special register");
+  return v;
+}
 
 
 /**
- * Read a vector register
+ * Write a vector to a special register
+ *
+ * Assign conditions and flags are ignored for special registers.
  */
-Vec readReg(QPUState* s, State* g, Reg reg) {
-  int r = reg.regId;
-  Vec v(0);
+void writeSpecial(QPUState* s, State* g, Reg dest, Vec const &v) {
+  assert(dest.tag == SPECIAL);
+
+  switch (dest.regId) {
+    case SPECIAL_RD_SETUP: {
+      int setup = v[0].intVal;
+      if ((setup & 0xf0000000) == 0x90000000) {
+        // Set read pitch
+        int pitch = (setup & 0x1fff);
+        s->readPitch = pitch;
+        return;
+      } else if ((setup & 0xc0000000) == 0) {
+        // QPU only allows two VPM loads queued at a time
+        assert(! s->vpmLoadQueue.isFull());
+        // Create VPM load request
+        VPMLoadReq req;
+        req.numVecs = (setup >> 20) & 0xf;
+        if (req.numVecs == 0) req.numVecs = 16;
+        req.hor = ((setup >> 11) & 1);
+        req.addr = setup & 0xff;
+        req.stride = (setup >> 12) & 0x3f;
+        if (req.stride == 0) req.stride = 64;
+        // Add VPM load request to queue
+        s->vpmLoadQueue.enq(req);
+        if (s->timing) s->timing->vpm_read_setup();
+        return;
+      } else if (setup & 0x80000000) {
+        // DMA load setup
+        DMALoadReq* req = &s->dmaLoadSetup;
+        req->rowLen = (setup >> 20) & 0xf;
+        if (req->rowLen == 0) req->rowLen = 16;
+        req->numRows = (setup >> 16) & 0xf;
+        if (req->numRows == 0) req->numRows = 16;
+        req->vpitch = (setup >> 12) & 0xf;
+        if (req->vpitch == 0) req->vpitch = 16;
+        req->hor = (setup & 0x800) ? false : true;
+        req->vpmAddr = (setup & 0x7ff);
+        return;
+      }
+      break;
+    }
 
-  switch (reg.tag) {
-    case NONE:
-      return v;
+    case SPECIAL_WR_SETUP: {
+      int setup = v[0].intVal;
+      if ((setup & 0xc0000000) == 0xc0000000) {
+        // Set write stride
+        int stride = setup & 0x1fff;
+        s->writeStride = stride;
+        return;
+      } else if ((setup & 0xc0000000) == 0x80000000) {
+        // DMA write setup
+        DMAStoreReq* req = &s->dmaStoreSetup;
+        req->rowLen = (setup >> 16) & 0x7f;
+        if (req->rowLen == 0) req->rowLen = 128;
+        req->numRows = (setup >> 23) & 0x7f;
+        if (req->numRows == 0) req->numRows = 128;
+        req->hor = (setup & 0x4000);
+        req->vpmAddr = (setup >> 3) & 0x7ff;
+        return;
+      } else if ((setup & 0xc0000000) == 0) {
+        VPMStoreReq req;
+        req.hor = (setup >> 11) & 1;
+        req.addr = setup & 0xff;
+        req.stride = (setup >> 12) & 0x3f;
+        if (req.stride == 0) req.stride = 64;
+        s->vpmStoreSetup = req;
+        return;
+      }
+      break;
+    }
 
-    case REG_A:
-      assert(r >= 0 && r < s->sizeRegFileA);
-      return s->regFileA[r];
-
-    case REG_B:
-      assert(r >= 0 && r < s->sizeRegFileB);
-      return s->regFileB[reg.regId];
-
-    case ACC:
-      assert(r >= 0 && r <= 5);
-      return s->accum[r];
-
-    case SPECIAL:
-      if (reg.regId == SPECIAL_ELEM_NUM) {
-        return EmuState::index_vec;
-      } else if (reg.regId == SPECIAL_UNIFORM) {
-        assertq(false, "readReg(): not expecting SPECIAL_UNIFORM to be handled any more");
-      } else if (reg.regId == SPECIAL_QPU_NUM) {
-        return Vec(s->id);
+    case SPECIAL_VPM_WRITE: {
+      std::lock_guard<std::mutex> lock(g->vpm_mutex);
+      VPMStoreReq* req = &s->vpmStoreSetup;
+      if (req->hor) {
+        // Horizontal store
+        for (int i = 0; i < NUM_LANES; i++) {
+          int index = (16*req->addr+i);
+          assert(index < VPM_SIZE);
+          g->vpm[index] = v[i];
+        }
       } else {
-        bool handled;
-        v = DMA_readReg(s, g, reg, handled);
-        if (handled) {
-          return v; // Return value unspecified, don't care at this point
+        // Vertical store
+        uint32_t x = req->addr & 0xf;
+        uint32_t y = req->addr >> 4;
+        for (int i = 0; i < NUM_LANES; i++) {
+          int index = (y*16*16 + x + i*16);
+          assert(index < VPM_SIZE);
+          g->vpm[index] = v[i];
         }
       }
-      fatal("V3DLib: can't read special register");
-      break;
+      req->addr = req->addr + req->stride;
+      return;
+    }
+
+    case SPECIAL_DMA_LD_ADDR: {
+      // Initiate DMA load
+      assert(!s->dmaLoad.active);
+      s->dmaLoad.active = true;
+      s->dmaLoad.addr   = v[0];
+      if (s->timing) s->timing->dma_start(true, s->dmaLoadSetup.numRows*s->dmaLoadSetup.rowLen);
+      return;
+    }
+
+    case SPECIAL_DMA_ST_ADDR: {
+      // Initiate DMA store
+      assert(!s->dmaStore.active);
+      s->dmaStore.active = true;
+      s->dmaStore.addr   = v[0];
+      if (s->timing) s->timing->dma_start(false, s->dmaStoreSetup.numRows*s->dmaStoreSetup.rowLen);
+      return;
+    }
+
+    case SPECIAL_HOST_INT: {
+      return;
+    }
+
+    case SPECIAL_TMU0_S: {
+      assert(s->loadBuffer.size() < 4);
+      Vec val;
+      {
+        std::lock_guard<std::mutex> lock(g->heap_mutex);
+        for (int i = 0; i < NUM_LANES; i++) {
+          uint32_t a = (uint32_t) v[i].intVal;
+          val[i].intVal = g->emuHeap.phy(a>>2);
+        }
+      }
+      s->loadBuffer.append(val);
+      if (s->timing) s->timing->tmu_load(v);
+      return;
+    }
 
     default:
-      break;  // Should not happen
+      if (s->sfu.writeReg(dest, v)) {
+        if (s->timing) s->timing->sfu_call();
+        return;
+      }
+      break;
   }
 
-  // Unreachable
-  assert(false);
-  return v;
+  assertq(false, "emulator: can not write to special register", true);
 }
 
 
@@ -311,22 +430,46 @@ Vec readReg(QPUState* s, State* g, Reg reg) {
 // Check condition flags
 // ============================================================================
 
-// Given an assignment condition and an vector index, determine if the
-// condition is true at that index using the implicit condition flags.
-
-inline bool checkAssignCond(QPUState* s, AssignCond cond, int i) {
-  using Tag = AssignCond::Tag;
-
-  switch (cond.tag) {
-    case Tag::NEVER:  return false;
-    case Tag::ALWAYS: return true;
-    case Tag::FLAG:
-      switch (cond.flag) {
-        case ZS: return  s->zeroFlags[i];
-        case ZC: return !s->zeroFlags[i];
-        case NS: return  s->negFlags[i];
-        case NC: return !s->negFlags[i];
+/**
+ * Get the flags to use for an assignment condition.
+ *
+ * @param invert  set to true if the lanes *not* set in the flags apply
+ *
+ * @return lane mask of the flags, nullptr for ALWAYS and NEVER
+ */
+Vec const *condFlags(QPUState const &s, EmuOp::Cond cond, bool &invert) {
+  invert = (cond == EmuOp::ZC || cond == EmuOp::NC);
+
+  switch (cond) {
+    case EmuOp::ZS:
+    case EmuOp::ZC: return &s.zeroFlags;
+    case EmuOp::NS:
+    case EmuOp::NC: return &s.negFlags;
+    default:        return nullptr;
+  }
+}
+
+
+/**
+ * Determine if a branch is taken, using the implicit condition flags.
+ */
+inline bool checkBranch(QPUState const &s, EmuOp const &op) {
+  switch (op.branch) {
+    case EmuOp::BR_ALWAYS: return true;
+    case EmuOp::BR_NEVER:  return false;
+
+    case EmuOp::BR_ALL:
+    case EmuOp::BR_ANY: {
+      bool invert;
+      Vec const *flags = condFlags(s, op.cond, invert);
+      assert(flags != nullptr);
+
+      if (op.branch == EmuOp::BR_ALL) {
+        return invert? !lanes::any(*flags) : lanes::all(*flags);
+      } else {
+        return invert? !lanes::all(*flags) : lanes::any(*flags);
       }
+    }
   }
 
   // Unreachable
@@ -335,259 +478,316 @@ inline bool checkAssignCond(QPUState* s, AssignCond cond, int i) {
 }
 
 
+inline Vec const &readSrc(QPUState &s, State &g, EmuProgram const &prog, EmuSrc const &src, Vec &tmp) {
+  switch (src.file) {
+    case EmuSrc::QPU:   return s.regs[src.index];
+    case EmuSrc::CONST: return prog.consts[src.index];
+    default:
+      tmp = readSpecial(&s, &g, prog.specials[src.index]);
+      return tmp;
+  }
+}
+
+
 /**
- * Given a branch condition, determine if it evaluates to true using
- * the implicit condition flags.
+ * Write the result of a micro-op to its destination
  */
-inline bool checkBranchCond(QPUState* s, BranchCond cond) {
-  bool bools[NUM_LANES];
-
-  auto set_bools = [&bools] (QPUState *s, BranchCond const &cond) {
-    for (int i = 0; i < NUM_LANES; i++)
-      switch (cond.flag) {
-        case ZS: bools[i] =  s->zeroFlags[i]; break;
-        case ZC: bools[i] = !s->zeroFlags[i]; break;
-        case NS: bools[i] =  s->negFlags[i];  break;
-        case NC: bools[i] = !s->negFlags[i];  break;
-        default: assert(false); break;
-      }
+inline void writeDst(QPUState &s, State &g, EmuProgram const &prog, EmuOp const &op, Vec const &v) {
+  if (op.dst.file == EmuSrc::SPECIAL) {
+    writeSpecial(&s, &g, prog.specials[op.dst.index], v);
+    return;
+  }
+
+  assert(op.dst.file == EmuSrc::QPU);
+  Vec &w = s.regs[op.dst.index];
+
+  if (op.cond == EmuOp::ALWAYS && !op.set_flags) {
+    w = v;
+    return;
+  }
+
+  if (op.cond == EmuOp::NEVER) return;
+
+  Vec mask(-1);
+  bool invert = false;
+  Vec const *flags = condFlags(s, op.cond, invert);
+  if (flags != nullptr) mask = *flags;  // Copy, flags may get updated below
+
+  auto select = [&mask, invert] (Vec &dst, Vec const &src) {
+    if (invert) {
+      lanes::select_not(dst, mask, src);
+    } else {
+      lanes::select(dst, mask, src);
+    }
   };
 
-  switch (cond.tag) {
-    case BranchCond::COND_ALWAYS: return true;
-    case BranchCond::COND_NEVER: return false;
-    case BranchCond::COND_ALL:
-      set_bools(s, cond);
+  select(w, v);
 
-      for (int i = 0; i < NUM_LANES; i++)
-        if (!bools[i]) return false;
-      return true;
+  if (op.set_flags) {
+    Vec tmp;
+    lanes::is_zero(tmp, v);
+    select(s.zeroFlags, tmp);
+    lanes::is_negative(tmp, v);
+    select(s.negFlags, tmp);
+  }
+}
 
-    case BranchCond::COND_ANY:
-      set_bools(s, cond);
 
-      for (int i = 0; i < NUM_LANES; i++)
-        if (bools[i]) return true;
-      return false;
+/**
+ * Perform a semaphore instruction
+ *
+ * @return true if the instruction needs to be retried, false otherwise
+ */
+bool sema(QPUState &s, State &g, int sema_id, bool inc) {
+  if (s.timing) s.timing->sema_release(sema_id);
+
+  bool retry = inc? g.sema_inc(sema_id) : g.sema_dec(sema_id);
 
-    default:
-      assertq(false, "checkBranchCond(): unexpected value");
-      return false;
+  if (s.timing) {
+    if (retry) {
+      s.timing->retry();
+    } else {
+      s.timing->sema_acquire(sema_id);
+    }
   }
+
+  return retry;
 }
 
 
 /**
- * Write a vector to a register
+ * Rotate a vector, same as in `Vec::apply()`
  */
-void writeReg(QPUState* s, State* g, bool setFlags, AssignCond cond, Reg dest, Vec v) {
-  switch (dest.tag) {
-    case REG_A:
-    case REG_B:
-    case ACC:
-    case NONE:
-      Vec* w;
-
-      if (dest.tag == REG_A) {
-        assert(dest.regId >= 0 && dest.regId < s->sizeRegFileA);
-        w = &s->regFileA[dest.regId];
-      } else if (dest.tag == REG_B) {
-        assert(dest.regId >= 0 && dest.regId < s->sizeRegFileB);
-        w = &s->regFileB[dest.regId];
-      } else if (dest.tag == ACC) {
-        assert(dest.regId >= 0 && dest.regId <= 5);
-        w = &s->accum[dest.regId];
-      }
-      
-      for (int i = 0; i < NUM_LANES; i++)
-        if (checkAssignCond(s, cond, i)) {
-          Word x = v[i];
-          if (dest.tag != NONE) w->get(i) = x;
-
-          if (setFlags) {
-            s->zeroFlags[i] = x.intVal == 0;
-            s->negFlags[i]  = x.intVal < 0;
-          }
-        }
+Vec rotate(Vec const &v, Vec const &amount) {
+  assert(amount.is_uniform());
+  int n = amount[0].intVal;
+
+  Vec w;
+  for (int i = 0; i < NUM_LANES; i++)
+    w[(i+n) % NUM_LANES] = v[i];
+  return w;
+}
 
-      return;
 
-    case SPECIAL:
-      switch (dest.regId) {
-        case SPECIAL_RD_SETUP: {
-          int setup = v[0].intVal;
-          if ((setup & 0xf0000000) == 0x90000000) {
-            // Set read pitch
-            int pitch = (setup & 0x1fff);
-            s->readPitch = pitch;
-            return;
-          } else if ((setup & 0xc0000000) == 0) {
-            // QPU only allows two VPM loads queued at a time
-            assert(! s->vpmLoadQueue.isFull());
-            // Create VPM load request
-            VPMLoadReq req;
-            req.numVecs = (setup >> 20) & 0xf;
-            if (req.numVecs == 0) req.numVecs = 16;
-            req.hor = ((setup >> 11) & 1);
-            req.addr = setup & 0xff;
-            req.stride = (setup >> 12) & 0x3f;
-            if (req.stride == 0) req.stride = 64;
-            // Add VPM load request to queue
-            s->vpmLoadQueue.enq(req);
-            return;
-          } else if (setup & 0x80000000) {
-            // DMA load setup
-            DMALoadReq* req = &s->dmaLoadSetup;
-            req->rowLen = (setup >> 20) & 0xf;
-            if (req->rowLen == 0) req->rowLen = 16;
-            req->numRows = (setup >> 16) & 0xf;
-            if (req->numRows == 0) req->numRows = 16;
-            req->vpitch = (setup >> 12) & 0xf;
-            if (req->vpitch == 0) req->vpitch = 16;
-            req->hor = (setup & 0x800) ? false : true;
-            req->vpmAddr = (setup & 0x7ff);
-            return;
-          }
-          break;
-        }
+//
+// Dispatch of micro-ops.
+//
+// With gcc and clang, dispatch is done with computed goto's (a gcc extension),
+// each handler jumps directly to the handler of the next micro-op.
+// Otherwise, a regular switch is used.
+//
+#if defined(__GNUC__)
+#define EMU_THREADED
+#endif
 
-        case SPECIAL_WR_SETUP: {
-          int setup = v[0].intVal;
-          if ((setup & 0xc0000000) == 0xc0000000) {
-            // Set write stride
-            int stride = setup & 0x1fff;
-            s->writeStride = stride;
-            return;
-          } else if ((setup & 0xc0000000) == 0x80000000) {
-            // DMA write setup
-            DMAStoreReq* req = &s->dmaStoreSetup;
-            req->rowLen = (setup >> 16) & 0x7f;
-            if (req->rowLen == 0) req->rowLen = 128;
-            req->numRows = (setup >> 23) & 0x7f;
-            if (req->numRows == 0) req->numRows = 128;
-            req->hor = (setup & 0x4000);
-            req->vpmAddr = (setup >> 3) & 0x7ff;
-            return;
-          } else if ((setup & 0xc0000000) == 0) {
-            VPMStoreReq req;
-            req.hor = (setup >> 11) & 1;
-            req.addr = setup & 0xff;
-            req.stride = (setup >> 12) & 0x3f;
-            if (req.stride == 0) req.stride = 64;
-            s->vpmStoreSetup = req;
-            return;
-          }
-          break;
-        }
+#ifdef EMU_THREADED
+#define CASE(x)    L_##x:
+#define DISPATCH() goto *labels[op->code]
+#else
+#define CASE(x)    case EmuOp::x:
+#define DISPATCH() goto dispatch
+#endif
 
-        case SPECIAL_VPM_WRITE: {
-          VPMStoreReq* req = &s->vpmStoreSetup;
-          if (req->hor) {
-            // Horizontal store
-            for (int i = 0; i < NUM_LANES; i++) {
-              int index = (16*req->addr+i);
-              assert(index < VPM_SIZE);
-              g->vpm[index] = v[i];
-            }
-          } else {
-            // Vertical store
-            uint32_t x = req->addr & 0xf;
-            uint32_t y = req->addr >> 4;
-            for (int i = 0; i < NUM_LANES; i++) {
-              int index = (y*16*16 + x + i*16);
-              assert(index < VPM_SIZE);
-              g->vpm[index] = v[i];
-            }
-          }
-          req->addr = req->addr + req->stride;
-          return;
-        }
+#ifdef DEBUG
+#define CHECK_BREAKPOINT() \
+  if (op->break_point) { \
+    printf("Emulator: hit breakpoint\n"); \
+    breakpoint \
+  }
+#else
+#define CHECK_BREAKPOINT()
+#endif
 
-        case SPECIAL_DMA_LD_ADDR: {
-          // Initiate DMA load
-          assert(!s->dmaLoad.active);
-          s->dmaLoad.active = true;
-          s->dmaLoad.addr   = v[0];
-          return;
-        }
+#define NEXT() \
+  if (--max_steps < 0) return; \
+  s.upkeep(); \
+  assert(s.pc < (int) prog.ops.size()); \
+  op = &ops[s.pc++]; \
+  if (s.timing) s.timing->issue(*op); \
+  CHECK_BREAKPOINT() \
+  DISPATCH()
+
+#define SRC_A() Vec const &a = readSrc(s, g, prog, op->a, tmp_a)
+#define SRC_B() Vec const &b = readSrc(s, g, prog, op->b, tmp_b)
+
+// Lane-wise binary operation
+#define BINOP(name, fn) \
+  CASE(name) { \
+    SRC_A(); \
+    SRC_B(); \
+    Vec res; \
+    lanes::fn(res, a, b); \
+    writeDst(s, g, prog, *op, res); \
+  } \
+  NEXT();
+
+// Lane-wise unary operation; src b is still read, in case it is a special register with side effects
+#define UNOP(name, fn) \
+  CASE(name) { \
+    SRC_A(); \
+    SRC_B(); \
+    (void) b; \
+    Vec res; \
+    lanes::fn(res, a); \
+    writeDst(s, g, prog, *op, res); \
+  } \
+  NEXT();
 
-        case SPECIAL_DMA_ST_ADDR: {
-          // Initiate DMA store
-          assert(!s->dmaStore.active);
-          s->dmaStore.active = true;
-          s->dmaStore.addr   = v[0];
-          return;
-        }
 
-        case SPECIAL_HOST_INT: {
-          return;
-        }
+/**
+ * Run micro-ops on given QPU.
+ *
+ * Returns when the QPU halts, or when `max_steps` micro-ops have been executed.
+ */
+void run(QPUState &s, State &g, EmuProgram const &prog, int max_steps) {
+  EmuOp const *ops = prog.ops.data();
+  EmuOp const *op  = nullptr;
+  Vec tmp_a;
+  Vec tmp_b;
+
+#ifdef EMU_THREADED
+  // Order must be the same as in enum EmuOp::Code
+  static void *const labels[EmuOp::NUM_CODES] = {
+    &&L_NOP, &&L_MOV, &&L_UNIFORM,
+    &&L_FADD, &&L_FSUB, &&L_FMIN, &&L_FMAX, &&L_FTOI, &&L_ITOF, &&L_FMUL,
+    &&L_ADD, &&L_SUB, &&L_SHR, &&L_ASR, &&L_SHL, &&L_MIN, &&L_MAX, &&L_BAND, &&L_BOR, &&L_BXOR, &&L_BNOT,
+    &&L_MUL24, &&L_ROTATE, &&L_ALU,
+    &&L_BRANCH, &&L_JUMP, &&L_RECV, &&L_SINC, &&L_SDEC, &&L_END, &&L_LABEL
+  };
+#endif
 
-        case SPECIAL_TMU0_S: {
-          assert(s->loadBuffer.size() < 4);
-          Vec val;
-          for (int i = 0; i < NUM_LANES; i++) {
-            uint32_t a = (uint32_t) v[i].intVal;
-            val[i].intVal = g->emuHeap.phy(a>>2);
-          }
-          s->loadBuffer.append(val);
-          return;
-        }
+  NEXT();
 
-        default:
-          if (s->sfu.writeReg(dest, v)) {
-            return;
-          }
-          break;
-      }
+#ifndef EMU_THREADED
+dispatch:
+  switch (op->code) {
+#endif
 
-      assertq(false, "emulator: can not write to special register", true);
-      return;
+  CASE(NOP) NEXT();
 
-    default:
-      assertq(false, "emulator: unexpected dest tag");
-      break;
+  CASE(MOV) {
+    SRC_A();
+    writeDst(s, g, prog, *op, a);
   }
-}
+  NEXT();
 
+  CASE(UNIFORM) {
+    Vec a = g.get_uniform(s.id, s.nextUniform);
+    Vec res;
+    res.apply(ALUOp(op->alu_op), a, a);
+    writeDst(s, g, prog, *op, res);
+  }
+  NEXT();
+
+  BINOP(FADD,  fadd)
+  BINOP(FSUB,  fsub)
+  BINOP(FMIN,  fmin)
+  BINOP(FMAX,  fmax)
+  UNOP(FTOI,   ftoi)
+  UNOP(ITOF,   itof)
+  BINOP(FMUL,  fmul)
+  BINOP(ADD,   add)
+  BINOP(SUB,   sub)
+  BINOP(SHR,   shr)
+  BINOP(ASR,   asr)
+  BINOP(SHL,   shl)
+  BINOP(MIN,   min)
+  BINOP(MAX,   max)
+  BINOP(BAND,  band)
+  BINOP(BOR,   bor)
+  BINOP(BXOR,  bxor)
+  UNOP(BNOT,   bnot)
+  BINOP(MUL24, mul24)
+
+  CASE(ROTATE) {
+    SRC_A();
+    SRC_B();
+    writeDst(s, g, prog, *op, rotate(a, b));
+  }
+  NEXT();
+
+  CASE(ALU) {
+    SRC_A();
+    SRC_B();
+    Vec res;
+    res.apply(ALUOp(op->alu_op), a, b);
+    writeDst(s, g, prog, *op, res);
+  }
+  NEXT();
 
-// ============================================================================
-// Interpret a small immediate operand
-// ============================================================================
+  CASE(BRANCH)
+    if (checkBranch(s, *op)) {
+      s.pc = op->target;
+      if (s.timing) s.timing->branch_taken();
+    }
+  NEXT();
 
-Vec evalSmallImm(QPUState* s, EncodedSmallImm imm) {
-  Vec v;
-  Word w = decodeSmallLit(imm.val);
+  CASE(JUMP)
+    s.pc = op->target;
+  NEXT();
 
-  for (int i = 0; i < NUM_LANES; i++) {
-    v[i] = w;
+  CASE(RECV) {                           // receive load-via-TMU response
+    assert(s.loadBuffer.size() > 0);
+    if (s.timing) s.timing->tmu_receive();
+    Vec val = s.loadBuffer.remove(0);
+    writeDst(s, g, prog, *op, val);
   }
+  NEXT();
 
-  return v;
-}
+  CASE(SINC) if (sema(s, g, op->target, true))  s.pc--; NEXT();
+  CASE(SDEC) if (sema(s, g, op->target, false)) s.pc--; NEXT();
+
+  CASE(END)                              // End program (halt)
+    s.running = false;
+    return;
 
+  CASE(LABEL)
+    fatal("V3DLib: emulator does not support labels");
+    return;
 
-Vec readRegOrImm(QPUState* s, State &state, RegOrImm const &src) {
-  if (src.is_reg()) {
-    return readReg(s, &state, src.reg());
-  } else {
-    return evalSmallImm(s, src.imm());
+#ifndef EMU_THREADED
+  default:
+    assert(false);
+    return;
   }
+#endif
 }
 
+#undef UNOP
+#undef BINOP
+#undef SRC_B
+#undef SRC_A
+#undef NEXT
+#undef CHECK_BREAKPOINT
+#undef DISPATCH
+#undef CASE
+
+}  // anon namespace
+
 
 // ============================================================================
 // Emulator
 // ============================================================================
 
 /**
+ * Emulate the execution of vc4 target code.
+ *
+ * The instruction list is first lowered to a list of micro-ops, in which all decoding
+ * has been done. This is what is actually executed.
+ *
+ * With multiple QPUs, all QPUs run in lockstep on the calling thread, or each QPU runs on
+ * its own host thread if `LibSettings::emu_lockstep()` is off. See `EmuState::run()`.
+ *
  * @param numQPUs   Number of QPUs active
  * @param instrs    Instruction sequence
  * @param maxReg    Max reg id used
  * @param uniforms  Kernel parameters
  * @param heap
+ * @param timing    If not null, run the timing model and put the results here
  */
-void emulate(int numQPUs, Instr::List &instrs, int maxReg, IntList &uniforms, BufferObject &heap) {
+void emulate(int numQPUs, Instr::List &instrs, int maxReg, IntList &uniforms, BufferObject &heap, EmuTiming *timing) {
+  EmuProgram prog(instrs, maxReg);
+
   State state(numQPUs, uniforms);
   state.emuHeap.heap_view(heap);
 
@@ -595,108 +795,22 @@ void emulate(int numQPUs, Instr::List &instrs, int maxReg, IntList &uniforms, Bu
   for (int i = 0; i < numQPUs; i++) {
     QPUState &q = state.qpu[i];
     q.id                 = i;
-    q.init(maxReg);
+    q.init(prog);
   }
 
-  bool anyRunning = true;
+  if (timing != nullptr) {
+    timing->qpus.assign(numQPUs, EmuTiming::Item());
 
-  while (anyRunning) {
-    auto ALWAYS = AssignCond::Tag::ALWAYS;
-    anyRunning = false;
-
-    // Execute an instruction in each active QPU
     for (int i = 0; i < numQPUs; i++) {
-      QPUState* s = &state.qpu[i];
-
-      if (s->running) {
-        anyRunning = true;
-        assert(s->pc < instrs.size());
-
-        s->upkeep();
-
-        //
-        // Run next instruction
-        //
-        Instr const instr = instrs.get(s->pc++);
-
-        if (instr.break_point()) {
-#ifdef DEBUG
-          printf("Emulator: hit breakpoint\n");
-          breakpoint
-#endif
-        }
-
-        switch (instr.tag) {
-          case LI: {
-            Vec imm(instr.LI.imm);
-            writeReg(s, &state, instr.set_cond().flags_set(), instr.assign_cond(), instr.dest(), imm);
-          }
-          break;
-
-          case ALU:
-          if (!instr.ALU.op.isNOP()) {
-            Vec a;
-            Vec b;
-
-            if (instr.isUniformLoad()) {
-              a = state.get_uniform(s->id, s->nextUniform);
-              b = a; 
-            } else {
-              a = readRegOrImm(s, state, instr.ALU.srcA);
-              b = readRegOrImm(s, state, instr.ALU.srcB);
-            }
-
-            Vec result;
-            result.apply(instr.ALU.op, a, b);
-
-            writeReg(s, &state, instr.set_cond().flags_set(), instr.assign_cond(), instr.dest(), result);
-          }
-          break;
-
-          case BR: {  // Branch to target
-            if (checkBranchCond(s, instr.branch_cond())) {
-              BranchTarget t = instr.branch_target();
-              if (t.relative && !t.useRegOffset) {
-                s->pc += 3+t.immOffset;
-              } else {
-                fatal("V3DLib: found unsupported form of branch target");
-              }
-            }
-          }
-          break;
-
-          case RECV: {                             // receive load-via-TMU response
-            assert(s->loadBuffer.size() > 0);
-            Vec val = s->loadBuffer.remove(0);
-            AssignCond always;
-            always.tag = ALWAYS;
-            writeReg(s, &state, false, always, instr.dest(), val);
-          }
-          break;
-
-          case SINC: if (state.sema_inc(instr.semaId)) s->pc--; break;
-          case SDEC: if (state.sema_dec(instr.semaId)) s->pc--; break;
-
-          case END:                                // End program (halt)
-            s->running = false;
-            break;
-
-          case BRL:                                // Branch to label
-          case LAB:                                // Label
-            fatal("V3DLib: emulator does not support labels");
-            // Fall-thru
-          case NO_OP:
-          case IRQ:
-          case INIT_BEGIN:
-          case INIT_END:
-            break;  // ignore
-
-          default: assert(false);
-        }
-      }
+      state.qpu[i].timing.reset(new QPUTiming(timing->qpus[i], state.timing, prog));
     }
   }
+
+  state.run([&state, &prog] (int qpu, int max_steps) {
+    QPUState &s = state.qpu[qpu];
+    run(s, state, prog, max_steps);
+    return s.running;
+  });
 }
 
 }  // namespace V3DLib
-
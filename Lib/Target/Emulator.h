@@ -1,12 +1,14 @@
 #ifndef _V3DLIB_TARGET_EMULATOR_H_
 #define _V3DLIB_TARGET_EMULATOR_H_
 #include "instr/Instr.h"
+#include "EmuTiming.h"
 
 namespace V3DLib {
 
 class BufferObject;
 
-void emulate(int numQPUs, Instr::List &instrs, int maxReg, IntList &uniforms, BufferObject &heap);
+void emulate(int numQPUs, Instr::List &instrs, int maxReg, IntList &uniforms, BufferObject &heap,
+             EmuTiming *timing = nullptr);
 
 }  // namespace V3DLib
 
@@ -0,0 +1,414 @@
+#include "LaneOps.h"
+#include <cstring>  // memcpy()
+
+//
+// Select implementation.
+//
+// Define V3DLIB_LANES_SCALAR to force the scalar implementation.
+//
+// NEON is only used on aarch64; on 32-bit ARM, NEON float operations are not IEEE-compliant
+// (denormals are flushed to zero), so the results would differ from the scalar code.
+//
+#if defined(V3DLIB_LANES_SCALAR)
+#define LANES_SCALAR
+#elif defined(__AVX2__)
+#define LANES_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define LANES_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define LANES_NEON
+#include <arm_neon.h>
+#else
+#define LANES_SCALAR
+#endif
+
+// Make sure the primitives are inlined, also in non-optimized builds
+#if defined(__GNUC__)
+#define PRIM static inline __attribute__((always_inline))
+#else
+#define PRIM static inline
+#endif
+
+namespace V3DLib {
+namespace lanes {
+namespace {
+
+///////////////////////////////////////////////////////////////////////////////
+// Primitives
+//
+// Type R is a chunk of W lanes. Masks are R's with lanes 0 or all bits set.
+///////////////////////////////////////////////////////////////////////////////
+
+#if defined(LANES_AVX2)
+
+char const *const ISA = "avx2";
+int const W = 8;
+using R = __m256i;
+
+PRIM R ld(Word const *p)     { return _mm256_loadu_si256((__m256i const *) p); }
+PRIM void st(Word *p, R a)   { _mm256_storeu_si256((__m256i *) p, a); }
+PRIM R set1(int32_t val)     { return _mm256_set1_epi32(val); }
+PRIM __m256 f(R a)           { return _mm256_castsi256_ps(a); }
+PRIM R i(__m256 a)           { return _mm256_castps_si256(a); }
+
+PRIM R iadd(R a, R b)        { return _mm256_add_epi32(a, b); }
+PRIM R isub(R a, R b)        { return _mm256_sub_epi32(a, b); }
+PRIM R mullo(R a, R b)       { return _mm256_mullo_epi32(a, b); }
+PRIM R and_(R a, R b)        { return _mm256_and_si256(a, b); }
+PRIM R or_(R a, R b)         { return _mm256_or_si256(a, b); }
+PRIM R xor_(R a, R b)        { return _mm256_xor_si256(a, b); }
+PRIM R sel(R m, R a, R b)    { return _mm256_blendv_epi8(b, a, m); }
+PRIM R ieq(R a, R b)         { return _mm256_cmpeq_epi32(a, b); }
+PRIM R igt(R a, R b)         { return _mm256_cmpgt_epi32(a, b); }
+
+PRIM R shl(R a, R n)         { return _mm256_sllv_epi32(a, and_(n, set1(31))); }
+PRIM R shr(R a, R n)         { return _mm256_srlv_epi32(a, and_(n, set1(31))); }
+PRIM R asr(R a, R n)         { return _mm256_srav_epi32(a, and_(n, set1(31))); }
+
+PRIM R fadd(R a, R b)        { return i(_mm256_add_ps(f(a), f(b))); }
+PRIM R fsub(R a, R b)        { return i(_mm256_sub_ps(f(a), f(b))); }
+PRIM R fmul(R a, R b)        { return i(_mm256_mul_ps(f(a), f(b))); }
+PRIM R flt(R a, R b)         { return i(_mm256_cmp_ps(f(a), f(b), _CMP_LT_OQ)); }
+PRIM R fle(R a, R b)         { return i(_mm256_cmp_ps(f(a), f(b), _CMP_LE_OQ)); }
+PRIM R feq(R a, R b)         { return i(_mm256_cmp_ps(f(a), f(b), _CMP_EQ_OQ)); }
+PRIM R ftoi(R a)             { return _mm256_cvttps_epi32(f(a)); }
+PRIM R itof(R a)             { return i(_mm256_cvtepi32_ps(a)); }
+
+#elif defined(LANES_SSE2)
+
+char const *const ISA = "sse2";
+int const W = 4;
+using R = __m128i;
+
+PRIM R ld(Word const *p)     { return _mm_loadu_si128((__m128i const *) p); }
+PRIM void st(Word *p, R a)   { _mm_storeu_si128((__m128i *) p, a); }
+PRIM R set1(int32_t val)     { return _mm_set1_epi32(val); }
+PRIM __m128 f(R a)           { return _mm_castsi128_ps(a); }
+PRIM R i(__m128 a)           { return _mm_castps_si128(a); }
+
+PRIM R iadd(R a, R b)        { return _mm_add_epi32(a, b); }
+PRIM R isub(R a, R b)        { return _mm_sub_epi32(a, b); }
+PRIM R and_(R a, R b)        { return _mm_and_si128(a, b); }
+PRIM R or_(R a, R b)         { return _mm_or_si128(a, b); }
+PRIM R xor_(R a, R b)        { return _mm_xor_si128(a, b); }
+PRIM R sel(R m, R a, R b)    { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+PRIM R ieq(R a, R b)         { return _mm_cmpeq_epi32(a, b); }
+PRIM R igt(R a, R b)         { return _mm_cmpgt_epi32(a, b); }
+
+/**
+ * SSE2 has no 32-bit multiply, combine the 64-bit products of the even and odd lanes
+ */
+PRIM R mullo(R a, R b) {
+  R even = _mm_mul_epu32(a, b);
+  R odd  = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+//
+// SSE2 has no shifts with a shift amount per lane
+//
+#define SSE2_SHIFT(name, expr) \
+PRIM R name(R a, R n) { \
+  int32_t x[W]; \
+  int32_t y[W]; \
+  _mm_storeu_si128((__m128i *) x, a); \
+  _mm_storeu_si128((__m128i *) y, n); \
+  for (int k = 0; k < W; k++) { \
+    int32_t s = y[k] & 31; \
+    x[k] = (expr); \
+  } \
+  return _mm_loadu_si128((__m128i const *) x); \
+}
+
+SSE2_SHIFT(shl, (int32_t) ((uint32_t) x[k] << s))
+SSE2_SHIFT(shr, (int32_t) ((uint32_t) x[k] >> s))
+SSE2_SHIFT(asr, x[k] >> s)
+
+#undef SSE2_SHIFT
+
+PRIM R fadd(R a, R b)        { return i(_mm_add_ps(f(a), f(b))); }
+PRIM R fsub(R a, R b)        { return i(_mm_sub_ps(f(a), f(b))); }
+PRIM R fmul(R a, R b)        { return i(_mm_mul_ps(f(a), f(b))); }
+PRIM R flt(R a, R b)         { return i(_mm_cmplt_ps(f(a), f(b))); }
+PRIM R fle(R a, R b)         { return i(_mm_cmple_ps(f(a), f(b))); }
+PRIM R feq(R a, R b)         { return i(_mm_cmpeq_ps(f(a), f(b))); }
+PRIM R ftoi(R a)             { return _mm_cvttps_epi32(f(a)); }
+PRIM R itof(R a)             { return i(_mm_cvtepi32_ps(a)); }
+
+#elif defined(LANES_NEON)
+
+char const *const ISA = "neon";
+int const W = 4;
+using R = int32x4_t;
+
+PRIM R ld(Word const *p)     { return vld1q_s32((int32_t const *) p); }
+PRIM void st(Word *p, R a)   { vst1q_s32((int32_t *) p, a); }
+PRIM R set1(int32_t val)     { return vdupq_n_s32(val); }
+PRIM float32x4_t f(R a)      { return vreinterpretq_f32_s32(a); }
+PRIM uint32x4_t u(R a)       { return vreinterpretq_u32_s32(a); }
+PRIM R i(float32x4_t a)      { return vreinterpretq_s32_f32(a); }
+PRIM R i(uint32x4_t a)       { return vreinterpretq_s32_u32(a); }
+
+PRIM R iadd(R a, R b)        { return vaddq_s32(a, b); }
+PRIM R isub(R a, R b)        { return vsubq_s32(a, b); }
+PRIM R mullo(R a, R b)       { return vmulq_s32(a, b); }
+PRIM R and_(R a, R b)        { return vandq_s32(a, b); }
+PRIM R or_(R a, R b)         { return vorrq_s32(a, b); }
+PRIM R xor_(R a, R b)        { return veorq_s32(a, b); }
+PRIM R sel(R m, R a, R b)    { return vbslq_s32(u(m), a, b); }
+PRIM R ieq(R a, R b)         { return i(vceqq_s32(a, b)); }
+PRIM R igt(R a, R b)         { return i(vcgtq_s32(a, b)); }
+
+// Negative shift amounts shift right
+PRIM R shl(R a, R n)         { return i(vshlq_u32(u(a), and_(n, set1(31)))); }
+PRIM R shr(R a, R n)         { return i(vshlq_u32(u(a), vnegq_s32(and_(n, set1(31))))); }
+PRIM R asr(R a, R n)         { return vshlq_s32(a, vnegq_s32(and_(n, set1(31)))); }
+
+PRIM R fadd(R a, R b)        { return i(vaddq_f32(f(a), f(b))); }
+PRIM R fsub(R a, R b)        { return i(vsubq_f32(f(a), f(b))); }
+PRIM R fmul(R a, R b)        { return i(vmulq_f32(f(a), f(b))); }
+PRIM R flt(R a, R b)         { return i(vcltq_f32(f(a), f(b))); }
+PRIM R fle(R a, R b)         { return i(vcleq_f32(f(a), f(b))); }
+PRIM R feq(R a, R b)         { return i(vceqq_f32(f(a), f(b))); }
+PRIM R ftoi(R a)             { return vcvtq_s32_f32(f(a)); }
+PRIM R itof(R a)             { return i(vcvtq_f32_s32(a)); }
+
+#else  // LANES_SCALAR
+
+char const *const ISA = "scalar";
+int const W = 1;
+using R = int32_t;
+
+PRIM R ld(Word const *p)     { return p->intVal; }
+PRIM void st(Word *p, R a)   { p->intVal = a; }
+PRIM R set1(int32_t val)     { return val; }
+PRIM float f(R a)            { float x; memcpy(&x, &a, sizeof(x)); return x; }
+PRIM R i(float a)            { R x; memcpy(&x, &a, sizeof(x)); return x; }
+PRIM R m(bool b)             { return b?-1:0; }
+
+PRIM R iadd(R a, R b)        { return (R) ((uint32_t) a + (uint32_t) b); }
+PRIM R isub(R a, R b)        { return (R) ((uint32_t) a - (uint32_t) b); }
+PRIM R mullo(R a, R b)       { return (R) ((uint32_t) a * (uint32_t) b); }
+PRIM R and_(R a, R b)        { return a & b; }
+PRIM R or_(R a, R b)         { return a | b; }
+PRIM R xor_(R a, R b)        { return a ^ b; }
+PRIM R sel(R mask, R a, R b) { return mask?a:b; }
+PRIM R ieq(R a, R b)         { return m(a == b); }
+PRIM R igt(R a, R b)         { return m(a > b); }
+
+PRIM R shl(R a, R n)         { return (R) ((uint32_t) a << (n & 31)); }
+PRIM R shr(R a, R n)         { return (R) ((uint32_t) a >> (n & 31)); }
+PRIM R asr(R a, R n)         { return a >> (n & 31); }
+
+PRIM R fadd(R a, R b)        { return i(f(a) + f(b)); }
+PRIM R fsub(R a, R b)        { return i(f(a) - f(b)); }
+PRIM R fmul(R a, R b)        { return i(f(a) * f(b)); }
+PRIM R flt(R a, R b)         { return m(f(a) <  f(b)); }
+PRIM R fle(R a, R b)         { return m(f(a) <= f(b)); }
+PRIM R feq(R a, R b)         { return m(f(a) == f(b)); }
+PRIM R ftoi(R a)             { return (R) f(a); }
+PRIM R itof(R a)             { return i((float) a); }
+
+#endif
+
+
+//
+// Derived primitives
+//
+PRIM R not_(R a)             { return xor_(a, set1(-1)); }
+PRIM R nz(R a)               { return not_(ieq(a, set1(0))); }  // mask for non-zero lanes
+PRIM R to_bool(R mask)       { return and_(mask, set1(1)); }
+
+
+//
+// Kernel definitions. Output may be the same as one of the inputs.
+//
+#define UNARY(name, expr) \
+void name(Vec &d, Vec const &a) { \
+  Word *pd = d.data(); \
+  Word const *pa = a.data(); \
+  for (int k = 0; k < NUM_LANES; k += W) { \
+    R x = ld(pa + k); \
+    st(pd + k, (expr)); \
+  } \
+}
+
+#define BINARY(name, expr) \
+void name(Vec &d, Vec const &a, Vec const &b) { \
+  Word *pd = d.data(); \
+  Word const *pa = a.data(); \
+  Word const *pb = b.data(); \
+  for (int k = 0; k < NUM_LANES; k += W) { \
+    R x = ld(pa + k); \
+    R y = ld(pb + k); \
+    st(pd + k, (expr)); \
+  } \
+}
+
+}  // anon namespace
+
+
+char const *isa() { return ISA; }
+
+BINARY(fadd,  fadd(x, y))
+BINARY(fsub,  fsub(x, y))
+BINARY(fmul,  fmul(x, y))
+BINARY(fmin,  sel(flt(x, y), x, y))
+BINARY(fmax,  sel(flt(y, x), x, y))
+UNARY(ftoi,   ftoi(x))
+UNARY(itof,   itof(x))
+BINARY(add,   iadd(x, y))
+BINARY(sub,   isub(x, y))
+BINARY(shl,   shl(x, y))
+BINARY(shr,   shr(x, y))
+BINARY(asr,   asr(x, y))
+BINARY(min,   sel(igt(y, x), x, y))
+BINARY(max,   sel(igt(x, y), x, y))
+BINARY(band,  and_(x, y))
+BINARY(bor,   or_(x, y))
+BINARY(bxor,  xor_(x, y))
+UNARY(bnot,   not_(x))
+BINARY(mul24, mullo(and_(x, set1(0xffffff)), and_(y, set1(0xffffff))))
+
+UNARY(is_zero,     ieq(x, set1(0)))
+UNARY(is_negative, igt(set1(0), x))
+UNARY(mask_not,    not_(x))
+
+UNARY(bool_not,    to_bool(ieq(x, set1(0))))
+BINARY(bool_and,   to_bool(and_(nz(x), nz(y))))
+BINARY(bool_or,    to_bool(or_(nz(x), nz(y))))
+
+BINARY(icmp_eq,    to_bool(ieq(x, y)))
+BINARY(icmp_ne,    to_bool(not_(ieq(x, y))))
+BINARY(icmp_lt,    to_bool(igt(set1(0), isub(x, y))))
+BINARY(fcmp_eq,    to_bool(feq(x, y)))
+BINARY(fcmp_ne,    to_bool(not_(feq(x, y))))
+BINARY(fcmp_lt,    to_bool(flt(x, y)))
+BINARY(fcmp_le,    to_bool(fle(x, y)))
+
+#undef BINARY
+#undef UNARY
+
+
+/**
+ * Assign the lanes of `a` to `d` which are set in `mask`
+ */
+void select(Vec &d, Vec const &mask, Vec const &a) {
+  Word *pd = d.data();
+  Word const *pm = mask.data();
+  Word const *pa = a.data();
+
+  for (int k = 0; k < NUM_LANES; k += W) {
+    st(pd + k, sel(ld(pm + k), ld(pa + k), ld(pd + k)));
+  }
+}
+
+
+/**
+ * Assign the lanes of `a` to `d` which are not set in `mask`
+ */
+void select_not(Vec &d, Vec const &mask, Vec const &a) {
+  Word *pd = d.data();
+  Word const *pm = mask.data();
+  Word const *pa = a.data();
+
+  for (int k = 0; k < NUM_LANES; k += W) {
+    st(pd + k, sel(ld(pm + k), ld(pd + k), ld(pa + k)));
+  }
+}
+
+
+/**
+ * Assign the lanes of `a` to `d` for which `cond` is non-zero
+ */
+void bool_select(Vec &d, Vec const &cond, Vec const &a) {
+  Word *pd = d.data();
+  Word const *pc = cond.data();
+  Word const *pa = a.data();
+
+  for (int k = 0; k < NUM_LANES; k += W) {
+    st(pd + k, sel(nz(ld(pc + k)), ld(pa + k), ld(pd + k)));
+  }
+}
+
+
+/**
+ * @return true if any lane of `cond` is non-zero
+ */
+bool any(Vec const &cond) {
+  Word const *pc = cond.data();
+
+  R acc = set1(0);
+  for (int k = 0; k < NUM_LANES; k += W) {
+    acc = or_(acc, ld(pc + k));
+  }
+
+  Word tmp[W];
+  st(tmp, acc);
+  for (int k = 0; k < W; k++) {
+    if (tmp[k].intVal != 0) return true;
+  }
+
+  return false;
+}
+
+
+/**
+ * @return true if all lanes of `cond` are non-zero
+ */
+bool all(Vec const &cond) {
+  Word const *pc = cond.data();
+
+  R acc = set1(-1);
+  for (int k = 0; k < NUM_LANES; k += W) {
+    acc = and_(acc, nz(ld(pc + k)));
+  }
+
+  Word tmp[W];
+  st(tmp, acc);
+  for (int k = 0; k < W; k++) {
+    if (tmp[k].intVal == 0) return false;
+  }
+
+  return true;
+}
+
+
+/**
+ * Perform a lane-wise ALU operation
+ *
+ * @return true if op handled, false otherwise
+ */
+bool apply(ALUOp::Enum op, Vec &d, Vec const &a, Vec const &b) {
+  switch (op) {
+    case ALUOp::A_FADD:  fadd(d, a, b);  break;
+    case ALUOp::A_FSUB:  fsub(d, a, b);  break;
+    case ALUOp::A_FMIN:  fmin(d, a, b);  break;
+    case ALUOp::A_FMAX:  fmax(d, a, b);  break;
+    case ALUOp::A_FtoI:  ftoi(d, a);     break;
+    case ALUOp::A_ItoF:  itof(d, a);     break;
+    case ALUOp::M_FMUL:  fmul(d, a, b);  break;
+    case ALUOp::A_ADD:   add(d, a, b);   break;
+    case ALUOp::A_SUB:   sub(d, a, b);   break;
+    case ALUOp::A_SHR:   shr(d, a, b);   break;
+    case ALUOp::A_ASR:   asr(d, a, b);   break;
+    case ALUOp::A_SHL:   shl(d, a, b);   break;
+    case ALUOp::A_MIN:   min(d, a, b);   break;
+    case ALUOp::A_MAX:   max(d, a, b);   break;
+    case ALUOp::A_BAND:  band(d, a, b);  break;
+    case ALUOp::A_BOR:   bor(d, a, b);   break;
+    case ALUOp::A_BXOR:  bxor(d, a, b);  break;
+    case ALUOp::A_BNOT:  bnot(d, a);     break;
+    case ALUOp::M_MUL24: mul24(d, a, b); break;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+}  // namespace lanes
+}  // namespace V3DLib
@@ -0,0 +1,82 @@
+#ifndef _V3DLIB_TARGET_LANEOPS_H_
+#define _V3DLIB_TARGET_LANEOPS_H_
+#include "EmuSupport.h"
+#include "instr/ALUOp.h"
+
+namespace V3DLib {
+
+/**
+ * Operations on all lanes of a vector at once.
+ *
+ * These are used by both the emulator and the interpreter.
+ * The implementation is selected at build time: AVX2 or SSE2 on x86, NEON on aarch64,
+ * with a plain loop over the lanes as fallback. All implementations give bit-exact the
+ * same results as the scalar code.
+ *
+ * There are two kinds of condition vectors:
+ *
+ *   - masks: per lane 0 for false, all bits set (-1) for true. Used in the emulator.
+ *   - bools: per lane 0 for false, 1 for true. Used in the interpreter.
+ *
+ * Input for `bool_*()` may be any value, non-zero counts as true.
+ *
+ * NOTES
+ * =====
+ *
+ * * Shift amounts are taken modulo 32, as on the QPU's.
+ */
+namespace lanes {
+
+char const *isa();  // Name of the selected implementation
+
+// ALU operations
+void fadd(Vec &d, Vec const &a, Vec const &b);
+void fsub(Vec &d, Vec const &a, Vec const &b);
+void fmul(Vec &d, Vec const &a, Vec const &b);
+void fmin(Vec &d, Vec const &a, Vec const &b);
+void fmax(Vec &d, Vec const &a, Vec const &b);
+void ftoi(Vec &d, Vec const &a);
+void itof(Vec &d, Vec const &a);
+void add(Vec &d, Vec const &a, Vec const &b);
+void sub(Vec &d, Vec const &a, Vec const &b);
+void shl(Vec &d, Vec const &a, Vec const &b);
+void shr(Vec &d, Vec const &a, Vec const &b);
+void asr(Vec &d, Vec const &a, Vec const &b);
+void min(Vec &d, Vec const &a, Vec const &b);
+void max(Vec &d, Vec const &a, Vec const &b);
+void band(Vec &d, Vec const &a, Vec const &b);
+void bor(Vec &d, Vec const &a, Vec const &b);
+void bxor(Vec &d, Vec const &a, Vec const &b);
+void bnot(Vec &d, Vec const &a);
+void mul24(Vec &d, Vec const &a, Vec const &b);
+
+bool apply(ALUOp::Enum op, Vec &d, Vec const &a, Vec const &b);
+
+// Masks
+void is_zero(Vec &d, Vec const &a);
+void is_negative(Vec &d, Vec const &a);
+void mask_not(Vec &d, Vec const &a);
+void select(Vec &d, Vec const &mask, Vec const &a);
+void select_not(Vec &d, Vec const &mask, Vec const &a);
+bool any(Vec const &cond);
+bool all(Vec const &cond);
+
+// Bools
+void bool_select(Vec &d, Vec const &cond, Vec const &a);
+void bool_not(Vec &d, Vec const &a);
+void bool_and(Vec &d, Vec const &a, Vec const &b);
+void bool_or(Vec &d, Vec const &a, Vec const &b);
+
+// Comparisons, output is bools
+void icmp_eq(Vec &d, Vec const &a, Vec const &b);
+void icmp_ne(Vec &d, Vec const &a, Vec const &b);
+void icmp_lt(Vec &d, Vec const &a, Vec const &b);  // Sign of a - b, as generated by the compiler
+void fcmp_eq(Vec &d, Vec const &a, Vec const &b);
+void fcmp_ne(Vec &d, Vec const &a, Vec const &b);
+void fcmp_lt(Vec &d, Vec const &a, Vec const &b);
+void fcmp_le(Vec &d, Vec const &a, Vec const &b);
+
+}  // namespace lanes
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_TARGET_LANEOPS_H_
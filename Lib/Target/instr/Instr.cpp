@@ -1,4 +1,5 @@
 #include "Instr.h"         // Location of definition struct Instr
+#include <cstring>         // memcpy()
 #include "Support/debug.h"
 #include "Target/Pretty.h"  // pretty_instr_tag()
 #include "Support/basics.h"
@@ -254,6 +255,7 @@ void Instr::assign_cond(AssignCond rhs) { assert(tag == InstrTag::LI || tag == I
 AssignCond Instr::assign_cond() const   { assert(tag == InstrTag::LI || tag == InstrTag::ALU); return m_assign_cond; }
 
 BranchTarget Instr::branch_target() const { assert(tag == V3DLib::BR); return m_branch_target; }
+void Instr::branch_target(BranchTarget const &rhs) { assert(tag == V3DLib::BR); m_branch_target = rhs; }
 
 void  Instr::branch_label(Label rhs) { assert(tag == InstrTag::BRL); m_branch_label = rhs; }
 Label Instr::branch_label() const    { assert(tag == InstrTag::BRL); return m_branch_label; }
@@ -476,6 +478,253 @@ uint32_t Instr::get_acc_usage() const {
 }
 
 
+/**
+ * Pass the fields of this instruction as words to the given function.
+ *
+ * Only the fields relevant for the instruction tag are passed, so that the output is
+ * fully determined by the instruction. Comments and break points are skipped.
+ *
+ * This is the basis for serialization, hashing and comparison.
+ */
+template<typename F>
+void Instr::for_each_field(F &&put) const {
+  auto put_reg = [&put] (Reg const &reg) {
+    put((uint32_t) reg.tag);
+    put((uint32_t) reg.regId);
+    put(reg.isUniformPtr? 1u : 0u);
+  };
+
+  auto put_src = [&put, &put_reg] (RegOrImm const &src) {
+    put(src.is_reg()? 1u : 0u);
+
+    if (src.is_reg()) {
+      put_reg(src.reg());
+    } else {
+      put((uint32_t) src.imm().val);
+    }
+  };
+
+  // The flag fields are only written if relevant, they may be uninitialized otherwise
+  auto put_cond = [this, &put] () {
+    bool has_flag = (m_assign_cond.tag == AssignCond::FLAG);
+    put((uint32_t) m_assign_cond.tag);
+    put(has_flag? (uint32_t) m_assign_cond.flag : 0u);
+    put((uint32_t) m_set_cond.tag());
+  };
+
+  auto put_branch_cond = [this, &put] () {
+    bool has_flag = (m_branch_cond.tag == BranchCond::COND_ALL || m_branch_cond.tag == BranchCond::COND_ANY);
+    put((uint32_t) m_branch_cond.tag);
+    put(has_flag? (uint32_t) m_branch_cond.flag : 0u);
+  };
+
+  put((uint32_t) tag);
+
+  switch (tag) {
+    case InstrTag::LI: {
+      put_reg(m_dest);
+      put_cond();
+
+      Imm const &imm = LI.imm;
+      put((uint32_t) imm.tag());
+
+      if (imm.is_float()) {
+        float f = imm.floatVal();
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        put(bits);
+      } else {
+        put((uint32_t) imm.intVal());
+      }
+    }
+    break;
+
+    case InstrTag::ALU:
+      put_reg(m_dest);
+      put_cond();
+      put_src(ALU.srcA);
+      put((uint32_t) ALU.op.value());
+      put_src(ALU.srcB);
+      put(m_paired? 1u : 0u);
+      break;
+
+    case InstrTag::RECV:
+      put_reg(m_dest);
+      break;
+
+    case InstrTag::BR:
+      put_branch_cond();
+      put(m_branch_target.relative? 1u : 0u);
+      put(m_branch_target.useRegOffset? 1u : 0u);
+      put(m_branch_target.useRegOffset? (uint32_t) m_branch_target.regOffset : 0u);
+      put((uint32_t) m_branch_target.immOffset);
+      break;
+
+    case InstrTag::BRL:
+      put_branch_cond();
+      put((uint32_t) m_branch_label);
+      break;
+
+    case InstrTag::LAB:
+      put((uint32_t) m_label);
+      break;
+
+    case InstrTag::SINC:
+    case InstrTag::SDEC:
+      put((uint32_t) semaId);
+      break;
+
+    default:
+      break;  // Only the tag is relevant
+  }
+}
+
+
+/**
+ * Append the fields of this instruction to a word buffer.
+ *
+ * This is the inverse of `deserialize()`.
+ */
+void Instr::serialize(std::vector<uint32_t> &out) const {
+  for_each_field([&out] (uint32_t word) { out.push_back(word); });
+}
+
+
+/**
+ * Hash the fields of this instruction.
+ *
+ * The hash is stable over runs and continues from the passed seed, so that the hash
+ * of an instruction list can be built up per instruction.
+ * It is equal to the FNV-1a hash of the output of `serialize()`.
+ */
+uint64_t Instr::hash(uint64_t seed) const {
+  for_each_field([&seed] (uint32_t word) { seed = hash_words(seed, &word, 1); });
+  return seed;
+}
+
+
+/**
+ * Field-wise comparison.
+ *
+ * Only the fields relevant for the instruction tag are compared; comments are ignored.
+ */
+bool Instr::operator==(Instr const &rhs) const {
+  if (tag != rhs.tag) return false;
+
+  int const MAX_WORDS = 24;  // Enough for the largest instruction, ALU
+  uint32_t words[MAX_WORDS];
+  int count = 0;
+
+  for_each_field([&words, &count] (uint32_t word) {
+    assert(count < MAX_WORDS);
+    words[count++] = word;
+  });
+
+  int index = 0;
+  bool equal = true;
+
+  rhs.for_each_field([&words, &count, &index, &equal] (uint32_t word) {
+    if (index >= count || words[index] != word) equal = false;
+    index++;
+  });
+
+  return equal && index == count;
+}
+
+
+/**
+ * Read an instruction written by `serialize()`.
+ *
+ * @param p  position in word buffer, advanced past the instruction on return
+ */
+Instr Instr::deserialize(uint32_t const *&p) {
+  auto get_reg = [&p] () -> Reg {
+    Reg ret((RegTag) p[0], (RegId) p[1]);
+    ret.isUniformPtr = (p[2] != 0);
+    p += 3;
+    return ret;
+  };
+
+  auto get_src = [&p, &get_reg] () -> RegOrImm {
+    if (*p++ != 0) {
+      return RegOrImm(get_reg());
+    }
+
+    return RegOrImm((int) *p++);
+  };
+
+  Instr ret;
+  ret.tag = (InstrTag) *p++;  // All fields for the tag are set below, no need for the tag ctor
+
+  auto get_cond = [&p, &ret] () {
+    ret.m_assign_cond.tag  = (AssignCond::Tag) *p++;
+    ret.m_assign_cond.flag = (Flag) *p++;
+    ret.m_set_cond.tag((SetCond::Tag) *p++);
+  };
+
+  switch (ret.tag) {
+    case InstrTag::LI: {
+      ret.m_dest = get_reg();
+      get_cond();
+
+      auto imm_tag = (Imm::ImmTag) *p++;
+
+      if (imm_tag == Imm::IMM_FLOAT32) {
+        float f;
+        memcpy(&f, p, sizeof(f));
+        ret.LI.imm = Imm(f);
+      } else {
+        ret.LI.imm = Imm((int) *p);
+      }
+      p++;
+    }
+    break;
+
+    case InstrTag::ALU:
+      ret.m_dest = get_reg();
+      get_cond();
+      ret.ALU.srcA = get_src();
+      ret.ALU.op   = ALUOp((ALUOp::Enum) *p++);
+      ret.ALU.srcB = get_src();
+      ret.m_paired = (*p++ != 0);
+      break;
+
+    case InstrTag::RECV:
+      ret.m_dest = get_reg();
+      break;
+
+    case InstrTag::BR:
+      ret.m_branch_cond.tag            = (BranchCond::Tag) *p++;
+      ret.m_branch_cond.flag           = (Flag) *p++;
+      ret.m_branch_target.relative     = (*p++ != 0);
+      ret.m_branch_target.useRegOffset = (*p++ != 0);
+      ret.m_branch_target.regOffset    = (RegId) *p++;
+      ret.m_branch_target.immOffset    = (int) *p++;
+      break;
+
+    case InstrTag::BRL:
+      ret.m_branch_cond.tag  = (BranchCond::Tag) *p++;
+      ret.m_branch_cond.flag = (Flag) *p++;
+      ret.m_branch_label     = (Label) *p++;
+      break;
+
+    case InstrTag::LAB:
+      ret.m_label = (Label) *p++;
+      break;
+
+    case InstrTag::SINC:
+    case InstrTag::SDEC:
+      ret.semaId = (int) *p++;
+      break;
+
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Class Instr::List
 ///////////////////////////////////////////////////////////////////////////////
@@ -622,6 +871,12 @@ int Instr::List::get_free_acc(int first, int last) const {
     // Target     : LI ACC4 <- 0
     // vc4 opcodes: load_imm tmu_noswap, nop, 0x00000000 (0.000000)
     acc_use = acc_use & 0xf;   // r0-r3
+
+    // satisfy() uses r0 as scratch register for reg file conflicts.
+    // For ranges with intermediate instructions, these might clobber a value held in r0.
+    if (last - first > 1) {
+      acc_use = acc_use & ~1u;
+    }
   } else {
     acc_use = acc_use & 0x1f;  // r0-r4
   }
@@ -698,7 +953,9 @@ std::string Instr::mnemonic(bool with_comments, std::string const &prefix) const
     ret << emit_header();
   }
 
-  std::string out = pretty_instr(*this);
+  std::string out;
+  if (m_paired) out << "& ";  // Issued with previous instruction
+  out << pretty_instr(*this);
   ret << prefix << out;
 
   if (with_comments) {
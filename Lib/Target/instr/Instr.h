@@ -1,6 +1,7 @@
 #ifndef _V3DLIB_TARGET_INSTR_INSTR_H_
 #define _V3DLIB_TARGET_INSTR_INSTR_H_
 #include <set>
+#include <vector>
 #include "Support/InstructionComment.h"
 #include "Common/Seq.h"
 #include "Label.h"
@@ -8,6 +9,7 @@
 #include "Conditions.h"
 #include "ALUInstruction.h"
 #include "Support/RegIdSet.h"
+#include "Support/Hash.h"
 
 namespace V3DLib {
 
@@ -124,6 +126,10 @@ struct Instr : public InstructionComment {
   void break_point() { m_break_point = true; }
   bool break_point() const { return m_break_point; }
 
+  // vc4 only: instruction is issued together with the previous one, as an add/mul ALU pair
+  void paired(bool val) { assert(!val || tag == InstrTag::ALU); m_paired = val; }
+  bool paired() const { return m_paired; }
+
   // ==================================================
   // Helper methods
   // ==================================================
@@ -140,6 +146,7 @@ struct Instr : public InstructionComment {
   AssignCond assign_cond() const;
 
   BranchTarget branch_target() const;
+  void branch_target(BranchTarget const &rhs);
   Instr &branch_cond(BranchCond rhs);
   BranchCond branch_cond() const;
 
@@ -168,13 +175,11 @@ struct Instr : public InstructionComment {
   std::string mnemonic(bool with_comments = false, std::string const &pref = "") const;
   std::string dump() const;
   uint32_t get_acc_usage() const;
+  void serialize(std::vector<uint32_t> &out) const;
+  static Instr deserialize(uint32_t const *&p);
+  uint64_t hash(uint64_t seed = FNV_OFFSET) const;
 
-  bool operator==(Instr const &rhs) const {
-    // Cheat by comparing the string representation,
-    // to avoid having to check the union members separately, and to skip unused fields
-    return this->mnemonic() == rhs.mnemonic();
-  }
-
+  bool operator==(Instr const &rhs) const;
   bool operator!=(Instr const &rhs) const { return !(*this == rhs); }
 
   static Instr nop();
@@ -207,6 +212,7 @@ struct Instr : public InstructionComment {
 
 private:
   bool m_break_point = false;
+  bool m_paired      = false;
   SetCond    m_set_cond;
   AssignCond m_assign_cond;
   BranchCond m_branch_cond;
@@ -216,6 +222,8 @@ private:
   BranchTarget m_branch_target;
   Label        m_branch_label;      // Label to jump to in BRL instruction
   Label        m_label;             // Label denoting branch target
+
+  template<typename F> void for_each_field(F &&put) const;
 };
 
 
@@ -223,4 +231,14 @@ void check_zeroes(Instr::List const &instrs);
 
 }  // namespace V3DLib
 
+
+namespace std {
+
+template<>
+struct hash<V3DLib::Instr> {
+  size_t operator()(V3DLib::Instr const &instr) const { return (size_t) instr.hash(); }
+};
+
+}  // namespace std
+
 #endif  // _V3DLIB_TARGET_INSTR_INSTRUCTIONS_H_
@@ -3,7 +3,7 @@
 namespace V3DLib {
 namespace {
 
-int globalLabelId = 0;  // Used for fresh label generation
+thread_local int globalLabelId = 0;  // Used for fresh label generation, per compiling thread
 
 }  // anon namespace
 
@@ -2,6 +2,7 @@
 
 #include "BufferObject.h"
 #include <memory>
+#include <mutex>
 #include "Support/basics.h"
 #include "Support/Platform.h"  // has_vc4() 
 #include "v3d.h"
@@ -40,6 +41,13 @@ void BufferObject::alloc_mem(uint32_t size_in_bytes) {
 }
 
 
+V3DLib::BufferObject *BufferObject::new_segment(uint32_t size_in_bytes) {
+  auto *ret = new BufferObject();
+  ret->alloc(size_in_bytes);
+  return ret;
+}
+
+
 void BufferObject::dealloc_mem() {
   if (arm_base != nullptr) {
     assert(size() > 0);
@@ -114,11 +122,14 @@ namespace {
 
 // Defined as a smart ptr to avoid issues on program init
 std::unique_ptr<BufferObject> mainHeap;
+std::mutex heap_mutex;
 
 }
 
 
 BufferObject &BufferObject::getHeap() {
+  std::lock_guard<std::mutex> lock(heap_mutex);
+
   if (!Platform::has_vc4()) {
     if (!mainHeap) {
       //debug("Allocating main heap v3d\n");
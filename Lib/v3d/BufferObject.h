@@ -31,6 +31,7 @@ private:
   uint32_t handle  = 0;
 
   void alloc_mem(uint32_t size_in_bytes) override;
+  V3DLib::BufferObject *new_segment(uint32_t size_in_bytes) override;
   void dealloc_mem();
   uint32_t &operator[] (int i);
   uint32_t size_word() const { return (uint32_t) (size()/sizeof(uint32_t)); }  // Returns size in words
@@ -0,0 +1,720 @@
+///////////////////////////////////////////////////////////////////////////////
+// Emulator for v3d code
+//
+// This runs the actual opcodes as generated for the v3d, in contrast to the
+// emulator under `Target`, which runs vc4 target code.
+//
+// ----------------------------------------------------------------------------
+// NOTES
+// =====
+//
+// * The opcodes are decoded with the mesa library, the same code that is used
+//   for the disassembly of v3d code. They are decoded once, before running.
+//
+// * Within an instruction, all registers are read before any are written.
+//   This matters for combined add/mul instructions, e.g.:
+//
+//       shl  r1, r1, r0      ; mov  r0, 5
+//
+//   Signal writes (`ldunif`, `ldtmu` etc) are done after the alu writes.
+//
+// * TMU reads and writes complete immediately. The TMU FIFO is modelled, so
+//   that `ldtmu` returns the results in order of request.
+//
+// * The SFU result arrives in r4 two instructions after the SFU write.
+//
+// * Branches have three delay slots, these are executed.
+//
+// * Only the subset of the v3d instruction set which is generated by V3DLib
+//   is supported. Unsupported opcodes and signals result in a fatal error.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include "Emulator.h"
+#include <cmath>
+#include <deque>
+#include "Support/basics.h"
+#include "Common/SharedArray.h"
+#include "Target/EmuSupport.h"
+#include "instr/v3d_api.h"
+
+namespace V3DLib {
+namespace v3d {
+
+using ::operator<<;  // C++ weirdness
+
+namespace {
+
+int const NUM_ACCS        =  6;
+int const NUM_RF          = 64;
+int const SFU_LATENCY     =  2;
+int const NUM_DELAY_SLOTS =  3;
+
+
+/**
+ * v3d instruction with the small immediate value decoded
+ */
+struct Decoded : public v3d_qpu_instr {
+  uint32_t small_imm = 0;    // Value of small immediate (also used for rotate)
+};
+
+
+Decoded decode(uint64_t code) {
+  Decoded ret;
+
+  if (!instr_unpack(code, &ret)) {
+    std::string msg;
+    msg << "v3d emulator: could not decode opcode " << code;
+    fatal(msg);
+  }
+
+  if (ret.type == V3D_QPU_INSTR_TYPE_ALU && (ret.sig.small_imm || ret.sig.rotate)) {
+    if (!small_imm_unpack(ret.raddr_b, &ret.small_imm)) {
+      // Can happen for rotate via r5, in which case raddr_b is not used
+      ret.small_imm = 0;
+    }
+  }
+
+  return ret;
+}
+
+
+void unsupported(char const *label, int value) {
+  std::string msg;
+  msg << "v3d emulator: unsupported " << label << " " << value;
+  fatal(msg);
+}
+
+
+struct Mask {
+  bool lane[NUM_LANES];
+};
+
+
+/**
+ * State of a single QPU.
+ */
+struct QPUState {
+  int id = 0;
+  int pc = 0;
+  bool running = true;
+  int next_uniform = 0;
+
+  Vec acc[NUM_ACCS];
+  Vec rf[NUM_RF];
+  bool flag_a[NUM_LANES];
+  bool flag_b[NUM_LANES];
+
+  // Branch handling
+  int delay = 0;                  // Number of delay slots still to execute
+  int branch_target = -1;
+
+  // TMU
+  std::deque<Vec> tmu_fifo;       // Results of TMU reads, to be picked up by ldtmu
+  bool has_tmud = false;          // If true, tmud has been written and next tmua is a store
+  Vec tmud;
+
+  // SFU
+  Vec sfu_value;
+  int sfu_timer = -1;
+
+  EmuStats::Item stats;
+
+  QPUState() {
+    for (int i = 0; i < NUM_LANES; i++) {
+      flag_a[i] = false;
+      flag_b[i] = false;
+    }
+  }
+
+  void upkeep() {
+    if (sfu_timer > 0) {
+      sfu_timer--;
+    }
+
+    if (sfu_timer == 0) {
+      acc[4] = sfu_value;
+      sfu_timer = -1;
+    }
+  }
+
+  Mask mask(v3d_qpu_cond cond) const {
+    Mask ret;
+
+    for (int i = 0; i < NUM_LANES; i++) {
+      switch (cond) {
+        case V3D_QPU_COND_NONE: ret.lane[i] = true;        break;
+        case V3D_QPU_COND_IFA:  ret.lane[i] =  flag_a[i];  break;
+        case V3D_QPU_COND_IFNA: ret.lane[i] = !flag_a[i];  break;
+        case V3D_QPU_COND_IFB:  ret.lane[i] =  flag_b[i];  break;
+        case V3D_QPU_COND_IFNB: ret.lane[i] = !flag_b[i];  break;
+        default: unsupported("condition", cond); break;
+      }
+    }
+
+    return ret;
+  }
+
+
+  void push_flags(v3d_qpu_pf pf, v3d_qpu_uf uf, Vec const &res, Mask const &m) {
+    if (uf != V3D_QPU_UF_NONE) unsupported("update flag", uf);
+    if (pf == V3D_QPU_PF_NONE) return;
+
+    for (int i = 0; i < NUM_LANES; i++) {
+      if (!m.lane[i]) continue;
+
+      flag_b[i] = flag_a[i];
+
+      switch (pf) {
+        case V3D_QPU_PF_PUSHZ: flag_a[i] = (res[i].intVal == 0); break;
+        case V3D_QPU_PF_PUSHN: flag_a[i] = (res[i].intVal <  0); break;
+        default: unsupported("push flag", pf); break;
+      }
+    }
+  }
+
+
+  /**
+   * Determine if branch is taken, using the A flags
+   */
+  bool branch_cond(v3d_qpu_branch_cond cond) const {
+    int count = 0;
+    for (int i = 0; i < NUM_LANES; i++) {
+      if (flag_a[i]) count++;
+    }
+
+    switch (cond) {
+      case V3D_QPU_BRANCH_COND_ALWAYS: return true;
+      case V3D_QPU_BRANCH_COND_A0:     return flag_a[0];
+      case V3D_QPU_BRANCH_COND_NA0:    return !flag_a[0];
+      case V3D_QPU_BRANCH_COND_ALLA:   return count == NUM_LANES;
+      case V3D_QPU_BRANCH_COND_ANYNA:  return count != NUM_LANES;
+      case V3D_QPU_BRANCH_COND_ANYA:   return count != 0;
+      case V3D_QPU_BRANCH_COND_ALLNA:  return count == 0;
+      default: unsupported("branch condition", cond); return false;
+    }
+  }
+};
+
+
+/**
+ * State of the v3d
+ */
+struct State {
+  IntList const &uniforms;
+  Data emuHeap;
+  std::vector<Decoded> instrs;
+
+  State(IntList const &in_uniforms) : uniforms(in_uniforms) {}
+
+  Vec get_uniform(QPUState &s) {
+    assertq(s.next_uniform < uniforms.size(), "v3d emulator: reading past end of uniforms", true);
+    return Vec(uniforms[s.next_uniform++]);
+  }
+};
+
+
+void assign(Vec &dst, Vec const &src, Mask const &m) {
+  for (int i = 0; i < NUM_LANES; i++) {
+    if (m.lane[i]) dst[i] = src[i];
+  }
+}
+
+
+Vec read_mux(QPUState &s, Decoded const &instr, v3d_qpu_mux mux) {
+  switch (mux) {
+    case V3D_QPU_MUX_R0:
+    case V3D_QPU_MUX_R1:
+    case V3D_QPU_MUX_R2:
+    case V3D_QPU_MUX_R3:
+    case V3D_QPU_MUX_R4:
+    case V3D_QPU_MUX_R5:
+      return s.acc[mux - V3D_QPU_MUX_R0];
+
+    case V3D_QPU_MUX_A:
+      return s.rf[instr.raddr_a];
+
+    case V3D_QPU_MUX_B:
+      if (instr.sig.small_imm) return Vec((int) instr.small_imm);
+      return s.rf[instr.raddr_b];
+  }
+
+  unsupported("mux", mux);
+  return Vec(0);
+}
+
+
+Vec unpack(Vec const &v, v3d_qpu_input_unpack unpack) {
+  if (unpack == V3D_QPU_UNPACK_NONE) return v;
+  if (unpack != V3D_QPU_UNPACK_ABS) unsupported("input unpack", unpack);
+
+  Vec ret;
+  for (int i = 0; i < NUM_LANES; i++) {
+    ret[i].floatVal = std::fabs(v[i].floatVal);
+  }
+
+  return ret;
+}
+
+
+bool is_float_op(v3d_qpu_add_op op) {
+  switch (op) {
+    case V3D_QPU_A_FADD:
+    case V3D_QPU_A_FADDNF:
+    case V3D_QPU_A_FSUB:
+    case V3D_QPU_A_FMIN:
+    case V3D_QPU_A_FMAX:
+    case V3D_QPU_A_FROUND:
+    case V3D_QPU_A_FTOIN:
+    case V3D_QPU_A_FTRUNC:
+    case V3D_QPU_A_FTOIZ:
+    case V3D_QPU_A_FFLOOR:
+    case V3D_QPU_A_FTOUZ:
+    case V3D_QPU_A_FCEIL:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+inline int32_t add_wrap(int32_t a, int32_t b) { return (int32_t) ((uint32_t) a + (uint32_t) b); }
+inline int32_t sub_wrap(int32_t a, int32_t b) { return (int32_t) ((uint32_t) a - (uint32_t) b); }
+inline int32_t sext24(int32_t a)              { return ((int32_t) ((uint32_t) a << 8)) >> 8; }
+
+
+Vec add_op(QPUState &s, v3d_qpu_add_op op, Vec const &a, Vec const &b) {
+  Vec ret;
+
+  for (int i = 0; i < NUM_LANES; i++) {
+    int32_t  x  = a[i].intVal;
+    int32_t  y  = b[i].intVal;
+    uint32_t ux = (uint32_t) x;
+    uint32_t uy = (uint32_t) y;
+    float    fx = a[i].floatVal;
+    float    fy = b[i].floatVal;
+    Word    &d  = ret[i];
+
+    switch (op) {
+      case V3D_QPU_A_ADD:    d.intVal = add_wrap(x, y);                        break;
+      case V3D_QPU_A_SUB:    d.intVal = sub_wrap(x, y);                        break;
+      case V3D_QPU_A_MIN:    d.intVal = (x < y)?x:y;                           break;
+      case V3D_QPU_A_MAX:    d.intVal = (x > y)?x:y;                           break;
+      case V3D_QPU_A_UMIN:   d.intVal = (int32_t) ((ux < uy)?ux:uy);           break;
+      case V3D_QPU_A_UMAX:   d.intVal = (int32_t) ((ux > uy)?ux:uy);           break;
+      case V3D_QPU_A_SHL:    d.intVal = (int32_t) (ux << (uy & 31));           break;
+      case V3D_QPU_A_SHR:    d.intVal = (int32_t) (ux >> (uy & 31));           break;
+      case V3D_QPU_A_ASR:    d.intVal = x >> (uy & 31);                        break;
+      case V3D_QPU_A_ROR:    d.intVal = (int32_t) ((ux >> (uy & 31)) | (ux << ((32 - (uy & 31)) & 31))); break;
+      case V3D_QPU_A_AND:    d.intVal = x & y;                                 break;
+      case V3D_QPU_A_OR:     d.intVal = x | y;                                 break;
+      case V3D_QPU_A_XOR:    d.intVal = x ^ y;                                 break;
+      case V3D_QPU_A_NOT:    d.intVal = ~x;                                    break;
+      case V3D_QPU_A_NEG:    d.intVal = sub_wrap(0, x);                        break;
+      case V3D_QPU_A_CLZ:    d.intVal = (ux == 0)?32:__builtin_clz(ux);        break;
+      case V3D_QPU_A_TIDX:   d.intVal = s.id << 2;                             break;
+      case V3D_QPU_A_EIDX:   d.intVal = i;                                     break;
+      case V3D_QPU_A_TMUWT:                                                    break;  // TMU writes complete immediately
+      case V3D_QPU_A_BARRIERID: d.intVal = 0;                                  break;  // Only used for end sync
+      case V3D_QPU_A_FADD:
+      case V3D_QPU_A_FADDNF: d.floatVal = fx + fy;                             break;
+      case V3D_QPU_A_FSUB:   d.floatVal = fx - fy;                             break;
+      case V3D_QPU_A_FMIN:   d.floatVal = (fx < fy)?fx:fy;                     break;
+      case V3D_QPU_A_FMAX:   d.floatVal = (fx > fy)?fx:fy;                     break;
+      case V3D_QPU_A_FROUND: d.floatVal = std::nearbyint(fx);                  break;
+      case V3D_QPU_A_FTRUNC: d.floatVal = std::trunc(fx);                      break;
+      case V3D_QPU_A_FFLOOR: d.floatVal = std::floor(fx);                      break;
+      case V3D_QPU_A_FCEIL:  d.floatVal = std::ceil(fx);                       break;
+      case V3D_QPU_A_FTOIN:  d.intVal = (int32_t) std::nearbyint(fx);          break;
+      case V3D_QPU_A_FTOIZ:  d.intVal = (int32_t) fx;                          break;
+      case V3D_QPU_A_FTOUZ:  d.intVal = (int32_t) (uint32_t) fx;               break;
+      case V3D_QPU_A_ITOF:   d.floatVal = (float) x;                           break;
+      case V3D_QPU_A_UTOF:   d.floatVal = (float) ux;                          break;
+      default:
+        unsupported("add alu op", op);
+        break;
+    }
+  }
+
+  return ret;
+}
+
+
+Vec mul_op(v3d_qpu_mul_op op, Vec const &a, Vec const &b) {
+  Vec ret;
+
+  for (int i = 0; i < NUM_LANES; i++) {
+    int32_t x = a[i].intVal;
+    int32_t y = b[i].intVal;
+    Word   &d = ret[i];
+
+    switch (op) {
+      case V3D_QPU_M_ADD:    d.intVal = add_wrap(x, y);                                  break;
+      case V3D_QPU_M_SUB:    d.intVal = sub_wrap(x, y);                                  break;
+      case V3D_QPU_M_UMUL24: d.intVal = (int32_t) (((uint32_t) x & 0xffffff)*((uint32_t) y & 0xffffff)); break;
+      case V3D_QPU_M_SMUL24: d.intVal = (int32_t) ((uint32_t) sext24(x)*(uint32_t) sext24(y));        break;
+      case V3D_QPU_M_FMUL:   d.floatVal = a[i].floatVal*b[i].floatVal;                   break;
+      case V3D_QPU_M_FMOV:
+      case V3D_QPU_M_MOV:    d = a[i];                                                   break;
+      default:
+        unsupported("mul alu op", op);
+        break;
+    }
+  }
+
+  return ret;
+}
+
+
+/**
+ * Rotate a vector upwards, same as the vc4 emulator
+ */
+Vec rotate(Vec const &v, int n) {
+  Vec ret;
+  n = ((n % NUM_LANES) + NUM_LANES) % NUM_LANES;
+
+  for (int i = 0; i < NUM_LANES; i++) {
+    ret[(i + n) % NUM_LANES] = v[i];
+  }
+
+  return ret;
+}
+
+
+void tmu_access(QPUState &s, State &g, Vec const &addr, Mask const &m) {
+  if (s.has_tmud) {
+    // Store
+    for (int i = 0; i < NUM_LANES; i++) {
+      if (!m.lane[i]) continue;
+      g.emuHeap.phy(((uint32_t) addr[i].intVal) >> 2) = (uint32_t) s.tmud[i].intVal;
+    }
+
+    s.has_tmud = false;
+    s.stats.num_tmu_stores++;
+    return;
+  }
+
+  // Load
+  Vec val(0);
+  for (int i = 0; i < NUM_LANES; i++) {
+    if (!m.lane[i]) continue;
+    val[i].intVal = (int32_t) g.emuHeap.phy(((uint32_t) addr[i].intVal) >> 2);
+  }
+
+  s.tmu_fifo.push_back(val);
+  s.stats.num_tmu_loads++;
+}
+
+
+void sfu_call(QPUState &s, uint8_t waddr, Vec const &v) {
+  assertq(s.sfu_timer == -1, "v3d emulator: SFU called while SFU is running", true);
+
+  switch (waddr) {
+    case V3D_QPU_WADDR_RECIP:  s.sfu_value = v.recip();      break;
+    case V3D_QPU_WADDR_RSQRT:
+    case V3D_QPU_WADDR_RSQRT2: s.sfu_value = v.recip_sqrt(); break;
+    case V3D_QPU_WADDR_EXP:    s.sfu_value = v.exp();        break;
+    case V3D_QPU_WADDR_LOG:    s.sfu_value = v.log();        break;
+    case V3D_QPU_WADDR_SIN:
+      // v3d sin takes its parameter in multiples of PI
+      for (int i = 0; i < NUM_LANES; i++) {
+        s.sfu_value[i].floatVal = (float) std::sin(M_PI*v[i].floatVal);
+      }
+      break;
+    default: assert(false); break;
+  }
+
+  s.sfu_timer = SFU_LATENCY;
+  s.stats.num_sfu_calls++;
+}
+
+
+void write(QPUState &s, State &g, uint8_t waddr, bool magic, Vec const &v, Mask const &m) {
+  if (!magic) {
+    assert(waddr < NUM_RF);
+    assign(s.rf[waddr], v, m);
+    return;
+  }
+
+  switch (waddr) {
+    case V3D_QPU_WADDR_R0:
+    case V3D_QPU_WADDR_R1:
+    case V3D_QPU_WADDR_R2:
+    case V3D_QPU_WADDR_R3:
+    case V3D_QPU_WADDR_R4:
+    case V3D_QPU_WADDR_R5:
+      assign(s.acc[waddr - V3D_QPU_WADDR_R0], v, m);
+      break;
+
+    case V3D_QPU_WADDR_R5REP:
+      s.acc[5] = Vec(v[0].intVal);
+      break;
+
+    case V3D_QPU_WADDR_NOP:
+    case V3D_QPU_WADDR_SYNC:   // Barriers have no effect, all QPUs are stepped in lockstep
+    case V3D_QPU_WADDR_SYNCU:
+    case V3D_QPU_WADDR_SYNCB:
+      break;
+
+    case V3D_QPU_WADDR_TMUD:
+      s.tmud = v;
+      s.has_tmud = true;
+      break;
+
+    case V3D_QPU_WADDR_TMUA:
+      tmu_access(s, g, v, m);
+      break;
+
+    case V3D_QPU_WADDR_RECIP:
+    case V3D_QPU_WADDR_RSQRT:
+    case V3D_QPU_WADDR_RSQRT2:
+    case V3D_QPU_WADDR_EXP:
+    case V3D_QPU_WADDR_LOG:
+    case V3D_QPU_WADDR_SIN:
+      sfu_call(s, waddr, v);
+      break;
+
+    default:
+      unsupported("magic write address", waddr);
+      break;
+  }
+}
+
+
+void exec_branch(QPUState &s, Decoded const &instr, int cur_pc) {
+  assertq(s.delay == 0, "v3d emulator: branch in delay slot of branch", true);
+  auto const &br = instr.branch;
+
+  if (br.ub) unsupported("uniform branch", br.bdu);
+  if (!s.branch_cond(br.cond)) return;
+
+  if (br.bdi != V3D_QPU_BRANCH_DEST_REL) unsupported("branch destination", br.bdi);
+
+  // Offset is in bytes, relative to the instruction after the delay slots
+  s.branch_target = cur_pc + 1 + NUM_DELAY_SLOTS + ((int32_t) br.offset)/8;
+  s.delay = NUM_DELAY_SLOTS;
+  s.stats.num_branches++;
+}
+
+
+void exec_signals(QPUState &s, State &g, Decoded const &instr) {
+  auto const &sig = instr.sig;
+
+  if (sig.ldunifa || sig.ldunifarf || sig.ldvary || sig.ldvpm
+   || sig.ldtlb || sig.ldtlbu || sig.ucb || sig.wrtmuc) {
+    fatal("v3d emulator: unsupported signal");
+  }
+
+  Mask all = s.mask(V3D_QPU_COND_NONE);
+
+  if (sig.ldunif) {
+    s.acc[5] = g.get_uniform(s);
+  }
+
+  if (sig.ldunifrf) {
+    write(s, g, instr.sig_addr, instr.sig_magic, g.get_uniform(s), all);
+  }
+
+  if (sig.ldtmu) {
+    assertq(!s.tmu_fifo.empty(), "v3d emulator: ldtmu without pending TMU read", true);
+    Vec val = s.tmu_fifo.front();
+    s.tmu_fifo.pop_front();
+    write(s, g, instr.sig_addr, instr.sig_magic, val, all);
+  }
+
+  // thrsw is ignored; each QPU runs a single thread
+}
+
+
+void exec_alu(QPUState &s, State &g, Decoded const &instr) {
+  auto const &add = instr.alu.add;
+  auto const &mul = instr.alu.mul;
+
+  if (add.output_pack != V3D_QPU_PACK_NONE) unsupported("add output pack", add.output_pack);
+  if (mul.output_pack != V3D_QPU_PACK_NONE) unsupported("mul output pack", mul.output_pack);
+
+  //
+  // Read all sources and determine results before writing anything
+  //
+  bool do_add = (add.op != V3D_QPU_A_NOP);
+  bool do_mul = (mul.op != V3D_QPU_M_NOP);
+  Vec add_res;
+  Vec mul_res;
+
+  if (do_add) {
+    int num_src = add_op_num_src(add.op);
+    Vec a(0);
+    Vec b(0);
+    if (num_src > 0) a = read_mux(s, instr, add.a);
+    if (num_src > 1) b = read_mux(s, instr, add.b);
+
+    if (is_float_op(add.op)) {
+      a = unpack(a, add.a_unpack);
+      if (num_src > 1) b = unpack(b, add.b_unpack);
+    }
+
+    add_res = add_op(s, add.op, a, b);
+  }
+
+  if (do_mul) {
+    Vec a = read_mux(s, instr, mul.a);
+
+    if (instr.sig.rotate) {
+      int n = (mul.b == V3D_QPU_MUX_R5)? s.acc[5][0].intVal : (int32_t) instr.small_imm;
+      mul_res = rotate(a, n);
+    } else {
+      Vec b(0);
+      if (mul_op_num_src(mul.op) > 1) b = read_mux(s, instr, mul.b);
+
+      if (mul.op == V3D_QPU_M_FMUL || mul.op == V3D_QPU_M_FMOV) {
+        a = unpack(a, mul.a_unpack);
+        if (mul.op == V3D_QPU_M_FMUL) b = unpack(b, mul.b_unpack);
+      }
+
+      mul_res = mul_op(mul.op, a, b);
+    }
+  }
+
+  Mask add_mask = s.mask(instr.flags.ac);
+  Mask mul_mask = s.mask(instr.flags.mc);
+
+  //
+  // Write results
+  //
+  if (do_add) {
+    if (add_op_has_dst(add.op)) {
+      write(s, g, add.waddr, add.magic_write, add_res, add_mask);
+    }
+    s.push_flags(instr.flags.apf, instr.flags.auf, add_res, add_mask);
+  }
+
+  if (do_mul) {
+    write(s, g, mul.waddr, mul.magic_write, mul_res, mul_mask);
+    s.push_flags(instr.flags.mpf, instr.flags.muf, mul_res, mul_mask);
+  }
+
+  exec_signals(s, g, instr);
+}
+
+
+void step(QPUState &s, State &g) {
+  if (s.pc >= (int) g.instrs.size()) {
+    assertq(s.delay == 0, "v3d emulator: program ended within branch delay slots", true);
+    s.running = false;
+    return;
+  }
+
+  s.upkeep();
+
+  bool in_delay_slot = (s.delay > 0);
+  int cur_pc = s.pc++;
+  auto const &instr = g.instrs[cur_pc];
+
+  if (instr.type == V3D_QPU_INSTR_TYPE_BRANCH) {
+    exec_branch(s, instr, cur_pc);
+  } else {
+    exec_alu(s, g, instr);
+  }
+
+  s.stats.num_instructions++;
+
+  if (in_delay_slot) {
+    s.delay--;
+    if (s.delay == 0) {
+      s.pc = s.branch_target;
+    }
+  }
+}
+
+}  // anon namespace
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Class EmuStats
+///////////////////////////////////////////////////////////////////////////////
+
+int EmuStats::max_instructions() const {
+  int ret = 0;
+
+  for (auto const &item : qpus) {
+    if (item.num_instructions > ret) ret = item.num_instructions;
+  }
+
+  return ret;
+}
+
+
+std::string EmuStats::dump() const {
+  std::string ret;
+
+  ret << "v3d emulator run\n";
+
+  for (int i = 0; i < (int) qpus.size(); i++) {
+    auto const &item = qpus[i];
+
+    ret << "  QPU " << i << ": "
+        << item.num_instructions << " instructions, "
+        << item.num_branches     << " branches taken, "
+        << item.num_tmu_loads    << " TMU loads, "
+        << item.num_tmu_stores   << " TMU stores, "
+        << item.num_sfu_calls    << " SFU calls\n";
+  }
+
+  return ret;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Emulator
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Run v3d opcodes on the emulator
+ *
+ * The QPUs are stepped in lockstep, one instruction per QPU per iteration.
+ *
+ * @param numQPUs   Number of QPUs active
+ * @param code      opcodes to run, as generated for the v3d
+ * @param uniforms  Full uniform stream, including the values added by the kernel driver
+ * @param heap      Memory accessed by the TMU
+ *
+ * @return statistics of the run
+ */
+EmuStats emulate(int numQPUs, ByteCode const &code, IntList const &uniforms, BufferObject &heap) {
+  assert(numQPUs > 0 && numQPUs <= MAX_QPUS);
+  assert(!code.empty());
+
+  State state(uniforms);
+  state.emuHeap.heap_view(heap);
+
+  state.instrs.reserve(code.size());
+  for (auto opcode : code) {
+    state.instrs.push_back(decode(opcode));
+  }
+
+  std::vector<QPUState> qpus(numQPUs);
+  for (int i = 0; i < numQPUs; i++) {
+    qpus[i].id = i;
+  }
+
+  bool anyRunning = true;
+
+  while (anyRunning) {
+    anyRunning = false;
+
+    for (auto &s : qpus) {
+      if (!s.running) continue;
+      anyRunning = true;
+      step(s, state);
+    }
+  }
+
+  EmuStats ret;
+  for (auto const &s : qpus) {
+    ret.qpus.push_back(s.stats);
+  }
+
+  return ret;
+}
+
+}  // namespace v3d
+}  // namespace V3DLib
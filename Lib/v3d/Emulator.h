@@ -0,0 +1,42 @@
+#ifndef _V3DLIB_V3D_EMULATOR_H_
+#define _V3DLIB_V3D_EMULATOR_H_
+#include <string>
+#include <vector>
+#include "Common/Seq.h"
+#include "instr/Instr.h"  // ByteCode
+
+namespace V3DLib {
+
+class BufferObject;
+
+namespace v3d {
+
+/**
+ * Run statistics of the v3d emulator, per QPU.
+ *
+ * The v3d QPU issues one instruction per cycle, so the number of executed instructions
+ * is the lower bound of the cycle count for a kernel. TMU and SFU usage are counted
+ * separately, because these are the main sources of stalls on the hardware.
+ */
+struct EmuStats {
+  struct Item {
+    int num_instructions = 0;  // Number of instructions executed, including delay slots
+    int num_tmu_loads    = 0;  // Number of TMU read requests
+    int num_tmu_stores   = 0;  // Number of TMU write requests
+    int num_sfu_calls    = 0;  // Number of SFU function calls
+    int num_branches     = 0;  // Number of branches taken
+  };
+
+  std::vector<Item> qpus;
+
+  int max_instructions() const;
+  std::string dump() const;
+};
+
+
+EmuStats emulate(int numQPUs, ByteCode const &code, IntList const &uniforms, BufferObject &heap);
+
+}  // namespace v3d
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_V3D_EMULATOR_H_
@@ -7,8 +7,9 @@
 #include "Target/RemoveLabels.h"
 #include "instr/Snippets.h"
 #include "Support/basics.h"
-#include "Support/Timer.h"
+#include "Common/SharedArrayPool.h"
 #include "SourceTranslate.h"
+#include "Scheduler.h"
 #include "instr/Encode.h"
 #include "instr/Mnemonics.h"
 #include "instr/OpItems.h"
@@ -27,7 +28,7 @@ namespace {
 // Also: the << definitions in `basics.h` DID get picked up; the std::string versions did not.
 using ::operator<<; // C++ weirdness
 
-std::vector<std::string> local_errors;
+thread_local std::vector<std::string> local_errors;
 
 
 /**
@@ -771,416 +772,6 @@ void _encode(V3DLib::Instr::List const &instrs, Instructions &instructions) {
 }
 
 
-template<typename AddAlu>
-bool can_be_mul_alu(AddAlu const &add_alu) {
-  return ((add_alu.op == V3D_QPU_A_OR && add_alu.a == add_alu.b)       // ORs with 1 source can be translated to mul alu MOV
-        || add_alu.op == V3D_QPU_A_ADD
-        || add_alu.op == V3D_QPU_A_SUB)
-       && (!add_alu.magic_write || add_alu.waddr < V3D_QPU_WADDR_NOP)  // Don't write to special registers in the mul alu
-  ;
-}
-
-
-/**
- * Check if given instructions have a dependency on each other.
- *
- * Pre: Instruction 'first' is predecessor of 'second'.
- * There is a dependency if:
- *   - instruction 'second' has a source which is a destination of 'first'.
- *   - instruction 'second' has a destination which is a destination of 'first'.
- */
-bool have_dependency(v3d::instr::Instr const &first, v3d::instr::Instr const &second) {
-  return second.is_src(first.sig_dest())
-      || second.is_src(first.add_dest())
-      || second.is_src(first.mul_dest())
-      || second.is_dst(first.sig_dest())
-      || second.is_dst(first.add_dest())
-      || second.is_dst(first.mul_dest());
-}
-
-
-bool can_combine(v3d::instr::Instr const &instr1, v3d::instr::Instr const &instr2, bool &do_converse) {
-  assert(instr1.add_nop() || instr1.mul_nop());  // Not expecting fully filled instructions
-  assert(instr2.add_nop() || instr2.mul_nop());  // idem
-
-  // Skip branches
-  if (instr1.type == V3D_QPU_INSTR_TYPE_BRANCH || instr2.type == V3D_QPU_INSTR_TYPE_BRANCH) return false;
-
-  // Skip special signals for now - there might be something to be won with the ld's
-  if (instr1.has_signal() || instr2.has_signal()) return false;
-
-  // Skip full NOPs, they are there for a reason
-  if (instr1.is_nop()) return false;
-  if (instr2.is_nop()) return false;
-
-  // skip both mul for now, needs extra logic and is probably scarce
-  if (!instr1.mul_nop() && !instr2.mul_nop())  {
-    return false;
-  }
-
-
-  auto magic_write1 = instr1.mul_nop()?instr1.alu.add.magic_write:instr1.alu.mul.magic_write;
-  auto waddr1       = instr1.mul_nop()?instr1.alu.add.waddr:instr1.alu.mul.waddr;
-  auto magic_write2 = instr2.mul_nop()?instr2.alu.add.magic_write:instr2.alu.mul.magic_write;
-  auto waddr2       = instr2.mul_nop()?instr2.alu.add.waddr:instr2.alu.mul.waddr;
-
-  // Skip combined special waddresses - important for tmu operations
-  if ((magic_write1 && waddr1 >= V3D_QPU_WADDR_NOP)
-   && (magic_write2 && waddr2 >= V3D_QPU_WADDR_NOP)) return false;
-
-  // Disallow same dest reg
-  if (waddr1 == waddr2 && magic_write1 == magic_write2) return false;
-
-
-  // Don't combine set conditional with use conditional
-  if (instr1.flags.apf && instr2.flags.ac) return false;
-
-
-  // Output instr1 should not be used as input instr2
-  auto a2 = instr2.mul_nop()?instr2.alu.add.a:instr2.alu.mul.a;
-  auto b2 = instr2.mul_nop()?instr2.alu.add.b:instr2.alu.mul.b;
-
-  bool is_rf1 = !magic_write1;
-  if (is_rf1) {
-    if (a2 == V3D_QPU_MUX_A && instr2.raddr_a == waddr1) return false;
-    if (b2 == V3D_QPU_MUX_A && instr2.raddr_a == waddr1) return false;
-
-    if (a2 == V3D_QPU_MUX_B && !instr2.sig.small_imm && instr2.raddr_b == waddr1) return false;
-    if (b2 == V3D_QPU_MUX_B && !instr2.sig.small_imm && instr2.raddr_b == waddr1) return false;
-  } else {
-    if (a2 < V3D_QPU_MUX_A && a2 == waddr1) return false;
-    if (b2 < V3D_QPU_MUX_A && b2 == waddr1) return false;
-  }
-
-  // mul/alu splits can always be combined
-  if (instr1.mul_nop() && !instr2.mul_nop()) {
-    do_converse = false;
-    return true;
-  }
-
-  if (!instr1.mul_nop() && instr2.mul_nop()) {
-    do_converse = true;
-    return true;
-  }
-
-
-  //
-  // Determine add alu instructions with mul alu equivalents
-  //
-  if (can_be_mul_alu(instr2.alu.add)) {
-    do_converse = false;
-    return true;
-  }
-
-  if (can_be_mul_alu(instr1.alu.add)) {
-    do_converse = true;
-    return true;
-  }
-
-  return false;
-}
-
-
-bool convert_alu_op_to_mul_op(v3d_qpu_mul_op &mul_op, v3d::instr::Instr const &add_instr) {
-  switch (add_instr.alu.add.op) {
-    case V3D_QPU_A_OR:
-      if (add_instr.alu.add.a == add_instr.alu.add.b) {
-        mul_op = V3D_QPU_M_MOV;
-        return true;
-      }
-
-    case V3D_QPU_A_ADD:
-      mul_op = V3D_QPU_M_ADD;
-      return true;
-
-    case V3D_QPU_A_SUB:
-      mul_op = V3D_QPU_M_SUB;
-      return true;
-
-    default: break;
-  }
-
-  return false;
-}
-
-
-/**
- * Set the mul alu with the add alu part of in_instr
- */
-bool add_alu_to_mul_alu(Instr const &in_instr, Instr &dst) {
-  assert((!in_instr.add_nop() &&  in_instr.mul_nop()) 
-      || ( in_instr.add_nop() && !in_instr.mul_nop())); 
-  assert(dst.mul_nop()); 
-
-  //
-  // Get used dst and src
-  //
-  std::unique_ptr<Location> dst_loc;
-  std::unique_ptr<Source> src_a;
-  std::unique_ptr<Source> src_b;
-
-  if (in_instr.mul_nop()) {
-    v3d_qpu_mul_op mul_op;
-    if (!convert_alu_op_to_mul_op(mul_op, in_instr)) return false;
-    dst.alu.mul.op = mul_op;
-
-    // Take values from add alu 
-    dst_loc = in_instr.add_alu_dst();
-    src_a   = in_instr.add_alu_a();
-    src_b   = in_instr.add_alu_b();
-  } else {
-    dst.alu.mul.op = in_instr.alu.mul.op;
-
-    // Take values from mul alu 
-    dst_loc = in_instr.mul_alu_dst();
-    src_a   = in_instr.mul_alu_a();
-    src_b   = in_instr.mul_alu_b();
-  }
-  assert(dst_loc.get() != nullptr);
-  assert(src_a.get()   != nullptr);
-  assert(src_b.get()   != nullptr);
-
-  if (!dst.alu_mul_set(*dst_loc, *src_a, *src_b)) return false;
-
-  if (in_instr.mul_nop()) {
-    dst.alu.mul.output_pack = in_instr.alu.add.output_pack;
-    dst.alu.mul.a_unpack    = in_instr.alu.add.a_unpack;
-    dst.alu.mul.b_unpack    = in_instr.alu.add.b_unpack;
-
-    dst.flags.mc  = in_instr.flags.ac;
-    dst.flags.mpf = in_instr.flags.apf;
-    dst.flags.muf = in_instr.flags.auf;
-  } else {
-    dst.alu.mul.output_pack = in_instr.alu.mul.output_pack;
-    dst.alu.mul.a_unpack    = in_instr.alu.mul.a_unpack;
-    dst.alu.mul.b_unpack    = in_instr.alu.mul.b_unpack;
-
-    dst.flags.mc  = in_instr.flags.mc;
-    dst.flags.mpf = in_instr.flags.mpf;
-    dst.flags.muf = in_instr.flags.muf;
-  }
-
-  dst.header(in_instr.header());
-  dst.comment(in_instr.comment());
-
-  return true;
-}
-
-
-void combine(Instructions &instructions) {
-
-  //
-  // Detect useless moves, eg: or  rf2, rf2, rf2    ; nop
-  //
-  auto check_assign_to_self = [] (Instr const &instr, int i) -> bool {
-    if (!instr.is_branch() && !instr.add_nop() && instr.mul_nop() && instr.alu.add.op == V3D_QPU_A_OR) {
-      auto dst = instr.add_alu_dst();
-      assert(dst);
-      auto a = instr.add_alu_a();
-      assert(a);
-      auto b = instr.add_alu_b();
-      assert(b);
-
-      if (*a == *b && *dst == *a) {
-        if (instr.has_signal(true)) {
-          breakpoint // Deal with this when it happens
-        }
-
-        if (instr.flag_set()) {
-          breakpoint // Deal with this when it happens
-        }
-/*
-        std::string msg = "Useless move at ";
-        msg << i << ": " << instr.mnemonic(false);
-        warning(msg);
-*/
-        return true;
-      }
-    }
-
-    return false;
-  };
-
-  assertq(!check_assign_to_self(instructions[0], 0), "First instruction is useless copy");
-
-  int combine_count = 0;
-
-  for (int i = 1; i < (int) instructions.size(); i++) {
-    auto &instr1 = instructions[i - 1];
-    auto &instr2 = instructions[i];
-
-    assertq(!instr1.mnemonic(false).empty(), "WTF 1", true);  // Paranoia
-    assertq(!instr2.mnemonic(false).empty(), "WTF 2", true);
-
-    assertq(!(instr1.skip() && instr2.skip()), "Deal with skips when they happen");
-    if (instr1.skip()) continue;
-
-    //
-    // Combine pure nop ldtmu instruction with next
-    // 
-    if (false && instr1.is_ldtmu() && instr1.is_nop()) {
-
-      // There can be multiple consecutive tmu loads, shift them all in reverse order
-      int first = i - 1;
-      int last  = i - 1;
-      for (int n = last + 1; n < (int) instructions.size(); n++) {
-        auto &instr = instructions[n];
-
-        //breakpoint
-
-        assert(!instr.skip());
-        if (!instr.is_nop()) break;  // pure nop ldtmu only
-        if (!instr.is_ldtmu()) break;
-        last = n;
-      }
-
-      for (int n = last; n >= first; n--) {
-        auto &instr = instructions[n];
-        int shift_to = 0;
-         
-        int max_shift = -1;  // If set > 0, max number of instructions to look forward
-
-        int end_m = (int) instructions.size();
-        if (max_shift > 0 && end_m > n + max_shift) {
-          end_m = n + max_shift;
-        }
-
-        for (int m = n + 1; m < end_m; m++) {
-          auto &instr2 = instructions[m];
-          if (instr2.skip()) continue;
-          if (instr2.is_branch()) break;   // Paranoia safeguard; it might actually be possible
-          if (instr2.uses_sig_dst()) break;
-          if (have_dependency(instr, instr2)) break;
-
-          // Specials
-          if (!instr2.is_branch()) 
-            if (instr2.alu.add.op == V3D_QPU_A_BARRIERID    // In program end, syncs last TMU operation
-
-            //
-            // Following empirically determined
-            //
-
-            // TMU read and load don't mix
-            || (instr2.alu.add.waddr == V3D_QPU_WADDR_TMUA && instr2.alu.add.magic_write)
-
-            // Apparently, can't combine setting flags with TMU loads
-            || (instr2.flags.ac != V3D_QPU_COND_NONE || instr2.flags.mc != V3D_QPU_COND_NONE)
-            ) {
-            break;
-          }
-          
-          shift_to = m;
-        }
-
-        //breakpoint
-
-        if (shift_to != 0) {
-          auto &instr2 = instructions[shift_to];
-          instr2.sig.ldtmu = true;
-          instr2.sig_addr  = instr.sig_addr;
-          instr2.sig_magic = instr.sig_magic;
-          instr.skip(true);
-        }
-      }
-
-      //breakpoint
-      i += (last - first);
-      continue;
-    }
-
-
-    //
-    // Skip instructions that have both add and mul alu
-    //
-    if (!instr1.add_nop() && !instr1.mul_nop()) continue;
-    if (!instr2.add_nop() && !instr2.mul_nop()) continue;
-
-
-    //
-    // Remove useless copies
-    //
-    if (check_assign_to_self(instr2, i)) {
-      instr2.skip(true);
-      continue;
-    }
-
-
-    //
-    // Combine add and mul instructions, if possible
-    //
-    bool do_converse;
-    if (!can_combine(instr1, instr2, do_converse)) continue;
-
-    std::string msg = "combine() considering ";
-    msg << "line " << i << ":\n"
-        << "  " << instr1.mnemonic(false) << "\n"
-        << "  " << instr2.mnemonic(false);
-
-    // attempt the conversion
-    {
-      auto const &add_instr = do_converse?instr2:instr1;
-      auto const &mul_instr = do_converse?instr1:instr2;
-
-      assert(add_instr.mul_nop());
-
-      v3d::instr::Instr dst = add_instr;
-
-      // First test: Don't deal with conditions yet in the mul alu
-      // These need a bit of extra logic to set them for mul
-      // TODO examine this
-      bool success = !mul_instr.flag_set() && add_alu_to_mul_alu(mul_instr, dst);
-
-      if (success) {
-        msg << "\n  Possible conversion: " << dst.mnemonic(false);
-        //debug(msg);
-
-        instr1.skip(true);
-        instr2 = dst;
-
-        combine_count++;
-        i++;
-      }
-      continue;
-    }
-
-    debug(msg);  // Deal with unhandled case in this loop
-    break;       // ...as we encounter them
-  }
-
-  compile_data.num_instructions_combined += combine_count;
-/*
-  if (combine_count > 0) {
-    std::string msg;
-    msg << "Combined " << combine_count << " v3d instructions";
-    debug(msg);
-  }
-*/
-
-  //
-  // Combine skips
-  //
-  Instructions ret;
-  int skip_count = 0;
-  for (int i = 0; i < (int) instructions.size(); i++) {
-    auto const &instr = instructions[i];
-    if (instr.skip()) {
-      skip_count++;
-    } else {
-      ret << instr;
-    }
-  }
-
-  if (skip_count > 0) {
-/*
-    std::string msg;
-    msg << "Skipped " << skip_count << " instructions";
-    debug(msg);
-*/
-    instructions = ret;
-  }
-}
-
-
 void load_uniforms(Data &unif, int numQPUs, Data const &devnull, Data const &done, IntList const &params) {
   int offset = 0;
 
@@ -1198,12 +789,29 @@ void load_uniforms(Data &unif, int numQPUs, Data const &devnull, Data const &don
 }
 
 
+/**
+ * Same as `load_uniforms()` above, for running on the emulator
+ */
+IntList emu_uniforms(int numQPUs, Data const &devnull, Data const &done, IntList const &params) {
+  IntList unif;
+
+  unif << 0                                 // qpu number (id for current qpu) - 0 is for 1 QPU
+       << numQPUs                           // num qpu's running for this job
+       << (int) devnull.getAddress()        // Memory location for values to be discarded
+       << params
+       << (int) done.getAddress();          // The last item is for the 'done' location
+
+  return unif;
+}
+
+
 void invoke(int numQPUs, Data &devnull, Code &codeMem, IntList &params) {
 #ifndef QPU_MODE
   assertq(false, "Cannot run v3d invoke(), QPU_MODE not enabled");
 #else
   assert(!codeMem.empty());
 
+  SharedArrayScope scope;  // Per-call buffers are recycled over calls
   Data unif(params.size() + 4);
   Data done(1);
   done[0] = 0;
@@ -1211,7 +819,10 @@ void invoke(int numQPUs, Data &devnull, Code &codeMem, IntList &params) {
   load_uniforms(unif, numQPUs, devnull, done, params);
 
   Driver drv;
-  drv.add_bo(getBufferObject().getHandle());
+  auto segments = getBufferObject().segments();  // Keeps the segments alive during execution
+  for (auto const &seg : *segments) {
+    drv.add_bo(seg->getHandle());
+  }
   drv.execute(codeMem, &unif, numQPUs);
 #endif  // QPU_MODE
 }
@@ -1233,7 +844,7 @@ void KernelDriver::encode() {
 
   // Encode target instructions
   _encode(m_targetCode, instructions);
-  combine(instructions);
+  schedule(instructions);
   removeLabels(instructions);
 
   if (!instructions.check_consistent()) {
@@ -1270,22 +881,39 @@ std::vector<uint64_t> KernelDriver::to_opcodes() {
 
 
 void KernelDriver::compile_intern() {
-  //Timer t1("compile_intern", true);
-
   obtain_ast();
 
-  //Timer t3("translate_stmt");
-  translate_stmt(m_targetCode, m_body);  // performance hog 2 12/45s
-  //t3.end();
+  {
+    CompilePhase phase("translate");
+    translate_stmt(m_targetCode, m_body);  // performance hog 2 12/45s
+  }
+
+  if (load_from_cache()) return;
 
   insertInitBlock(m_targetCode);
   add_init(m_targetCode);
 
-  //Timer t5("compile_postprocess");
   compile_postprocess(m_targetCode);  // performance hog 1 31/45s
-  //t5.end();
 
-  encode();
+  {
+    CompilePhase phase("encode");  // Includes scheduling
+    encode();
+  }
+
+  store_in_cache();
+}
+
+
+/**
+ * Set the v3d instructions from previously encoded opcodes, instead of encoding the target code
+ */
+void KernelDriver::load_opcodes(std::vector<uint64_t> const &code) {
+  assert(instructions.empty());
+  assert(!code.empty());
+
+  for (auto op : code) {
+    instructions << Instruction(op);
+  }
 }
 
 
@@ -1327,6 +955,29 @@ void KernelDriver::invoke_intern(int numQPUs, IntList &params) {
 }
 
 
+/**
+ * Run the encoded v3d opcodes on the v3d emulator
+ */
+EmuStats KernelDriver::emu(int numQPUs, IntList &params) {
+  if (numQPUs != 1 && numQPUs != 8) {
+    error("Num QPU's must be 1 or 8", true);
+  }
+
+  assertq(!has_errors(), "v3d kernels has errors, can not emulate");
+  assert(!instructions.empty());
+
+  if (!devnull.allocated()) {
+    devnull.alloc(16);
+  }
+
+  Data done(1);
+  done[0] = 0;
+
+  IntList unif = emu_uniforms(numQPUs, devnull, done, spill_params(params));
+  return v3d::emulate(numQPUs, to_opcodes(), unif, getBufferObject());
+}
+
+
 void KernelDriver::emit_opcodes(FILE *f) {
   fprintf(f, "Opcodes for v3d\n");
   fprintf(f, "===============\n\n");
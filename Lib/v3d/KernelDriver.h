@@ -4,6 +4,7 @@
 #include "Common/SharedArray.h"
 #include "instr/Instr.h"
 #include "BufferObject.h"
+#include "Emulator.h"
 
 namespace V3DLib {
 namespace v3d {
@@ -29,6 +30,7 @@ public:
 
   void encode() override;
   int kernel_size() const { return (int) instructions.size(); }
+  EmuStats emu(int numQPUs, IntList &params);
 
 private:
   Instructions  instructions;
@@ -38,6 +40,8 @@ private:
 
   void compile_intern() override;
   void invoke_intern(int numQPUs, IntList &params) override;
+  std::vector<uint64_t> opcodes() override { return to_opcodes(); }
+  void load_opcodes(std::vector<uint64_t> const &code) override;
 
   void allocate();
   std::vector<uint64_t> to_opcodes();
@@ -0,0 +1,588 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "Common/CompileData.h"
+#include "Support/basics.h"
+
+namespace V3DLib {
+namespace v3d {
+
+using namespace V3DLib::v3d::instr;
+
+namespace {
+
+template<typename AddAlu>
+bool can_be_mul_alu(AddAlu const &add_alu) {
+  return ((add_alu.op == V3D_QPU_A_OR && add_alu.a == add_alu.b)       // ORs with 1 source can be translated to mul alu MOV
+        || add_alu.op == V3D_QPU_A_ADD
+        || add_alu.op == V3D_QPU_A_SUB)
+       && (!add_alu.magic_write || add_alu.waddr < V3D_QPU_WADDR_NOP)  // Don't write to special registers in the mul alu
+  ;
+}
+
+
+bool can_combine(v3d::instr::Instr const &instr1, v3d::instr::Instr const &instr2, bool &do_converse) {
+  assert(instr1.add_nop() || instr1.mul_nop());  // Not expecting fully filled instructions
+  assert(instr2.add_nop() || instr2.mul_nop());  // idem
+
+  // Skip branches
+  if (instr1.type == V3D_QPU_INSTR_TYPE_BRANCH || instr2.type == V3D_QPU_INSTR_TYPE_BRANCH) return false;
+
+  // Skip special signals for now - there might be something to be won with the ld's
+  if (instr1.has_signal() || instr2.has_signal()) return false;
+
+  // Skip full NOPs, they are there for a reason
+  if (instr1.is_nop()) return false;
+  if (instr2.is_nop()) return false;
+
+  // skip both mul for now, needs extra logic and is probably scarce
+  if (!instr1.mul_nop() && !instr2.mul_nop())  {
+    return false;
+  }
+
+
+  auto magic_write1 = instr1.mul_nop()?instr1.alu.add.magic_write:instr1.alu.mul.magic_write;
+  auto waddr1       = instr1.mul_nop()?instr1.alu.add.waddr:instr1.alu.mul.waddr;
+  auto magic_write2 = instr2.mul_nop()?instr2.alu.add.magic_write:instr2.alu.mul.magic_write;
+  auto waddr2       = instr2.mul_nop()?instr2.alu.add.waddr:instr2.alu.mul.waddr;
+
+  // Skip combined special waddresses - important for tmu operations
+  if ((magic_write1 && waddr1 >= V3D_QPU_WADDR_NOP)
+   && (magic_write2 && waddr2 >= V3D_QPU_WADDR_NOP)) return false;
+
+  // Disallow same dest reg
+  if (waddr1 == waddr2 && magic_write1 == magic_write2) return false;
+
+
+  // Don't combine set conditional with use conditional
+  if (instr1.flags.apf && instr2.flags.ac) return false;
+
+
+  // Output instr1 should not be used as input instr2
+  auto a2 = instr2.mul_nop()?instr2.alu.add.a:instr2.alu.mul.a;
+  auto b2 = instr2.mul_nop()?instr2.alu.add.b:instr2.alu.mul.b;
+
+  bool is_rf1 = !magic_write1;
+  if (is_rf1) {
+    if (a2 == V3D_QPU_MUX_A && instr2.raddr_a == waddr1) return false;
+    if (b2 == V3D_QPU_MUX_A && instr2.raddr_a == waddr1) return false;
+
+    if (a2 == V3D_QPU_MUX_B && !instr2.sig.small_imm && instr2.raddr_b == waddr1) return false;
+    if (b2 == V3D_QPU_MUX_B && !instr2.sig.small_imm && instr2.raddr_b == waddr1) return false;
+  } else {
+    if (a2 < V3D_QPU_MUX_A && a2 == waddr1) return false;
+    if (b2 < V3D_QPU_MUX_A && b2 == waddr1) return false;
+  }
+
+  // mul/alu splits can always be combined
+  if (instr1.mul_nop() && !instr2.mul_nop()) {
+    do_converse = false;
+    return true;
+  }
+
+  if (!instr1.mul_nop() && instr2.mul_nop()) {
+    do_converse = true;
+    return true;
+  }
+
+
+  //
+  // Determine add alu instructions with mul alu equivalents
+  //
+  if (can_be_mul_alu(instr2.alu.add)) {
+    do_converse = false;
+    return true;
+  }
+
+  if (can_be_mul_alu(instr1.alu.add)) {
+    do_converse = true;
+    return true;
+  }
+
+  return false;
+}
+
+
+bool convert_alu_op_to_mul_op(v3d_qpu_mul_op &mul_op, v3d::instr::Instr const &add_instr) {
+  switch (add_instr.alu.add.op) {
+    case V3D_QPU_A_OR:
+      if (add_instr.alu.add.a == add_instr.alu.add.b) {
+        mul_op = V3D_QPU_M_MOV;
+        return true;
+      }
+
+    case V3D_QPU_A_ADD:
+      mul_op = V3D_QPU_M_ADD;
+      return true;
+
+    case V3D_QPU_A_SUB:
+      mul_op = V3D_QPU_M_SUB;
+      return true;
+
+    default: break;
+  }
+
+  return false;
+}
+
+
+/**
+ * Set the mul alu with the add alu part of in_instr
+ */
+bool add_alu_to_mul_alu(Instr const &in_instr, Instr &dst) {
+  assert((!in_instr.add_nop() &&  in_instr.mul_nop()) 
+      || ( in_instr.add_nop() && !in_instr.mul_nop())); 
+  assert(dst.mul_nop()); 
+
+  //
+  // Get used dst and src
+  //
+  std::unique_ptr<Location> dst_loc;
+  std::unique_ptr<Source> src_a;
+  std::unique_ptr<Source> src_b;
+
+  if (in_instr.mul_nop()) {
+    v3d_qpu_mul_op mul_op;
+    if (!convert_alu_op_to_mul_op(mul_op, in_instr)) return false;
+    dst.alu.mul.op = mul_op;
+
+    // Take values from add alu 
+    dst_loc = in_instr.add_alu_dst();
+    src_a   = in_instr.add_alu_a();
+    src_b   = in_instr.add_alu_b();
+  } else {
+    dst.alu.mul.op = in_instr.alu.mul.op;
+
+    // Take values from mul alu 
+    dst_loc = in_instr.mul_alu_dst();
+    src_a   = in_instr.mul_alu_a();
+    src_b   = in_instr.mul_alu_b();
+  }
+  assert(dst_loc.get() != nullptr);
+  assert(src_a.get()   != nullptr);
+  assert(src_b.get()   != nullptr);
+
+  if (!dst.alu_mul_set(*dst_loc, *src_a, *src_b)) return false;
+
+  if (in_instr.mul_nop()) {
+    dst.alu.mul.output_pack = in_instr.alu.add.output_pack;
+    dst.alu.mul.a_unpack    = in_instr.alu.add.a_unpack;
+    dst.alu.mul.b_unpack    = in_instr.alu.add.b_unpack;
+
+    dst.flags.mc  = in_instr.flags.ac;
+    dst.flags.mpf = in_instr.flags.apf;
+    dst.flags.muf = in_instr.flags.auf;
+  } else {
+    dst.alu.mul.output_pack = in_instr.alu.mul.output_pack;
+    dst.alu.mul.a_unpack    = in_instr.alu.mul.a_unpack;
+    dst.alu.mul.b_unpack    = in_instr.alu.mul.b_unpack;
+
+    dst.flags.mc  = in_instr.flags.mc;
+    dst.flags.mpf = in_instr.flags.mpf;
+    dst.flags.muf = in_instr.flags.muf;
+  }
+
+  dst.header(in_instr.header());
+  dst.comment(in_instr.comment());
+
+  return true;
+}
+
+
+/**
+ * Detect useless moves, eg: or  rf2, rf2, rf2    ; nop
+ */
+bool is_useless_move(Instr const &instr) {
+  if (instr.is_label() || instr.is_branch()) return false;
+  if (instr.add_nop() || !instr.mul_nop() || instr.alu.add.op != V3D_QPU_A_OR) return false;
+  if (instr.has_signal(true) || instr.flag_set()) return false;
+
+  auto dst = instr.add_alu_dst();
+  assert(dst);
+  auto a = instr.add_alu_a();
+  assert(a);
+  auto b = instr.add_alu_b();
+  assert(b);
+
+  return (*a == *b && *dst == *a);
+}
+
+
+bool is_pure_ldtmu(Instr const &instr) {
+  if (!instr.is_nop() || !instr.is_ldtmu()) return false;
+
+  Instr tmp = instr;
+  tmp.sig.ldtmu = false;
+  return !tmp.has_signal(true);
+}
+
+
+bool is_tmu_write(Instr const &instr) {
+  auto is_tmu = [] (bool magic_write, uint8_t waddr) {
+    return magic_write && (waddr == V3D_QPU_WADDR_TMUD || waddr == V3D_QPU_WADDR_TMUA);
+  };
+
+  return (!instr.add_nop() && is_tmu(instr.alu.add.magic_write, instr.alu.add.waddr))
+      || (!instr.mul_nop() && is_tmu(instr.alu.mul.magic_write, instr.alu.mul.waddr));
+}
+
+
+/**
+ * Check if the given instruction can be moved around within a basic block.
+ *
+ * This is deliberately conservative. Only plain ALU operations on registers,
+ * TMU writes and pure `ldtmu` loads are allowed. Everything else has side effects
+ * or timing constraints (SFU, uniforms, thread switches, syncs, branches, full nops)
+ * and is left in place as a block boundary.
+ */
+bool can_schedule(Instr const &instr) {
+  if (instr.is_label() || instr.is_branch()) return false;
+  if (is_pure_ldtmu(instr)) return true;
+  if (instr.is_nop()) return false;                   // Full NOPs are there for a reason
+
+  if (instr.has_signal()) return false;               // Small immediates are fine
+  if (instr.sig.rotate) return false;
+
+  auto dst_ok = [] (bool magic_write, uint8_t waddr) {
+    return !magic_write
+        || waddr <= V3D_QPU_WADDR_NOP                   // accumulators r0-r5 and nop
+        || waddr == V3D_QPU_WADDR_TMUD
+        || waddr == V3D_QPU_WADDR_TMUA;
+  };
+
+  if (!instr.add_nop()) {
+    if (!dst_ok(instr.alu.add.magic_write, instr.alu.add.waddr)) return false;
+
+    switch (instr.alu.add.op) {
+      case V3D_QPU_A_ADD:    case V3D_QPU_A_SUB:    case V3D_QPU_A_OR:     case V3D_QPU_A_AND:
+      case V3D_QPU_A_XOR:    case V3D_QPU_A_NOT:    case V3D_QPU_A_NEG:    case V3D_QPU_A_SHL:
+      case V3D_QPU_A_SHR:    case V3D_QPU_A_ASR:    case V3D_QPU_A_ROR:    case V3D_QPU_A_MIN:
+      case V3D_QPU_A_MAX:    case V3D_QPU_A_UMIN:   case V3D_QPU_A_UMAX:   case V3D_QPU_A_CLZ:
+      case V3D_QPU_A_FADD:   case V3D_QPU_A_FADDNF: case V3D_QPU_A_FSUB:   case V3D_QPU_A_FMIN:
+      case V3D_QPU_A_FMAX:   case V3D_QPU_A_ITOF:   case V3D_QPU_A_UTOF:   case V3D_QPU_A_FTOIN:
+      case V3D_QPU_A_FTOIZ:  case V3D_QPU_A_FTOUZ:  case V3D_QPU_A_FFLOOR: case V3D_QPU_A_FCEIL:
+      case V3D_QPU_A_FTRUNC: case V3D_QPU_A_FROUND: case V3D_QPU_A_EIDX:   case V3D_QPU_A_TIDX:
+        break;
+      default:
+        return false;
+    }
+  }
+
+  if (!instr.mul_nop()) {
+    if (!dst_ok(instr.alu.mul.magic_write, instr.alu.mul.waddr)) return false;
+
+    switch (instr.alu.mul.op) {
+      case V3D_QPU_M_ADD:    case V3D_QPU_M_SUB:    case V3D_QPU_M_MOV:    case V3D_QPU_M_FMOV:
+      case V3D_QPU_M_FMUL:   case V3D_QPU_M_VFMUL:  case V3D_QPU_M_SMUL24: case V3D_QPU_M_UMUL24:
+        break;
+      default:
+        return false;
+    }
+  }
+
+  return true;
+}
+
+
+/**
+ * Pseudo-register for the condition flags, so that these can be treated as a register dependency.
+ */
+DestReg const FLAGS(0xff, true);
+
+
+/**
+ * Instruction in the dependency graph of a basic block
+ */
+struct Node {
+  Node(Instr const &in_instr, int in_index);
+
+  Instr instr;
+  int  index;                          // Position in the original block
+  bool tmu_write = false;
+  bool ldtmu     = false;
+  std::vector<DestReg> reads;
+  std::vector<DestReg> writes;
+
+  std::vector<std::pair<int, int>> succs;  // Pairs of (node index, latency)
+  int  num_preds = 0;                  // Number of unscheduled predecessors
+  int  height    = 1;                  // Length of the longest path to the end of the block
+  int  earliest  = 0;                  // Earliest cycle allowed by the scheduled predecessors
+  bool scheduled = false;
+
+  bool single_alu() const { return !ldtmu && (instr.add_nop() != instr.mul_nop()); }
+  int latency_to(Node const &rhs) const;
+};
+
+
+Node::Node(Instr const &in_instr, int in_index) : instr(in_instr), index(in_index) {
+  tmu_write = is_tmu_write(instr);
+  ldtmu     = is_pure_ldtmu(instr);
+
+  auto add_reg = [] (std::vector<DestReg> &list, DestReg const &reg) {
+    if (!reg.used()) return;
+    if (reg == DestReg(V3D_QPU_WADDR_NOP, true)) return;
+    list.push_back(reg);
+  };
+
+  add_reg(reads, instr.add_src_a());
+  add_reg(reads, instr.add_src_b());
+  add_reg(reads, instr.mul_src_a());
+  add_reg(reads, instr.mul_src_b());
+  add_reg(writes, instr.sig_dest());
+  add_reg(writes, instr.add_dest());
+  add_reg(writes, instr.mul_dest());
+
+  auto const &f = instr.flags;
+  if (f.ac || f.mc || f.auf || f.muf) reads.push_back(FLAGS);
+  if (f.apf || f.mpf || f.auf || f.muf) writes.push_back(FLAGS);
+}
+
+
+/**
+ * Determine the minimal distance in cycles between this node and a following node.
+ *
+ * An instruction reads its sources before writing its destinations, so a write-after-read
+ * on a register may be issued in the same instruction.
+ *
+ * @return latency, -1 if there is no dependency
+ */
+int Node::latency_to(Node const &rhs) const {
+  // Keep all TMU accesses in program order, the TMU FIFOs depend on it
+  if ((tmu_write || ldtmu) && (rhs.tmu_write || rhs.ldtmu)) return 1;
+
+  auto contains = [] (std::vector<DestReg> const &list, DestReg const &reg) {
+    for (auto const &item : list) {
+      if (item == reg) return true;
+    }
+    return false;
+  };
+
+  for (auto const &reg : writes) {
+    if (contains(rhs.reads, reg) || contains(rhs.writes, reg)) return 1;
+  }
+
+  int ret = -1;
+  for (auto const &reg : reads) {
+    if (contains(rhs.writes, reg)) {
+      if (reg == FLAGS) return 1;
+      ret = 0;
+    }
+  }
+
+  return ret;
+}
+
+
+/**
+ * List scheduler for a single basic block.
+ *
+ * Instructions are issued cycle by cycle from the set of ready instructions, picked on:
+ *   - TMU writes first, so that memory requests are issued as early as possible
+ *   - `ldtmu` loads last, so that TMU latency is covered by other work
+ *   - longest path to end of block (critical path)
+ *   - original position
+ *
+ * After an instruction with a single ALU operation is selected, the other ready instructions
+ * are searched for one that can be combined into the other ALU.
+ */
+class BlockScheduler {
+public:
+  BlockScheduler(Instructions const &block);
+
+  void run(Instructions &output);
+  int combine_count() const { return m_combine_count; }
+
+private:
+  std::vector<Node> m_nodes;
+  int m_combine_count = 0;
+
+  bool ready(Node const &node, int cycle) const { return !node.scheduled && node.num_preds == 0 && node.earliest <= cycle; }
+  bool better(Node const &lhs, Node const &rhs) const;
+  void issue(Node &node, int cycle);
+  bool combine(Node const &node1, Node const &node2, Instr &dst) const;
+};
+
+
+BlockScheduler::BlockScheduler(Instructions const &block) {
+  for (int i = 0; i < (int) block.size(); i++) {
+    m_nodes.emplace_back(block[i], i);
+  }
+
+  int size = (int) m_nodes.size();
+
+  for (int i = 0; i < size; i++) {
+    for (int j = i + 1; j < size; j++) {
+      int latency = m_nodes[i].latency_to(m_nodes[j]);
+      if (latency < 0) continue;
+
+      m_nodes[i].succs.emplace_back(j, latency);
+      m_nodes[j].num_preds++;
+    }
+  }
+
+  for (int i = size - 1; i >= 0; i--) {
+    auto &node = m_nodes[i];
+
+    for (auto const &succ : node.succs) {
+      node.height = std::max(node.height, m_nodes[succ.first].height + 1);
+    }
+  }
+}
+
+
+/**
+ * @return true if lhs should be issued before rhs
+ */
+bool BlockScheduler::better(Node const &lhs, Node const &rhs) const {
+  if (lhs.ldtmu     != rhs.ldtmu)     return !lhs.ldtmu;
+  if (lhs.tmu_write != rhs.tmu_write) return lhs.tmu_write;
+  if (lhs.height    != rhs.height)    return lhs.height > rhs.height;
+  return lhs.index < rhs.index;
+}
+
+
+void BlockScheduler::issue(Node &node, int cycle) {
+  node.scheduled = true;
+
+  for (auto const &succ : node.succs) {
+    auto &next = m_nodes[succ.first];
+    assert(next.num_preds > 0);
+    next.num_preds--;
+    next.earliest = std::max(next.earliest, cycle + succ.second);
+  }
+}
+
+
+/**
+ * Try to combine two instructions with a single ALU operation into one instruction.
+ */
+bool BlockScheduler::combine(Node const &node1, Node const &node2, Instr &dst) const {
+  // Pass the instructions in program order
+  auto const &instr1 = (node1.index < node2.index)? node1.instr : node2.instr;
+  auto const &instr2 = (node1.index < node2.index)? node2.instr : node1.instr;
+
+  bool do_converse;
+  if (!can_combine(instr1, instr2, do_converse)) return false;
+
+  auto const &add_instr = do_converse?instr2:instr1;
+  auto const &mul_instr = do_converse?instr1:instr2;
+  assert(add_instr.mul_nop());
+
+  // Don't deal with conditions yet in the mul alu
+  if (mul_instr.flag_set()) return false;
+
+  dst = add_instr;
+  return add_alu_to_mul_alu(mul_instr, dst);
+}
+
+
+void BlockScheduler::run(Instructions &output) {
+  int size = (int) m_nodes.size();
+  int num_scheduled = 0;
+
+  for (int cycle = 0; num_scheduled < size; cycle++) {
+    Node *first = nullptr;
+
+    for (auto &node : m_nodes) {
+      if (!ready(node, cycle)) continue;
+      if (first == nullptr || better(node, *first)) first = &node;
+    }
+
+    // All latencies are at most 1 cycle, so there is always something to issue
+    assertq(first != nullptr, "schedule(): no instruction ready for issue", true);
+
+    issue(*first, cycle);
+    num_scheduled++;
+
+    Instr instr = first->instr;
+
+    if (first->single_alu()) {
+      Node *second = nullptr;
+      Instr combined;
+
+      for (auto &node : m_nodes) {
+        if (!ready(node, cycle) || !node.single_alu()) continue;
+        if (second != nullptr && !better(node, *second)) continue;
+
+        Instr tmp;
+        if (combine(*first, node, tmp)) {
+          second   = &node;
+          combined = tmp;
+        }
+      }
+
+      if (second != nullptr) {
+        issue(*second, cycle);
+        num_scheduled++;
+        m_combine_count++;
+        instr = combined;
+      }
+    }
+
+    output << instr;
+  }
+}
+
+
+void schedule_block(Instructions &block, Instructions &output, int &combine_count) {
+  if (block.empty()) return;
+
+  // The header belongs to the start of the block, not to a specific instruction
+  std::string header = block.front().header();
+  std::string comment = block.front().comment();
+  block.front().clear_comments();
+  block.front().comment(comment);
+
+  BlockScheduler scheduler(block);
+  int first = (int) output.size();
+  scheduler.run(output);
+  output[first].header(header);
+
+  combine_count += scheduler.combine_count();
+  block.clear();
+}
+
+}  // anon namespace
+
+
+/**
+ * Reorder and combine the instructions within basic blocks.
+ *
+ * A dependency graph is made of each block and the instructions are list scheduled,
+ * combining add alu and mul alu operations into single instructions where possible.
+ * Independent of the order in which they appear in the block.
+ */
+void schedule(Instructions &instructions) {
+  Instructions ret;
+  Instructions block;
+  int combine_count = 0;
+  int delay_slots = 0;
+
+  for (auto const &instr : instructions) {
+    if (is_useless_move(instr)) continue;
+
+    bool movable = (delay_slots == 0) && can_schedule(instr);
+    if (delay_slots > 0) delay_slots--;
+
+    if (!movable || !instr.header().empty()) {
+      schedule_block(block, ret, combine_count);
+    }
+
+    if (movable) {
+      block << instr;
+    } else {
+      ret << instr;
+    }
+
+    if (instr.is_branch()) delay_slots = 3;
+  }
+
+  schedule_block(block, ret, combine_count);
+
+  compile_data.num_instructions_combined += combine_count;
+  instructions = ret;
+}
+
+}  // namespace v3d
+}  // namespace V3DLib
@@ -0,0 +1,13 @@
+#ifndef _LIB_V3D_SCHEDULER_H
+#define _LIB_V3D_SCHEDULER_H
+#include "instr/Instr.h"
+
+namespace V3DLib {
+namespace v3d {
+
+void schedule(Instructions &instructions);
+
+}  // namespace v3d
+}  // namespace V3DLib
+
+#endif  // _LIB_V3D_SCHEDULER_H
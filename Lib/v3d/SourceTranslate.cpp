@@ -1,10 +1,10 @@
 #include "SourceTranslate.h"
 #include <iostream>
 #include "Support/basics.h"
-#include "Support/Timer.h"
 #include "Source/Translate.h"
 #include "Source/Stmt.h"
 #include "Liveness/Liveness.h"
+#include "Liveness/Spill.h"
 #include "Target/Subst.h"
 #include "vc4/DMA/DMA.h"
 #include "Target/instr/Mnemonics.h"
@@ -33,54 +33,108 @@ Instr::List SourceTranslate::store_var(Var dst_addr, Var src) {
 }
 
 
+/**
+ * Load a spilled variable via the TMU.
+ *
+ * @param addr  accumulator to use for the address, gets set by `addr_code`
+ */
+Instr::List SourceTranslate::spill_load(Reg dst, Instr::List const &addr_code, Reg addr, Reg tmp) {
+  using namespace V3DLib::Target::instr;
+  Instr::List ret;
+
+  ret << addr_code
+      << mov(TMU0_S, addr)
+      << recv(dst);
+
+  ret.front().comment("spill load v3d");
+  return ret;
+}
+
+
+/**
+ * Store a spilled variable via the TMU.
+ *
+ * Same as `store_var()`, the store is waited for so that a subsequent load gets the new value.
+ */
+Instr::List SourceTranslate::spill_store(Reg src, Instr::List const &addr_code, Reg addr, Reg tmp) {
+  using namespace V3DLib::Target::instr;
+  Instr::List ret;
+
+  ret << addr_code
+      << mov(TMUD, src)
+      << mov(TMUA, addr)
+      << tmuwt();
+
+  ret.front().comment("spill store v3d");
+  return ret;
+}
+
+
+/**
+ * If no register is available for a variable, a variable is selected for spilling
+ * to main memory, and allocation is redone. See `Spill`.
+ */
 void SourceTranslate::regAlloc(Instr::List &instrs) {
-  //Timer t1("regAlloc", true);
-  int numVars = VarGen::count();
-
-  //Timer t2("regAlloc optimize");
-  Liveness::optimize(instrs, numVars);
-  //t2.end();
-
-  // Step 0 - Perform liveness analysis
-  //Timer t3("regAlloc compute");
-  Liveness live(numVars);
-  live.compute(instrs);
-  //t3.end();
-
-  // Step 2 - For each variable, determine all variables ever live at the same time
-  //Timer t4("regAlloc liveWith");
-  LiveSets liveWith(numVars);
-  liveWith.init(instrs, live);
-  //t4.end();
-
-  //Timer t5("regAlloc Allocate reg to var");
-
-  // Step 3 - Allocate a register to each variable
-  for (int i = 0; i < numVars; i++) {
-    if (live.reg_usage()[i].reg.tag != NONE) continue;
-
-    auto possible = liveWith.possible_registers(i, live.reg_usage());
-
-    live.reg_usage()[i].reg.tag = REG_A;
-    RegId regId = LiveSets::choose_register(possible, false);
-
-    if (regId < 0) {
-      std::string buf = "v3d regAlloc(): register allocation failed for target instruction ";
-      buf << i << ": " << instrs[i].mnemonic();
-      error(buf, true);
-    } else {
-      live.reg_usage()[i].reg.regId = regId;
+  Liveness::optimize(instrs, VarGen::count());
+
+  Spill spill(instrs);
+
+  while (true) {
+    int numVars = VarGen::count();
+
+    // Step 0 - Perform liveness analysis
+    Liveness live(numVars);
+
+    {
+      CompilePhase phase("liveness");
+      live.compute(instrs);
+    }
+
+    // Step 2 - For each variable, determine all variables ever live at the same time
+    LiveSets liveWith(numVars);
+
+    {
+      CompilePhase phase("live sets");
+      liveWith.init(instrs, live);
     }
-  }
 
-  //t5.end();
+    // Step 3 - Allocate a register to each variable
+    for (int i = 0; i < numVars; i++) {
+      if (live.reg_usage()[i].reg.tag != NONE) continue;
 
-  compile_data.allocated_registers_dump = live.reg_usage().dump(true);
+      auto possible = liveWith.possible_registers(i, live.reg_usage());
+
+      live.reg_usage()[i].reg.tag = REG_A;
+      RegId regId = LiveSets::choose_register(possible, false);
+
+      if (regId >= 0) {
+        live.reg_usage()[i].reg.regId = regId;
+        continue;
+      }
+
+      live.reg_usage()[i].reg.tag = NONE;
+
+      if (spill.choose(i, live, liveWith) < 0) {
+        std::string buf = "v3d regAlloc(): register allocation failed for target instruction ";
+        buf << i << ": " << instrs[i].mnemonic();
+        error(buf, true);
+      }
+    }
+
+    if (!spill.pending()) {
+      if (CompileData::capture_dumps()) {
+        compile_data.allocated_registers_dump = [usage = live.reg_usage()] () { return usage.dump(true); };
+      }
+
+      // Step 4 - Apply the allocation to the code
+      allocate_registers(instrs, live.reg_usage());
+      break;
+    }
+
+    spill.apply();
+  }
 
-  // Step 4 - Apply the allocation to the code
-  //Timer t6("regAlloc allocate_registers");
-  allocate_registers(instrs, live.reg_usage());
-  //t6.end();
+  compile_data.num_spill_slots = spill.num_slots();
 }
 
 
@@ -8,6 +8,8 @@ namespace v3d {
 class SourceTranslate : public ISourceTranslate {
 public:
   Instr::List store_var(Var dst_addr, Var src) override;
+  Instr::List spill_load(Reg dst, Instr::List const &addr_code, Reg addr, Reg tmp) override;
+  Instr::List spill_store(Reg src, Instr::List const &addr_code, Reg addr, Reg tmp) override;
   void regAlloc(Instr::List &instrs) override;
   bool stmt(Instr::List &seq, Stmt::Ptr s) override; 
 };
@@ -469,6 +469,112 @@ bool Instr::compare_codes(uint64_t code1, uint64_t code2) {
 }
 
 
+/**
+ * Pass the fields of this instruction as words to the given function.
+ *
+ * Only the fields relevant for the instruction type are passed, the same way as for
+ * `compare_codes()`. Label fields are included, comments and the skip flag are not.
+ */
+template<typename F>
+void Instr::for_each_field(F &&put) const {
+  put((uint32_t) type);
+  put(m_is_label? 1u : 0u);
+  put((uint32_t) m_label);
+
+  if (type == V3D_QPU_INSTR_TYPE_BRANCH) {
+    put((uint32_t) branch.cond);
+    put((uint32_t) branch.msfign);
+    put((uint32_t) branch.bdi);
+    put(branch.ub? 1u : 0u);
+    put(branch.ub? (uint32_t) branch.bdu : 0u);  // bdu is only used if ub is set
+    put((uint32_t) branch.raddr_a);
+    put(branch.offset);
+    return;
+  }
+
+  uint32_t sig_bits = (uint32_t) sig.thrsw
+                    | (uint32_t) sig.ldunif    <<  1
+                    | (uint32_t) sig.ldunifa   <<  2
+                    | (uint32_t) sig.ldunifrf  <<  3
+                    | (uint32_t) sig.ldunifarf <<  4
+                    | (uint32_t) sig.ldtmu     <<  5
+                    | (uint32_t) sig.ldvary    <<  6
+                    | (uint32_t) sig.ldvpm     <<  7
+                    | (uint32_t) sig.ldtlb     <<  8
+                    | (uint32_t) sig.ldtlbu    <<  9
+                    | (uint32_t) sig.small_imm << 10
+                    | (uint32_t) sig.ucb       << 11
+                    | (uint32_t) sig.rotate    << 12
+                    | (uint32_t) sig.wrtmuc    << 13;
+  put(sig_bits);
+  put((uint32_t) sig_addr);
+  put(sig_magic? 1u : 0u);
+  put((uint32_t) raddr_a);
+  put((uint32_t) raddr_b);
+
+  put((uint32_t) flags.ac);
+  put((uint32_t) flags.mc);
+  put((uint32_t) flags.apf);
+  put((uint32_t) flags.mpf);
+  put((uint32_t) flags.auf);
+  put((uint32_t) flags.muf);
+
+  auto put_alu = [&put] (auto const &op) {
+    put((uint32_t) op.op);
+    put((uint32_t) op.a);
+    put((uint32_t) op.b);
+    put((uint32_t) op.waddr);
+    put(op.magic_write? 1u : 0u);
+    put((uint32_t) op.output_pack);
+    put((uint32_t) op.a_unpack);
+    put((uint32_t) op.b_unpack);
+  };
+
+  put_alu(alu.add);
+  put_alu(alu.mul);
+}
+
+
+/**
+ * Hash the fields of this instruction.
+ *
+ * The hash is stable over runs and continues from the passed seed, so that the hash
+ * of an instruction list can be built up per instruction.
+ */
+uint64_t Instr::hash(uint64_t seed) const {
+  for_each_field([&seed] (uint32_t word) { seed = hash_words(seed, &word, 1); });
+  return seed;
+}
+
+
+/**
+ * Field-wise comparison.
+ *
+ * Unlike comparing the output of `code()`, this takes the label fields into account
+ * and does not need to encode the instructions.
+ */
+bool Instr::operator==(Instr const &rhs) const {
+  int const MAX_WORDS = 40;  // Enough for an ALU instruction
+  uint32_t words[MAX_WORDS];
+  int count = 0;
+
+  for_each_field([&words, &count] (uint32_t word) {
+    assert(count < MAX_WORDS);
+    words[count++] = word;
+  });
+
+  int index = 0;
+  bool equal = true;
+
+  rhs.for_each_field([&words, &count, &index, &equal] (uint32_t word) {
+    if (index >= count || words[index] != word) equal = false;
+    index++;
+  });
+
+  return equal && index == count;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Conditions branch instructions
 ///////////////////////////////////////////////////////////////////////////////
@@ -5,6 +5,7 @@
 #include <vector>
 #include "v3d_api.h"
 #include "Support/InstructionComment.h"
+#include "Support/Hash.h"
 #include "Source.h"
 #include "Encode.h"
 #include "Target/instr/ALUInstruction.h"
@@ -85,6 +86,12 @@ public:
 
   static bool compare_codes(uint64_t code1, uint64_t code2);
 
+  uint64_t hash(uint64_t seed = FNV_OFFSET) const;
+  bool operator==(Instr const &rhs) const;
+  bool operator!=(Instr const &rhs) const { return !(*this == rhs); }
+  bool operator==(uint64_t rhs) const { return code() == rhs; }
+  bool operator!=(uint64_t rhs) const { return code() != rhs; }
+
   bool check_dst() const;
   bool uses_sig_dst() const;
   bool is_ldtmu() const { assert(sig_dst_count() <= 1); return sig.ldtmu; }
@@ -135,6 +142,8 @@ protected:
 private:
   bool m_skip = false;
 
+  template<typename F> void for_each_field(F &&put) const;
+
   std::string pretty_instr() const;
   int sig_dst_count() const;
 
@@ -1,4 +1,5 @@
 #include "OpItems.h"
+#include <atomic>
 #include <vector>
 #include "Support/basics.h"
 
@@ -64,7 +65,7 @@ std::vector<op_item> op_items = {
 
 
 void op_items_check_sorted() {
-  static bool checked = false;
+  static std::atomic<bool> checked(false);  // Can be called from multiple compiling threads
 
   if (checked) return;
 
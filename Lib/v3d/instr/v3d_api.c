@@ -518,3 +518,19 @@ bool small_imm_pack(uint32_t value, uint32_t *packed_small_immediate) {
 
   return v3d_qpu_small_imm_pack(&devinfo, value, packed_small_immediate);
 }
+
+
+bool small_imm_unpack(uint32_t packed_small_immediate, uint32_t *small_immediate) {
+  struct v3d_device_info devinfo;
+  devinfo.ver = 42;
+
+  return v3d_qpu_small_imm_unpack(&devinfo, packed_small_immediate, small_immediate);
+}
+
+
+//
+// Following are wrappers, because the mesa functions are not callable from C++
+//
+int add_op_num_src(enum v3d_qpu_add_op op) { return v3d_qpu_add_op_num_src(op); }
+int mul_op_num_src(enum v3d_qpu_mul_op op) { return v3d_qpu_mul_op_num_src(op); }
+bool add_op_has_dst(enum v3d_qpu_add_op op) { return v3d_qpu_add_op_has_dst(op); }
@@ -19,6 +19,10 @@ bool instr_unpack(uint64_t packed_instr, struct v3d_qpu_instr *instr);
 uint64_t instr_pack(struct v3d_qpu_instr const *instr);
 const char *instr_mnemonic(const struct v3d_qpu_instr *instr);
 bool small_imm_pack(uint32_t value, uint32_t *packed_small_immediate);
+bool small_imm_unpack(uint32_t packed_small_immediate, uint32_t *small_immediate);
+int  add_op_num_src(enum v3d_qpu_add_op op);
+int  mul_op_num_src(enum v3d_qpu_mul_op op);
+bool add_op_has_dst(enum v3d_qpu_add_op op);
 
 #ifdef __cplusplus
 }
@@ -2,6 +2,7 @@
 
 #include "BufferObject.h"
 #include <cassert>
+#include <mutex>
 #include <stdio.h>
 #include "Mailbox.h"
 #include "vc4.h"
@@ -19,6 +20,7 @@ namespace vc4 {
 namespace {
 
 BufferObject heap;
+std::mutex heap_mutex;
 
 }
 
@@ -44,6 +46,13 @@ void BufferObject::alloc_mem(uint32_t size_in_bytes) {
 }
 
 
+V3DLib::BufferObject *BufferObject::new_segment(uint32_t size_in_bytes) {
+  auto *ret = new BufferObject();
+  ret->alloc(size_in_bytes);
+  return ret;
+}
+
+
 // Deallocation
 void BufferObject::dealloc() {
   uint32_t const IOCTL_ERROR = (uint32_t) -1;
@@ -77,6 +86,8 @@ void BufferObject::dealloc() {
 
 
 BufferObject &BufferObject::getHeap() {
+  std::lock_guard<std::mutex> lock(heap_mutex);
+
   if (Platform::has_vc4()) {
     if (heap.size() == 0) {
       //debug("Allocating main heap vc4\n");
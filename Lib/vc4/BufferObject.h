@@ -18,6 +18,7 @@ private:
   uint32_t handle = 0;
 
   void alloc_mem(uint32_t size_in_bytes) override;
+  V3DLib::BufferObject *new_segment(uint32_t size_in_bytes) override;
   void dealloc();
 };
 
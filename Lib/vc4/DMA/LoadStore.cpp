@@ -612,6 +612,69 @@ Instr::List storeRequest(Var dst_addr, Var src) {
 }
 
 
+/**
+ * Store a spilled variable to main memory.
+ *
+ * Same as `storeRequest()`, but only uses the passed accumulators as temporaries,
+ * so that it can be inserted after register allocation has started.
+ *
+ * @param src        variable to store
+ * @param addr_code  code which puts the store address in `addr`
+ * @param addr, tmp  accumulators which are free at the point of insertion
+ */
+Instr::List spillStoreRequest(Reg src, Instr::List const &addr_code, Reg addr, Reg tmp) {
+  using namespace V3DLib::Target::instr;
+
+  Instr::List ret;
+
+  ret << li(tmp, vpmSetupWriteCode(0, 1) | 16).comment("Start spill store")       // Setup VPM
+      << add(WR_SETUP, tmp, QPU_ID)
+      << genWaitDMAStore()                                                        // Wait for any previous store to complete
+      << genSetWriteStride(0)                                                     // Setup DMA
+      << li(tmp, dmaSetupStoreCode(16, 1, 1) | (256 << 3))
+      << mov(addr, QPU_ID)
+      << shl(addr, addr, 3)
+      << bor(WR_SETUP, tmp, addr)
+      << shl(Target::instr::VPM_WRITE, src, 0)                                    // Put to VPM
+      << addr_code
+      << genStartDMAStore(addr);                                                  // Start DMA
+
+  ret.back().comment("End spill store");
+  return ret;
+}
+
+
+/**
+ * Load a spilled variable from main memory.
+ *
+ * Same as `loadRequest()`, but only uses the passed accumulators as temporaries.
+ * A spill store to the same location may still be running, this is waited for first.
+ *
+ * @param dst        variable to load
+ * @param addr_code  code which puts the load address in `addr`
+ * @param addr, tmp  accumulators which are free at the point of insertion
+ */
+Instr::List spillLoadRequest(Reg dst, Instr::List const &addr_code, Reg addr, Reg tmp) {
+  using namespace V3DLib::Target::instr;
+
+  Instr::List ret;
+
+  ret << genWaitDMAStore().comment("Start spill load")                            // Wait for spill store
+      << genSetReadPitch(4)                                                       // Setup DMA
+      << li(tmp, dmaSetupLoadCode(16, 1, 1, 1))
+      << bor(RD_SETUP, QPU_ID, tmp)
+      << addr_code
+      << genStartDMALoad(addr)                                                    // Start DMA load
+      << genWaitDMALoad(false)                                                    // Wait for DMA
+      << li(tmp, vpmSetupReadCode(1, 0, 1))                                       // Setup VPM
+      << bor(RD_SETUP, QPU_ID, tmp)
+      << Instr(VPM_STALL)
+      << shl(dst, Target::instr::VPM_READ, 0).comment("End spill load");          // Get from VPM
+
+  return ret;
+}
+
+
 /**
  * @return true if statement handled, false otherwise
  */
@@ -8,6 +8,8 @@ namespace DMA {
 
 Instr::List loadRequest(Var &dst, Expr &e);
 Instr::List storeRequest(Var dst_addr, Var src);
+Instr::List spillStoreRequest(Reg src, Instr::List const &addr_code, Reg addr, Reg tmp);
+Instr::List spillLoadRequest(Reg dst, Instr::List const &addr_code, Reg addr, Reg tmp);
 bool translate_stmt(Instr::List &seq, int in_tag, Stmt &s);
 
 }  // namespace DMA
@@ -1,9 +1,21 @@
 #include "Operations.h"
 #include "Source/StmtStack.h"
+#include "Common/CompileData.h"
 
 namespace V3DLib {
 namespace  {
 
+/**
+ * Register that the kernel uses the VPM/DMA directly.
+ *
+ * The kernel then keeps its own state in the VPM and DMA setup registers,
+ * which spill code would overwrite (see `Spill`).
+ */
+void mark_vpm_use() {
+  compile_data.uses_vpm = true;
+}
+
+
 //=============================================================================
 // VPM Setup
 //=============================================================================
@@ -25,28 +37,33 @@ Stmt::Ptr vpmSetupWriteCore(IntExpr addr, bool hor, int stride) {
 
 
 void vpmPutExpr(Expr::Ptr e) {
+  mark_vpm_use();
   stmtStack() << Stmt::create_assign(mkVar(Var(VPM_WRITE)), e);
 }
 
 
 void dmaStartReadExpr(Expr::Ptr e) {
+  mark_vpm_use();
   Stmt::Ptr s = Stmt::create(Stmt::DMA_START_READ, e, nullptr);
   stmtStack().append(s);
 }
 
 
 void dmaStartWriteExpr(Expr::Ptr e) {
+  mark_vpm_use();
   Stmt::Ptr s = Stmt::create(Stmt::DMA_START_WRITE, e, nullptr);
   stmtStack().append(s);
 }
 
 
 void vpmSetupRead(Dir d, int n, IntExpr addr, int stride) {
+  mark_vpm_use();
   stmtStack() << vpmSetupReadCore(n, addr, d == HORIZ ? 1 : 0, stride);
 }
 
 
 void vpmSetupWrite(Dir d, IntExpr addr, int stride) {
+  mark_vpm_use();
   stmtStack() << vpmSetupWriteCore(addr, d == HORIZ ? 1 : 0, stride);
 }
 
@@ -56,16 +73,19 @@ void vpmSetupWrite(Dir d, IntExpr addr, int stride) {
 // ============================================================================
 
 void dmaSetReadPitch(IntExpr stride) {
+  mark_vpm_use();
   stmtStack() << Stmt::create(Stmt::SET_READ_STRIDE, stride.expr(), nullptr);
 }
 
 
 void dmaSetWriteStride(IntExpr stride) {
+  mark_vpm_use();
   stmtStack() << Stmt::create(Stmt::SET_WRITE_STRIDE, stride.expr(), nullptr);
 }
 
 
 void dmaSetupRead(Dir dir, int numRows, IntExpr vpmAddr, int rowLen, int vpitch) {
+  mark_vpm_use();
   Stmt::Ptr s = Stmt::create(Stmt::SETUP_DMA_READ);
   s->dma.setupDMARead(dir == HORIZ, numRows, vpmAddr.expr(), rowLen, vpitch);
   stmtStack() << s;
@@ -73,6 +93,7 @@ void dmaSetupRead(Dir dir, int numRows, IntExpr vpmAddr, int rowLen, int vpitch)
 
 
 void dmaSetupWrite(Dir dir, int numRows, IntExpr vpmAddr, IntExpr rowLen) {
+  mark_vpm_use();
   Stmt::Ptr s = Stmt::create(Stmt::SETUP_DMA_WRITE);
   s->dma.setupDMAWrite(dir == HORIZ, numRows, vpmAddr.expr(), rowLen);
   stmtStack() << s;
@@ -15,7 +15,7 @@ namespace {
  * See also NOTES in header comment for `encodeSrcReg()`.
  *
  * @param reg   register definition for which to determine output value
- * @param file  out-parameter; the regfile to use (either REG_A or REG_B)
+ * @param file  out-parameter; the regfile to use (REG_A or REG_B), NONE if either can be used
  *
  * @return index into regfile (A, B or both) of the passed register
  *
@@ -32,10 +32,7 @@ namespace {
  */
 uint32_t encodeDestReg(Reg reg, RegTag* file) {
   // Selection of regfile for the cases where using A or B doesn't matter
-  RegTag AorB = REG_A;  // Select A as default
-  if (reg.tag == REG_A || reg.tag == REG_B) {
-    AorB = reg.tag;     // If the regfile is preselected in `reg`, use that.
-  }
+  RegTag AorB = NONE;
 
   switch (reg.tag) {
     case REG_A:
@@ -76,83 +73,25 @@ uint32_t encodeDestReg(Reg reg, RegTag* file) {
 
 
 /**
- * @brief Determine regfile index and the read field encoding for alu-instructions, for the passed 
- *        register 'reg'.
- *
- * The read field encoding, output parameter `mux` is a bitfield in instructions `alu` and 
- * 'alu small imm'. It specifies the register(s) to use as input.
- *
- * This function deals exclusively with 'read' values.
- *
- * @param reg   register definition for which to determine output value
- * @param file  regfile to use. This is used mainly to validate the `regid` field in param `reg`. In specific
- *              cases where both regfile A and B are valid (e.g. NONE), it is used to select the regfile.
- * @param mux   out-parameter; value in ALU instruction encoding for fields `add_a`, `add_b`, `mul_a` and `mul_b`.
- *
- * @return index into regfile (A, B or both) of the passed register.
- *
- * ----------------------------------------------------------------------------------------------
- * ## NOTES
- *
- * * There are four combinations of access to regfiles:
- *   - read A
- *   - read B
- *   - write A
- *   - write B
- *
- * This is significant, because SPECIAL registers may only be accessible through a specific combination
- * of A/B and read/write.
- *
- * * References in VideoCore IV Reference document:
- *
- *   - Fields `add_a`, `add_b`, `mul_a` and `mul_b`: "Figure 4: ALU Instruction Encoding", page 26
- *   - mux value: "Table 3: ALU Input Mux Encoding", page 28
- *   - Index regfile: "Table 14: 'QPU Register Addess Map'", page 37.
- *
- * ----------------------------------------------------------------------------------------------
- * ## TODO
- *
- * * NONE/NOP - There are four distinct versions for `NOP`, A/B and no read/no write.
- *              Verify if those distinctions are important at least for A/B.
- *              They might be the same thing.
+ * Check if the given source operand can be read from either regfile
  */
-uint32_t encodeSrcReg(Reg reg, RegTag file, uint32_t* mux) {
-  assert (file == REG_A || file == REG_B);
+bool is_flexible_src(RegOrImm const &src) {
+  if (!src.is_reg()) return false;
 
-  const uint32_t NO_REGFILE_INDEX = 0;  // Return value to use when there is no regfile mapping for the register
+  Reg const &reg = src.reg();
+  return reg.tag == NONE
+      || (reg.tag == SPECIAL && (reg.regId == SPECIAL_UNIFORM || reg.regId == SPECIAL_VPM_READ));
+}
 
-  // Selection of regfile for the cases that both A and B are possible.
-  // Note that param `file` has precedence here.
-  uint32_t AorB = (file == REG_A)? 6 : 7;
 
-  switch (reg.tag) {
-    case REG_A:
-      assert(reg.regId >= 0 && reg.regId < 32 && file == REG_A);
-      *mux = 6; return reg.regId;
-    case REG_B:
-      assert(reg.regId >= 0 && reg.regId < 32 && file == REG_B);
-      *mux = 7; return reg.regId;
-    case ACC:
-      // ACC does not map onto a regfile for 'read'
-      assert(reg.regId >= 0 && reg.regId <= 4);  // TODO index 5 missing, is this correct??
-      *mux = reg.regId; return NO_REGFILE_INDEX;
-    case NONE:
-      // NONE maps to `NOP` in the regfile
-      *mux = AorB; return 39;
-    case SPECIAL:
-      switch (reg.regId) {
-        case SPECIAL_UNIFORM:     *mux = AorB;                     return 32;
-        case SPECIAL_ELEM_NUM:    assert(file == REG_A); *mux = 6; return 38;
-        case SPECIAL_QPU_NUM:     assert(file == REG_B); *mux = 7; return 38;
-        case SPECIAL_VPM_READ:    *mux = AorB;                     return 48;
-        case SPECIAL_DMA_LD_WAIT: assert(file == REG_A); *mux = 6; return 50;
-        case SPECIAL_DMA_ST_WAIT: assert(file == REG_B); *mux = 7; return 50;
-      }
-
-    default:
-      fatal("V3DLib: missing case in encodeSrcReg");
-      return 0;
-  }
+/**
+ * Check if the given ALU instruction is a plain move, i.e. `or` with identical operands.
+ *
+ * This can be executed on the mul ALU as a `v8min` with identical operands.
+ */
+bool is_mov(V3DLib::Instr const &instr) {
+  auto const &alu = instr.ALU;
+  return alu.op == ALUOp::A_BOR && alu.srcA == alu.srcB && !instr.set_cond().flags_set();
 }
 
 }  // anon namespace
@@ -198,72 +137,134 @@ void Instr::tag(Tag in_tag, bool imm) {
 
 
 /**
- * Handle case where there are two source operands
+ * Claim a regfile read port for given register address.
  *
- * This is fairly convoluted stuff; apparently there are rules with regfile A/B usage
- * which I am not aware of.
+ * There is one read port per regfile, which is shared by the add and the mul ALU.
+ * Regfile B shares its read address with the small immediate.
+ *
+ * @return true if successful, false if the port is already in use for another address
  */
-void Instr::encode_operands(RegOrImm const &srcA, RegOrImm const &srcB) {
-  uint32_t muxa, muxb;
-  uint32_t raddra = 0, raddrb;
-
-  if (srcA.is_reg() && srcB.is_reg()) { // Both operands are registers
-    RegTag aFile = srcA.reg().regfile();
-    RegTag aTag  = srcA.reg().tag;
-
-    RegTag bFile = srcB.reg().regfile();
-
-    // If operands are the same register
-    if (aTag != NONE && srcA == srcB) {
-      if (aFile == REG_A) {
-        raddra = encodeSrcReg(srcA.reg(), REG_A, &muxa);
-        raddrb = 39;
-        muxb = muxa;
-      } else {
-        raddra = 39;
-        raddrb = encodeSrcReg(srcA.reg(), REG_B, &muxa);
-        muxb = muxa;
-      }
-    } else {
-      // Operands are different registers
-      assert(aFile == NONE || bFile == NONE || aFile != bFile);  // TODO examine why aFile == bFile is disallowed here
-      if (aFile == REG_A || bFile == REG_B) {
-        raddra = encodeSrcReg(srcA.reg(), REG_A, &muxa);
-        raddrb = encodeSrcReg(srcB.reg(), REG_B, &muxb);
-      } else {
-        raddra = encodeSrcReg(srcB.reg(), REG_A, &muxb);
-        raddrb = encodeSrcReg(srcA.reg(), REG_B, &muxa);
+bool Instr::read_port(bool file_b, uint32_t raddr, uint32_t &mux) {
+  bool     &used = file_b? m_raddrb_used : m_raddra_used;
+  uint32_t &port = file_b? raddrb : raddra;
+
+  if (used && (port != raddr || (file_b && m_small_imm))) return false;
+
+  used = true;
+  port = raddr;
+  mux  = file_b? 7 : 6;
+  return true;
+}
+
+
+/**
+ * Determine regfile index and the read field encoding for an ALU operand.
+ *
+ * The read field encoding, output parameter `mux` is a bitfield in instructions `alu` and 
+ * 'alu small imm'. It specifies the register(s) to use as input.
+ *
+ * ----------------------------------------------------------------------------------------------
+ * ## NOTES
+ *
+ * * There are four combinations of access to regfiles:
+ *   - read A
+ *   - read B
+ *   - write A
+ *   - write B
+ *
+ * This is significant, because SPECIAL registers may only be accessible through a specific combination
+ * of A/B and read/write.
+ *
+ * * References in VideoCore IV Reference document:
+ *
+ *   - Fields `add_a`, `add_b`, `mul_a` and `mul_b`: "Figure 4: ALU Instruction Encoding", page 26
+ *   - mux value: "Table 3: ALU Input Mux Encoding", page 28
+ *   - Index regfile: "Table 14: 'QPU Register Addess Map'", page 37.
+ *
+ * @return true if successful, false if the needed read port is not available
+ */
+bool Instr::encode_src(RegOrImm const &src, uint32_t &mux) {
+  if (src.is_imm()) {
+    auto val = (uint32_t) src.imm().val;
+    if (m_raddrb_used && (!m_small_imm || raddrb != val)) return false;
+
+    m_raddrb_used = true;
+    m_small_imm   = true;
+    raddrb        = val;
+    mux           = 7;
+    return true;
+  }
+
+  Reg const &reg = src.reg();
+
+  switch (reg.tag) {
+    case REG_A:
+      assert(reg.regId >= 0 && reg.regId < 32);
+      return read_port(false, reg.regId, mux);
+    case REG_B:
+      assert(reg.regId >= 0 && reg.regId < 32);
+      return read_port(true, reg.regId, mux);
+    case ACC:
+      // ACC does not map onto a regfile for 'read'
+      assert(reg.regId >= 0 && reg.regId <= 4);  // TODO index 5 missing, is this correct??
+      mux = reg.regId;
+      return true;
+    case NONE:
+      // NONE maps to `NOP` in the regfile
+      return read_port(false, 39, mux) || read_port(true, 39, mux);
+    case SPECIAL:
+      switch (reg.regId) {
+        case SPECIAL_UNIFORM:     return read_port(false, 32, mux) || read_port(true, 32, mux);
+        case SPECIAL_ELEM_NUM:    return read_port(false, 38, mux);
+        case SPECIAL_QPU_NUM:     return read_port(true,  38, mux);
+        case SPECIAL_VPM_READ:    return read_port(false, 48, mux) || read_port(true, 48, mux);
+        case SPECIAL_DMA_LD_WAIT: return read_port(false, 50, mux);
+        case SPECIAL_DMA_ST_WAIT: return read_port(true,  50, mux);
       }
-    }
-  } else if (srcA.is_imm() || srcB.is_imm()) {
-    if (srcA.is_imm() && srcB.is_imm()) {
-      assertq(srcA.imm().val == srcB.imm().val,
-        "srcA and srcB can not both be immediates with different values", true);
-
-      raddrb = (uint32_t) srcA.imm().val;  // srcB is the same
-      muxa   = 7;
-      muxb   = 7;
-    } else if (srcB.is_imm()) {
-      // Second operand is a small immediate
-      raddra = encodeSrcReg(srcA.reg(), REG_A, &muxa);
-      raddrb = (uint32_t) srcB.imm().val;
-      muxb   = 7;
-    } else if (srcA.is_imm()) {
-      // First operand is a small immediate
-      raddra = encodeSrcReg(srcB.reg(), REG_A, &muxb);
-      raddrb = (uint32_t) srcA.imm().val;
-      muxa   = 7;
-    } else {
-      assert(false);  // Not expecting this
-    }
+
+    default:
+      fatal("V3DLib: missing case in encode_src()");
+      return false;
+  }
+}
+
+
+/**
+ * Encode the ALU operation of given instruction in the add or mul ALU.
+ *
+ * @param use_mul  if true, use the mul ALU. For an add operation, this is only possible for a move
+ * @param file     out-parameter; regfile of the destination, NONE if either can be used
+ *
+ * @return true if successful, false if the regfile read ports are not available
+ */
+bool Instr::encode_alu(V3DLib::Instr const &instr, bool use_mul, RegTag &file) {
+  auto const &alu = instr.ALU;
+  assert(!alu.op.isRot());
+  assert(!use_mul || alu.op.isMul() || is_mov(instr));
+
+  uint32_t &mux_a = use_mul? mul_a : add_a;
+  uint32_t &mux_b = use_mul? mul_b : add_b;
+
+  // Operands with a fixed regfile go first, so that the flexible ones can take the remaining port
+  if (is_flexible_src(alu.srcA)) {
+    if (!encode_src(alu.srcB, mux_b) || !encode_src(alu.srcA, mux_a)) return false;
   } else {
-    assert(false);  // Not expecting this
+    if (!encode_src(alu.srcA, mux_a) || !encode_src(alu.srcB, mux_b)) return false;
   }
 
-  raddra  = raddra;
-  raddrb  = raddrb;
-  muxa  = muxa;
-  muxb  = muxb;
+  uint32_t dest = encodeDestReg(instr.dest(), &file);
+
+  if (use_mul) {
+    cond_mul  = instr.assign_cond().encode();
+    waddr_mul = dest;
+    mulOp     = alu.op.isMul()? alu.op.vc4_encodeMulOp() : ALUOp(ALUOp::M_V8MIN).vc4_encodeMulOp();
+  } else {
+    cond_add  = instr.assign_cond().encode();
+    waddr_add = dest;
+    addOp     = alu.op.vc4_encodeAddOp();
+  }
+
+  return true;
 }
 
 
@@ -291,8 +292,8 @@ uint32_t Instr::low() const {
       return (mulOp << 29) | (raddra << 18) | (raddrb << 12);
     case ALU:
       return (mulOp << 29) | (addOp << 24) | (raddra << 18) | (raddrb << 12)
-           | (muxa << 9) | (muxb << 6)
-           | (muxa << 3) | muxb;
+           | (add_a << 9) | (add_b << 6)
+           | (mul_a << 3) | mul_b;
     case END:
     case LDTMU:
       return (raddra << 18) | (raddrb << 12);
@@ -322,7 +323,7 @@ void Instr::encode(V3DLib::Instr const &instr) {
       tag(Instr::LI);
       cond_add  = instr.assign_cond().encode();
       waddr_add = encodeDestReg(instr.dest(), &file);
-      ws(file != REG_A);
+      ws(file == REG_B);
       li_imm = li.imm.encode();
       sf(instr.set_cond().flags_set());
     }
@@ -340,40 +341,34 @@ void Instr::encode(V3DLib::Instr const &instr) {
     case InstrTag::ALU: {
       auto &alu = instr.ALU;
 
-      RegTag file;
-      uint32_t dest  = encodeDestReg(instr.dest(), &file);
-
-      if (alu.op.isMul()) {
-        cond_mul  = instr.assign_cond().encode();
-        waddr_mul = dest;
-        ws(file != REG_B);
-      } else {
-        cond_add  = instr.assign_cond().encode();
-        waddr_add = dest;
-        ws(file != REG_A);
-      }
-
       sf(instr.set_cond().flags_set());
 
       if (alu.op.isRot()) {
         assert(alu.srcA.is_reg() && alu.srcA.reg().tag == ACC && alu.srcA.reg().regId == 0);
         assert(!alu.srcB.is_reg() || (alu.srcB.reg().tag == ACC && alu.srcB.reg().regId == 5));
-        uint32_t raddrb = 48;
+
+        RegTag file;
+        waddr_mul = encodeDestReg(instr.dest(), &file);
+        cond_mul  = instr.assign_cond().encode();
+        ws(file == REG_A);
+
+        raddrb = 48;
 
         if (!alu.srcB.is_reg()) {  // i.e. value is an imm
           uint32_t n = (uint32_t) alu.srcB.imm().val;
-          assert(n >= 1 || n <= 15);
+          assert(n >= 1 && n <= 15);
           raddrb += n;
         }
 
         tag(Instr::ROT);
         mulOp  = ALUOp(ALUOp::M_V8MIN).vc4_encodeMulOp();
-        raddrb = raddrb;
       } else {
-        tag(Instr::ALU, instr.hasImm());
-        mulOp = (alu.op.isMul() ? alu.op.vc4_encodeMulOp() : 0);
-        addOp = (alu.op.isMul() ? 0 : alu.op.vc4_encodeAddOp());
-        encode_operands(alu.srcA, alu.srcB);
+        RegTag file;
+        bool use_mul = alu.op.isMul();
+        bool ok = encode_alu(instr, use_mul, file);
+        assertq(ok, "vc4::Instr::encode(): regfile read conflict in ALU operands", true);
+        ws(use_mul? (file == REG_A) : (file == REG_B));
+        tag(Instr::ALU, m_small_imm);
       }
     }
     break;
@@ -406,5 +401,63 @@ void Instr::encode(V3DLib::Instr const &instr) {
   }
 }
 
+
+/**
+ * Encode two ALU instructions into a single instruction, one in the add ALU and one in the mul ALU.
+ *
+ * The instructions are assumed to be independent of each other.
+ * Only the add ALU operation may set the condition flags.
+ *
+ * @return true if successful, false if the instructions can not be combined.
+ *         In the latter case, the state of the current instance is undefined.
+ */
+bool Instr::encode(V3DLib::Instr const &instr1, V3DLib::Instr const &instr2) {
+  if (instr1.tag != InstrTag::ALU || instr2.tag != InstrTag::ALU) return false;
+  if (instr1.ALU.op.isRot() || instr2.ALU.op.isRot()) return false;
+
+  V3DLib::Instr const *add_instr = nullptr;
+  V3DLib::Instr const *mul_instr = nullptr;
+
+  if (instr1.ALU.op.isMul() && instr2.ALU.op.isMul()) {
+    return false;
+  } else if (instr1.ALU.op.isMul()) {
+    add_instr = &instr2; mul_instr = &instr1;
+  } else if (instr2.ALU.op.isMul()) {
+    add_instr = &instr1; mul_instr = &instr2;
+  } else if (is_mov(instr2)) {
+    add_instr = &instr1; mul_instr = &instr2;
+  } else if (is_mov(instr1)) {
+    add_instr = &instr2; mul_instr = &instr1;
+  } else {
+    return false;
+  }
+
+  if (mul_instr->set_cond().flags_set()) return false;
+
+  RegTag add_file;
+  RegTag mul_file;
+  if (!encode_alu(*add_instr, false, add_file)) return false;
+  if (!encode_alu(*mul_instr, true,  mul_file)) return false;
+
+  // Without write swap, the add ALU writes to regfile A and the mul ALU to regfile B
+  if (add_file != REG_B && mul_file != REG_A) {
+    ws(false);
+  } else if (add_file != REG_A && mul_file != REG_B) {
+    ws(true);
+  } else {
+    return false;
+  }
+
+  sf(add_instr->set_cond().flags_set());
+  tag(Instr::ALU, m_small_imm);
+  return true;
+}
+
+
+bool Instr::can_pair(V3DLib::Instr const &instr1, V3DLib::Instr const &instr2) {
+  Instr tmp;
+  return tmp.encode(instr1, instr2);
+}
+
 }  // namespace vc4
 }  // namespace V3DLib
@@ -9,8 +9,11 @@ namespace vc4 {
 class Instr {
 public:
   void encode(V3DLib::Instr const &instr);
+  bool encode(V3DLib::Instr const &instr1, V3DLib::Instr const &instr2);
   uint64_t code() const { return (((uint64_t) high()) << 32) + low(); }
 
+  static bool can_pair(V3DLib::Instr const &instr1, V3DLib::Instr const &instr2);
+
 private:
   enum Tag {
     NOP,
@@ -31,11 +34,18 @@ private:
 
   uint32_t addOp  = 0;
   uint32_t mulOp  = 0;
-  uint32_t muxa   = 0;
-  uint32_t muxb   = 0;
+  uint32_t add_a  = 0;      // Input muxes of the ALUs
+  uint32_t add_b  = 0;
+  uint32_t mul_a  = 0;
+  uint32_t mul_b  = 0;
   uint32_t raddra = 39;
   uint32_t raddrb = 0;
 
+  // Usage of the regfile read ports, for combining add and mul operations
+  bool m_raddra_used = false;
+  bool m_raddrb_used = false;
+  bool m_small_imm   = false;
+
   uint32_t li_imm = 0;  // Also used as BR target
   uint32_t sema_id = 0;
   Tag m_tag = NOP;
@@ -51,7 +61,9 @@ private:
   void ws(bool val) { assert(m_tag != BR); m_ws = val; }
   void rel(bool val) { assert(m_tag == BR); m_rel = val; }
 
-  void encode_operands(RegOrImm const &srcA, RegOrImm const &srcB);
+  bool read_port(bool file_b, uint32_t raddr, uint32_t &mux);
+  bool encode_src(RegOrImm const &src, uint32_t &mux);
+  bool encode_alu(V3DLib::Instr const &instr, bool use_mul, RegTag &file);
 
   uint32_t high() const;
   uint32_t low() const;
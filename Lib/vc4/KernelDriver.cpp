@@ -1,6 +1,7 @@
 #include "KernelDriver.h"
 #include <iostream>
 #include <sstream>
+#include <vector>
 #include "Source/Lang.h"
 #include "Source/Translate.h"
 #include "Target/RemoveLabels.h"
@@ -10,6 +11,7 @@
 #include "Target/instr/Mnemonics.h"
 #include "SourceTranslate.h"  // add_uniform_pointer_offset()
 #include "Instr.h"
+#include "Scheduler.h"
 
 namespace V3DLib {
 namespace vc4 {
@@ -52,9 +54,28 @@ void convertInstr(V3DLib::Instr &instr) {
 }
 
 
+/**
+ * Encode the target instructions into vc4 opcodes.
+ *
+ * Paired instructions are encoded into a single opcode with the preceding instruction.
+ * The branch offsets in the target code count instructions, these are adjusted to count opcodes.
+ */
 CodeList encode_instructions(V3DLib::Instr::List &instrs) {
   CodeList code;
 
+  // Determine the opcode index of each instruction
+  std::vector<int> index(instrs.size() + 1);
+  int count = 0;
+
+  for (int i = 0; i < instrs.size(); i++) {
+    auto const &instr = instrs[i];
+    index[i] = instr.paired()? (count - 1) : count;
+
+    if (instr.tag == INIT_BEGIN || instr.tag == INIT_END) continue;
+    if (!instr.paired()) count++;
+  }
+  index[instrs.size()] = count;
+
   for (int i = 0; i < instrs.size(); i++) {
     V3DLib::Instr instr = instrs.get(i);
     check_instruction_tag_for_platform(instr.tag, true);
@@ -63,9 +84,27 @@ CodeList encode_instructions(V3DLib::Instr::List &instrs) {
       continue;  // Don't encode these block markers
     }
 
+    assert(!instr.paired());
     convertInstr(instr);
+
+    if (instr.tag == BR) {
+      BranchTarget t = instr.branch_target();
+      int dest = i + 4 + t.immOffset;
+      assert(0 <= dest && dest <= instrs.size());
+      t.immOffset = index[dest] - (index[i] + 4);
+      instr.branch_target(t);
+    }
+
     vc4::Instr vc4_instr;
-    vc4_instr.encode(instr);
+
+    if (i + 1 < instrs.size() && instrs[i + 1].paired()) {
+      bool ok = vc4_instr.encode(instr, instrs[i + 1]);
+      assertq(ok, "encode_instructions(): can not combine paired instructions", true);
+      i++;
+    } else {
+      vc4_instr.encode(instr);
+    }
+
     code << vc4_instr.code();
   }
 
@@ -129,6 +168,31 @@ void KernelDriver::encode() {
 }
 
 
+std::vector<uint64_t> KernelDriver::opcodes() {
+  std::vector<uint64_t> ret;
+
+  for (int i = 0; i < (int) qpuCodeMem.size(); i++) {
+    ret.push_back(qpuCodeMem[i]);
+  }
+
+  return ret;
+}
+
+
+/**
+ * Load previously encoded opcodes into code memory, instead of encoding the target code
+ */
+void KernelDriver::load_opcodes(std::vector<uint64_t> const &code) {
+  assert(qpuCodeMem.empty());
+  assert(!code.empty());
+
+  qpuCodeMem.alloc((uint32_t) code.size());
+  for (int i = 0; i < (int) code.size(); i++) {
+    qpuCodeMem[i] = code[i];
+  }
+}
+
+
 void KernelDriver::emit_opcodes(FILE *f) {
   fprintf(f, "Opcodes for vc4\n");
   fprintf(f, "===============\n\n");
@@ -156,7 +220,12 @@ void KernelDriver::compile_intern() {
 
   obtain_ast();
 
-  V3DLib::translate_stmt(m_targetCode, m_body);
+  {
+    CompilePhase phase("translate");
+    V3DLib::translate_stmt(m_targetCode, m_body);
+  }
+
+  if (load_from_cache()) return;
 
   {
     using namespace V3DLib::Target::instr;  // for mov()
@@ -177,10 +246,20 @@ void KernelDriver::compile_intern() {
 
   compile_postprocess(m_targetCode);
 
+  {
+    CompilePhase phase("schedule");
+    schedule(m_targetCode);
+  }
+
   // Translate branch-to-labels to relative branches
   removeLabels(m_targetCode);
 
-  encode();
+  {
+    CompilePhase phase("encode");
+    encode();
+  }
+
+  store_in_cache();
 }
 
 
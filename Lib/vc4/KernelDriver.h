@@ -24,6 +24,8 @@ private:
   void kernelFinish();
   void compile_intern() override;
   void invoke_intern(int numQPUs, IntList &params) override;
+  std::vector<uint64_t> opcodes() override;
+  void load_opcodes(std::vector<uint64_t> const &code) override;
 
   void emit_opcodes(FILE *f) override;
 };
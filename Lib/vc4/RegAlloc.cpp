@@ -2,8 +2,8 @@
 #include <stdio.h>
 #include <iostream>
 #include "Support/basics.h"
-#include "Support/Timer.h"
 #include "Target/Subst.h"
+#include "Liveness/Spill.h"
 #include "SourceTranslate.h"
 #include "Common/CompileData.h"
 
@@ -129,6 +129,10 @@ namespace vc4 {
  *
  * The list can contain predefined accumulators, SPECIAL registers and NONE.
  *
+ * If no register is available for a variable, a variable is selected for spilling
+ * to main memory. After all variables have been handled, the spilled variables are
+ * rewritten in the code and the allocation is redone. See `Spill`.
+ *
  * ============================================================================
  * NOTES
  * =====
@@ -147,88 +151,91 @@ namespace vc4 {
  */
 void regAlloc(Instr::List &instrs) {
   assert(count_reg_types(instrs).safe_for_regalloc());
-  //Timer t1("vc4 regAlloc", true);
   //std::cout << count_reg_types(instrs).dump() << std::endl;
 
-  int numVars = VarGen::count();
+  Liveness::optimize(instrs, VarGen::count());
+
+  Spill spill(instrs);
 
-//{
-//  Timer t("vc4 regAlloc optimize", true);
-  Liveness::optimize(instrs, numVars);
-//}
+  // Allocation is redone after variables have been spilled
+  while (true) {
+    int numVars = VarGen::count();
 
-  // Step 0 - Perform liveness analysis
-  Liveness live(numVars);
-//{
-//  Timer t("vc4 regAlloc compute", true);
-  live.compute(instrs);
-//}
+    // Step 0 - Perform liveness analysis
+    Liveness live(numVars);
 
+    {
+      CompilePhase phase("liveness");
+      live.compute(instrs);
+    }
 
-  // Step 1 - For each variable, determine a preference for register file A or B.
-  int *prefA = new int [numVars];
-  int *prefB = new int [numVars];
+    // Step 1 - For each variable, determine a preference for register file A or B.
+    std::vector<int> prefA(numVars);
+    std::vector<int> prefB(numVars);
 
-  regalloc_determine_regfileAB(instrs, prefA, prefB, numVars);
+    regalloc_determine_regfileAB(instrs, prefA.data(), prefB.data(), numVars);
 
-  // Step 2 - For each variable, determine all variables ever live at same time
-  LiveSets liveWith(numVars);
-//{
-//  Timer t("vc4 regAlloc liveWith", true);
-  liveWith.init(instrs, live);
-//}
-  //debug(liveWith.dump());
+    // Step 2 - For each variable, determine all variables ever live at same time
+    LiveSets liveWith(numVars);
 
-  // Step 3 - Allocate a register to each variable
-  RegTag prevChosenRegFile = REG_B;
+    {
+      CompilePhase phase("live sets");
+      liveWith.init(instrs, live);
+    }
+    //debug(liveWith.dump());
 
-//{
-//  Timer t("vc4 regAlloc allocate_reg", true);
+    // Step 3 - Allocate a register to each variable
+    RegTag prevChosenRegFile = REG_B;
 
-  for (int i = 0; i < numVars; i++) {
-    if (live.reg_usage()[i].reg.tag != NONE) continue;
-    if (live.reg_usage()[i].unused()) continue;
+    for (int i = 0; i < numVars; i++) {
+      if (live.reg_usage()[i].reg.tag != NONE) continue;
+      if (live.reg_usage()[i].unused()) continue;
 
-    auto possibleA = liveWith.possible_registers(i, live.reg_usage());
-    auto possibleB = liveWith.possible_registers(i, live.reg_usage(), REG_B);
+      auto possibleA = liveWith.possible_registers(i, live.reg_usage());
+      auto possibleB = liveWith.possible_registers(i, live.reg_usage(), REG_B);
 
-    // Find possible register in each register file
-    RegId chosenA = LiveSets::choose_register(possibleA, false);
-    RegId chosenB = LiveSets::choose_register(possibleB, false);
+      // Find possible register in each register file
+      RegId chosenA = LiveSets::choose_register(possibleA, false);
+      RegId chosenB = LiveSets::choose_register(possibleB, false);
+
+      // Choose a register file
+      RegTag chosenRegFile;
+      if (chosenA < 0 && chosenB < 0) {
+        if (spill.choose(i, live, liveWith) < 0) {
+          error("regAlloc(): register allocation failed, insufficient capacity", true);
+        }
+        continue;
+      }
+      else if (chosenA < 0) chosenRegFile = REG_B;
+      else if (chosenB < 0) chosenRegFile = REG_A;
+      else {
+        if (prefA[i] > prefB[i]) chosenRegFile = REG_A;
+        else if (prefA[i] < prefB[i]) chosenRegFile = REG_B;
+        else chosenRegFile = prevChosenRegFile == REG_A ? REG_B : REG_A;
+      }
+      prevChosenRegFile = chosenRegFile;
 
-    // Choose a register file
-    RegTag chosenRegFile;
-    if (chosenA < 0 && chosenB < 0) {
-      error("regAlloc(): register allocation failed, insufficient capacity", true);
+      // Finally, allocate a register to the variable
+      live.reg_usage()[i].reg = Reg(chosenRegFile, (chosenRegFile == REG_A)? chosenA : chosenB);
     }
-    else if (chosenA < 0) chosenRegFile = REG_B;
-    else if (chosenB < 0) chosenRegFile = REG_A;
-    else {
-      if (prefA[i] > prefB[i]) chosenRegFile = REG_A;
-      else if (prefA[i] < prefB[i]) chosenRegFile = REG_B;
-      else chosenRegFile = prevChosenRegFile == REG_A ? REG_B : REG_A;
+
+    if (!spill.pending()) {
+      if (CompileData::capture_dumps()) {
+        compile_data.allocated_registers_dump = [usage = live.reg_usage()] () { return usage.dump(true); };
+      }
+      //std::cout << count_reg_types(instrs).dump() << std::endl;
+
+      // Step 4 - Apply the allocation to the code
+      allocate_registers(instrs, live.reg_usage());
+      break;
     }
-    prevChosenRegFile = chosenRegFile;
 
-    // Finally, allocate a register to the variable
-    live.reg_usage()[i].reg = Reg(chosenRegFile, (chosenRegFile == REG_A)? chosenA : chosenB);
+    spill.apply();
   }
-//}
-  
-  compile_data.allocated_registers_dump = live.reg_usage().dump(true);
-  //std::cout << count_reg_types(instrs).dump() << std::endl;
 
-  // Step 4 - Apply the allocation to the code
-//{
-//  Timer t("vc4 regAlloc apply allocate_registers", true);
-  allocate_registers(instrs, live.reg_usage());
-//}
+  compile_data.num_spill_slots = spill.num_slots();
 
   //std::cout << instrs.check_acc_usage() << std::endl;
-
-  // Free memory
-  delete [] prefA;
-  delete [] prefB;
 }
 
 }  // namespace vc4; 
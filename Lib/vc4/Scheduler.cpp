@@ -0,0 +1,675 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <vector>
+#include "Common/CompileData.h"
+#include "Support/basics.h"
+#include "Instr.h"
+
+namespace V3DLib {
+namespace vc4 {
+namespace {
+
+using TargetInstr = V3DLib::Instr;
+
+
+/**
+ * Check if given register can be written by a movable instruction.
+ *
+ * Special registers have side effects, ACC4 and ACC5 have special usages.
+ */
+bool is_plain_dest(Reg const &reg) {
+  switch (reg.tag) {
+    case REG_A:
+    case REG_B:
+    case NONE:
+      return true;
+    case ACC:
+      return reg.regId <= 3;
+    default:
+      return false;
+  }
+}
+
+
+/**
+ * Check if given operand can be read by a movable instruction.
+ *
+ * Reading uniforms and VPM has side effects, DMA wait registers stall.
+ */
+bool is_plain_src(RegOrImm const &src) {
+  if (src.is_imm()) return true;
+
+  Reg const &reg = src.reg();
+
+  switch (reg.tag) {
+    case REG_A:
+    case REG_B:
+    case ACC:
+    case NONE:
+      return true;
+    case SPECIAL:
+      return reg.regId == SPECIAL_ELEM_NUM || reg.regId == SPECIAL_QPU_NUM;
+    default:
+      return false;
+  }
+}
+
+
+/**
+ * Check if the given instruction can be moved around within a basic block.
+ *
+ * This is deliberately conservative. Only load immediates and plain ALU operations
+ * on registers are allowed. Everything else has side effects or timing constraints
+ * (uniforms, DMA/VPM, SFU, TMU, rotates, semaphores, branches) and is left in place
+ * as a block boundary.
+ */
+bool can_schedule(TargetInstr const &instr) {
+  if (instr.break_point()) return false;
+
+  switch (instr.tag) {
+    case InstrTag::LI:
+      return is_plain_dest(instr.dest());
+
+    case InstrTag::ALU:
+      return !instr.ALU.op.isRot()
+          && is_plain_dest(instr.dest())
+          && is_plain_src(instr.ALU.srcA)
+          && is_plain_src(instr.ALU.srcB);
+
+    default:
+      return false;
+  }
+}
+
+
+/**
+ * @return the destination register if it is in a regfile, NONE register otherwise
+ */
+Reg rf_dest(TargetInstr const &instr) {
+  if (!instr.has_dest()) return Reg(NONE, 0);
+
+  Reg dst = instr.dest();
+  return dst.is_rf_reg()? dst : Reg(NONE, 0);
+}
+
+
+/**
+ * Check if the given instruction reads a regfile register written in the previous cycle
+ */
+bool has_rf_hazard(TargetInstr const &instr, std::vector<Reg> const &last_writes) {
+  for (auto const &reg : last_writes) {
+    if (instr.is_src_reg(reg)) return true;
+  }
+
+  return false;
+}
+
+
+/**
+ * Pseudo-register for the condition flags, so that these can be treated as a register dependency.
+ */
+Reg const FLAGS(SPECIAL, -1);
+
+
+/**
+ * Instruction in the dependency graph of a basic block
+ */
+struct Node {
+  Node(TargetInstr const &in_instr, int in_index);
+
+  TargetInstr instr;
+  int  index;                          // Position in the original block
+  std::vector<Reg> reads;
+  std::vector<Reg> writes;
+
+  std::vector<std::pair<int, int>> succs;  // Pairs of (node index, latency)
+  int  num_preds = 0;                  // Number of unscheduled predecessors
+  int  height    = 1;                  // Length of the longest path to the end of the block
+  int  earliest  = 0;                  // Earliest cycle allowed by the scheduled predecessors
+  bool scheduled = false;
+
+  int latency_to(Node const &rhs) const;
+};
+
+
+Node::Node(TargetInstr const &in_instr, int in_index) : instr(in_instr), index(in_index) {
+  auto add_src = [this] (RegOrImm const &src) {
+    if (!src.is_reg()) return;
+    Reg const &reg = src.reg();
+    if (reg.tag == REG_A || reg.tag == REG_B || reg.tag == ACC) reads.push_back(reg);
+  };
+
+  if (instr.tag == InstrTag::ALU) {
+    add_src(instr.ALU.srcA);
+    add_src(instr.ALU.srcB);
+  }
+
+  if (instr.dest().tag != NONE) writes.push_back(instr.dest());
+
+  if (instr.isCondAssign())         reads.push_back(FLAGS);
+  if (instr.set_cond().flags_set()) writes.push_back(FLAGS);
+}
+
+
+/**
+ * Determine the minimal distance in cycles between this node and a following node.
+ *
+ * A regfile register can not be read in the instruction directly after the one writing it.
+ * An instruction reads its sources before writing its destination, so a write-after-read
+ * may be issued in the same instruction.
+ *
+ * @return latency, -1 if there is no dependency
+ */
+int Node::latency_to(Node const &rhs) const {
+  auto contains = [] (std::vector<Reg> const &list, Reg const &reg) {
+    for (auto const &item : list) {
+      if (item == reg) return true;
+    }
+    return false;
+  };
+
+  int ret = -1;
+
+  for (auto const &reg : writes) {
+    if (contains(rhs.reads, reg))  ret = std::max(ret, reg.is_rf_reg()? 2 : 1);
+    if (contains(rhs.writes, reg)) ret = std::max(ret, 1);
+  }
+
+  if (ret != -1) return ret;
+
+  for (auto const &reg : reads) {
+    if (contains(rhs.writes, reg)) return 0;
+  }
+
+  return -1;
+}
+
+
+/**
+ * List scheduler for a single basic block.
+ *
+ * Instructions are issued cycle by cycle from the set of ready instructions, picked on:
+ *   - longest path to end of block (critical path)
+ *   - original position
+ *
+ * If nothing is ready, a NOP is issued.
+ *
+ * After an instruction is selected, the other ready instructions are searched for one
+ * that can be paired with it in the other ALU. The partner is placed directly after
+ * the selected instruction and marked as paired.
+ */
+class BlockScheduler {
+public:
+  BlockScheduler(TargetInstr::List const &block, std::vector<Reg> const &last_writes);
+
+  void run(TargetInstr::List &output, std::vector<Reg> &last_writes);
+  int pair_count() const { return m_pair_count; }
+
+private:
+  std::vector<Node> m_nodes;
+  int m_pair_count = 0;
+
+  bool ready(Node const &node, int cycle) const { return !node.scheduled && node.num_preds == 0 && node.earliest <= cycle; }
+  bool better(Node const &lhs, Node const &rhs) const;
+  void issue(Node &node, int cycle);
+};
+
+
+BlockScheduler::BlockScheduler(TargetInstr::List const &block, std::vector<Reg> const &last_writes) {
+  for (int i = 0; i < block.size(); i++) {
+    m_nodes.emplace_back(block[i], i);
+
+    // Respect the regfile hazard with the instruction preceding the block
+    if (has_rf_hazard(block[i], last_writes)) m_nodes.back().earliest = 1;
+  }
+
+  int size = (int) m_nodes.size();
+
+  for (int i = 0; i < size; i++) {
+    for (int j = i + 1; j < size; j++) {
+      int latency = m_nodes[i].latency_to(m_nodes[j]);
+      if (latency < 0) continue;
+
+      m_nodes[i].succs.emplace_back(j, latency);
+      m_nodes[j].num_preds++;
+    }
+  }
+
+  for (int i = size - 1; i >= 0; i--) {
+    auto &node = m_nodes[i];
+
+    for (auto const &succ : node.succs) {
+      node.height = std::max(node.height, m_nodes[succ.first].height + succ.second);
+    }
+  }
+}
+
+
+/**
+ * @return true if lhs should be issued before rhs
+ */
+bool BlockScheduler::better(Node const &lhs, Node const &rhs) const {
+  if (lhs.height != rhs.height) return lhs.height > rhs.height;
+  return lhs.index < rhs.index;
+}
+
+
+void BlockScheduler::issue(Node &node, int cycle) {
+  node.scheduled = true;
+
+  for (auto const &succ : node.succs) {
+    auto &next = m_nodes[succ.first];
+    assert(next.num_preds > 0);
+    next.num_preds--;
+    next.earliest = std::max(next.earliest, cycle + succ.second);
+  }
+}
+
+
+void BlockScheduler::run(TargetInstr::List &output, std::vector<Reg> &last_writes) {
+  int size = (int) m_nodes.size();
+  int num_scheduled = 0;
+
+  for (int cycle = 0; num_scheduled < size; cycle++) {
+    Node *first = nullptr;
+
+    for (auto &node : m_nodes) {
+      if (!ready(node, cycle)) continue;
+      if (first == nullptr || better(node, *first)) first = &node;
+    }
+
+    last_writes.clear();
+
+    if (first == nullptr) {
+      output << TargetInstr::nop();  // Wait for a regfile write to complete
+      continue;
+    }
+
+    issue(*first, cycle);
+    num_scheduled++;
+    output << first->instr;
+
+    Node *second = nullptr;
+
+    for (auto &node : m_nodes) {
+      if (!ready(node, cycle)) continue;
+      if (second != nullptr && !better(node, *second)) continue;
+      if (Instr::can_pair(first->instr, node.instr)) second = &node;
+    }
+
+    Reg dst = rf_dest(first->instr);
+    if (dst.tag != NONE) last_writes.push_back(dst);
+
+    if (second != nullptr) {
+      issue(*second, cycle);
+      num_scheduled++;
+      m_pair_count++;
+
+      TargetInstr instr = second->instr;
+      instr.paired(true);
+      output << instr;
+
+      Reg dst = rf_dest(instr);
+      if (dst.tag != NONE) last_writes.push_back(dst);
+    }
+  }
+}
+
+
+void schedule_block(TargetInstr::List &block, TargetInstr::List &output, std::vector<Reg> &last_writes, int &pair_count) {
+  if (block.empty()) return;
+
+  // The header belongs to the start of the block, not to a specific instruction
+  std::string header = block[0].header();
+  std::string comment = block[0].comment();
+  block[0].clear_comments();
+  block[0].comment(comment);
+
+  BlockScheduler scheduler(block, last_writes);
+  int first = output.size();
+  scheduler.run(output, last_writes);
+  output[first].header(header);
+
+  pair_count += scheduler.pair_count();
+  block.clear();
+}
+
+
+/**
+ * Determine which instructions may be moved by the scheduler.
+ *
+ * The NOPs separating a regfile write from its read are not needed any more,
+ * the scheduler recreates these where required. All other NOPs are kept.
+ */
+std::vector<bool> find_movable(TargetInstr::List const &instrs) {
+  int size = instrs.size();
+  std::vector<bool> ret(size, false);
+  int vpm_window = 0;
+
+  for (int i = 0; i < size; i++) {
+    auto const &instr = instrs[i];
+
+    // Keep the distance between a VPM read setup and the VPM read, it has been determined
+    // by counting instructions.
+    if (vpm_window > 0) {
+      vpm_window--;
+    } else {
+      ret[i] = can_schedule(instr);
+    }
+
+    if (instr.has_dest() && instr.dest() == Reg(SPECIAL, SPECIAL_RD_SETUP)) vpm_window = 3;
+  }
+
+  for (int i = 1; i + 1 < size; i++) {
+    auto const &instr = instrs[i];
+
+    if (instr.tag == InstrTag::NO_OP && instr.header().empty() && ret[i - 1] && ret[i + 1]) {
+      ret[i] = true;
+    }
+  }
+
+  return ret;
+}
+
+
+using Cycles = std::vector<std::vector<TargetInstr>>;
+
+
+/**
+ * Check if a regfile register written in a cycle is read in the next cycle.
+ */
+bool has_rf_hazard(Cycles const &cycles) {
+  std::vector<Reg> last_writes;
+
+  for (auto const &cycle : cycles) {
+    for (auto const &instr : cycle) {
+      if (has_rf_hazard(instr, last_writes)) return true;
+    }
+
+    last_writes.clear();
+
+    for (auto const &instr : cycle) {
+      Reg dst = rf_dest(instr);
+      if (dst.tag != NONE) last_writes.push_back(dst);
+    }
+  }
+
+  return false;
+}
+
+
+/**
+ * Fill the delay slots of a single branch.
+ *
+ * Candidates are the single instructions of the scheduled code directly preceding the branch,
+ * which can be moved past all following instructions up to the branch.
+ */
+class DelaySlotFiller {
+public:
+  DelaySlotFiller(TargetInstr::List const &output, std::vector<bool> const &movable);
+
+  int run();
+  void apply(TargetInstr::List &output, std::vector<bool> &movable, TargetInstr const &branch) const;
+
+private:
+  TargetInstr::List m_region;    // Instructions which may be moved, directly preceding the branch
+  std::vector<TargetInstr> m_prev;  // Cycle preceding the region, for regfile hazards
+  std::vector<bool> m_moved;
+
+  bool can_move(int index) const;
+  bool valid() const;
+};
+
+
+DelaySlotFiller::DelaySlotFiller(TargetInstr::List const &output, std::vector<bool> const &movable) {
+  int end   = output.size();
+  int start = end;
+
+  while (start > 0 && movable[start - 1] && output[start - 1].tag != InstrTag::NO_OP) {
+    start--;
+    if (!output[start].header().empty()) break;  // Don't move past the start of a block
+  }
+
+  while (start < end && output[start].paired()) start++;
+
+  for (int i = start; i < end; i++) {
+    m_region << output[i];
+  }
+
+  m_moved.resize(m_region.size(), false);
+
+  // Labels don't take a cycle
+  int prev = start - 1;
+  while (prev >= 0 && output[prev].tag == InstrTag::LAB) prev--;
+
+  if (prev >= 0) {
+    if (output[prev].paired()) m_prev.push_back(output[prev - 1]);
+    m_prev.push_back(output[prev]);
+  }
+}
+
+
+/**
+ * Check if given instruction in the region can be moved past the non-moved instructions following it
+ */
+bool DelaySlotFiller::can_move(int index) const {
+  int size = m_region.size();
+  auto const &instr = m_region[index];
+
+  if (instr.paired() || (index + 1 < size && m_region[index + 1].paired())) return false;
+  if (!instr.header().empty()) return false;
+  if (instr.set_cond().flags_set()) return false;  // Branch condition depends on it
+
+  Node node(instr, index);
+
+  for (int i = index + 1; i < size; i++) {
+    if (m_moved[i]) continue;
+    if (node.latency_to(Node(m_region[i], i)) >= 0) return false;
+  }
+
+  return true;
+}
+
+
+/**
+ * Check that the regfile hazards are respected after moving the selected instructions
+ */
+bool DelaySlotFiller::valid() const {
+  Cycles remaining;
+  Cycles slots;
+
+  if (!m_prev.empty()) remaining.push_back(m_prev);
+
+  for (int i = 0; i < m_region.size(); i++) {
+    auto const &instr = m_region[i];
+
+    if (m_moved[i]) {
+      slots.push_back({instr});
+    } else if (instr.paired()) {
+      remaining.back().push_back(instr);
+    } else {
+      remaining.push_back({instr});
+    }
+  }
+
+  // The instruction after the delay slots may read the last slot
+  if (slots.size() == 3 && rf_dest(slots.back().front()).tag != NONE) return false;
+
+  return !has_rf_hazard(remaining) && !has_rf_hazard(slots);
+}
+
+
+/**
+ * Select the instructions to move into the delay slots, starting from the branch.
+ *
+ * @return number of delay slots filled
+ */
+int DelaySlotFiller::run() {
+  int count = 0;
+
+  for (int i = m_region.size() - 1; i >= 0 && count < 3; i--) {
+    if (!can_move(i)) continue;
+
+    m_moved[i] = true;
+
+    if (valid()) {
+      count++;
+    } else {
+      m_moved[i] = false;
+    }
+  }
+
+  return count;
+}
+
+
+/**
+ * Replace the region and the branch with delay slots in the output.
+ *
+ * @param movable  flags for the instructions in output which may be moved, updated along with output
+ */
+void DelaySlotFiller::apply(TargetInstr::List &output, std::vector<bool> &movable, TargetInstr const &branch) const {
+  for (int i = 0; i < m_region.size(); i++) {
+    output.deleteLast();
+    movable.pop_back();
+  }
+
+  int count = 0;
+
+  for (int i = 0; i < m_region.size(); i++) {
+    if (m_moved[i]) continue;
+    output << m_region[i];
+    movable.push_back(true);
+  }
+
+  output << branch;
+
+  for (int i = 0; i < m_region.size(); i++) {
+    if (!m_moved[i]) continue;
+    output << m_region[i];
+    count++;
+  }
+
+  for (int i = count; i < 3; i++) {
+    output << TargetInstr::nop();
+  }
+
+  movable.resize(output.size(), false);
+}
+
+
+/**
+ * Move instructions preceding a branch into the branch delay slots.
+ *
+ * The delay slots are executed whether the branch is taken or not,
+ * so this is allowed for all instructions which don't influence the branch condition.
+ *
+ * @param movable  flags for instructions which may be moved
+ * @return number of delay slots filled
+ */
+int fill_delay_slots(TargetInstr::List &instrs, std::vector<bool> const &movable) {
+  int ret = 0;
+  int size = instrs.size();
+  TargetInstr::List output(size);
+  std::vector<bool> out_movable;  // Flags for the instructions in output
+
+  for (int i = 0; i < size; i++) {
+    auto const &instr = instrs[i];
+
+    bool has_slots = (instr.tag == InstrTag::BRL && i + 3 < size);
+    for (int j = 1; has_slots && j <= 3; j++) {
+      has_slots = (instrs[i + j].tag == InstrTag::NO_OP && instrs[i + j].header().empty());
+    }
+
+    if (has_slots) {
+      DelaySlotFiller filler(output, out_movable);
+      int count = filler.run();
+
+      if (count > 0) {
+        filler.apply(output, out_movable, instr);
+        ret += count;
+        i += 3;
+        continue;
+      }
+    }
+
+    output << instr;
+    out_movable.push_back(movable[i]);
+  }
+
+  instrs = output;
+  return ret;
+}
+
+}  // anon namespace
+
+
+/**
+ * Reorder and pair the instructions of the vc4 target code.
+ *
+ * This is done after register allocation and satisfying the vc4 constraints.
+ * A dependency graph is made of each basic block and the instructions are list scheduled,
+ * pairing add ALU and mul ALU operations into single instructions where possible.
+ * Afterwards, the branch delay slots are filled with the instructions preceding the branch.
+ */
+void schedule(TargetInstr::List &instrs) {
+  std::vector<bool> movable = find_movable(instrs);
+
+  TargetInstr::List ret(instrs.size());
+  std::vector<bool> ret_movable;
+  TargetInstr::List block;
+  std::vector<Reg> last_writes;
+  int pair_count = 0;
+
+  auto flush = [&] () {
+    int first = ret.size();
+    schedule_block(block, ret, last_writes, pair_count);
+    ret_movable.resize(ret.size(), true);
+
+    for (int i = first; i < ret.size(); i++) {
+      if (ret[i].tag == InstrTag::NO_OP) ret_movable[i] = false;
+    }
+  };
+
+  for (int i = 0; i < instrs.size(); i++) {
+    auto const &instr = instrs[i];
+
+    if (!movable[i] || !instr.header().empty()) {
+      flush();
+    }
+
+    if (movable[i]) {
+      if (instr.tag != InstrTag::NO_OP) block << instr;
+      continue;
+    }
+
+    if (instr.tag == InstrTag::LAB) {
+      ret << instr;                         // Labels don't take a cycle
+      ret_movable.push_back(false);
+      continue;
+    }
+
+    if (has_rf_hazard(instr, last_writes)) {
+      ret << TargetInstr::nop();
+      ret_movable.push_back(false);
+    }
+
+    ret << instr;
+    ret_movable.push_back(false);
+
+    last_writes.clear();
+    Reg dst = rf_dest(instr);
+    if (dst.tag != NONE) last_writes.push_back(dst);
+  }
+
+  flush();
+
+  int delay_slots_filled = fill_delay_slots(ret, ret_movable);
+
+  compile_data.num_instructions_combined += pair_count;
+  compile_data.num_delay_slots_filled    += delay_slots_filled;
+  instrs = ret;
+}
+
+}  // namespace vc4
+}  // namespace V3DLib
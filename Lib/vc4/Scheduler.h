@@ -0,0 +1,13 @@
+#ifndef _V3DLIB_VC4_SCHEDULER_H_
+#define _V3DLIB_VC4_SCHEDULER_H_
+#include "Target/instr/Instr.h"
+
+namespace V3DLib {
+namespace vc4 {
+
+void schedule(V3DLib::Instr::List &instrs);
+
+}  // namespace vc4
+}  // namespace V3DLib
+
+#endif  // _V3DLIB_VC4_SCHEDULER_H_
@@ -27,6 +27,22 @@ Instr::List SourceTranslate::store_var(Var dst_addr, Var src) {
 }
 
 
+/**
+ * Spilled variables are transferred with DMA.
+ *
+ * The TMU is not used for this, because it would read stale data from its cache
+ * after a spilled variable is stored again.
+ */
+Instr::List SourceTranslate::spill_load(Reg dst, Instr::List const &addr_code, Reg addr, Reg tmp) {
+  return DMA::spillLoadRequest(dst, addr_code, addr, tmp);
+}
+
+
+Instr::List SourceTranslate::spill_store(Reg src, Instr::List const &addr_code, Reg addr, Reg tmp) {
+  return DMA::spillStoreRequest(src, addr_code, addr, tmp);
+}
+
+
 void SourceTranslate::regAlloc(Instr::List &instrs) {
   vc4::regAlloc(instrs);
 }
@@ -12,6 +12,8 @@ class SourceTranslate : public ISourceTranslate {
 public:
   Instr::List load_var(Var &dst, Expr &e) override;
   Instr::List store_var(Var dst_addr, Var src) override;
+  Instr::List spill_load(Reg dst, Instr::List const &addr_code, Reg addr, Reg tmp) override;
+  Instr::List spill_store(Reg src, Instr::List const &addr_code, Reg addr, Reg tmp) override;
   void regAlloc(Instr::List &instrs) override;
   bool stmt(Instr::List &seq, Stmt::Ptr s) override; 
 };
@@ -0,0 +1,44 @@
+#include "CompileBench.h"
+#include <cstdio>
+#include "../doctest.h"
+#include "KernelDriver.h"
+
+using namespace V3DLib;
+
+namespace {
+
+char const *OUTPUT_FILE = "obj/test/compile_bench.csv";
+
+FILE *out = nullptr;  // Opened on first usage, so that a run without benchmarks leaves the file alone
+
+void output(std::string const &kernel, int param, char const *platform, KernelDriver const &driver) {
+  if (out == nullptr) {
+    out = fopen(OUTPUT_FILE, "w");
+    REQUIRE(out != nullptr);
+    fprintf(out, "kernel,param,platform,phase,depth,ms\n");
+  }
+
+  for (auto const &phase : driver.stats().phase_times) {
+    fprintf(out, "%s,%d,%s,%s,%d,%.3f\n", kernel.c_str(), param, platform, phase.name, phase.depth, phase.usecs/1000.0);
+  }
+
+  fflush(out);
+}
+
+}  // anon namespace
+
+
+CompileBench::CompileBench() : m_prev_level(LibSettings::compile_diagnostics()) {
+  LibSettings::compile_diagnostics(LibSettings::DIAG_TIMING);
+}
+
+
+CompileBench::~CompileBench() {
+  LibSettings::compile_diagnostics(m_prev_level);
+}
+
+
+void CompileBench::add(std::string const &kernel, int param, BaseKernel const &k) {
+  if (k.has_vc4()) output(kernel, param, "vc4", k.vc4());
+  if (k.has_v3d()) output(kernel, param, "v3d", k.v3d());
+}
@@ -0,0 +1,30 @@
+#ifndef _TEST_SUPPORT_COMPILEBENCH_H
+#define _TEST_SUPPORT_COMPILEBENCH_H
+#include <string>
+#include "BaseKernel.h"
+#include "LibSettings.h"
+
+/**
+ * Support for the compile benchmark, run with `make bench-compile`.
+ *
+ * The benchmark test cases are tagged `[bench]` and are skipped in a regular test run.
+ * While an instance exists, the compile phases of new kernels are timed.
+ * `add()` writes the phase times of a compiled kernel as CSV to `obj/test/compile_bench.csv`,
+ * for regression tracking. Columns:
+ *
+ *     kernel,param,platform,phase,depth,ms
+ *
+ * The file is rewritten in each run with benchmarks.
+ */
+class CompileBench {
+public:
+  CompileBench();
+  ~CompileBench();
+
+  void add(std::string const &kernel, int param, V3DLib::BaseKernel const &k);
+
+private:
+  V3DLib::LibSettings::Diagnostics m_prev_level;
+};
+
+#endif  // _TEST_SUPPORT_COMPILEBENCH_H
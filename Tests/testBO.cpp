@@ -1,8 +1,20 @@
 #include "doctest.h"
 #include <memory>
+#include "V3DLib.h"
+#include "LibSettings.h"
 #include "Common/SharedArray.h"
 #include "Target/BufferObject.h"
 
+namespace {
+
+void add_one_kernel(V3DLib::Int::Ptr dst, V3DLib::Int::Ptr src) {
+  V3DLib::Int a = *src;
+  *dst = a + 1;
+}
+
+}  // anon namespace
+
+
 
 TEST_CASE("Test Buffer Objects [bo]") {
   using Data = V3DLib::Data;
@@ -135,4 +147,520 @@ TEST_CASE("Test Buffer Objects [bo]") {
       REQUIRE(heap.num_free_ranges() == 0);
     }
   }
+
+
+  SUBCASE("Freed blocks should be reused and coalesced") {
+    auto stats = heap.stats();
+    REQUIRE(stats.used == 0);
+
+    {
+      // Many small fragments, no cap on the number of free ranges
+      const int NUM_ARRAYS = 100;
+      SharedArrays arrays(NUM_ARRAYS);
+      for (auto &arr : arrays) arr.reset(new Data(16, heap));
+
+      uint32_t top = heap.stats().top;
+
+      for (int i = 0; i < NUM_ARRAYS; i += 2) arrays[i]->dealloc();
+      REQUIRE(heap.num_free_ranges() == NUM_ARRAYS/2);
+
+      // Same size class is reused, heap does not grow
+      for (int i = 0; i < NUM_ARRAYS; i += 2) arrays[i]->alloc(16);
+      REQUIRE(heap.num_free_ranges() == 0);
+      REQUIRE(heap.stats().top == top);
+    }
+
+    REQUIRE(heap.empty());
+
+    {
+      // Large blocks are coalesced with free neighbours
+      Data arr1(4096, heap);
+      Data arr2(4096, heap);
+      Data arr3(4096, heap);
+      Data arr4(4096, heap);
+
+      arr1.dealloc();
+      arr3.dealloc();
+      REQUIRE(heap.num_free_ranges() == 2);
+
+      arr2.dealloc();
+      REQUIRE(heap.num_free_ranges() == 1);
+      REQUIRE(heap.stats().largest_free >= 3*4096*4);
+
+      Data arr5(3*4096, heap);  // Should fit exactly in the coalesced block
+      REQUIRE(heap.num_free_ranges() == 0);
+      REQUIRE(arr5.getAddress() == arr1.getAddress());
+    }
+
+    REQUIRE(heap.empty());
+    stats = heap.stats();
+    REQUIRE(stats.num_allocs == stats.num_deallocs);
+    REQUIRE(stats.high_water > 0);
+    REQUIRE(stats.fragmentation() == 0.0f);
+  }
+
+
+  SUBCASE("Alignment of allocated blocks should be as requested") {
+    uint8_t *addr = nullptr;
+
+    uint32_t phy1 = heap.alloc_array(4, addr);
+    REQUIRE(phy1 % V3DLib::HeapManager::GRANULE == 0);
+    REQUIRE(((uintptr_t) addr) % V3DLib::HeapManager::GRANULE == 0);
+
+    uint32_t phy2 = heap.alloc_array(256, addr, 1024);
+    REQUIRE((phy2 - heap.phy_address()) % 1024 == 0);
+    REQUIRE(((uintptr_t) addr) % 1024 == 0);
+    REQUIRE(heap.num_free_ranges() == 1);  // Padding before aligned block
+
+    heap.dealloc_array(phy1, 4);
+    heap.dealloc_array(phy2, 256);
+    REQUIRE(heap.empty());
+  }
+}
+
+
+TEST_CASE("Test growth of heap with extra segments [bo]") {
+  using namespace V3DLib;
+
+  SUBCASE("Arrays in extra segments should stay in place") {
+    emu::BufferObject heap;
+    heap.alloc(64*1024);
+
+    Data arr1(8*1024, heap);
+    Data arr2(8*1024, heap);  // Fills the initial segment
+    REQUIRE(heap.num_segments() == 1);
+    arr1.fill(1);
+    arr2.fill(2);
+
+    Data arr3(8*1024, heap);
+    REQUIRE(heap.num_segments() == 2);
+    REQUIRE((*heap.segments())[1]->phy_address() == 64*1024);
+    REQUIRE(arr3.getAddress() >= 64*1024);
+    arr3.fill(3);
+
+    // Array larger than the initial segment gets a segment of its own
+    Data arr4(32*1024, heap);
+    REQUIRE(heap.num_segments() == 3);
+    REQUIRE((*heap.segments())[2]->size() > 64*1024);
+
+    REQUIRE(arr1[8*1024 - 1] == 1);
+    REQUIRE(arr2[8*1024 - 1] == 2);
+    REQUIRE(arr3[8*1024 - 1] == 3);
+
+    // Physical addresses are resolved over all segments
+    {
+      Data view;
+      view.heap_view(heap);
+      REQUIRE(view.phy(arr2.getAddress()/4) == 2);
+      REQUIRE(view.phy(arr3.getAddress()/4) == 3);
+    }
+
+    arr4.dealloc();
+    REQUIRE(heap.num_segments() == 3);  // Empty segment kept as spare
+    arr3.dealloc();
+    REQUIRE(heap.num_segments() == 2);  // Already have a spare, release
+
+    arr1.dealloc();
+    arr2.dealloc();
+    REQUIRE(heap.empty());
+  }
+
+
+  SUBCASE("Heap views should keep the segments they use") {
+    emu::BufferObject heap;
+    heap.alloc(64*1024);
+
+    Data arr1(16*1024, heap);  // Fills the initial segment
+    auto arr2 = std::make_unique<Data>(16, heap);
+    (*arr2)[0] = 42;
+    uint32_t addr = arr2->getAddress();
+
+    Data view;
+    view.heap_view(heap);
+    REQUIRE(heap.segments()->size() == 2);
+
+    auto arr3 = std::make_unique<Data>(32*1024, heap);  // Segment of its own
+    REQUIRE(heap.num_segments() == 3);
+    arr3.reset();  // Segment kept as spare
+    arr2.reset();  // Segment released, there is already a spare
+    REQUIRE(heap.num_segments() == 2);
+
+    // Released segment is still available to the view
+    REQUIRE(view.phy(addr/4) == 42);
+    REQUIRE(heap.dump().find("Segment 1") != std::string::npos);
+  }
+
+
+  SUBCASE("Heap overflow should be fatal without growth") {
+    emu::BufferObject heap;
+    heap.alloc(64*1024);
+    Data arr1(16*1024, heap);
+
+    LibSettings::heap_growth(false);
+    REQUIRE_THROWS(Data(16, heap));
+    LibSettings::heap_growth(true);
+
+    REQUIRE(heap.num_segments() == 1);
+  }
+
+
+  SUBCASE("Kernels should be able to use arrays from all segments") {
+    auto &heap = getBufferObject();
+    uint32_t const N = heap.size()/4 + 16;  // Too big for the initial segment
+
+    Int::Array src(N);
+    Int::Array dst(N);
+    REQUIRE(heap.num_segments() >= 3);
+    REQUIRE(src.getAddress() >= heap.size());
+    REQUIRE(dst.getAddress() >= heap.size());
+
+    for (int i = 0; i < 16; i++) src[i] = i;
+
+    auto k = compile(add_one_kernel);
+    k.load(&dst, &src);
+
+    dst.fill(0);
+    k.interpret();
+    for (int i = 0; i < 16; i++) REQUIRE(dst[i] == i + 1);
+
+    dst.fill(0);
+    k.emu();
+    for (int i = 0; i < 16; i++) REQUIRE(dst[i] == i + 1);
+  }
+}
+
+
+TEST_CASE("Test pooled shared arrays [bo][pool]") {
+  using namespace V3DLib;
+
+  SUBCASE("Pool should recycle memory of same-sized arrays") {
+    emu::BufferObject heap;
+    heap.alloc(1024*1024);
+    auto pool = std::make_shared<SharedArrayPool>(heap);
+
+    uint32_t addr = 0;
+    {
+      Data arr(1024, pool);
+      addr = arr.getAddress();
+    }
+    REQUIRE(!heap.empty());
+    REQUIRE(pool->cached_bytes() == 4*1024);
+
+    for (int i = 0; i < 10; ++i) {
+      Data arr(1024, pool);
+      REQUIRE(arr.getAddress() == addr);
+    }
+
+    REQUIRE(pool->misses() == 1);
+    REQUIRE(pool->hits() == 10);
+    REQUIRE(heap.stats().num_allocs == 1);
+
+    pool->trim();
+    REQUIRE(pool->cached_bytes() == 0);
+    REQUIRE(heap.empty());
+  }
+
+
+  SUBCASE("Pool should cap the cached memory") {
+    emu::BufferObject heap;
+    heap.alloc(1024*1024);
+    auto pool = std::make_shared<SharedArrayPool>(heap);
+    REQUIRE(pool->max_cached_bytes() == 256*1024);
+
+    pool->max_cached_bytes(8*1024);
+
+    uint32_t last = 0;
+    {
+      auto a = std::make_unique<Data>(1024, pool);
+      auto b = std::make_unique<Data>(1024, pool);
+      auto c = std::make_unique<Data>(1024, pool);
+      last = c->getAddress();
+
+      a.reset();
+      b.reset();
+      REQUIRE(pool->cached_bytes() == 8*1024);
+      c.reset();  // Least recently released block goes back to the heap
+    }
+
+    REQUIRE(pool->cached_bytes() == 8*1024);
+    REQUIRE(heap.stats().used == 8*1024);
+
+    {
+      Data arr(1024, pool);
+      REQUIRE(arr.getAddress() == last);  // Most recently released block is used first
+    }
+
+    {
+      Data big(4*1024, pool);  // Larger than the cap, not cached
+    }
+    REQUIRE(pool->cached_bytes() == 8*1024);
+    REQUIRE(heap.stats().used == 8*1024);
+
+    pool->max_cached_bytes(0);
+    REQUIRE(pool->cached_bytes() == 0);
+    REQUIRE(heap.empty());
+  }
+
+
+  SUBCASE("Pool should return its cache to the heap before the heap grows") {
+    emu::BufferObject heap;
+    heap.alloc(64*1024);
+    auto pool = std::make_shared<SharedArrayPool>(heap);
+    pool->max_cached_bytes(64*1024);
+
+    {
+      Data arr(8*1024, pool);
+    }
+    REQUIRE(pool->cached_bytes() == 32*1024);
+
+    {
+      Data arr(12*1024, pool);  // Only fits if the cached block is released
+      REQUIRE(heap.num_segments() == 1);
+      REQUIRE(pool->cached_bytes() == 0);
+    }
+  }
+
+
+  SUBCASE("Scope should release its arrays in bulk") {
+    emu::BufferObject heap;
+    heap.alloc(1024*1024);
+    auto pool = std::make_shared<SharedArrayPool>(heap);
+
+    std::vector<uint32_t> addresses;
+
+    for (int pass = 0; pass < 3; ++pass) {
+      SharedArrayScope scope(pool);
+      REQUIRE(SharedArrayScope::current() == &scope);
+
+      auto &a = scope.array<float>(256);
+      auto &b = scope.array<int>(64);
+      Data c(16);  // No explicit heap, also from the pool of the scope
+
+      if (pass == 0) {
+        addresses = {a.getAddress(), b.getAddress(), c.getAddress()};
+      } else {
+        REQUIRE(a.getAddress() == addresses[0]);
+        REQUIRE(b.getAddress() == addresses[1]);
+        REQUIRE(c.getAddress() == addresses[2]);
+      }
+    }
+
+    REQUIRE(SharedArrayScope::current() == nullptr);
+    REQUIRE(heap.stats().num_allocs == 3);
+    REQUIRE(pool->cached_bytes() == 4*(256 + 64 + 16));
+
+    pool.reset();  // Pool returns its memory on destruction
+    REQUIRE(heap.empty());
+  }
+
+
+  SUBCASE("Kernel calls should not touch the heap for pooled arrays") {
+    auto k = compile(add_one_kernel);
+    auto &heap = getBufferObject();
+    uint32_t num_allocs = 0;
+
+    for (int pass = 0; pass < 3; ++pass) {
+      SharedArrayScope scope;
+      auto &src = scope.array<int>(16);
+      auto &dst = scope.array<int>(16);
+
+      for (int i = 0; i < 16; i++) src[i] = i;
+      dst.fill(0);
+
+      k.load(&dst, &src).interpret();
+      for (int i = 0; i < 16; i++) REQUIRE(dst[i] == i + 1);
+
+      if (pass == 1) num_allocs = heap.stats().num_allocs;
+      if (pass == 2) REQUIRE(heap.stats().num_allocs == num_allocs);
+    }
+  }
+}
+
+
+TEST_CASE("Test bulk transfers of shared arrays [bo][transfer]") {
+  using namespace V3DLib;
+
+  SUBCASE("Contiguous copies and views") {
+    std::vector<float> src(1000);
+    for (int i = 0; i < (int) src.size(); i++) src[i] = 0.5f*(float) i;
+
+    Float::Array arr(1024);
+    arr.fill(-1.0f);
+    arr.copyFrom(src);
+
+    auto view = arr.view();
+    REQUIRE(view.size() == 1024);
+    REQUIRE(view[999] == 499.5f);
+    REQUIRE(view[1000] == -1.0f);
+
+    std::vector<float> dst;
+    arr.copyTo(dst);
+    REQUIRE(dst.size() == 1024);
+    REQUIRE(std::equal(src.begin(), src.end(), dst.begin()));
+
+    float sum = 0;
+    for (auto val : arr.view().subview(0, 4)) sum += val;
+    REQUIRE(sum == 3.0f);
+
+    REQUIRE_THROWS(arr.copyFrom(std::vector<float>(2000)));
+  }
+
+
+  SUBCASE("Transpose should work for all sizes") {
+    // Sizes chosen to have partial blocks
+    for (auto dims : std::vector<std::pair<int, int>>{{16, 16}, {48, 48}, {16, 80}, {80, 32}}) {
+      int rows = dims.first;
+      int cols = dims.second;
+
+      Float::Array2D a(rows, cols);
+      Float::Array2D b(cols, rows);
+
+      for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+          a[r][c] = (float) (r*1000 + c);
+        }
+      }
+
+      b.copy_transposed(a);
+
+      for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+          INFO("r: " << r << ", c: " << c);
+          REQUIRE(b[c][r] == a[r][c]);
+        }
+      }
+    }
+  }
+
+
+  SUBCASE("Strided 2D copies") {
+    int const STRIDE = 40;
+    std::vector<int> host(20*STRIDE);
+    for (int i = 0; i < (int) host.size(); i++) host[i] = i;
+
+    Shared2DArray<int> arr(32, 32);
+    arr.fill(0);
+
+    arr.copyFrom(host.data(), STRIDE, 20, 30, 2, 1);
+    REQUIRE(arr[2][1] == 0);
+    REQUIRE(arr[2][30] == 29);
+    REQUIRE(arr[3][1] == STRIDE);
+    REQUIRE(arr[21][30] == 19*STRIDE + 29);
+    REQUIRE(arr[2][31] == 0);
+    REQUIRE(arr[22][1] == 0);
+
+    REQUIRE(arr.row(3)[1] == STRIDE);
+    REQUIRE(arr.row(3).size() == 32);
+
+    std::vector<int> back(20*STRIDE, -1);
+    arr.copyTo(back.data(), STRIDE, 20, 30, 2, 1);
+    for (int r = 0; r < 20; r++) {
+      for (int c = 0; c < STRIDE; c++) {
+        REQUIRE(back[r*STRIDE + c] == ((c < 30)? host[r*STRIDE + c] : -1));
+      }
+    }
+
+    REQUIRE_THROWS(arr.copyFrom(host.data(), STRIDE, 20, 30, 20, 0));
+  }
+}
+
+
+TEST_CASE("Test import of host memory into the heap [bo][import]") {
+  using namespace V3DLib;
+
+  SUBCASE("Caller-owned memory should be used as is") {
+    emu::BufferObject heap;
+    heap.alloc(64*1024);
+
+    std::vector<uint32_t> buf(1000);
+    for (int i = 0; i < (int) buf.size(); i++) buf[i] = (uint32_t) i;
+
+    {
+      Data arr(heap);
+      REQUIRE(arr.import(buf.data(), (uint32_t) buf.size()));
+      REQUIRE(arr.size() == 1000);
+      REQUIRE(arr.ptr() == buf.data());
+      REQUIRE(heap.num_segments() == 2);
+      REQUIRE(!heap.empty());
+
+      arr[5] = 42;
+      REQUIRE(buf[5] == 42);
+
+      Data view;
+      view.heap_view(heap);
+      REQUIRE(view.phy(arr.getAddress()/4 + 7) == 7);
+
+      // Imported segments are not used for other arrays
+      Data other(16*1024, heap);
+      Data more(16, heap);
+      REQUIRE(heap.num_segments() == 3);
+    }
+
+    REQUIRE(heap.num_segments() == 2);  // Imported segment released, grown segment kept as spare
+    REQUIRE(heap.empty());
+  }
+
+
+  SUBCASE("Kernels should be able to use imported memory and files") {
+    std::string const filename = "obj/test/import_data.bin";
+    int const HEADER = 16;
+    int const N = 64;
+
+    {
+      std::vector<int> values(HEADER/4 + N);
+      for (int i = 0; i < (int) values.size(); i++) values[i] = 100 + i;
+
+      FILE *f = fopen(filename.c_str(), "wb");
+      REQUIRE(f != nullptr);
+      fwrite(values.data(), sizeof(int), values.size(), f);
+      fclose(f);
+    }
+
+    Int::Array src;
+    REQUIRE(src.import_file(filename, HEADER));
+    REQUIRE(src.size() == N);
+    REQUIRE(src[0] == 100 + HEADER/4);
+
+    std::vector<int> buf(16, -1);
+    Int::Array dst;
+    REQUIRE(dst.import(buf.data(), 16));
+
+    auto k = compile(add_one_kernel);
+    k.load(&dst, &src);
+
+    k.interpret();
+    for (int i = 0; i < 16; i++) REQUIRE(buf[i] == 101 + HEADER/4 + i);
+
+    std::fill(buf.begin(), buf.end(), -1);
+    k.emu();
+    for (int i = 0; i < 16; i++) REQUIRE(buf[i] == 101 + HEADER/4 + i);
+
+    Shared2DArray<int> mat;
+    REQUIRE(mat.import_file(filename, 4, 16, HEADER));
+    REQUIRE(mat[3][15] == 100 + HEADER/4 + N - 1);
+
+    Shared2DArray<int> too_big;
+    REQUIRE_THROWS(too_big.import_file(filename, 8, 16, HEADER));
+  }
+
+
+  SUBCASE("Imports over 4GB should fail instead of being truncated") {
+    std::vector<int> buf(16);
+    Int::Array arr;
+    REQUIRE_THROWS(arr.import(buf.data(), 0x40000001));
+    REQUIRE(!arr.allocated());
+
+    // Sparse file, takes no space on disk
+    std::string const filename = "obj/test/import_huge.bin";
+    FILE *f = fopen(filename.c_str(), "wb");
+    REQUIRE(f != nullptr);
+    REQUIRE(fseeko(f, 0x100000000LL, SEEK_SET) == 0);
+    fputc(0, f);
+    fclose(f);
+
+    Int::Array huge;
+    REQUIRE_THROWS(huge.import_file(filename));
+    REQUIRE(!huge.allocated());
+    remove(filename.c_str());
+  }
 }
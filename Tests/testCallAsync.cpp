@@ -0,0 +1,127 @@
+#include "doctest.h"
+#include "V3DLib.h"
+#include "Common/CallQueue.h"
+
+using namespace V3DLib;
+
+namespace {
+
+int const NUM_QPUS = 8;
+int const NUM_BLOCKS = 6;
+
+
+void scale_kernel(Int::Ptr dst, Int::Ptr src, Int factor) {
+  Int sum = 0;
+
+  For (Int i = 0, i < 20, i++)  // Some busy work, so that the call takes a while
+    sum += factor;
+  End
+
+  Int val = src[16*me()];
+  dst[16*me()] = val*sum;
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test asynchronous kernel calls [call][async]") {
+  auto k = compile(scale_kernel);
+  REQUIRE(!k.has_errors());
+  k.setNumQPUs(NUM_QPUS);
+
+  SUBCASE("Double-buffered calls should give the same results as synchronous calls") {
+    // Two sets of buffers; the host fills one set while the kernel works on the other
+    Int::Array src[2] = { Int::Array(16*NUM_QPUS), Int::Array(16*NUM_QPUS) };
+    Int::Array dst[2] = { Int::Array(16*NUM_QPUS), Int::Array(16*NUM_QPUS) };
+    std::shared_future<void> done[2];
+
+    std::vector<int> results;
+
+    auto collect = [&results] (Int::Array &arr) {
+      for (int i = 0; i < (int) arr.size(); i++) results.push_back(arr[i]);
+    };
+
+    for (int block = 0; block < NUM_BLOCKS; block++) {
+      int b = block % 2;
+
+      if (done[b].valid()) {
+        done[b].get();
+        collect(dst[b]);
+      }
+
+      for (int i = 0; i < (int) src[b].size(); i++) src[b][i] = block*1000 + i;
+      dst[b].fill(-1);
+
+      k.load(&dst[b], &src[b], block + 1);
+      done[b] = k.call_async();
+    }
+
+    for (int block = NUM_BLOCKS; block < NUM_BLOCKS + 2; block++) {
+      int b = block % 2;
+      done[b].get();
+      collect(dst[b]);
+    }
+
+    REQUIRE(results.size() == (size_t) (NUM_BLOCKS*16*NUM_QPUS));
+
+    // Compare with synchronous calls
+    Int::Array src_sync(16*NUM_QPUS);
+    Int::Array dst_sync(16*NUM_QPUS);
+
+    for (int block = 0; block < NUM_BLOCKS; block++) {
+      for (int i = 0; i < (int) src_sync.size(); i++) src_sync[i] = block*1000 + i;
+      dst_sync.fill(-1);
+
+      k.load(&dst_sync, &src_sync, block + 1);
+      k.call();
+
+      for (int i = 0; i < (int) dst_sync.size(); i++) {
+        INFO("block: " << block << ", i: " << i);
+        int expected = (block*1000 + i)*20*(block + 1);
+        REQUIRE(dst_sync[i] == expected);
+        REQUIRE(results[block*16*NUM_QPUS + i] == expected);
+      }
+    }
+  }
+
+  SUBCASE("Host should be able to grow and shrink the heap while calls run") {
+    uint32_t const BIG = getBufferObject().size()/4 + 16;  // Needs a segment of its own
+
+    Int::Array src(16*NUM_QPUS);
+    Int::Array dst(16*NUM_QPUS);
+    src.fill(2);
+    dst.fill(-1);
+
+    k.load(&dst, &src, 1);
+    for (int n = 0; n < 4; n++) k.call_async();
+
+    for (int n = 0; n < 4; n++) {
+      Int::Array tmp1(BIG);
+      Int::Array tmp2(BIG);
+      tmp1[0] = n;
+    }
+
+    k.wait();
+
+    for (int i = 0; i < (int) dst.size(); i++) {
+      REQUIRE(dst[i] == 40);
+    }
+  }
+
+  SUBCASE("wait() should complete all pending calls of the kernel") {
+    Int::Array src(16*NUM_QPUS);
+    Int::Array dst(16*NUM_QPUS);
+    src.fill(3);
+    dst.fill(-1);
+
+    k.load(&dst, &src, 1);
+    for (int n = 0; n < 4; n++) k.call_async();
+
+    k.wait();
+    REQUIRE(CallQueue::instance().pending() == 0);
+
+    for (int i = 0; i < (int) dst.size(); i++) {
+      REQUIRE(dst[i] == 60);
+    }
+  }
+}
@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////////////
+// Compile benchmark
+//
+// The test cases here are skipped by default. Run with `make bench-compile`.
+// See `support/CompileBench.h` for the output.
+//
+// The FFT kernel is benchmarked in `testFFT.cpp`, where it is defined.
+///////////////////////////////////////////////////////////////////////////////
+#include "doctest.h"
+#include "V3DLib.h"
+#include "Kernels/Matrix.h"
+#include "Kernels/Cursor.h"
+#include "support/CompileBench.h"
+
+using namespace V3DLib;
+
+namespace {
+
+// Same as the kernel in Examples/HeatMap.cpp
+float const K = 0.25;   // Heat dissipation constant
+
+void heatmap_kernel(Float::Ptr map, Float::Ptr mapOut, Int height, Int width) {
+  Cursor cursor(width);
+
+  For (Int offset = cursor.offset()*me() + 1,
+       offset < height - cursor.offset() - 1,
+       offset += cursor.offset()*numQPUs())
+
+    Float::Ptr src = map    + offset*width;
+    Float::Ptr dst = mapOut + offset*width;
+
+    cursor.init(src, dst);
+
+    // Compute one output row
+    For (Int x = 0, x < width, x = x + 16)
+      cursor.step([&x, &width] (Cursor::Block const &b, Float &output) {
+        Float sum = b.left(0) + b.current(0) + b.right(0) +
+                    b.left(1) +                b.right(1) +
+                    b.left(2) + b.current(2) + b.right(2);
+
+        output = b.current(1) - K * (b.current(1) - sum * 0.125);
+
+        // Ensure left and right borders are zero
+        Int actual_x = x + index();
+        Where (actual_x == 0)
+          output = 0.0f;
+        End
+        Where (actual_x == width - 1)
+          output = 0.0f;
+        End
+      });
+    End
+
+    cursor.finish();
+  End
+}
+
+
+// Same as the multi-QPU kernel in Examples/Mandelbrot.cpp
+void mandelbrot_kernel(
+  Float topLeftReal, Float topLeftIm,
+  Float offsetX, Float offsetY,
+  Int numStepsWidth, Int numStepsHeight,
+  Int numIterations,
+  Int::Ptr result
+) {
+  For (Int yStep = 0, yStep < numStepsHeight - numQPUs(), yStep += numQPUs())
+    Int yIndex = yStep + me();
+    Int::Ptr dst = result + yIndex*numStepsWidth;
+
+    For (Int xStep = 0, xStep < numStepsWidth - 16, xStep += 16)
+      Int xIndex = xStep + index();
+      Complex c(topLeftReal + offsetX*toFloat(xIndex), topLeftIm - offsetY*toFloat(yIndex));
+
+      Int count = 0;
+      Complex x = c;
+      Float mag = x.mag_square();
+
+      FloatExpr condition = (4.0f - mag)*toFloat(numIterations - count);
+      Float checkvar = condition;
+
+      While (any(checkvar > 0.0f))
+        Where (checkvar > 0.0f)
+          x = x*x + c;
+
+          mag = x.mag_square();
+          count++;
+          checkvar = condition; 
+        End
+      End
+
+      *dst = count;
+      dst.inc();
+    End
+  End
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Compile benchmark [bench]" * doctest::skip()) {
+  CompileBench bench;
+
+  SUBCASE("Matrix multiplication") {
+    for (int dim : {64, 128, 256, 512, 800}) {
+      auto k = compile(kernels::matrix_mult_decorator(dim));
+      REQUIRE(!k.has_errors());
+      bench.add("matrix", dim, k);
+    }
+  }
+
+  SUBCASE("DFT") {
+    for (int dim : {64, 256}) {
+      Float::Array input(dim);
+      Complex::Array2D result;
+      auto k = compile(kernels::dft_decorator(input, result));
+      REQUIRE(!k.has_errors());
+      bench.add("dft", dim, k);
+    }
+  }
+
+  SUBCASE("HeatMap") {
+    auto k = compile(heatmap_kernel);
+    REQUIRE(!k.has_errors());
+    bench.add("heatmap", 0, k);
+  }
+
+  SUBCASE("Mandelbrot") {
+    auto k = compile(mandelbrot_kernel);
+    REQUIRE(!k.has_errors());
+    bench.add("mandelbrot", 0, k);
+  }
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <future>
 #include <string>
 #include <sstream>
 #include <V3DLib.h>
@@ -612,6 +613,27 @@ TEST_CASE("Test For-loops [dsl][for]") {
     check_vector(result, 0, expected);
   }
 
+  SUBCASE("Concurrent compiles should generate the same code as a single compile") {
+    int const NUM_THREADS = 4;
+
+    auto code = [] () -> std::string {
+      auto k = compile(nested_for_kernel);
+      return k.vc4().targetCode().mnemonics() + k.v3d().targetCode().mnemonics();
+    };
+
+    std::string expected = code();
+    REQUIRE(!expected.empty());
+
+    std::vector<std::future<std::string>> results;
+    for (int i = 0; i < NUM_THREADS; i++) {
+      results.push_back(std::async(std::launch::async, code));
+    }
+
+    for (auto &result : results) {
+      REQUIRE(result.get() == expected);
+    }
+  }
+
   Platform::use_main_memory(false);
 } 
 
@@ -0,0 +1,109 @@
+#include "doctest.h"
+#include "V3DLib.h"
+#include "LibSettings.h"
+#include "vc4/DMA/Operations.h"
+
+using namespace V3DLib;
+
+namespace {
+
+int const NUM_QPUS = 12;
+
+
+/**
+ * Each QPU does a different amount of work, so that the QPUs finish out of order
+ */
+void work_kernel(Int::Ptr result) {
+  Int sum = 0;
+
+  For (Int i = 0, i < 10*(me() + 1), i++)
+    sum += i*(index() + 1);
+  End
+
+  result += 16*me();
+  *result = sum;
+}
+
+
+/**
+ * Update a shared value, using a semaphore as mutex.
+ *
+ * QPU 0 goes first, the other QPUs wait their turn.
+ */
+void mutex_kernel(Int::Ptr p) {
+  If (me() != 0)
+    semaDec(0);
+  End
+
+  Int x = *p;
+  *p = x + me() + 1;
+  dmaWaitWrite();  // Make sure the store is done before the next QPU reads
+
+  semaInc(0);
+}
+
+
+/**
+ * Run the kernel in lockstep and in parallel mode, and check that the results are the same
+ */
+template<typename Kernel>
+void check_same(Kernel &k, Int::Array &result, bool interpret, int init = -1) {
+  k.setNumQPUs(NUM_QPUS);
+  k.load(&result);
+
+  bool prev_lockstep = LibSettings::emu_lockstep();
+
+  LibSettings::emu_lockstep(true);
+  result.fill(init);
+  if (interpret) k.interpret(); else k.emu();
+  std::vector<int> expected(result.size());
+  for (int i = 0; i < (int) result.size(); i++) expected[i] = result[i];
+
+  LibSettings::emu_lockstep(false);
+  result.fill(init);
+  if (interpret) k.interpret(); else k.emu();
+
+  LibSettings::emu_lockstep(prev_lockstep);
+
+  for (int i = 0; i < (int) result.size(); i++) {
+    INFO("i: " << i);
+    REQUIRE(result[i] == expected[i]);
+  }
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test parallel execution of QPUs in emulator and interpreter [emu][parallel]") {
+  SUBCASE("Parallel execution is opt-in") {
+    REQUIRE(LibSettings::emu_lockstep());
+  }
+
+  SUBCASE("Parallel and lockstep give same results") {
+    auto k = compile(work_kernel);
+    Int::Array result(16*NUM_QPUS);
+
+    check_same(k, result, false);
+    check_same(k, result, true);
+
+    // Sanity check on the output
+    for (int q = 0; q < NUM_QPUS; q++) {
+      int n = 10*(q + 1);
+      REQUIRE(result[16*q + 1] == 2*(n*(n - 1)/2));
+    }
+  }
+
+
+  SUBCASE("Semaphores synchronize the QPUs") {
+    int const expected = NUM_QPUS*(NUM_QPUS + 1)/2;
+
+    auto k = compile(mutex_kernel, VC4);  // Semaphores are vc4 only
+    Int::Array result(16);
+
+    check_same(k, result, false, 0);
+    for (int i = 0; i < (int) result.size(); i++) REQUIRE(result[i] == expected);
+
+    check_same(k, result, true, 0);
+    for (int i = 0; i < (int) result.size(); i++) REQUIRE(result[i] == expected);
+  }
+}
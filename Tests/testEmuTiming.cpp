@@ -0,0 +1,170 @@
+#include "doctest.h"
+#include "V3DLib.h"
+#include "LibSettings.h"
+#include "vc4/DMA/Operations.h"
+
+using namespace V3DLib;
+
+namespace {
+
+void load_kernel(Int::Ptr src, Int::Ptr dst, Int stride) {
+  Int a = src[stride*index()];
+  *dst = a + 1;
+}
+
+
+/**
+ * All QPUs wait for QPU 0, which does extra work first
+ */
+void wait_kernel(Int::Ptr dst) {
+  If (me() == 0)
+    Int sum = 0;
+    For (Int i = 0, i < 100, i++)
+      sum += i;
+    End
+    *dst = sum;
+
+    For (Int i = 0, i < numQPUs() - 1, i++)
+      semaInc(1);
+    End
+  Else
+    semaDec(1);
+  End
+}
+
+
+/**
+ * Independent add and mul operations in a loop, which can be paired
+ */
+void pair_kernel(Int::Ptr src, Int::Ptr dst, Int n) {
+  Int sum  = 0;
+  Int prod = 1;
+
+  For (Int i = 0, i < n, i += 16)
+    Int a = src[i];
+    Int b = src[i + n];
+    sum  = sum + a;
+    prod = prod * b;
+  End
+
+  *dst = sum + prod;
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test timing model of the vc4 emulator [emu][timing]") {
+  bool prev_use_tmu = LibSettings::use_tmu_for_load();
+  LibSettings::use_tmu_for_load(true);
+
+  Int::Array src(16*16);
+  for (int i = 0; i < (int) src.size(); i++) src[i] = i;
+  Int::Array dst(16);
+
+  SUBCASE("Timing does not change the results") {
+    auto k = compile(load_kernel);
+    k.load(&src, &dst, 1);
+
+    dst.fill(-1);
+    k.emu();
+    std::vector<int> expected(16);
+    for (int i = 0; i < 16; i++) expected[i] = dst[i];
+
+    dst.fill(-1);
+    auto timing = k.emu_timed();
+    for (int i = 0; i < 16; i++) REQUIRE(dst[i] == expected[i]);
+
+    REQUIRE(timing.qpus.size() == 1);
+    auto const &item = timing.qpus[0];
+    REQUIRE(item.num_instructions > 0);
+    REQUIRE(item.num_tmu_loads > 0);
+    REQUIRE(item.num_dma_stores > 0);
+    REQUIRE(item.tmu_stalls > 0);
+    REQUIRE(item.regfile_stalls == 0);  // The compiler should avoid these
+    REQUIRE(timing.max_cycles() == item.cycles);
+    REQUIRE(item.cycles == item.num_instructions + item.tmu_stalls + item.vpm_stalls + item.dma_stalls
+                         + item.sema_stalls + item.regfile_stalls + item.branch_delays);
+  }
+
+
+  SUBCASE("Scattered TMU loads take longer") {
+    auto k = compile(load_kernel);
+
+    k.load(&src, &dst, 1);
+    auto contiguous = k.emu_timed();
+
+    k.load(&src, &dst, 16);
+    auto scattered = k.emu_timed();
+
+    REQUIRE(scattered.qpus[0].num_instructions == contiguous.qpus[0].num_instructions);
+    REQUIRE(scattered.max_cycles() > contiguous.max_cycles());
+  }
+
+
+  SUBCASE("DMA loads are timed") {
+    LibSettings::use_tmu_for_load(false);
+    auto k = compile(load_kernel);
+    LibSettings::use_tmu_for_load(true);
+
+    k.load(&src, &dst, 1);
+    auto timing = k.emu_timed();
+
+    REQUIRE(timing.qpus[0].num_tmu_loads == 0);
+    REQUIRE(timing.qpus[0].num_dma_loads > 0);
+    REQUIRE(timing.qpus[0].dma_stalls > 0);
+  }
+
+
+  SUBCASE("Paired instructions and filled delay slots take no extra cycles") {
+    int const N = 16*10;
+
+    auto k = compile(pair_kernel, VC4);
+    auto &stats = k.vc4().stats();
+    REQUIRE(stats.num_instructions_combined > 0);
+    REQUIRE(stats.num_delay_slots_filled > 0);
+
+    Int::Array src2(2*N);
+    for (int i = 0; i < (int) src2.size(); i++) src2[i] = (i < N)? i : 1 + (i % 2);
+    k.load(&src2, &dst, N);
+
+    dst.fill(-1);
+    k.interpret();
+    std::vector<int> expected(16);
+    for (int i = 0; i < 16; i++) expected[i] = dst[i];
+
+    dst.fill(-1);
+    auto timing = k.emu_timed();
+    for (int i = 0; i < 16; i++) REQUIRE(dst[i] == expected[i]);
+
+    auto const &item = timing.qpus[0];
+    REQUIRE(item.regfile_stalls == 0);
+    REQUIRE(item.cycles == item.num_instructions + item.tmu_stalls + item.vpm_stalls + item.dma_stalls
+                         + item.sema_stalls + item.regfile_stalls + item.branch_delays);
+  }
+
+
+  SUBCASE("Semaphore waits are timed, lockstep is reproducible") {
+    int const numQPUs = 4;
+
+    auto k = compile(wait_kernel, VC4);  // Semaphores are vc4 only
+    k.setNumQPUs(numQPUs);
+    k.load(&dst);
+
+    bool prev_lockstep = LibSettings::emu_lockstep();
+    LibSettings::emu_lockstep(true);
+    auto timing1 = k.emu_timed();
+    auto timing2 = k.emu_timed();
+    LibSettings::emu_lockstep(prev_lockstep);
+
+    REQUIRE(timing1.qpus.size() == numQPUs);
+    for (int i = 1; i < numQPUs; i++) {
+      INFO("QPU " << i);
+      REQUIRE(timing1.qpus[i].sema_stalls > 0);
+      REQUIRE(timing1.qpus[i].cycles > timing1.qpus[i].num_instructions);
+    }
+
+    REQUIRE(timing1.dump() == timing2.dump());
+  }
+
+  LibSettings::use_tmu_for_load(prev_use_tmu);
+}
@@ -0,0 +1,175 @@
+#include "doctest.h"
+#include <cmath>
+#include "V3DLib.h"
+
+using namespace V3DLib;
+
+namespace {
+
+void gcd_kernel(Int::Ptr p, Int::Ptr q, Int::Ptr r) {
+  Int a = *p;
+  Int b = *q;
+
+  While (any(a != b))
+    Where (a > b)
+      a = a-b;
+    End
+    Where (a < b)
+      b = b-a;
+    End
+  End
+
+  *r = a;
+}
+
+
+void id_kernel(Int::Ptr p, Int::Ptr q) {
+  p += 16*me();
+  q += 16*me();
+
+  *p = me();
+  *q = index();
+}
+
+
+void float_kernel(Float::Ptr x, Float::Ptr r) {
+  Float a = *x;
+
+  *r = 2*a + 1;            r += 16;
+  *r = a*a - a;            r += 16;
+  *r = V3DLib::recip(a);   r += 16;
+  *r = rotate(a, 1);
+}
+
+
+/**
+ * Kernel with independent operations in the loop body, to exercise the instruction scheduler
+ */
+void sched_kernel(Int::Ptr src, Int::Ptr dst, Int n) {
+  Int sum = 0;
+  Int count = 0;
+
+  For (Int i = 0, i < n, i += 16)
+    Int val = src[i];
+    Where (val > 50)
+      val = val - 50;
+    End
+    sum += val*3 + (val << 2);
+    count += 1;
+  End
+
+  *dst = sum + count;
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test v3d emulator [emu][v3d]") {
+  SUBCASE("Test gcd") {
+    int const N = 16;
+    Int::Array a(N), b(N), r(N);
+
+    for (int i = 0; i < N; i++) {
+      a[i] = 100 + 7*i;
+      b[i] = 100 + (13*i) % 50;
+    }
+
+    auto k = compile(gcd_kernel);
+    k.load(&a, &b, &r);
+
+    r.fill(-1);
+    k.interpret();
+    std::vector<int> expected(N);
+    for (int i = 0; i < N; i++) expected[i] = r[i];
+
+    r.fill(-1);
+    auto stats = k.emu_v3d();
+    for (int i = 0; i < N; i++) {
+      INFO("i: " << i);
+      REQUIRE(r[i] == expected[i]);
+    }
+
+    REQUIRE(stats.qpus.size() == 1);
+    REQUIRE(stats.qpus[0].num_tmu_loads  == 2);
+    REQUIRE(stats.qpus[0].num_tmu_stores == 1);
+    REQUIRE(stats.qpus[0].num_branches > 0);
+    REQUIRE(stats.max_instructions() == stats.qpus[0].num_instructions);
+  }
+
+
+  SUBCASE("Test multiple QPUs") {
+    int const numQPUs = 8;
+
+    auto k = compile(id_kernel);
+    k.setNumQPUs(numQPUs);
+
+    Int::Array result(16*numQPUs);
+    Int::Array index_array(16*numQPUs);
+    result.fill(-1);
+    index_array.fill(-1);
+
+    k.load(&result, &index_array);
+    auto stats = k.emu_v3d();
+
+    REQUIRE(stats.qpus.size() == numQPUs);
+
+    for (int i = 0; i < (int) result.size(); i++) {
+      INFO("i: " << i);
+      REQUIRE(result[i] == i/16);
+      REQUIRE(index_array[i] == i % 16);
+    }
+  }
+
+
+  SUBCASE("Test float operations") {
+    Float::Array x(16), r(4*16), expected(4*16);
+
+    for (int i = 0; i < 16; i++) {
+      x[i] = 0.5f + (float) i;
+    }
+
+    auto k = compile(float_kernel);
+    k.load(&x, &r);
+
+    r.fill(0.0f);
+    k.emu();
+    for (int i = 0; i < (int) r.size(); i++) expected[i] = r[i];
+
+    r.fill(0.0f);
+    auto stats = k.emu_v3d();
+    REQUIRE(stats.qpus[0].num_sfu_calls == 1);
+
+    for (int i = 0; i < (int) r.size(); i++) {
+      INFO("i: " << i);
+      REQUIRE(std::abs(r[i] - expected[i]) < 1e-6);
+    }
+  }
+
+
+  SUBCASE("Test instruction scheduling") {
+    int const N = 16*10;
+    Int::Array src(N), r(16);
+
+    for (int i = 0; i < N; i++) {
+      src[i] = (7*i) % 101;
+    }
+
+    auto k = compile(sched_kernel);
+    k.load(&src, &r, N);
+
+    r.fill(-1);
+    k.interpret();
+    std::vector<int> expected(16);
+    for (int i = 0; i < 16; i++) expected[i] = r[i];
+
+    r.fill(-1);
+    auto stats = k.emu_v3d();
+    REQUIRE(k.v3d().stats().num_instructions_combined > 0);
+    REQUIRE(stats.qpus[0].num_tmu_loads == 10);
+
+    for (int i = 0; i < 16; i++) {
+      INFO("i: " << i);
+      REQUIRE(r[i] == expected[i]);
+    }
+  }
+}
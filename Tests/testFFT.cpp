@@ -6,6 +6,7 @@
 #include "Support/Timer.h"
 #include "Support/pgm.h"
 #include "support/dft_support.h"
+#include "support/CompileBench.h"
 #include "Kernels/Matrix.h"
 #include "Source/gather.h"
 #include "Source/Functions.h"
@@ -1494,3 +1495,17 @@ TEST_CASE("FFT Support [fft]") {
     }
   }
 }
+
+
+TEST_CASE("Compile benchmark FFT [fft][bench]" * doctest::skip()) {
+  CompileBench bench;
+
+  for (int log2n : {6, 10}) {
+    fft_context.init(log2n);
+    fft_context.num_qpus = 8;
+
+    auto k = compile(fft_kernel, V3D);
+    REQUIRE(!k.has_errors());
+    bench.add("fft", 1 << log2n, k);
+  }
+}
@@ -0,0 +1,271 @@
+#include "doctest.h"
+#include <cstdio>
+#include <string>
+#include <stdlib.h>   // mkdtemp()
+#include <dirent.h>
+#include <unistd.h>
+#include "V3DLib.h"
+#include "LibSettings.h"
+#include "Target/instr/Mnemonics.h"
+#include "v3d/instr/Instr.h"
+
+using namespace V3DLib;
+
+namespace {
+
+float scale = 0.1f;  // Literal used in the kernel; changing it must change the cache key
+
+void cache_kernel(Float::Ptr dst, Int::Ptr src) {
+  Float sum = 0;
+
+  For (Int n = 0, n < 4, n++)
+    Int val = src[16*n];  // Pointers already include the offset of the vector element
+    sum += toFloat(val)*scale;
+  End
+
+  Where (index() > 7)
+    sum = sum + 1.0f;
+  End
+
+  dst[16*me()] = sum;
+}
+
+
+int count_files(std::string const &dir) {
+  int ret = 0;
+  DIR *d = opendir(dir.c_str());
+  REQUIRE(d != nullptr);
+
+  struct dirent *entry;
+  while ((entry = readdir(d)) != nullptr) {
+    if (entry->d_name[0] != '.') ret++;
+  }
+
+  closedir(d);
+  return ret;
+}
+
+
+void remove_dir(std::string const &dir) {
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) return;
+
+  struct dirent *entry;
+  while ((entry = readdir(d)) != nullptr) {
+    if (entry->d_name[0] == '.') continue;
+    unlink((dir + "/" + entry->d_name).c_str());
+  }
+
+  closedir(d);
+  rmdir(dir.c_str());
+}
+
+
+/**
+ * Flip a bit in the byte at given offset from the end of each file in the directory
+ */
+void corrupt_files(std::string const &dir, int offset_from_end) {
+  DIR *d = opendir(dir.c_str());
+  REQUIRE(d != nullptr);
+
+  struct dirent *entry;
+  while ((entry = readdir(d)) != nullptr) {
+    if (entry->d_name[0] == '.') continue;
+
+    FILE *f = fopen((dir + "/" + entry->d_name).c_str(), "r+b");
+    REQUIRE(f != nullptr);
+    REQUIRE(fseek(f, -offset_from_end, SEEK_END) == 0);
+    int c = fgetc(f);
+    REQUIRE(fseek(f, -offset_from_end, SEEK_END) == 0);
+    fputc(c ^ 0x10, f);
+    fclose(f);
+  }
+
+  closedir(d);
+}
+
+
+struct Results {
+  std::string vc4_code;
+  std::vector<float> vc4;
+  std::vector<float> v3d;
+  int v3d_size = 0;
+};
+
+
+Results run_kernel(KernelCache::Status expected_status) {
+  int const numQPUs = 8;
+  Results ret;
+
+  auto k = compile(cache_kernel);
+  INFO(k.get_errors());
+  REQUIRE(!k.has_errors());
+  REQUIRE(k.vc4().cache_status() == expected_status);
+  REQUIRE(k.v3d().cache_status() == expected_status);
+
+  Int::Array src(4*16);
+  for (int i = 0; i < (int) src.size(); i++) src[i] = i;
+  Float::Array dst(numQPUs*16);
+
+  k.setNumQPUs(numQPUs);
+  k.load(&dst, &src);
+
+  dst.fill(-1);
+  k.emu();
+  for (int i = 0; i < (int) dst.size(); i++) ret.vc4.push_back(dst[i]);
+
+  dst.fill(-1);
+  k.emu_v3d();
+  for (int i = 0; i < (int) dst.size(); i++) ret.v3d.push_back(dst[i]);
+
+  ret.vc4_code = k.vc4().targetCode().mnemonics();
+  ret.v3d_size = k.v3d_kernel_size();
+  return ret;
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test on-disk kernel cache [cache]") {
+  char tmpl[] = "/tmp/v3dlib_cacheXXXXXX";
+  REQUIRE(mkdtemp(tmpl) != nullptr);
+  std::string dir = tmpl;
+  dir += "/kernels";  // Check that the cache dir is created
+
+  std::string prev_dir = LibSettings::kernel_cache_dir();
+  REQUIRE(prev_dir.empty());
+  Results uncached = run_kernel(KernelCache::DISABLED);
+
+  LibSettings::kernel_cache_dir(dir);
+
+  SUBCASE("Cached kernels should be the same as compiled kernels") {
+    Results first = run_kernel(KernelCache::MISS);
+    REQUIRE(count_files(dir) == 2);  // One each for vc4 and v3d
+
+    Results second = run_kernel(KernelCache::HIT);
+    REQUIRE(count_files(dir) == 2);
+
+    for (auto const *res : {&first, &second}) {
+      REQUIRE(res->vc4_code == uncached.vc4_code);
+      REQUIRE(res->v3d_size == uncached.v3d_size);
+      REQUIRE(res->vc4 == uncached.vc4);
+      REQUIRE(res->v3d == uncached.v3d);
+    }
+
+    // Change in a literal value should result in a new entry
+    float prev_scale = scale;
+    scale = 0.1000001f;
+    Results changed = run_kernel(KernelCache::MISS);
+    scale = prev_scale;
+
+    REQUIRE(count_files(dir) == 4);
+    REQUIRE(changed.vc4 != uncached.vc4);
+  }
+
+  SUBCASE("Corrupt entries should be compiled again") {
+    run_kernel(KernelCache::MISS);
+    corrupt_files(dir, 1);
+
+    Results again = run_kernel(KernelCache::MISS);
+    REQUIRE(again.vc4 == uncached.vc4);
+    REQUIRE(again.v3d == uncached.v3d);
+
+    run_kernel(KernelCache::HIT);  // Entries have been replaced
+  }
+
+  SUBCASE("Entries should only be used if the full key matches") {
+    using namespace V3DLib::Target::instr;
+
+    Instr::List code;
+    code << add(rf(2), rf(1), rf(0));
+
+    KernelCache::Entry entry;
+    entry.num_vars = 3;
+    entry.opcodes  = {1, 2, 3};
+
+    auto key = KernelCache::key(code);
+    KernelCache::store(key, entry);
+
+    KernelCache::Entry loaded;
+    REQUIRE(KernelCache::load(key, loaded));
+    REQUIRE(loaded.num_vars == 3);
+    REQUIRE(loaded.opcodes == entry.opcodes);
+
+    // Same hash with different input, as with a hash collision
+    auto other = key;
+    other.input.back() ^= 1;
+    REQUIRE(!KernelCache::load(other, loaded));
+
+    other = key;
+    other.input.pop_back();
+    REQUIRE(!KernelCache::load(other, loaded));
+
+    // Corrupt payload of the same size, here the last word of the target code
+    entry.target_code.clear();
+    code.front().serialize(entry.target_code);
+    KernelCache::store(key, entry);
+    REQUIRE(KernelCache::load(key, loaded));
+
+    corrupt_files(dir, 3*8 + 1);  // Before the 3 opcodes
+    REQUIRE(!KernelCache::load(key, loaded));
+
+    // Key depends on the code
+    Instr::List code2;
+    code2 << add(rf(2), rf(1), rf(3));
+    REQUIRE(KernelCache::key(code2).hash != key.hash);
+  }
+
+  LibSettings::kernel_cache_dir(prev_dir);
+  remove_dir(dir);
+  rmdir(tmpl);
+}
+
+
+TEST_CASE("Test instruction equality and hashing [cache]") {
+  SUBCASE("Target instructions should compare and hash field-wise") {
+    using namespace V3DLib::Target::instr;
+
+    Instr a = add(rf(2), rf(1), rf(0));
+    Instr b = add(rf(2), rf(1), rf(0));
+    b.comment("Comments are ignored");
+
+    REQUIRE(a == b);
+    REQUIRE(a.hash() == b.hash());
+    REQUIRE(std::hash<Instr>()(a) == std::hash<Instr>()(b));
+
+    Instr c = add(rf(2), rf(1), rf(3));
+    REQUIRE(a != c);
+    REQUIRE(a.hash() != c.hash());
+    REQUIRE(a != mov(rf(2), rf(1)));
+    REQUIRE(li(rf(0), 1.0f) != li(rf(0), 1));
+
+    // The hash is that of the serialized fields
+    std::vector<uint32_t> words;
+    a.serialize(words);
+    REQUIRE(a.hash() == hash_words(FNV_OFFSET, words.data(), words.size()));
+  }
+
+  SUBCASE("v3d instructions should compare and hash field-wise") {
+    using V3DLib::v3d::instr::Instr;
+
+    Instr nop(0x3d803186bb800000);
+    Instr eidx(0x3c003181bb802000);
+
+    REQUIRE(nop == Instr(0x3d803186bb800000));
+    REQUIRE(nop.hash() == Instr(0x3d803186bb800000).hash());
+    REQUIRE(nop != eidx);
+    REQUIRE(nop.hash() != eidx.hash());
+    REQUIRE(nop == (uint64_t) 0x3d803186bb800000);
+
+    // Branch with field ub == false: bdu field is not used
+    Instr br1(0x02ffeff3ff009000);
+    Instr br2(0x02ffeff3ff001000);
+    REQUIRE(br1 == br2);
+    REQUIRE(br1.hash() == br2.hash());
+
+    Instr lab = nop;
+    lab.is_label(true);
+    lab.label(3);
+    REQUIRE(lab != nop);
+  }
+}
@@ -0,0 +1,197 @@
+#include "doctest.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "Target/LaneOps.h"
+
+using namespace V3DLib;
+
+namespace {
+
+/**
+ * Input values with edge cases for int and float operations
+ */
+std::vector<Word> test_values() {
+  std::vector<int32_t> ints = {
+    0, 1, -1, 2, -2, 31, 32, 33, -31, -32, 0x7fffffff, (int32_t) 0x80000000, 0xffffff, 0x1000000,
+    12345678, -12345678
+  };
+
+  std::vector<float> floats = {
+    0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 1.5f, -2.5f, 1e10f, -1e10f, 3e9f, 1e-40f, -1e-40f,
+    std::numeric_limits<float>::infinity(),
+    -std::numeric_limits<float>::infinity(),
+    std::numeric_limits<float>::quiet_NaN(),
+    std::numeric_limits<float>::max()
+  };
+
+  std::vector<Word> ret;
+
+  for (auto i : ints) {
+    Word w;
+    w.intVal = i;
+    ret.push_back(w);
+  }
+
+  for (auto f : floats) {
+    Word w;
+    w.floatVal = f;
+    ret.push_back(w);
+  }
+
+  return ret;
+}
+
+
+/**
+ * Fill two vectors with all combinations of the test values.
+ *
+ * @return false if all combinations have been done
+ */
+bool fill(Vec &a, Vec &b, int &index) {
+  static std::vector<Word> const values = test_values();
+  int const N = (int) values.size();
+
+  if (index >= N*N) return false;
+
+  for (int i = 0; i < NUM_LANES; i++) {
+    int k = (index + i) % (N*N);
+    a[i] = values[k / N];
+    b[i] = values[k % N];
+  }
+
+  index += NUM_LANES;
+  return true;
+}
+
+
+/**
+ * Bit pattern of a float.
+ *
+ * The payload of NaN's is not defined by C++, the compiler may even swap the operands
+ * of commutative operations. Therefore, all NaN's are considered equal.
+ */
+int32_t bits(float f) {
+  if (std::isnan(f)) return 0x7fc00000;
+
+  int32_t ret;
+  memcpy(&ret, &f, sizeof(ret));
+  return ret;
+}
+
+
+template<typename BinOp, typename Expected>
+void check_binary(char const *name, BinOp op, Expected expected, bool float_result = false) {
+  INFO("op: " << name << ", implementation: " << lanes::isa());
+
+  Vec a, b, d;
+  int index = 0;
+
+  while (fill(a, b, index)) {
+    op(d, a, b);
+
+    for (int i = 0; i < NUM_LANES; i++) {
+      INFO("lane " << i << ": a = " << a[i].intVal << ", b = " << b[i].intVal);
+      int32_t result = float_result? bits(d[i].floatVal) : d[i].intVal;
+      REQUIRE(result == expected(a[i], b[i]));
+    }
+  }
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test vectorized lane operations [emu][lanes]") {
+  SUBCASE("ALU operations are bit-exact with scalar code") {
+    check_binary("fadd", lanes::fadd, [] (Word x, Word y) { return bits(x.floatVal + y.floatVal); }, true);
+    check_binary("fsub", lanes::fsub, [] (Word x, Word y) { return bits(x.floatVal - y.floatVal); }, true);
+    check_binary("fmul", lanes::fmul, [] (Word x, Word y) { return bits(x.floatVal * y.floatVal); }, true);
+    check_binary("fmin", lanes::fmin, [] (Word x, Word y) {
+      return bits(x.floatVal < y.floatVal ? x.floatVal : y.floatVal);
+    }, true);
+    check_binary("fmax", lanes::fmax, [] (Word x, Word y) {
+      return bits(x.floatVal > y.floatVal ? x.floatVal : y.floatVal);
+    }, true);
+    check_binary("itof", [] (Vec &d, Vec const &a, Vec const &) { lanes::itof(d, a); },
+                         [] (Word x, Word) { return bits((float) x.intVal); }, true);
+
+    check_binary("add",  lanes::add,  [] (Word x, Word y) { return (int32_t) ((uint32_t) x.intVal + (uint32_t) y.intVal); });
+    check_binary("sub",  lanes::sub,  [] (Word x, Word y) { return (int32_t) ((uint32_t) x.intVal - (uint32_t) y.intVal); });
+    check_binary("shl",  lanes::shl,  [] (Word x, Word y) { return (int32_t) ((uint32_t) x.intVal << (y.intVal & 31)); });
+    check_binary("shr",  lanes::shr,  [] (Word x, Word y) { return (int32_t) ((uint32_t) x.intVal >> (y.intVal & 31)); });
+    check_binary("asr",  lanes::asr,  [] (Word x, Word y) { return x.intVal >> (y.intVal & 31); });
+    check_binary("min",  lanes::min,  [] (Word x, Word y) { return x.intVal < y.intVal ? x.intVal : y.intVal; });
+    check_binary("max",  lanes::max,  [] (Word x, Word y) { return x.intVal > y.intVal ? x.intVal : y.intVal; });
+    check_binary("band", lanes::band, [] (Word x, Word y) { return x.intVal & y.intVal; });
+    check_binary("bor",  lanes::bor,  [] (Word x, Word y) { return x.intVal | y.intVal; });
+    check_binary("bxor", lanes::bxor, [] (Word x, Word y) { return x.intVal ^ y.intVal; });
+    check_binary("bnot", [] (Vec &d, Vec const &a, Vec const &) { lanes::bnot(d, a); },
+                         [] (Word x, Word) { return ~x.intVal; });
+    check_binary("mul24", lanes::mul24, [] (Word x, Word y) {
+      return (int32_t) (((uint32_t) x.intVal & 0xffffff) * ((uint32_t) y.intVal & 0xffffff));
+    });
+  }
+
+
+  SUBCASE("Float to int conversion is bit-exact with scalar code") {
+    // Only values in range; out of range is undefined behaviour in C++
+    Vec a, d;
+    for (int i = 0; i < NUM_LANES; i++) {
+      a[i].floatVal = -1000.75f + 133.3f*(float) i;
+    }
+
+    lanes::ftoi(d, a);
+
+    for (int i = 0; i < NUM_LANES; i++) {
+      REQUIRE(d[i].intVal == (int) a[i].floatVal);
+    }
+  }
+
+
+  SUBCASE("Comparisons and bools are bit-exact with scalar code") {
+    check_binary("icmp_eq", lanes::icmp_eq, [] (Word x, Word y) { return (int32_t) (x.intVal == y.intVal); });
+    check_binary("icmp_ne", lanes::icmp_ne, [] (Word x, Word y) { return (int32_t) (x.intVal != y.intVal); });
+    check_binary("icmp_lt", lanes::icmp_lt, [] (Word x, Word y) {
+      return (int32_t) ((((uint32_t) x.intVal - (uint32_t) y.intVal) & 0x80000000) != 0);
+    });
+    check_binary("fcmp_eq", lanes::fcmp_eq, [] (Word x, Word y) { return (int32_t) (x.floatVal == y.floatVal); });
+    check_binary("fcmp_ne", lanes::fcmp_ne, [] (Word x, Word y) { return (int32_t) (x.floatVal != y.floatVal); });
+    check_binary("fcmp_lt", lanes::fcmp_lt, [] (Word x, Word y) { return (int32_t) (x.floatVal <  y.floatVal); });
+    check_binary("fcmp_le", lanes::fcmp_le, [] (Word x, Word y) { return (int32_t) (x.floatVal <= y.floatVal); });
+
+    check_binary("bool_and", lanes::bool_and, [] (Word x, Word y) { return (int32_t) (x.intVal && y.intVal); });
+    check_binary("bool_or",  lanes::bool_or,  [] (Word x, Word y) { return (int32_t) (x.intVal || y.intVal); });
+    check_binary("bool_not", [] (Vec &d, Vec const &a, Vec const &) { lanes::bool_not(d, a); },
+                             [] (Word x, Word) { return (int32_t) !x.intVal; });
+  }
+
+
+  SUBCASE("Masks and conditional assignment") {
+    Vec v(std::vector<int>{0, 1, -1, 5, 0, (int) 0x80000000, 7, 0, 0, 0, 3, 0, -7, 0, 1, 0});
+    Vec mask;
+
+    lanes::is_zero(mask, v);
+    for (int i = 0; i < NUM_LANES; i++) REQUIRE(mask[i].intVal == ((v[i].intVal == 0)? -1 : 0));
+
+    lanes::is_negative(mask, v);
+    for (int i = 0; i < NUM_LANES; i++) REQUIRE(mask[i].intVal == ((v[i].intVal < 0)? -1 : 0));
+
+    Vec d(100);
+    lanes::select(d, mask, EmuState::index_vec);
+    for (int i = 0; i < NUM_LANES; i++) REQUIRE(d[i].intVal == ((v[i].intVal < 0)? i : 100));
+
+    d = 100;
+    lanes::select_not(d, mask, EmuState::index_vec);
+    for (int i = 0; i < NUM_LANES; i++) REQUIRE(d[i].intVal == ((v[i].intVal < 0)? 100 : i));
+
+    d = 100;
+    lanes::bool_select(d, v, EmuState::index_vec);
+    for (int i = 0; i < NUM_LANES; i++) REQUIRE(d[i].intVal == ((v[i].intVal != 0)? i : 100));
+
+    REQUIRE(lanes::any(v));
+    REQUIRE(!lanes::all(v));
+    REQUIRE(!lanes::any(Vec(0)));
+    REQUIRE(lanes::all(Vec(-1)));
+    REQUIRE(lanes::all(Vec(1)));
+  }
+}
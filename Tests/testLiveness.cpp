@@ -0,0 +1,130 @@
+#include "doctest.h"
+#include <vector>
+#include "Support/RegBitSet.h"
+#include "Support/RegIdSet.h"
+#include "Liveness/Liveness.h"
+#include "Liveness/Optimizations.h"
+#include "Target/instr/Mnemonics.h"
+
+using namespace V3DLib;
+
+namespace {
+
+std::vector<int> to_vector(RegBitSet const &set) {
+  std::vector<int> ret;
+  for (auto id : set) ret.push_back(id);
+  return ret;
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test bit vector sets for liveness analysis [liveness]") {
+  int const SIZE = 150;  // Spans multiple words, last word partially used
+
+  SUBCASE("Insert, remove and iterate") {
+    RegBitSet set(SIZE);
+    REQUIRE(set.empty());
+    REQUIRE(!(set.begin() != set.end()));
+
+    std::vector<int> ids = {0, 1, 63, 64, 65, 127, 128, 149};
+    for (auto id : ids) set.insert(id);
+
+    REQUIRE(!set.empty());
+    REQUIRE(set.count() == (int) ids.size());
+    REQUIRE(to_vector(set) == ids);
+
+    for (auto id : ids) REQUIRE(set.member(id));
+    REQUIRE(!set.member(2));
+    REQUIRE(!set.member(148));
+
+    set.remove(64);
+    REQUIRE(!set.member(64));
+    REQUIRE(set.count() == (int) ids.size() - 1);
+    REQUIRE(set.dump() == "(0, 1, 63, 65, 127, 128, 149, )");
+
+    set.clear();
+    REQUIRE(set.empty());
+  }
+
+
+  SUBCASE("Union and difference are the same as for RegIdSet") {
+    RegBitSet a(SIZE), b(SIZE), exclude(SIZE);
+    RegIdSet  ra, rb, rexclude;
+
+    for (int i = 0; i < SIZE; i++) {
+      if (i % 3 == 0) { a.insert(i);       ra.insert(i); }
+      if (i % 5 == 0) { b.insert(i);       rb.insert(i); }
+      if (i % 7 == 0) { exclude.insert(i); rexclude.insert(i); }
+    }
+
+    RegBitSet c = a;
+    REQUIRE(c.add(b));
+    REQUIRE(!c.add(b));  // No change second time
+    RegIdSet rc = ra;
+    rc.add(rb);
+    REQUIRE(c.dump() == rc.dump());
+
+    c.remove(exclude);
+    for (auto id : rexclude) rc.remove(id);
+    REQUIRE(c.dump() == rc.dump());
+
+    RegBitSet d = a;
+    REQUIRE(d.add_diff(b, exclude));
+    REQUIRE(!d.add_diff(b, exclude));
+    RegIdSet rd = rb;
+    for (auto id : rexclude) rd.remove(id);
+    rd.add(ra);
+    REQUIRE(d.dump() == rd.dump());
+  }
+}
+
+
+TEST_CASE("Test rewriting with incremental liveness [liveness]") {
+  using namespace V3DLib::Target::instr;
+
+  int const NUM_VARS = 5;
+
+  Instr::List instrs;
+  instrs << mov(rf(0), ELEM_ID)
+         << mov(rf(1), rf(0))           // Copy, propagated and then removed
+         << add(rf(2), rf(1), rf(1))
+         << add(rf(3), rf(2), rf(0))
+         << mov(rf(4), rf(3))           // Dead assignment
+         << mov(Target::instr::VPM_WRITE, rf(3));  // Side effect, stays
+
+  Liveness live(NUM_VARS);
+  live.compute(instrs);
+
+  int count = simplifyVars(live, instrs);
+  REQUIRE(count == 3);
+
+  REQUIRE(instrs[1].tag == InstrTag::SKIP);
+  REQUIRE(instrs[4].tag == InstrTag::SKIP);
+  REQUIRE(instrs[2].ALU.srcA.reg() == rf(0));
+  REQUIRE(instrs[2].ALU.srcB.reg() == rf(0));
+  REQUIRE(instrs[5].tag == InstrTag::ALU);
+
+  // Incrementally updated liveness should be the same as when computed anew
+  Liveness fresh(NUM_VARS);
+  fresh.compute(instrs);
+
+  for (int i = 0; i < instrs.size(); i++) {
+    INFO("Instruction " << i);
+    REQUIRE(to_vector(live[i]) == to_vector(fresh[i]));
+  }
+
+  for (int var = 0; var < NUM_VARS; var++) {
+    INFO("Variable " << var);
+    auto const &item1 = live.reg_usage()[var];
+    auto const &item2 = fresh.reg_usage()[var];
+
+    REQUIRE(item1.srcs() == item2.srcs());
+    REQUIRE(item1.dsts() == item2.dsts());
+    REQUIRE(item1.first_live() == item2.first_live());
+    REQUIRE(item1.last_live() == item2.last_live());
+  }
+
+  REQUIRE(live.reg_usage()[1].unused());
+  REQUIRE(live.reg_usage()[4].unused());
+}
@@ -0,0 +1,315 @@
+#include "doctest.h"
+#include "V3DLib.h"
+#include "Support/Arena.h"
+#include "LibSettings.h"
+
+using namespace V3DLib;
+
+namespace {
+
+int const NUM_QPUS = 8;
+
+/**
+ * Kernel with plenty of opportunities for the source code optimizer:
+ * constant expressions, identities, common subexpressions and dead assignments.
+ */
+void optimize_kernel(Int::Ptr src, Int::Ptr dst) {
+  IntExpr n = 5;
+
+  Int a = src[16*me()];
+  Int b = n * 4;                 // Constant folded
+  Int c = (a + 0) - 0;           // Simplified
+  Int d = a*c + b;
+  Int e = a*c + b;               // Reused
+  Int unused = a*a;              // Removed
+  unused = unused + 1;           // Removed
+
+  Float f = toFloat(a) * 1.0f;   // Simplified
+  Int g = (toInt(f) + 3) + n;    // Simplified
+
+  dst[16*me()] = d + e + g;
+}
+
+
+int expected(int a) {
+  return 2*(a*a + 20) + (a + 8);
+}
+
+
+int const ROWS   = 3*NUM_QPUS;
+int const STRIDE = 48;  // Row length in ints
+
+
+/**
+ * Kernel with loop invariants and address arithmetic on induction variables
+ */
+void loop_kernel(Int::Ptr src, Int::Ptr dst, Int stride) {
+  For (Int y = me(), y < ROWS, y = y + numQPUs())
+    Int sum = 0;
+
+    For (Int x = 0, x < stride, x += 16)
+      Int::Ptr p = src + y*stride + x;  // y is not reduced, x is
+      Int val = *p;
+      sum += val * (stride - 1);        // Invariant
+    End
+
+    *(dst + 16*y) = sum;
+  End
+}
+
+
+int expected_loop(Int::Array const &src, int row, int lane) {
+  int sum = 0;
+
+  for (int x = 0; x < STRIDE; x += 16) {
+    sum += src[row*STRIDE + x + lane] * (STRIDE - 1);
+  }
+
+  return sum;
+}
+
+
+
+int const UNROLL_SIZE = 16*23;  // Not a multiple of the unroll factor, so the remainder is used
+
+
+/**
+ * Kernel with loops to unroll, containing `Where` and gather/receive
+ */
+void unroll_kernel(Int::Ptr src, Int::Ptr dst, Int n) {
+  Int sum = 0;
+
+  ForUnroll(4, Int i = 0, i < n, i += 16)
+    Int val = src[i];
+    Where (val > 50)
+      val = val - 50;
+    End
+    sum += val;
+  End
+
+  ForUnroll(1000, Int i = 0, i < n, i += 16)  // Factor too large, should be limited
+    Int val;
+    gather(src + i);
+    receive(val);
+    sum += val;
+  End
+
+  *dst = sum;
+}
+
+
+int expected_unroll(Int::Array const &src, int lane) {
+  int sum = 0;
+
+  for (int i = lane; i < UNROLL_SIZE; i += 16) {
+    int val = src[i];
+    if (val > 50) val -= 50;
+    sum += val + src[i];
+  }
+
+  return sum;
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test source code optimizer [optimize]") {
+  auto k = compile(optimize_kernel);
+  INFO(k.get_errors());
+  REQUIRE(!k.has_errors());
+
+  auto &stats = k.vc4().stats();
+  REQUIRE(stats.num_constants_folded > 0);
+  REQUIRE(stats.num_exprs_simplified > 0);
+  REQUIRE(stats.num_subexprs_reused > 0);
+  REQUIRE(stats.num_dead_assigns_removed > 0);
+
+  Int::Array src(16*NUM_QPUS);
+  for (int i = 0; i < (int) src.size(); i++) src[i] = i;  // Small positive values, int mul is 24-bit
+  Int::Array dst(16*NUM_QPUS);
+
+  k.setNumQPUs(NUM_QPUS);
+  k.load(&src, &dst);
+
+  auto check = [&src, &dst] (char const *label) {
+    for (int i = 0; i < (int) dst.size(); i++) {
+      INFO(label << " index " << i);
+      REQUIRE(dst[i] == expected(src[i]));
+    }
+  };
+
+  dst.fill(-1);
+  k.interpret();
+  check("interpreter");
+
+  dst.fill(-1);
+  k.emu();
+  check("vc4 emulator");
+
+  dst.fill(-1);
+  k.emu_v3d();
+  check("v3d emulator");
+}
+
+
+TEST_CASE("Test loop optimizations [optimize]") {
+  auto k = compile(loop_kernel);
+  INFO(k.get_errors());
+  REQUIRE(!k.has_errors());
+
+  auto &stats = k.vc4().stats();
+  REQUIRE(stats.num_invariants_hoisted > 0);
+  REQUIRE(stats.num_strength_reductions > 0);
+
+  Int::Array src(ROWS*STRIDE);
+  for (int i = 0; i < (int) src.size(); i++) src[i] = i % 101;
+  Int::Array dst(16*ROWS);
+
+  k.setNumQPUs(NUM_QPUS);
+  k.load(&src, &dst, STRIDE);
+
+  auto check = [&src, &dst] (char const *label) {
+    for (int i = 0; i < (int) dst.size(); i++) {
+      INFO(label << " index " << i);
+      REQUIRE(dst[i] == expected_loop(src, i/16, i % 16));
+    }
+  };
+
+  dst.fill(-1);
+  k.interpret();
+  check("interpreter");
+
+  dst.fill(-1);
+  k.emu();
+  check("vc4 emulator");
+
+  dst.fill(-1);
+  k.emu_v3d();
+  check("v3d emulator");
+}
+
+
+TEST_CASE("Test loop unrolling [optimize]") {
+  auto k = compile(unroll_kernel);
+  INFO(k.get_errors());
+  REQUIRE(!k.has_errors());
+
+  auto &stats = k.vc4().stats();
+  REQUIRE(stats.num_loops_unrolled == 2);
+  REQUIRE(stats.num_unrolls_limited == 1);
+
+  Int::Array src(UNROLL_SIZE);
+  for (int i = 0; i < (int) src.size(); i++) src[i] = i % 97;
+  Int::Array dst(16);
+
+  k.load(&src, &dst, UNROLL_SIZE);
+
+  auto check = [&src, &dst] (char const *label) {
+    for (int i = 0; i < (int) dst.size(); i++) {
+      INFO(label << " index " << i);
+      REQUIRE(dst[i] == expected_unroll(src, i));
+    }
+  };
+
+  dst.fill(-1);
+  k.interpret();
+  check("interpreter");
+
+  dst.fill(-1);
+  k.emu();
+  check("vc4 emulator");
+
+  dst.fill(-1);
+  k.emu_v3d();
+  check("v3d emulator");
+}
+
+
+TEST_CASE("Test arena for syntax tree [optimize]") {
+  Arena::start_new();
+  int prev_count = Arena::count();
+
+  {
+    auto k = compile(optimize_kernel);
+    REQUIRE(!k.has_errors());
+
+    REQUIRE(Arena::current().size() > 0);
+    REQUIRE(Arena::count() > prev_count);  // Arena of the vc4 compile thread is still in use
+
+    // Syntax tree is still usable
+    Int::Array src(16*NUM_QPUS);
+    for (int i = 0; i < (int) src.size(); i++) src[i] = i;
+    Int::Array dst(16*NUM_QPUS);
+
+    k.setNumQPUs(NUM_QPUS);
+    k.load(&src, &dst);
+    k.interpret();
+
+    for (int i = 0; i < (int) dst.size(); i++) {
+      INFO("index " << i);
+      REQUIRE(dst[i] == expected(src[i]));
+    }
+  }
+
+  Arena::start_new();
+  REQUIRE(Arena::count() == prev_count);  // Released together with the kernel
+}
+
+
+TEST_CASE("Test compile diagnostics level [optimize]") {
+  REQUIRE(LibSettings::compile_diagnostics() == LibSettings::DIAG_NONE);
+
+  auto has_phase = [] (CompileData const &data, std::string const &name) -> bool {
+    for (auto const &phase : data.phase_times) {
+      if (name == phase.name) return true;
+    }
+    return false;
+  };
+
+  SUBCASE("By default, no dumps or timings are taken") {
+    auto k = compile(optimize_kernel);
+    REQUIRE(!k.has_errors());
+
+    for (auto const *data : {&k.vc4().stats(), &k.v3d().stats()}) {
+      REQUIRE(!data->liveness_dump);
+      REQUIRE(!data->target_code_before_optimization);
+      REQUIRE(data->phase_times.empty());
+      REQUIRE(data->num_constants_folded > 0);  // Statistics are always collected
+    }
+  }
+
+  SUBCASE("Timing level times the compile phases only") {
+    LibSettings::compile_diagnostics(LibSettings::DIAG_TIMING);
+    auto k = compile(optimize_kernel);
+    LibSettings::compile_diagnostics(LibSettings::DIAG_NONE);
+    REQUIRE(!k.has_errors());
+
+    for (auto const *data : {&k.vc4().stats(), &k.v3d().stats()}) {
+      REQUIRE(!data->liveness_dump);
+      REQUIRE(!data->phase_times.empty());
+      REQUIRE(data->phase_times[0].depth == 0);
+
+      for (auto name : {"compile", "build AST", "translate", "liveness optimize", "regalloc", "encode"}) {
+        INFO(name);
+        REQUIRE(has_phase(*data, name));
+      }
+    }
+
+    REQUIRE(k.compile_info().find("compile phases") != std::string::npos);
+  }
+
+  SUBCASE("Full level takes the dumps, formatted on request") {
+    LibSettings::compile_diagnostics(LibSettings::DIAG_FULL);
+    auto k = compile(optimize_kernel);
+    LibSettings::compile_diagnostics(LibSettings::DIAG_NONE);
+    REQUIRE(!k.has_errors());
+
+    auto const &data = k.v3d().stats();
+    REQUIRE(data.liveness_dump);
+    REQUIRE(data.target_code_before_optimization);
+    REQUIRE(!data.target_code_before_optimization().empty());
+    REQUIRE(!data.reg_usage_dump().empty());
+    REQUIRE(!data.allocated_registers_dump().empty());
+    REQUIRE(has_phase(data, "regalloc"));
+  }
+}
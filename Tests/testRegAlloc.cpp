@@ -0,0 +1,171 @@
+#include "doctest.h"
+#include <vector>
+#include "V3DLib.h"
+#include "LibSettings.h"
+#include "vc4/DMA/Operations.h"
+
+using namespace V3DLib;
+
+namespace {
+
+int const NUM_VALUES = 100;  // More than fit in the register files at the same time
+
+/**
+ * Kernel with many variables live at the same time, so that spilling is required
+ */
+void spill_kernel(Int::Ptr src, Int::Ptr dst) {
+  std::vector<Int> vals;
+  vals.reserve(NUM_VALUES);
+
+  for (int i = 0; i < NUM_VALUES; i++) {
+    Int val = src[16*(i % 4)];  // Pointers already include the offset of the vector element
+    vals.emplace_back(val + i);
+  }
+
+  Int sum = 0;
+  For (Int k = 0, k < 3, k++)
+    for (int i = 0; i < NUM_VALUES; i++) {
+      Where (vals[i] > 40)
+        vals[i] = vals[i] - k;
+      End
+
+      sum += vals[i];
+    }
+  End
+
+  dst[16*me()] = sum;
+}
+
+
+/**
+ * Same as `spill_kernel()`, but passes a value through the VPM while the other values are live
+ */
+void vpm_kernel(Int::Ptr src, Int::Ptr dst, int num_values) {
+  std::vector<Int> vals;
+  vals.reserve(num_values);
+
+  for (int i = 0; i < num_values; i++) {
+    Int val = src[16*(i % 4)];
+    vals.emplace_back(val + i);
+  }
+
+  vpmSetupWrite(HORIZ, me());
+  vpmPut(vals[0]);
+  vpmSetupRead(HORIZ, 1, me());
+
+  Int sum = vpmGetInt() + 1;  // Not a plain copy; the emulator would read the VPM twice for that
+  for (int i = 0; i < num_values; i++) {
+    sum += vals[i];
+  }
+
+  dst[16*me()] = sum;
+}
+
+
+void vpm_spill_kernel(Int::Ptr src, Int::Ptr dst)    { vpm_kernel(src, dst, NUM_VALUES); }
+void vpm_no_spill_kernel(Int::Ptr src, Int::Ptr dst) { vpm_kernel(src, dst, 4); }
+
+
+std::vector<int> expected_results(Int::Array const &src) {
+  std::vector<int> ret;
+
+  for (int lane = 0; lane < 16; lane++) {
+    std::vector<int> vals;
+    for (int i = 0; i < NUM_VALUES; i++) vals.push_back(src[16*(i % 4) + lane] + i);
+
+    int sum = 0;
+    for (int k = 0; k < 3; k++) {
+      for (int i = 0; i < NUM_VALUES; i++) {
+        if (vals[i] > 40) vals[i] -= k;
+        sum += vals[i];
+      }
+    }
+
+    ret.push_back(sum);
+  }
+
+  return ret;
+}
+
+
+void check_spill_kernel(bool use_tmu) {
+  int const numQPUs = 8;
+
+  bool prev_use_tmu = LibSettings::use_tmu_for_load();
+  LibSettings::use_tmu_for_load(use_tmu);
+  auto k = compile(spill_kernel);
+  LibSettings::use_tmu_for_load(prev_use_tmu);
+
+  INFO(k.get_errors());
+  REQUIRE(!k.has_errors());
+  REQUIRE(k.vc4().num_spill_slots() > 0);
+  REQUIRE(k.v3d().num_spill_slots() > 0);
+
+  Int::Array src(4*16);
+  for (int i = 0; i < (int) src.size(); i++) src[i] = i;
+  Int::Array dst(numQPUs*16);
+
+  auto expected = expected_results(src);
+
+  k.setNumQPUs(numQPUs);
+  k.load(&src, &dst);
+
+  dst.fill(-1);
+  k.emu();
+  for (int i = 0; i < (int) dst.size(); i++) {
+    INFO("vc4 index " << i);
+    REQUIRE(dst[i] == expected[i % 16]);
+  }
+
+  dst.fill(-1);
+  k.emu_v3d();
+  for (int i = 0; i < (int) dst.size(); i++) {
+    INFO("v3d index " << i);
+    REQUIRE(dst[i] == expected[i % 16]);
+  }
+}
+
+}  // anon namespace
+
+
+TEST_CASE("Test register allocation with spilling [regalloc]") {
+  SUBCASE("Spilling with TMU loads") {
+    check_spill_kernel(true);
+  }
+
+  SUBCASE("Spilling with DMA loads") {
+    check_spill_kernel(false);  // Only relevant for vc4
+  }
+}
+
+
+TEST_CASE("Test spilling in kernels using the VPM directly [regalloc]") {
+  SUBCASE("Spilling should be refused on vc4") {
+    auto k = compile(vpm_spill_kernel, CompileFor::VC4);
+    REQUIRE(k.has_errors());
+    REQUIRE(k.get_errors().find("spilling is not supported") != std::string::npos);
+  }
+
+  SUBCASE("Kernels which do not need spilling should be unaffected") {
+    auto k = compile(vpm_no_spill_kernel, CompileFor::VC4);
+    INFO(k.get_errors());
+    REQUIRE(!k.has_errors());
+    REQUIRE(k.vc4().num_spill_slots() == 0);
+
+    Int::Array src(4*16);
+    for (int i = 0; i < (int) src.size(); i++) src[i] = i;
+    Int::Array dst(16);
+    dst.fill(-1);
+
+    k.load(&src, &dst);
+    k.emu();
+
+    for (int lane = 0; lane < 16; lane++) {
+      int expected = src[lane] + 1;  // Value passed through the VPM
+      for (int i = 0; i < 4; i++) expected += src[16*i + lane] + i;
+
+      INFO("lane " << lane);
+      REQUIRE(dst[lane] == expected);
+    }
+  }
+}
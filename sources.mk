@@ -22,6 +22,9 @@ OBJ := \
   Target/SmallLiteral.o  \
   Target/EmuSupport.o  \
   Target/Emulator.o  \
+  Target/EmuProgram.o  \
+  Target/LaneOps.o  \
+  Target/EmuTiming.o  \
   Target/Satisfy.o  \
   BaseKernel.o  \
   Source/Lang.o  \
@@ -29,6 +32,7 @@ OBJ := \
   Source/OpItems.o  \
   Source/Interpreter.o  \
   Source/Translate.o  \
+  Source/Optimize.o  \
   Source/Ptr.o  \
   Source/Pretty.o  \
   Source/BExpr.o  \
@@ -48,14 +52,19 @@ OBJ := \
   Support/InstructionComment.o  \
   Support/basics.o  \
   Support/RegIdSet.o  \
+  Support/RegBitSet.o  \
+  Support/Arena.o  \
   Support/pgm.o  \
   Support/Helpers.o  \
   Support/Platform.o  \
   Support/HeapManager.o  \
   SourceTranslate.o  \
   Common/SharedArray.o  \
+  Common/SharedArrayPool.o  \
   Common/BufferObject.o  \
   Common/CompileData.o  \
+  Common/KernelCache.o  \
+  Common/CallQueue.o  \
   Kernels/DotVector.o  \
   Kernels/Cursor.o  \
   Kernels/Rot3D.o  \
@@ -65,8 +74,10 @@ OBJ := \
   Liveness/LiveSet.o  \
   Liveness/UseDef.o  \
   Liveness/Optimizations.o  \
+  Liveness/Peephole.o  \
   Liveness/RegUsage.o  \
   Liveness/Liveness.o  \
+  Liveness/Spill.o  \
   Liveness/CFG.o  \
   LibSettings.o  \
   v3d/PerformanceCounters.o  \
@@ -84,7 +95,9 @@ OBJ := \
   v3d/instr/Mnemonics.o  \
   v3d/Driver.o  \
   v3d/RegisterMapping.o  \
+  v3d/Scheduler.o  \
   v3d/KernelDriver.o  \
+  v3d/Emulator.o  \
   vc4/PerformanceCounters.o  \
   vc4/Mailbox.o  \
   vc4/BufferObject.o  \
@@ -93,6 +106,7 @@ OBJ := \
   vc4/Invoke.o  \
   vc4/RegisterMap.o  \
   vc4/Instr.o  \
+  vc4/Scheduler.o  \
   vc4/DMA/Helpers.o  \
   vc4/DMA/DMA.o  \
   vc4/DMA/LoadStore.o  \
@@ -129,10 +143,21 @@ TESTS_FILES := \
   Tests/testMatrix.o  \
   Tests/testFFT.o  \
   Tests/testV3d.o  \
+  Tests/testEmuV3d.o  \
+  Tests/testLaneOps.o  \
+  Tests/testEmuParallel.o  \
+  Tests/testEmuTiming.o  \
+  Tests/testLiveness.o  \
+  Tests/testRegAlloc.o  \
+  Tests/testKernelCache.o  \
+  Tests/testCallAsync.o  \
+  Tests/testOptimize.o  \
   Tests/testRot3D.o  \
   Tests/testPrefetch.o  \
   Tests/testFunctions.o  \
+  Tests/testCompileBench.o  \
   Tests/support/ProfileOutput.o  \
+  Tests/support/CompileBench.o  \
   Tests/support/disasm_kernel.o  \
   Tests/support/rotate_kernel.o  \
   Tests/support/support.o  \